@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+
+/// Run `func` `iterations` times and return the average number of seconds per run.
+template <class Func>
+double bench_time(size_t iterations, Func&& func) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        func();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count() / iterations;
+}
+
+/// Print the throughput of a benchmark that processed `bytes` bytes in `seconds`.
+inline void bench_report(const char* name, uint64_t bytes, double seconds) {
+    printf("%-40s %10.1f MB/s\n", name, bytes / seconds / (1024.0 * 1024.0));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Benchmarks
+///////////////////////////////////////////////////////////////////////////////
+
+void bench_scan();
+void bench_compositor();
+void bench_compress();
+void bench_lines();
+void bench_progress();
+void bench_search();
+void bench_regex();
@@ -0,0 +1,145 @@
+#include "bench.hpp"
+
+#include <SDL.h>
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/vector.hpp>
+#include "compositor.hpp"
+
+// A 4K window with a small font.
+static const int screen_width = 3840;
+static const int screen_height = 2160;
+static const int cell_width = 8;
+static const int cell_height = 16;
+static const int num_glyphs = 95;
+
+/// Fake glyph coverage: a solid stem with anti-aliased edges.
+static void make_mask(uint8_t* mask, int glyph) {
+    for (int y = 0; y < cell_height; ++y) {
+        for (int x = 0; x < cell_width; ++x) {
+            int distance = (x * 7 + y * 3 + glyph) % 11;
+            uint8_t coverage = 0;
+            if (y >= 3 && y < 13) {
+                if (distance < 3)
+                    coverage = 0xff;
+                else if (distance < 6)
+                    coverage = (uint8_t)(distance * 40);
+            }
+            mask[y * cell_width + x] = coverage;
+        }
+    }
+}
+
+/// Which glyph is at each cell.  Roughly a fifth of the cells are blank.
+static int glyph_at(int row, int col) {
+    int value = (row * 31 + col * 17) % 125;
+    return value < num_glyphs ? value : -1;
+}
+
+static uint32_t background_at(int row, int col) {
+    return (col / 20 + row) % 7 == 0 ? 0xff303030 : 0xff000000;
+}
+
+/// Draw a frame the way `render_code_point` did: a fill and a blit for every cell.
+static void draw_frame_sdl(SDL_Surface* screen, SDL_Surface** glyphs) {
+    int rows = screen_height / cell_height;
+    int cols = screen_width / cell_width;
+    for (int row = 0; row < rows; ++row) {
+        for (int col = 0; col < cols; ++col) {
+            SDL_Rect rect = {col * cell_width, row * cell_height, cell_width, cell_height};
+            SDL_FillRect(screen, &rect, background_at(row, col));
+            int glyph = glyph_at(row, col);
+            if (glyph != -1)
+                SDL_BlitSurface(glyphs[glyph], nullptr, screen, &rect);
+        }
+    }
+}
+
+/// Draw a frame with `composite_row`.
+static void draw_frame_compositor(SDL_Surface* screen,
+                                  const cz::Vector<uint8_t>& masks,
+                                  cz::Vector<Composite_Span>* spans) {
+    int rows = screen_height / cell_height;
+    int cols = screen_width / cell_width;
+    for (int row = 0; row < rows; ++row) {
+        spans->len = 0;
+        for (int col = 0; col < cols; ++col) {
+            uint32_t background = background_at(row, col);
+            int glyph = glyph_at(row, col);
+            if (glyph == -1 && spans->len > 0 && !spans->last().mask &&
+                spans->last().background == background) {
+                spans->last().width += cell_width;
+                continue;
+            }
+
+            Composite_Span span = {};
+            span.x = col * cell_width;
+            span.width = cell_width;
+            span.background = background;
+            if (glyph != -1) {
+                span.mask = &masks[(size_t)glyph * cell_width * cell_height];
+                span.foreground = 0xffd0d0d0;
+            }
+            spans->push(span);
+        }
+
+        uint8_t* pixels = (uint8_t*)screen->pixels + (size_t)row * cell_height * screen->pitch;
+        composite_row(pixels, screen->pitch, 0, cell_height, cell_height - 2, *spans);
+    }
+}
+
+template <class Blend>
+static void bench_blend_one(const char* name, const cz::Vector<uint8_t>& masks, Blend blend) {
+    cz::Vector<uint32_t> pixels = {};
+    CZ_DEFER(pixels.drop(cz::heap_allocator()));
+    pixels.reserve_exact(cz::heap_allocator(), masks.len);
+    pixels.len = masks.len;
+
+    double seconds = bench_time(200, [&]() {
+        blend(pixels.elems, masks.elems, masks.len, 0xff000000, 0xffd0d0d0);
+    });
+    bench_report(name, masks.len * sizeof(uint32_t), seconds);
+}
+
+void bench_compositor() {
+    size_t mask_size = cell_width * cell_height;
+    cz::Vector<uint8_t> masks = {};
+    CZ_DEFER(masks.drop(cz::heap_allocator()));
+    masks.reserve_exact(cz::heap_allocator(), mask_size * num_glyphs);
+    masks.len = mask_size * num_glyphs;
+    for (int glyph = 0; glyph < num_glyphs; ++glyph) {
+        make_mask(&masks[glyph * mask_size], glyph);
+    }
+
+    bench_blend_one("blend (scalar)", masks, composite_blend_scalar);
+    bench_blend_one("blend (composite_blend)", masks, composite_blend);
+
+    SDL_Surface* screen = SDL_CreateRGBSurfaceWithFormat(0, screen_width, screen_height, 32,
+                                                         SDL_PIXELFORMAT_ARGB8888);
+    CZ_ASSERT(screen);
+    CZ_DEFER(SDL_FreeSurface(screen));
+    uint64_t frame_bytes = (uint64_t)screen_width * screen_height * sizeof(uint32_t);
+
+    // The glyphs as they came out of TTF_RenderUTF8_Blended.
+    SDL_Surface* glyphs[num_glyphs];
+    for (int glyph = 0; glyph < num_glyphs; ++glyph) {
+        glyphs[glyph] = SDL_CreateRGBSurfaceWithFormat(0, cell_width, cell_height, 32,
+                                                       SDL_PIXELFORMAT_ARGB8888);
+        CZ_ASSERT(glyphs[glyph]);
+        SDL_SetSurfaceBlendMode(glyphs[glyph], SDL_BLENDMODE_BLEND);
+        uint32_t* pixels = (uint32_t*)glyphs[glyph]->pixels;
+        for (size_t i = 0; i < mask_size; ++i) {
+            pixels[i] = ((uint32_t)masks[glyph * mask_size + i] << 24) | 0xd0d0d0;
+        }
+    }
+    CZ_DEFER(for (int glyph = 0; glyph < num_glyphs; ++glyph) SDL_FreeSurface(glyphs[glyph]));
+
+    double seconds = bench_time(10, [&]() { draw_frame_sdl(screen, glyphs); });
+    bench_report("frame (SDL_FillRect + SDL_BlitSurface)", frame_bytes, seconds);
+
+    cz::Vector<Composite_Span> spans = {};
+    CZ_DEFER(spans.drop(cz::heap_allocator()));
+    spans.reserve_exact(cz::heap_allocator(), screen_width / cell_width);
+    seconds = bench_time(10, [&]() { draw_frame_compositor(screen, masks, &spans); });
+    bench_report("frame (composite_row)", frame_bytes, seconds);
+}
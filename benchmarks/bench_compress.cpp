@@ -0,0 +1,78 @@
+#include "bench.hpp"
+
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/string.hpp>
+#include "backlog.hpp"
+#include "compress.hpp"
+
+/// Simulate a build log: mostly repeated lines with a few changing numbers.
+static cz::String make_build_log(size_t size) {
+    cz::String log = {};
+    log.reserve_exact(cz::heap_allocator(), size + 128);
+    for (size_t line = 0; log.len < size; ++line) {
+        log.append("[");
+        log.push('0' + (line / 10) % 10);
+        log.push('0' + line % 10);
+        log.append("%] Building CXX object CMakeFiles/tesh-lib.dir/src/");
+        log.append(line % 3 == 0 ? "backlog.cpp.o\n" : "render.cpp.o\n");
+    }
+    return log;
+}
+
+static void bench_compress_one(const char* name, cz::Str data) {
+    // Compress chunk by chunk like `backlog_compress_tick` does.
+    size_t chunks = data.len / BACKLOG_BUFFER_SIZE;
+    size_t bound = compress_block_bound(BACKLOG_BUFFER_SIZE);
+    cz::String blocks = {};
+    CZ_DEFER(blocks.drop(cz::heap_allocator()));
+    blocks.reserve_exact(cz::heap_allocator(), chunks * bound);
+    cz::Vector<size_t> lens = {};
+    CZ_DEFER(lens.drop(cz::heap_allocator()));
+    lens.reserve_exact(cz::heap_allocator(), chunks);
+    lens.len = chunks;
+
+    size_t compressed = 0;
+    double seconds = bench_time(5, [&]() {
+        compressed = 0;
+        for (size_t i = 0; i < chunks; ++i) {
+            lens[i] = compress_block(data.buffer + i * BACKLOG_BUFFER_SIZE, BACKLOG_BUFFER_SIZE,
+                                     blocks.buffer + i * bound);
+            compressed += lens[i];
+        }
+    });
+    char label[64];
+    snprintf(label, sizeof(label), "compress %s (ratio %.1f)", name,
+             (double)(chunks * BACKLOG_BUFFER_SIZE) / compressed);
+    bench_report(label, chunks * BACKLOG_BUFFER_SIZE, seconds);
+
+    char output[BACKLOG_BUFFER_SIZE];
+    seconds = bench_time(5, [&]() {
+        for (size_t i = 0; i < chunks; ++i) {
+            bool ok = decompress_block(blocks.buffer + i * bound, lens[i], output,
+                                       BACKLOG_BUFFER_SIZE);
+            CZ_ASSERT(ok);
+        }
+    });
+    snprintf(label, sizeof(label), "decompress %s", name);
+    bench_report(label, chunks * BACKLOG_BUFFER_SIZE, seconds);
+}
+
+void bench_compress() {
+    const size_t size = 64 << 20;
+
+    cz::String log = make_build_log(size);
+    CZ_DEFER(log.drop(cz::heap_allocator()));
+    bench_compress_one("build log", log);
+
+    // Noise is the worst case: nothing matches.
+    cz::String noise = {};
+    CZ_DEFER(noise.drop(cz::heap_allocator()));
+    noise.reserve_exact(cz::heap_allocator(), size);
+    uint32_t state = 12345;
+    for (size_t i = 0; i < size; ++i) {
+        state = state * 1103515245 + 12345;
+        noise.push((char)(state >> 16));
+    }
+    bench_compress_one("noise", noise);
+}
@@ -0,0 +1,55 @@
+#include "bench.hpp"
+
+#include <cz/defer.hpp>
+#include "line_index.hpp"
+
+/// Simulate the line starts of `find /`: 4 GiB of short paths.  The text itself is
+/// never built since only the line starts are stored in the index.
+static uint64_t push_find_lines(Line_Index* lines, uint64_t size) {
+    uint64_t start = 0;
+    uint32_t state = 12345;
+    while (1) {
+        state = state * 1103515245 + 12345;
+        start += 20 + (state >> 16) % 80;
+        if (start >= size)
+            return start;
+        lines->push(start);
+    }
+}
+
+void bench_lines() {
+    const uint64_t size = 4ull << 30;
+
+    Line_Index lines = {};
+    CZ_DEFER(lines.drop());
+
+    uint64_t length = 0;
+    double seconds = bench_time(1, [&]() { length = push_find_lines(&lines, size); });
+    printf("%-40s %10.1f ns/line\n", "line index push", seconds * 1e9 / lines.count());
+
+    // The old index stored a `uint64_t` per line.  Compare
+    // without the slack from growing the vectors.
+    double old_bytes = (double)lines.count() * sizeof(uint64_t);
+    double new_bytes = (double)lines.offsets.len * sizeof(uint16_t) +
+                       (double)lines.block_starts.len * sizeof(uint64_t);
+    printf("%-40s %10llu\n", "lines", (unsigned long long)lines.count());
+    printf("%-40s %10.1f MB (%.1f%% of text)\n", "line index (uint64_t per line)",
+           old_bytes / (1024.0 * 1024.0), old_bytes * 100 / length);
+    printf("%-40s %10.1f MB (%.1f%% of text)\n", "line index (two-level)",
+           new_bytes / (1024.0 * 1024.0), new_bytes * 100 / length);
+
+    // Lookups like `make_info` and `scroll_up` do.
+    const size_t lookups = 1 << 22;
+    size_t sum = 0;
+    uint32_t state = 54321;
+    seconds = bench_time(1, [&]() {
+        for (size_t i = 0; i < lookups; ++i) {
+            state = state * 1103515245 + 12345;
+            uint64_t position = ((uint64_t)state << 16) % length;
+            size_t line = lines.upper_bound(position);
+            sum += (line > 0 ? lines.get(line - 1) : 0);
+        }
+    });
+    printf("%-40s %10.1f ns/lookup (%zu)\n", "line index upper_bound + get",
+           seconds * 1e9 / lookups, sum & 1);
+}
@@ -0,0 +1,65 @@
+#include "bench.hpp"
+
+#include <string.h>
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/string.hpp>
+#include <cz/util.hpp>
+#include "backlog.hpp"
+
+/// The output of `test-programs/progress.c`.
+static cz::String make_progress(size_t redraws, bool color) {
+    cz::String output = {};
+    output.reserve_exact(cz::heap_allocator(), redraws * 96 + 128);
+    char bar[41];
+    char line[128];
+    for (size_t i = 0; i <= redraws; ++i) {
+        size_t filled = i * 40 / redraws;
+        memset(bar, '=', filled);
+        memset(bar + filled, ' ', 40 - filled);
+        bar[40] = '\0';
+        int len;
+        if (color)
+            len = snprintf(line, sizeof(line), "\r\x1b[K\x1b[1;32m   Building\x1b[0m [%s] %zu/%zu",
+                           bar, i, redraws);
+        else
+            len = snprintf(line, sizeof(line), "\r   Building [%s] %zu/%zu", bar, i, redraws);
+        output.append({line, (size_t)len});
+    }
+    output.push('\n');
+    return output;
+}
+
+static void bench_progress_one(const char* name, cz::Str output, bool coalesce) {
+    size_t events = 0;
+    double seconds = bench_time(5, [&]() {
+        Backlog_State backlog = {};
+        init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+        backlog.coalesce_progress = coalesce;
+
+        // Feed it in 64 KiB reads and flush once per read like `read_tty_output` does.
+        for (size_t start = 0; start < output.len; start += 64 << 10) {
+            append_text(&backlog, output.slice(start, cz::min(start + (64 << 10), output.len)));
+            backlog_flush(&backlog);
+        }
+        events = backlog.events.len;
+
+        Backlog_State* backlogs[] = {&backlog};
+        backlog_dec_refcount(backlogs, &backlog);
+    });
+    char label[64];
+    snprintf(label, sizeof(label), "%s (%zu events)", name, events);
+    bench_report(label, output.len, seconds);
+}
+
+void bench_progress() {
+    cz::String plain = make_progress(200000, /*color=*/false);
+    CZ_DEFER(plain.drop(cz::heap_allocator()));
+    cz::String color = make_progress(200000, /*color=*/true);
+    CZ_DEFER(color.drop(cz::heap_allocator()));
+
+    bench_progress_one("progress plain", plain, false);
+    bench_progress_one("progress plain (coalesced)", plain, true);
+    bench_progress_one("progress color", color, false);
+    bench_progress_one("progress color (coalesced)", color, true);
+}
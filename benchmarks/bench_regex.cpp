@@ -0,0 +1,169 @@
+#include "bench.hpp"
+
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/string.hpp>
+#include "backlog.hpp"
+#include "regex.hpp"
+
+/// Make a MiB of log lines.  None of them have an error.
+static cz::String make_log_lines() {
+    static const char* const levels[] = {"INFO", "DEBUG", "WARN", "INFO", "TRACE"};
+    static const char* const messages[] = {
+        "connection established to", "request completed for", "cache miss on key",
+        "retrying connection to",    "closed connection to",   "context deadline for",
+    };
+
+    char line[256];
+    cz::String output = {};
+    output.reserve_exact(cz::heap_allocator(), (1 << 20) + sizeof(line));
+    uint32_t state = 12345;
+    for (size_t i = 0; output.len < (1 << 20); ++i) {
+        state = state * 1103515245 + 12345;
+        int len = snprintf(line, sizeof(line),
+                           "2024-01-01T12:%02zu:%02zu.%03u %-5s %s host-%u:%u timeout=%u\n",
+                           i / 60 % 60, i % 60, state % 1000, levels[state % 5],
+                           messages[(state >> 8) % 6], (state >> 12) % 1000, state % 65536,
+                           (state >> 4) % 5000);
+        output.append({line, (size_t)len});
+    }
+    return output;
+}
+
+/// Try every start of every line with backtracking.
+static bool search_backtracking(Regex* regex,
+                                Backlog_State* backlog,
+                                uint64_t start,
+                                uint64_t end,
+                                uint64_t* match_start) {
+    cz::String line = {};
+    CZ_DEFER(line.drop(cz::heap_allocator()));
+    while (start < end) {
+        uint64_t line_end;
+        if (!backlog_find(backlog, start, end, '\n', &line_end))
+            line_end = end;
+        line.len = 0;
+        backlog_append_range(backlog, start, line_end, cz::heap_allocator(), &line);
+        for (size_t i = 0; i <= line.len; ++i) {
+            size_t match_end;
+            if (regex_match_backtracking(regex, line, i, &match_end)) {
+                *match_start = start + i;
+                return true;
+            }
+        }
+        start = line_end + 1;
+    }
+    return false;
+}
+
+void bench_regex() {
+    // 512 MiB of logs with the only error at the very end.
+    const uint64_t size = 512ull << 20;
+    const cz::Str error_line = "2024-01-01T13:00:00.000 ERROR request failed timeout=30000\n";
+
+    cz::String lines = make_log_lines();
+    CZ_DEFER(lines.drop(cz::heap_allocator()));
+
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/size + (4 << 20));
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+    while (backlog.length < size)
+        append_text(&backlog, lines);
+    const uint64_t match = backlog.length + 24;
+    append_text(&backlog, error_line);
+
+    Regex regex = {};
+    CZ_DEFER(regex_drop(&regex));
+    const char* error;
+    CZ_ASSERT(regex_compile(&regex, "ERROR.*timeout=\\d+", 0, &error));
+
+    uint64_t start = 0, end = 0;
+    bool found;
+
+    // Backtracking is too slow to run over everything.
+    const uint64_t slow_size = 8 << 20;
+    double seconds = bench_time(1, [&]() {
+        found = search_backtracking(&regex, &backlog, 0, slow_size, &start);
+    });
+    CZ_ASSERT(!found);
+    bench_report("regex backtracking", slow_size, seconds);
+
+    seconds = bench_time(3, [&]() {
+        found = regex_search_forward(&regex, &backlog, 0, backlog.length, &start, &end);
+    });
+    CZ_ASSERT(found && start == match);
+    bench_report("regex_search_forward", backlog.length, seconds);
+
+    seconds = bench_time(3, [&]() {
+        found = regex_search_backward(&regex, &backlog, 0, match, &start, &end);
+    });
+    CZ_ASSERT(!found);
+    bench_report("regex_search_backward", match, seconds);
+
+    CZ_ASSERT(regex_compile(&regex, "(?i)^.*error.*timeout=\\d+$", 0, &error));
+    seconds = bench_time(3, [&]() {
+        found = regex_search_forward(&regex, &backlog, 0, backlog.length, &start, &end);
+    });
+    CZ_ASSERT(found && start == match - 24);
+    bench_report("regex_search_forward (?i) anchored", backlog.length, seconds);
+
+    // A pattern that makes backtracking take exponential time.
+    Backlog_State as = {};
+    init_backlog(&as, /*id=*/0, /*max_length=*/1 << 20);
+    Backlog_State* as_backlogs[] = {&as};
+    CZ_DEFER(backlog_dec_refcount(as_backlogs, &as));
+    for (size_t i = 0; i < 16; ++i)
+        append_text(&as, "aaaaaaaaaaaaaaaaaaaaaaaa\n");
+
+    CZ_ASSERT(regex_compile(&regex, "(a|aa)*b", 0, &error));
+    seconds = bench_time(1, [&]() {
+        found = search_backtracking(&regex, &as, 0, as.length, &start);
+    });
+    CZ_ASSERT(!found);
+    bench_report("regex backtracking (a|aa)*b", as.length, seconds);
+
+    seconds = bench_time(1000, [&]() {
+        found = regex_search_forward(&regex, &as, 0, as.length, &start, &end);
+    });
+    CZ_ASSERT(!found);
+    bench_report("regex_search_forward (a|aa)*b", as.length, seconds);
+
+    // Step through every match on one 2 MiB line.  Each step only rescans part of the line.
+    Backlog_State line = {};
+    init_backlog(&line, /*id=*/0, /*max_length=*/4 << 20);
+    Backlog_State* line_backlogs[] = {&line};
+    CZ_DEFER(backlog_dec_refcount(line_backlogs, &line));
+    cz::String row = {};
+    CZ_DEFER(row.drop(cz::heap_allocator()));
+    row.reserve_exact(cz::heap_allocator(), 64);
+    for (size_t i = 0; i < 63; ++i)
+        row.push('.');
+    row.push('x');
+    while (line.length < (2 << 20))
+        append_text(&line, row);
+
+    CZ_ASSERT(regex_compile(&regex, "x", 0, &error));
+    size_t matches = 0;
+    seconds = bench_time(3, [&]() {
+        matches = 0;
+        for (uint64_t position = 0;
+             regex_search_forward(&regex, &line, position, line.length, &start, &end);
+             position = end) {
+            ++matches;
+        }
+    });
+    CZ_ASSERT(matches == line.length / 64);
+    bench_report("regex_search_forward every match on a line", line.length, seconds);
+
+    seconds = bench_time(3, [&]() {
+        matches = 0;
+        for (uint64_t position = line.length;
+             regex_search_backward(&regex, &line, 0, position, &start, &end);
+             position = start) {
+            ++matches;
+        }
+    });
+    CZ_ASSERT(matches == line.length / 64);
+    bench_report("regex_search_backward every match on a line", line.length, seconds);
+}
@@ -0,0 +1,75 @@
+#include "bench.hpp"
+
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/string.hpp>
+#include "scan.hpp"
+
+/// The scanning `append_text` and `append_chunk` did before `scan_text`.
+static size_t scan_text_multipass(cz::Str text, uint64_t base, Line_Index* lines) {
+    size_t chunk_len = text.len;
+    chunk_len = text.slice_end(chunk_len).find_index('\r');
+    chunk_len = text.slice_end(chunk_len).find_index(0x1b);
+    chunk_len = text.slice_end(chunk_len).find_index(0x08);
+    chunk_len = text.slice_end(chunk_len).find_index('\a');
+
+    cz::Str chunk = text.slice_end(chunk_len);
+    for (size_t i = 0;;) {
+        const char* ptr = chunk.slice_start(i).find('\n');
+        if (!ptr)
+            break;
+        i = ptr - chunk.buffer + 1;
+        lines->push(base + i);
+    }
+    return chunk_len;
+}
+
+/// Simulate a compiler log: lines of ~80 characters with an
+/// occasional color escape sequence every `escape_every` lines.
+static cz::String make_log(size_t size, size_t escape_every) {
+    cz::String log = {};
+    log.reserve_exact(cz::heap_allocator(), size + 128);
+    for (size_t line = 0; log.len < size; ++line) {
+        if (escape_every && line % escape_every == 0)
+            log.append("\x1b[1;31merror:\x1b[0m ");
+        log.append("src/backlog.cpp:123:45: note: in expansion of macro 'CZ_DEBUG_ASSERT'");
+        for (size_t i = 0; i < line % 17; ++i)
+            log.push('~');
+        log.push('\n');
+    }
+    return log;
+}
+
+template <class Scan>
+static void bench_scan_one(const char* name, cz::Str log, Scan scan) {
+    Line_Index lines = {};
+    CZ_DEFER(lines.drop());
+
+    // Feed the log in 4 KiB reads like `read_tty_output` does.
+    double seconds = bench_time(5, [&]() {
+        lines.remove_front(lines.count());
+        for (size_t start = 0; start < log.len; start += 4096) {
+            cz::Str read = log.slice(start, cz::min(start + 4096, log.len));
+            for (size_t i = 0; i < read.len;) {
+                i += scan(read.slice_start(i), start + i, &lines) + 1;
+            }
+        }
+    });
+    bench_report(name, log.len, seconds);
+}
+
+void bench_scan() {
+    const size_t size = 64 << 20;
+
+    cz::String plain = make_log(size, 0);
+    CZ_DEFER(plain.drop(cz::heap_allocator()));
+    cz::String colored = make_log(size, 8);
+    CZ_DEFER(colored.drop(cz::heap_allocator()));
+
+    bench_scan_one("scan plain (multipass)", plain, scan_text_multipass);
+    bench_scan_one("scan plain (scalar)", plain, scan_text_scalar);
+    bench_scan_one("scan plain (scan_text)", plain, scan_text);
+    bench_scan_one("scan colored (multipass)", colored, scan_text_multipass);
+    bench_scan_one("scan colored (scalar)", colored, scan_text_scalar);
+    bench_scan_one("scan colored (scan_text)", colored, scan_text);
+}
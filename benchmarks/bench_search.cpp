@@ -0,0 +1,170 @@
+#include "bench.hpp"
+
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/string.hpp>
+#include <cz/util.hpp>
+#include "backlog.hpp"
+#include "backlog_index.hpp"
+#include "backlog_search.hpp"
+#include "search.hpp"
+#include "work_pool.hpp"
+
+/// Make a MiB of log lines.  The needle is never in them.
+static cz::String make_log_lines() {
+    static const char* const levels[] = {"INFO", "DEBUG", "WARN", "INFO", "TRACE"};
+    static const char* const messages[] = {
+        "connection established to", "request completed for", "cache miss on key",
+        "retrying connection to",    "closed connection to",   "context deadline for",
+    };
+
+    char line[256];
+    cz::String output = {};
+    output.reserve_exact(cz::heap_allocator(), (1 << 20) + sizeof(line));
+    uint32_t state = 12345;
+    for (size_t i = 0; output.len < (1 << 20); ++i) {
+        state = state * 1103515245 + 12345;
+        int len = snprintf(line, sizeof(line),
+                           "2024-01-01T12:%02zu:%02zu.%03u %-5s %s host-%u:%u\n", i / 60 % 60,
+                           i % 60, state % 1000, levels[state % 5], messages[(state >> 8) % 6],
+                           (state >> 12) % 1000, state % 65536);
+        output.append({line, (size_t)len});
+    }
+    return output;
+}
+
+/// The search before the search engine: compare every position byte by byte.
+static bool search_byte_by_byte(Backlog_State* backlog,
+                                uint64_t start,
+                                uint64_t end,
+                                cz::Str needle,
+                                uint64_t* index) {
+    for (uint64_t i = start; i + needle.len <= end; ++i) {
+        size_t j = 0;
+        while (j < needle.len && backlog->get(i + j) == needle[j])
+            ++j;
+        if (j == needle.len) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Jump between occurrences of the first byte and verify them.
+static bool search_memchr(Backlog_State* backlog,
+                          uint64_t start,
+                          uint64_t end,
+                          cz::Str needle,
+                          uint64_t* index) {
+    uint64_t last = end - needle.len + 1;
+    for (uint64_t i = start; i < last && backlog_find(backlog, i, last, needle[0], &i); ++i) {
+        if (backlog_matches(backlog, i, needle)) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void bench_search() {
+    // 2 GiB of logs with the only match at the very end.
+    const uint64_t size = 2ull << 30;
+    const cz::Str needle = "connection reset by peer";
+
+    cz::String lines = make_log_lines();
+    CZ_DEFER(lines.drop(cz::heap_allocator()));
+
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/size + (4 << 20));
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+    while (backlog.length < size)
+        append_text(&backlog, lines);
+    const uint64_t match = backlog.length;
+    append_text(&backlog, needle);
+    append_text(&backlog, "\n");
+
+    uint64_t index = 0;
+    bool found;
+
+    // The old search is too slow to run over everything.
+    const uint64_t slow_size = 128 << 20;
+    double seconds = bench_time(1, [&]() {
+        found = search_byte_by_byte(&backlog, 0, slow_size, needle, &index);
+    });
+    CZ_ASSERT(!found);
+    bench_report("search byte by byte", slow_size, seconds);
+
+    seconds = bench_time(1, [&]() {
+        found = search_memchr(&backlog, 0, backlog.length, needle, &index);
+    });
+    CZ_ASSERT(found && index == match);
+    bench_report("search memchr first byte", backlog.length, seconds);
+
+    seconds = bench_time(3, [&]() {
+        found = backlog_search_forward(&backlog, 0, backlog.length, needle, &index);
+    });
+    CZ_ASSERT(found && index == match);
+    bench_report("backlog_search_forward", backlog.length, seconds);
+
+    seconds = bench_time(3, [&]() {
+        found = backlog_search_backward(&backlog, 0, match, needle, &index);
+    });
+    CZ_ASSERT(!found);
+    bench_report("backlog_search_backward", match, seconds);
+
+    // A needle whose first and last bytes are everywhere.
+    const cz::Str common = "connection to host-1000";
+    seconds = bench_time(3, [&]() {
+        found = backlog_search_forward(&backlog, 0, backlog.length, common, &index);
+    });
+    CZ_ASSERT(!found);
+    bench_report("backlog_search_forward (common bytes)", backlog.length, seconds);
+
+    // Find every match on the work pool like the search prompt does.
+    Backlog_State* visible[] = {&backlog};
+    size_t total = 0;
+    seconds = bench_time(3, [&]() {
+        Search_State search = {};
+        search_refresh(&search, visible, "retrying connection to host-42:");
+        total = search.total_matches;
+        search_drop_matches(&search);
+    });
+    char label[64];
+    snprintf(label, sizeof(label), "search_refresh (%zu threads, %zu matches)", work_pool_threads(),
+             total);
+    bench_report(label, backlog.length, seconds);
+
+    seconds = bench_time(3, [&]() {
+        Search_State search = {};
+        search_refresh(&search, visible, needle);
+        total = search.total_matches;
+        search_drop_matches(&search);
+    });
+    CZ_ASSERT(total == 1);
+    bench_report("search_refresh (rare needle)", backlog.length, seconds);
+
+    // Index everything like the main loop does over many frames.
+    const uint64_t budget = size / 4;
+    seconds = bench_time(1, [&]() {
+        while (backlog.indexed_until + BACKLOG_BUFFER_SIZE + 2 <= backlog.length) {
+            backlog_index_tick(visible, budget);
+            backlog_index_wait();
+        }
+        backlog_index_tick(visible, budget);
+    });
+    Backlog_Index_Stats stats = backlog_index_stats();
+    snprintf(label, sizeof(label), "backlog_index_tick (%zu MiB of filters)",
+             (size_t)(stats.filter_bytes >> 20));
+    bench_report(label, backlog.length, seconds);
+
+    seconds = bench_time(3, [&]() {
+        Search_State search = {};
+        search_refresh(&search, visible, needle);
+        total = search.total_matches;
+        search_drop_matches(&search);
+    });
+    CZ_ASSERT(total == 1);
+    bench_report("search_refresh (rare needle, indexed)", backlog.length, seconds);
+}
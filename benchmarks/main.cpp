@@ -0,0 +1,12 @@
+#include "bench.hpp"
+
+int main() {
+    bench_scan();
+    bench_compositor();
+    bench_compress();
+    bench_lines();
+    bench_progress();
+    bench_search();
+    bench_regex();
+    return 0;
+}
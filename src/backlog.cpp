@@ -1,23 +1,44 @@
 #include "backlog.hpp"
 
+#include <string.h>
 #include <cz/heap.hpp>
-#include <cz/parse.hpp>
 #include <tracy/Tracy.hpp>
+#include "backlog_compress.hpp"
+#include "backlog_index.hpp"
+#include "backlog_pool.hpp"
+#include "backlog_spill.hpp"
 #include "global.hpp"
+#include "scan.hpp"
+#include "unicode.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////
 // Module Configuration
 ///////////////////////////////////////////////////////////////////////////////
 
-#define OUTER_INDEX(index) ((index) >> 12)
-#define INNER_INDEX(index) ((index)&0xfff)
+#define OUTER_INDEX(index) ((index) >> BACKLOG_BUFFER_SHIFT)
+#define INNER_INDEX(index) ((index) & (BACKLOG_BUFFER_SIZE - 1))
+
+/// Width maps store two bits per byte of the chunk.
+#define WIDTH_MAP_SIZE (BACKLOG_BUFFER_SIZE / 4)
+enum : uint8_t {
+    WIDTH_CODE_ONE = 0,  // Zero so a freshly cleared map means every code point is one column.
+    WIDTH_CODE_ZERO = 1,
+    WIDTH_CODE_TWO = 2,
+};
+
+/// What text looks like before any escape sequences.
+static const Backlog_Style default_style = {7, 0, 0};
 
 ///////////////////////////////////////////////////////////////////////////////
 // Forward Declarations
 ///////////////////////////////////////////////////////////////////////////////
 
 static void backlog_push_buffer(Backlog_State* backlog);
+static void free_chunk(Backlog_State* backlog, size_t outer);
 static void truncate_to(Backlog_State* backlog, uint64_t new_length);
+static void make_room(Backlog_State* backlog, uint64_t len);
+static void measure_widths(Backlog_State* backlog);
+static void start_line_edit(Backlog_State* backlog);
 
 ///////////////////////////////////////////////////////////////////////////////
 // Module Code
@@ -34,28 +55,72 @@ void init_backlog(Backlog_State* backlog, uint64_t id, uint64_t max_length) {
 
     backlog->start2 = std::chrono::system_clock::now();
     backlog->start = std::chrono::steady_clock::now();
-    backlog->graphics_rendition = (7 << GR_FOREGROUND_SHIFT);
+    backlog->event_state.style_event = -1;
+    backlog->event_state.hyperlink_event = -1;
+
+    backlog->style = default_style;
+    uint16_t default_id = backlog_intern_style(backlog, default_style);
+    CZ_DEBUG_ASSERT(default_id == 0);
 }
 
 void cleanup_backlog(cz::Slice<Backlog_State*> backlogs, Backlog_State* backlog) {
     CZ_DEBUG_ASSERT(backlog->refcount == 0);
     backlogs[backlog->id] = nullptr;
+    backlog_compress_forget(backlog);
+    backlog_index_forget(backlog);
     for (size_t i = 0; i < backlog->buffers.len; ++i) {
-        char* buffer = backlog->buffers[i];
-        cz::heap_allocator().dealloc({buffer, BACKLOG_BUFFER_SIZE});
+        free_chunk(backlog, i);
     }
+    if (backlog->spare_buffer)
+        backlog_pool_free(backlog->spare_buffer);
     backlog->buffers.drop(cz::heap_allocator());
-    backlog->lines.drop(cz::heap_allocator());
+    backlog->spill_slots.drop(cz::heap_allocator());
+    backlog->compressed.drop(cz::heap_allocator());
+    backlog->widths.drop(cz::heap_allocator());
+    backlog->filters.drop(cz::heap_allocator());
+    backlog->lines.drop();
+    backlog->wrap_index.points.drop(cz::heap_allocator());
     backlog->events.drop(cz::heap_allocator());
-    backlog->escape_backlog.drop(cz::heap_allocator());
+    backlog->event_checkpoints.drop(cz::heap_allocator());
+    backlog->styles.drop(cz::heap_allocator());
+    backlog->style_table.drop(cz::heap_allocator());
+    backlog->hyperlinks.drop(cz::heap_allocator());
+    backlog->escape_parser.osc_string.drop(cz::heap_allocator());
+    backlog->line_edit.text.drop(cz::heap_allocator());
+    backlog->rewrite_buffer.drop(cz::heap_allocator());
     backlog->arena.drop();
 }
 
 static void backlog_push_buffer(Backlog_State* backlog) {
+    char* buffer = backlog->spare_buffer;
+    backlog->spare_buffer = nullptr;
+    if (!buffer)
+        buffer = backlog_pool_alloc();
     backlog->buffers.reserve(cz::heap_allocator(), 1);
-    char* buffer = (char*)cz::heap_allocator().alloc({BACKLOG_BUFFER_SIZE, 1});
-    CZ_ASSERT(buffer);
     backlog->buffers.push(buffer);
+    backlog->spill_slots.reserve(cz::heap_allocator(), 1);
+    backlog->spill_slots.push(BACKLOG_NOT_SPILLED);
+    backlog->compressed.reserve(cz::heap_allocator(), 1);
+    backlog->compressed.push(nullptr);
+    backlog->widths.reserve(cz::heap_allocator(), 1);
+    backlog->widths.push(nullptr);
+    backlog->filters.reserve(cz::heap_allocator(), 1);
+    backlog->filters.push(nullptr);
+}
+
+static void free_chunk(Backlog_State* backlog, size_t outer) {
+    if (backlog->compressed[outer])
+        backlog_compress_release(backlog, outer);
+    else if (backlog->spill_slots[outer] != BACKLOG_NOT_SPILLED)
+        backlog_spill_release(backlog, outer);
+    else
+        backlog_pool_free(backlog->buffers[outer]);
+
+    if (backlog->widths[outer]) {
+        cz::heap_allocator().dealloc({backlog->widths[outer], WIDTH_MAP_SIZE});
+        backlog->widths[outer] = nullptr;
+    }
+    backlog_index_release(backlog, outer);
 }
 
 void backlog_dec_refcount(cz::Slice<Backlog_State*> backlogs, Backlog_State* backlog) {
@@ -67,31 +132,590 @@ void backlog_dec_refcount(cz::Slice<Backlog_State*> backlogs, Backlog_State* bac
 
 char Backlog_State::get(size_t i) {
     CZ_DEBUG_ASSERT(i < length);
-    return buffers[OUTER_INDEX(i)][INNER_INDEX(i)];
+    return buffer_at(i)[INNER_INDEX(i)];
+}
+
+char* Backlog_State::buffer_at(size_t i) {
+    CZ_DEBUG_ASSERT(i >= discarded);
+    size_t outer = OUTER_INDEX(i - discarded);
+    char* buffer = buffers[outer];
+    if (!buffer) {
+        if (compressed[outer])
+            buffer = backlog_compress_load(this, outer);
+        else
+            buffer = backlog_spill_fault(this, outer);
+    }
+    return buffer;
+}
+
+int Backlog_State::width_at(size_t i) {
+    // Text that hasn't been measured yet is the start of an incomplete code point.
+    if (i >= widths_until)
+        return 1;
+
+    uint8_t* map = widths[OUTER_INDEX(i - discarded)];
+    if (!map)
+        return 1;
+
+    size_t inner = INNER_INDEX(i);
+    uint8_t code = (map[inner / 4] >> (inner % 4 * 2)) & 3;
+    static const int code_widths[] = {1, 0, 2, 1};
+    return code_widths[code];
 }
 
 cz::String dbg_stringify_backlog(Backlog_State* backlog) {
     cz::String string = {};
-    string.reserve_exact(cz::heap_allocator(), backlog->length);
-    for (size_t i = 0; i < backlog->length / BACKLOG_BUFFER_SIZE; ++i) {
-        string.append(cz::Str{backlog->buffers[i], BACKLOG_BUFFER_SIZE});
+    string.reserve_exact(cz::heap_allocator(), backlog->length - backlog->discarded);
+    backlog_append_range(backlog, backlog->discarded, backlog->length, cz::heap_allocator(),
+                         &string);
+    return string;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - spans
+///////////////////////////////////////////////////////////////////////////////
+
+Backlog_Spans backlog_spans(Backlog_State* backlog, uint64_t start, uint64_t end) {
+    CZ_DEBUG_ASSERT(start >= backlog->discarded || start >= end);
+    CZ_DEBUG_ASSERT(end <= backlog->length);
+    Backlog_Spans spans;
+    spans.backlog = backlog;
+    spans.start = start;
+    spans.end = end;
+    return spans;
+}
+
+bool Backlog_Spans::next(cz::Str* span) {
+    if (start >= end)
+        return false;
+    uint64_t chunk_end = start - INNER_INDEX(start) + BACKLOG_BUFFER_SIZE;
+    size_t len = cz::min(chunk_end, end) - start;
+    *span = {backlog->buffer_at(start) + INNER_INDEX(start), len};
+    start += len;
+    return true;
+}
+
+bool Backlog_Spans::prev(cz::Str* span) {
+    if (start >= end)
+        return false;
+    uint64_t chunk_start = (end - 1) - INNER_INDEX(end - 1);
+    uint64_t span_start = cz::max(chunk_start, start);
+    *span = {backlog->buffer_at(span_start) + INNER_INDEX(span_start), (size_t)(end - span_start)};
+    end = span_start;
+    return true;
+}
+
+void backlog_copy(Backlog_State* backlog, uint64_t start, uint64_t end, char* out) {
+    Backlog_Spans spans = backlog_spans(backlog, start, end);
+    cz::Str span;
+    while (spans.next(&span)) {
+        memcpy(out, span.buffer, span.len);
+        out += span.len;
+    }
+}
+
+void backlog_append_range(Backlog_State* backlog,
+                          uint64_t start,
+                          uint64_t end,
+                          cz::Allocator allocator,
+                          cz::String* string) {
+    if (start >= end)
+        return;
+    string->reserve(allocator, end - start);
+    backlog_copy(backlog, start, end, string->buffer + string->len);
+    string->len += end - start;
+}
+
+bool backlog_find(Backlog_State* backlog, uint64_t start, uint64_t end, char ch, uint64_t* index) {
+    Backlog_Spans spans = backlog_spans(backlog, start, end);
+    cz::Str span;
+    while (spans.next(&span)) {
+        const char* ptr = span.find(ch);
+        if (ptr) {
+            *index = spans.start - span.len + (ptr - span.buffer);
+            return true;
+        }
     }
-    if (backlog->length % BACKLOG_BUFFER_SIZE != 0) {
-        string.append(cz::Str{backlog->buffers[backlog->length / BACKLOG_BUFFER_SIZE],
-                              backlog->length % BACKLOG_BUFFER_SIZE});
+    return false;
+}
+
+bool backlog_rfind(Backlog_State* backlog, uint64_t start, uint64_t end, char ch, uint64_t* index) {
+    Backlog_Spans spans = backlog_spans(backlog, start, end);
+    cz::Str span;
+    while (spans.prev(&span)) {
+        const char* ptr = span.rfind(ch);
+        if (ptr) {
+            *index = spans.end + (ptr - span.buffer);
+            return true;
+        }
     }
-    return string;
+    return false;
+}
+
+bool backlog_matches(Backlog_State* backlog, uint64_t index, cz::Str str) {
+    if (index < backlog->discarded || index + str.len > backlog->length)
+        return false;
+    Backlog_Spans spans = backlog_spans(backlog, index, index + str.len);
+    cz::Str span;
+    while (spans.next(&span)) {
+        if (memcmp(span.buffer, str.buffer, span.len) != 0)
+            return false;
+        str = str.slice_start(span.len);
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - events
+///////////////////////////////////////////////////////////////////////////////
+
+static void update_event_state(Backlog_Event_State* state,
+                               const Backlog_Event& event,
+                               size_t event_index) {
+    switch (event.type) {
+    case BACKLOG_EVENT_START_INPUT:
+    case BACKLOG_EVENT_START_PROCESS:
+    case BACKLOG_EVENT_START_DIRECTORY:
+    case BACKLOG_EVENT_SET_GRAPHIC_RENDITION:
+        state->style_event = event_index;
+        break;
+    case BACKLOG_EVENT_START_HYPERLINK:
+        state->hyperlink_event = event_index;
+        break;
+    case BACKLOG_EVENT_END_HYPERLINK:
+        state->hyperlink_event = -1;
+        break;
+    default:
+        CZ_PANIC("unreachable");
+    }
+}
+
+void backlog_push_event(Backlog_State* backlog,
+                        uint64_t index,
+                        Backlog_Event_Type type,
+                        uint32_t payload) {
+    CZ_DEBUG_ASSERT(backlog->events.len == 0 || index >= backlog->last_event_index);
+
+    Backlog_Event event = {};
+    event.type = type;
+    event.payload = payload;
+    CZ_DEBUG_ASSERT(event.payload == payload);
+
+    // Start a new block when this one is full or the distance doesn't fit.
+    uint64_t offset = index - backlog->last_event_index;
+    uint64_t block_start =
+        (backlog->event_checkpoints.len > 0 ? backlog->event_checkpoints.last().first_event : 0);
+    if (backlog->events.len == 0 ||
+        backlog->events.len - block_start == BACKLOG_EVENT_CHECKPOINT_INTERVAL ||
+        offset > UINT32_MAX) {
+        Backlog_Event_Checkpoint checkpoint;
+        checkpoint.first_event = backlog->events.len;
+        checkpoint.index = index;
+        checkpoint.state = backlog->event_state;
+        backlog->event_checkpoints.reserve(cz::heap_allocator(), 1);
+        backlog->event_checkpoints.push(checkpoint);
+        offset = 0;
+    }
+    event.offset = (uint32_t)offset;
+
+    update_event_state(&backlog->event_state, event, backlog->events.len);
+    backlog->events.reserve(cz::heap_allocator(), 1);
+    backlog->events.push(event);
+    backlog->last_event_index = index;
+}
+
+/// Find the block holding the event `event_index`.
+static size_t checkpoint_of_event(Backlog_State* backlog, size_t event_index) {
+    cz::Slice<Backlog_Event_Checkpoint> checkpoints = backlog->event_checkpoints;
+    size_t start = 0;
+    size_t end = checkpoints.len;
+    while (start < end) {
+        size_t mid = start + (end - start) / 2;
+        if (checkpoints[mid].first_event <= event_index)
+            start = mid + 1;
+        else
+            end = mid;
+    }
+    return start - 1;
+}
+
+bool Backlog_Event_Cursor::done() const {
+    return event >= backlog->events.len;
+}
+
+void Backlog_Event_Cursor::next() {
+    ++event;
+    if (done())
+        return;
+
+    cz::Slice<Backlog_Event_Checkpoint> checkpoints = backlog->event_checkpoints;
+    if (checkpoint + 1 < checkpoints.len && checkpoints[checkpoint + 1].first_event == event) {
+        ++checkpoint;
+        index = checkpoints[checkpoint].index;
+    } else {
+        index += backlog->events[event].offset;
+    }
+}
+
+Backlog_Event_Cursor backlog_event_cursor(Backlog_State* backlog, size_t event_index) {
+    CZ_DEBUG_ASSERT(event_index <= backlog->events.len);
+    Backlog_Event_Cursor cursor = {};
+    cursor.backlog = backlog;
+    cursor.event = event_index;
+    if (cursor.done())
+        return cursor;
+
+    cursor.checkpoint = checkpoint_of_event(backlog, event_index);
+    const Backlog_Event_Checkpoint& checkpoint = backlog->event_checkpoints[cursor.checkpoint];
+    cursor.index = checkpoint.index;
+    for (size_t i = checkpoint.first_event + 1; i <= event_index; ++i) {
+        cursor.index += backlog->events[i].offset;
+    }
+    return cursor;
+}
+
+uint64_t backlog_event_index(Backlog_State* backlog, size_t event_index) {
+    CZ_DEBUG_ASSERT(event_index < backlog->events.len);
+    return backlog_event_cursor(backlog, event_index).index;
+}
+
+size_t backlog_events_lower_bound(Backlog_State* backlog, uint64_t index) {
+    // Find the last block that starts before `index`.
+    cz::Slice<Backlog_Event_Checkpoint> checkpoints = backlog->event_checkpoints;
+    size_t start = 0;
+    size_t end = checkpoints.len;
+    while (start < end) {
+        size_t mid = start + (end - start) / 2;
+        if (checkpoints[mid].index < index)
+            start = mid + 1;
+        else
+            end = mid;
+    }
+    if (start == 0)
+        return 0;
+
+    // The answer is in that block or is the start of the next one.
+    Backlog_Event_Cursor cursor = backlog_event_cursor(backlog, checkpoints[start - 1].first_event);
+    while (!cursor.done() && cursor.index < index)
+        cursor.next();
+    return cursor.event;
+}
+
+size_t backlog_events_upper_bound(Backlog_State* backlog, uint64_t index) {
+    if (index == (uint64_t)-1)
+        return backlog->events.len;
+    return backlog_events_lower_bound(backlog, index + 1);
+}
+
+Backlog_Event_State backlog_event_state_at(Backlog_State* backlog, size_t event_index) {
+    CZ_DEBUG_ASSERT(event_index <= backlog->events.len);
+    if (event_index == backlog->events.len)
+        return backlog->event_state;
+
+    // Replay the events since the start of the block.
+    const Backlog_Event_Checkpoint& checkpoint =
+        backlog->event_checkpoints[checkpoint_of_event(backlog, event_index)];
+    Backlog_Event_State state = checkpoint.state;
+    for (size_t i = checkpoint.first_event; i < event_index; ++i) {
+        update_event_state(&state, backlog->events[i], i);
+    }
+    return state;
+}
+
+/// Move events after `new_length` back to it.  The styles they set are still in
+/// effect for the text that replaces what was removed.  Keeps the events sorted.
+static void clamp_events_to(Backlog_State* backlog, uint64_t new_length) {
+    if (backlog->events.len == 0 || backlog->last_event_index <= new_length)
+        return;
+
+    size_t first = backlog_events_upper_bound(backlog, new_length);
+    for (size_t i = first; i < backlog->events.len; ++i) {
+        backlog->events[i].offset = 0;
+    }
+
+    // The first moved event is now `new_length - previous` after the event before it.
+    size_t checkpoint = checkpoint_of_event(backlog, first);
+    Backlog_Event_Checkpoint* block = &backlog->event_checkpoints[checkpoint];
+    if (block->first_event == first)
+        block->index = new_length;
+    else
+        backlog->events[first].offset =
+            (uint32_t)(new_length - backlog_event_index(backlog, first - 1));
+    for (size_t c = checkpoint + 1; c < backlog->event_checkpoints.len; ++c) {
+        backlog->event_checkpoints[c].index = new_length;
+    }
+    backlog->last_event_index = new_length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - styles
+///////////////////////////////////////////////////////////////////////////////
+
+static bool same_style(const Backlog_Style& left, const Backlog_Style& right) {
+    return left.foreground == right.foreground && left.background == right.background &&
+           left.flags == right.flags;
+}
+
+static uint32_t hash_style(const Backlog_Style& style) {
+    uint64_t hash = style.foreground;
+    hash = hash * 0x9e3779b97f4a7c15 + style.background;
+    hash = hash * 0x9e3779b97f4a7c15 + style.flags;
+    hash *= 0x9e3779b97f4a7c15;
+    return (uint32_t)(hash >> 32);
+}
+
+/// Slot in `style_table` that holds `style` or the empty slot it should go in.
+static size_t find_style_slot(Backlog_State* backlog, const Backlog_Style& style) {
+    size_t mask = backlog->style_table.len - 1;
+    for (size_t slot = hash_style(style) & mask;; slot = (slot + 1) & mask) {
+        uint32_t entry = backlog->style_table[slot];
+        if (entry == 0 || same_style(backlog->styles[entry - 1], style))
+            return slot;
+    }
+}
+
+static void grow_style_table(Backlog_State* backlog) {
+    size_t capacity = cz::max(backlog->style_table.len * 2, (size_t)16);
+    backlog->style_table.len = 0;
+    backlog->style_table.reserve_exact(cz::heap_allocator(), capacity);
+    backlog->style_table.len = capacity;
+    memset(backlog->style_table.elems, 0, capacity * sizeof(uint32_t));
+
+    for (size_t id = 0; id < backlog->styles.len; ++id) {
+        size_t slot = find_style_slot(backlog, backlog->styles[id]);
+        backlog->style_table[slot] = (uint32_t)(id + 1);
+    }
+}
+
+uint16_t backlog_intern_style(Backlog_State* backlog, const Backlog_Style& style) {
+    // Keep the table at most half full.
+    if ((backlog->styles.len + 1) * 2 > backlog->style_table.len)
+        grow_style_table(backlog);
+
+    size_t slot = find_style_slot(backlog, style);
+    uint32_t entry = backlog->style_table[slot];
+    if (entry != 0)
+        return (uint16_t)(entry - 1);
+
+    if (backlog->styles.len == BACKLOG_MAX_STYLES)
+        return 0;
+
+    backlog->styles.reserve(cz::heap_allocator(), 1);
+    backlog->styles.push(style);
+    backlog->style_table[slot] = (uint32_t)backlog->styles.len;
+    return (uint16_t)(backlog->styles.len - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - widths
+///////////////////////////////////////////////////////////////////////////////
+
+static void set_width(Backlog_State* backlog, uint64_t index, int width) {
+    uint8_t*& map = backlog->widths[OUTER_INDEX(index - backlog->discarded)];
+    if (!map) {
+        map = (uint8_t*)cz::heap_allocator().alloc({WIDTH_MAP_SIZE, 1});
+        CZ_ASSERT(map);
+        memset(map, 0, WIDTH_MAP_SIZE);
+    }
+
+    uint8_t code = (width == 0 ? WIDTH_CODE_ZERO : WIDTH_CODE_TWO);
+    size_t inner = INNER_INDEX(index);
+    map[inner / 4] |= code << (inner % 4 * 2);
+}
+
+/// Forget the widths of the text that was removed by truncating the backlog to `new_length`.
+static void forget_widths_after(Backlog_State* backlog, uint64_t new_length) {
+    if (backlog->widths_until <= new_length)
+        return;
+
+    // If a code point was cut in half then measure it again once the rest is rewritten.
+    uint64_t start = new_length;
+    for (uint64_t i = new_length; i-- > backlog->discarded && i + 4 > new_length;) {
+        uint8_t ch = backlog->get(i);
+        if (!unicode::utf8_is_continuation(ch)) {
+            if (i + unicode::utf8_width(ch) > new_length)
+                start = i;
+            break;
+        }
+    }
+
+    // Chunks after the last one have already been freed.
+    uint64_t end = backlog->discarded + (uint64_t)backlog->buffers.len * BACKLOG_BUFFER_SIZE;
+    end = cz::min(end, backlog->widths_until);
+    for (uint64_t index = start; index < end; ++index) {
+        uint8_t* map = backlog->widths[OUTER_INDEX(index - backlog->discarded)];
+        if (map) {
+            size_t inner = INNER_INDEX(index);
+            map[inner / 4] &= ~(3 << (inner % 4 * 2));
+        }
+    }
+    backlog->widths_until = start;
+}
+
+/// Decode the text appended since the last call and record the code points that aren't
+/// one column wide.  Stops before a code point whose end hasn't been appended yet.
+static void measure_widths(Backlog_State* backlog) {
+    uint64_t index = cz::max(backlog->widths_until, backlog->discarded);
+    while (index < backlog->length) {
+        const char* buffer = backlog->buffer_at(index);
+        uint64_t chunk_start = index - INNER_INDEX(index);
+        size_t chunk_len = cz::min(backlog->length - chunk_start, (uint64_t)BACKLOG_BUFFER_SIZE);
+        cz::Str chunk = {buffer, chunk_len};
+
+        size_t inner = INNER_INDEX(index);
+        while (inner < chunk.len) {
+            // Most output is ASCII so skip it a vector at a time.
+            inner += scan_ascii(chunk.slice_start(inner));
+            if (inner == chunk.len)
+                break;
+
+            // The code point may straddle two chunks.
+            const char* seq = chunk.buffer + inner;
+            size_t available = cz::min(backlog->length - (chunk_start + inner), (uint64_t)4);
+            char bytes[4];
+            if (inner + available > chunk.len) {
+                backlog_copy(backlog, chunk_start + inner, chunk_start + inner + available, bytes);
+                seq = bytes;
+            }
+
+            uint32_t code_point;
+            size_t len = unicode::utf8_decode(seq, available, &code_point);
+            if (len == 0) {
+                backlog->widths_until = chunk_start + inner;
+                return;
+            }
+
+            if (code_point != UNICODE_INVALID) {
+                int width = unicode::code_point_width(code_point);
+                if (width != 1)
+                    set_width(backlog, chunk_start + inner, width);
+            }
+            inner += len;
+        }
+        index = chunk_start + inner;
+    }
+    backlog->widths_until = index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - ring retention
+///////////////////////////////////////////////////////////////////////////////
+
+/// Drop everything before `new_discarded`.  Indices aren't rebased so this only has to
+/// remove the front of each index.  That is linear in what is kept, but `make_room` drops
+/// an eighth of the backlog at a time so it is amortized over at least that much output.
+static void discard_before(Backlog_State* backlog, uint64_t new_discarded) {
+    ZoneScoped;
+
+    CZ_DEBUG_ASSERT(INNER_INDEX(new_discarded) == 0);
+    CZ_DEBUG_ASSERT(new_discarded > backlog->discarded && new_discarded < backlog->length);
+
+    size_t chunks = OUTER_INDEX(new_discarded - backlog->discarded);
+    for (size_t i = 0; i < chunks; ++i) {
+        free_chunk(backlog, i);
+    }
+    backlog->buffers.remove_range(0, chunks);
+    backlog->spill_slots.remove_range(0, chunks);
+    backlog->compressed.remove_range(0, chunks);
+    backlog->widths.remove_range(0, chunks);
+    backlog->filters.remove_range(0, chunks);
+    backlog->discarded = new_discarded;
+    backlog->widths_until = cz::max(backlog->widths_until, new_discarded);
+
+    // Line starts.
+    size_t lines = backlog->lines.upper_bound(new_discarded - 1);
+    backlog->lines.remove_front(lines);
+    backlog->discarded_lines += lines;
+
+    // The first row now starts at `discarded` so the wrap points after it
+    // are shifted.  Rebuild the wrap index lazily from the new start.
+    Backlog_Wrap_Index* wrap_index = &backlog->wrap_index;
+    wrap_index->points.len = 0;
+    wrap_index->indexed_until = new_discarded;
+    wrap_index->x = 0;
+    wrap_index->column = 0;
+
+    // Events.  Restate the style and hyperlink in effect at the new start then keep
+    // the rest.  The checkpoints are rebuilt because they are positions in `events`.
+    size_t first_event = backlog_events_lower_bound(backlog, new_discarded);
+    if (first_event > 0) {
+        Backlog_Event_State state = backlog_event_state_at(backlog, first_event);
+
+        // Events only store offsets so decode the indices of the kept ones first.
+        cz::Vector<uint64_t> indices = {};
+        indices.reserve_exact(cz::heap_allocator(), backlog->events.len - first_event);
+        for (Backlog_Event_Cursor cursor = backlog_event_cursor(backlog, first_event);
+             !cursor.done(); cursor.next()) {
+            indices.push(cursor.index);
+        }
+
+        cz::Vector<Backlog_Event> events = backlog->events;
+        backlog->events = {};
+        backlog->events.reserve_exact(cz::heap_allocator(), events.len - first_event + 2);
+        backlog->event_checkpoints.len = 0;
+        backlog->event_state.style_event = -1;
+        backlog->event_state.hyperlink_event = -1;
+
+        if (state.style_event != (uint64_t)-1) {
+            Backlog_Event event = events[state.style_event];
+            backlog_push_event(backlog, new_discarded, (Backlog_Event_Type)event.type,
+                               event.payload);
+        }
+        if (state.hyperlink_event != (uint64_t)-1) {
+            Backlog_Event event = events[state.hyperlink_event];
+            backlog_push_event(backlog, new_discarded, (Backlog_Event_Type)event.type,
+                               event.payload);
+        }
+        for (size_t i = first_event; i < events.len; ++i) {
+            backlog_push_event(backlog, indices[i - first_event], (Backlog_Event_Type)events[i].type,
+                               events[i].payload);
+        }
+        events.drop(cz::heap_allocator());
+        indices.drop(cz::heap_allocator());
+    }
+}
+
+/// If ring retention is on then drop the oldest chunks so `len` more bytes fit.
+static void make_room(Backlog_State* backlog, uint64_t len) {
+    uint64_t kept = backlog->length - backlog->discarded;
+    if (!backlog->ring_retention || kept + len <= backlog->max_length)
+        return;
+
+    // Drop extra so we don't have to do this again for a while.
+    uint64_t new_discarded =
+        backlog->discarded + (kept + len - backlog->max_length) + backlog->max_length / 8;
+    new_discarded = OUTER_INDEX(new_discarded + BACKLOG_BUFFER_SIZE - 1) << BACKLOG_BUFFER_SHIFT;
+
+    // Keep the chunk with the last character.
+    uint64_t last_chunk = OUTER_INDEX(backlog->length - 1) << BACKLOG_BUFFER_SHIFT;
+    new_discarded = cz::min(new_discarded, last_chunk);
+
+    if (new_discarded > backlog->discarded)
+        discard_before(backlog, new_discarded);
+}
+
+/// Can more text be appended?
+static bool has_space(Backlog_State* backlog) {
+    return backlog->ring_retention || backlog->length - backlog->discarded < backlog->max_length;
+}
+
+/// Get the start of the line at the end of the backlog.
+static uint64_t current_line_start(Backlog_State* backlog) {
+    return backlog->lines.count() > 0 ? backlog->lines.last() : backlog->discarded;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Module Code - append chunk
 ///////////////////////////////////////////////////////////////////////////////
 
-static int64_t append_chunk(Backlog_State* backlog, cz::Str text) {
+/// Copy `text` into the backlog without recording line starts.  Returns the number of
+/// bytes appended, which is less than `text.len` if we have hit the maximum length.
+static int64_t append_chunk_raw_bounded(Backlog_State* backlog, cz::Str text) {
     // Truncate `text` if it would overfill the backlog.
-    if (backlog->length + text.len > backlog->max_length) {
-        CZ_DEBUG_ASSERT(backlog->length < backlog->max_length);
-        text.len = backlog->max_length - backlog->length;
+    uint64_t kept = backlog->length - backlog->discarded;
+    if (kept + text.len > backlog->max_length) {
+        CZ_DEBUG_ASSERT(kept < backlog->max_length);
+        text.len = backlog->max_length - kept;
     }
     if (text.len == 0)
         return 0;
@@ -111,129 +735,386 @@ static int64_t append_chunk(Backlog_State* backlog, cz::Str text) {
             written += to_write;
         }
 
+        backlog->length += text.len;
+
         // Always need to have a buffer on hand if there is space to grow.
-        if (backlog->length + text.len != backlog->max_length &&
-            INNER_INDEX(backlog->length + text.len) == 0) {
+        if (has_space(backlog) && INNER_INDEX(backlog->length) == 0)
             backlog_push_buffer(backlog);
-        }
     } else {
         // Just stick everything in the current buffer since there will still be space left.
         memcpy(backlog->buffers.last() + current_inner, text.buffer, text.len);
+        backlog->length += text.len;
     }
 
-finish:
-    // Log all the line starts.
-    for (size_t i = 0;;) {
-        const char* ptr = text.slice_start(i).find('\n');
-        if (!ptr)
-            break;
-        i = ptr - text.buffer + 1;
-        backlog->lines.reserve(cz::heap_allocator(), 1);
-        backlog->lines.push(backlog->length + i);
-    }
-
-    backlog->length += text.len;
-    CZ_DEBUG_ASSERT(backlog->length < backlog->max_length);
+    CZ_DEBUG_ASSERT(backlog->length - backlog->discarded <= backlog->max_length);
 
     return text.len;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// Module Code - Escape sequences - Utility
-///////////////////////////////////////////////////////////////////////////////
-
-static bool ensure_char(Backlog_State* backlog, size_t it, cz::Str fresh, size_t* skip) {
-    if (it < backlog->escape_backlog.len)
-        return true;
-    if (fresh.len <= *skip)
-        return false;
-    backlog->escape_backlog.reserve(cz::heap_allocator(), 1);
-    backlog->escape_backlog.push(fresh[*skip]);
-    ++*skip;
-    return true;
+/// Like `append_chunk_raw_bounded` but with ring retention the
+/// oldest output is dropped instead so `text` is never truncated.
+static int64_t append_chunk_raw(Backlog_State* backlog, cz::Str text) {
+    if (!backlog->ring_retention)
+        return append_chunk_raw_bounded(backlog, text);
+
+    // Append in pieces so each one fits after dropping the oldest chunks.
+    CZ_DEBUG_ASSERT(backlog->max_length >= 2 * BACKLOG_BUFFER_SIZE);
+    uint64_t piece = backlog->max_length / 4;
+    for (size_t done = 0; done < text.len;) {
+        cz::Str part = text.slice(done, done + cz::min(piece, (uint64_t)(text.len - done)));
+        make_room(backlog, part.len);
+        int64_t result = append_chunk_raw_bounded(backlog, part);
+        CZ_DEBUG_ASSERT(result == part.len);
+        done += result;
+    }
+    return text.len;
 }
 
-static bool eat_number(Backlog_State* backlog,
-                       size_t* it,
-                       cz::Str fresh,
-                       size_t* skip,
-                       int32_t* number) {
-    cz::String* text = &backlog->escape_backlog;
+/// Append `text` where the line starts in it have already been recorded by `scan_text`.
+static int64_t append_scanned_chunk(Backlog_State* backlog, cz::Str text) {
+    int64_t result = append_chunk_raw(backlog, text);
 
-    // Load the number.
-    size_t end = *it;
-    while (1) {
-        if (!ensure_char(backlog, end, fresh, skip))
-            return false;
+    // Forget line starts that were cut off by the maximum length.
+    if (result != text.len) {
+        while (backlog->lines.count() > 0 && backlog->lines.last() > backlog->length)
+            backlog->lines.pop();
+    }
 
-        if (!cz::is_digit((*text)[end]))
-            break;
+    measure_widths(backlog);
+    return result;
+}
 
-        ++end;
+static int64_t append_chunk(Backlog_State* backlog, cz::Str text) {
+    // Log all the line starts.  Special characters are treated as normal text here.
+    for (size_t i = 0; i < text.len;) {
+        i += scan_text(text.slice_start(i), backlog->length + i, &backlog->lines) + 1;
     }
 
-    // No number.
-    if (*it == end)
-        return true;
+    return append_scanned_chunk(backlog, text);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - Flow control
+///////////////////////////////////////////////////////////////////////////////
+
+Backlog_Flow backlog_flow(Backlog_State* backlog) {
+    if (backlog->paused)
+        return BACKLOG_FLOW_PAUSED;
+    if (!has_space(backlog))
+        return BACKLOG_FLOW_FULL;
+    return BACKLOG_FLOW_READING;
+}
 
-    // Parse the number.
-    uint16_t temp = 0;
-    int64_t consumed = cz::parse(text->slice(*it, end), &temp);
-    // Overflow means the number is too large.
-    if (consumed != end - *it) {
-        temp = 32767;
+/// A full backlog doesn't keep a buffer on hand.  Get one once it can grow again.
+static void ensure_tail_buffer(Backlog_State* backlog) {
+    if (has_space(backlog) && INNER_INDEX(backlog->length) == 0 &&
+        OUTER_INDEX(backlog->length - backlog->discarded) == backlog->buffers.len) {
+        backlog_push_buffer(backlog);
     }
+}
 
-    *number = temp;
-    *it = end;
-    return true;
+void backlog_raise_max_length(Backlog_State* backlog, uint64_t max_length) {
+    backlog->max_length = cz::max(backlog->max_length, max_length);
+    ensure_tail_buffer(backlog);
 }
 
-static bool parse_args(Backlog_State* backlog,
-                       size_t* it,
-                       cz::Str fresh,
-                       size_t* skip,
-                       cz::Vector<int32_t>* args) {
-    cz::String* text = &backlog->escape_backlog;
-    while (1) {
-        int32_t arg = -1;
-        if (!eat_number(backlog, it, fresh, skip, &arg))
-            return false;
+void backlog_enable_ring_retention(Backlog_State* backlog) {
+    backlog->max_length = cz::max(backlog->max_length, (uint64_t)(2 * BACKLOG_BUFFER_SIZE));
+    backlog->ring_retention = true;
+    ensure_tail_buffer(backlog);
+}
 
-        // Args are separated by semicolons.  Also, arguments should
-        // default if they are not specified and cut off by a semicolon.
-        if (!ensure_char(backlog, *it, fresh, skip))
-            return false;
-        char semicolon = ((*text)[*it] == ';');
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - Escape sequences - Tables
+///////////////////////////////////////////////////////////////////////////////
 
-        if (arg == -1 && !semicolon)
-            break;
-        args->reserve(temp_allocator, 1);
-        args->push(arg);
+enum Escape_State : uint8_t {
+    ESCAPE_GROUND,            // Normal text.  Handled by `append_text` directly.
+    ESCAPE_CARRIAGE_RETURN,   // After '\r'.
+    ESCAPE_ESCAPE,            // After ESC.
+    ESCAPE_CHARSET,           // After ESC and an intermediate byte (ie ESC ( B).
+    ESCAPE_CSI_PARAM,         // ESC [ then parameters.
+    ESCAPE_CSI_INTERMEDIATE,  // ESC [ then parameters then intermediate bytes.
+    ESCAPE_CSI_IGNORE,        // Malformed CSI sequence; discard up to the final byte.
+    ESCAPE_OSC_COMMAND,       // ESC ] then the command number.
+    ESCAPE_OSC_STRING,        // ESC ] <command> ; then the string.
+    ESCAPE_OSC_ESCAPE,        // ESC inside an OSC string (ESC \ terminates it).
+    ESCAPE_STATE_COUNT,
+};
+
+enum Escape_Class : uint8_t {
+    CLASS_CONTROL,       // C0 control codes not listed below.
+    CLASS_BELL,          // 0x07
+    CLASS_NEWLINE,       // 0x0a
+    CLASS_RETURN,        // 0x0d
+    CLASS_ESCAPE,        // 0x1b
+    CLASS_INTERMEDIATE,  // 0x20 - 0x2f
+    CLASS_DIGIT,         // 0x30 - 0x39
+    CLASS_SEPARATOR,     // : ;
+    CLASS_PRIVATE,       // < = > ?
+    CLASS_CSI,           // [
+    CLASS_OSC,           // ]
+    CLASS_ST,            // backslash
+    CLASS_FINAL,         // 0x40 - 0x7e not listed above.
+    CLASS_HIGH,          // 0x7f - 0xff
+    CLASS_COUNT,
+};
+
+enum Escape_Action : uint8_t {
+    ACTION_NONE,
+    ACTION_RETURN_NEWLINE,  // '\r\n' -> '\n'.
+    ACTION_RETURN,          // '\rX' -> go to the start of the line.
+    ACTION_CSI_START,
+    ACTION_CSI_PRIVATE,
+    ACTION_CSI_INTERMEDIATE,
+    ACTION_CSI_DIGIT,
+    ACTION_CSI_SEPARATOR,
+    ACTION_CSI_DISPATCH,
+    ACTION_OSC_START,
+    ACTION_OSC_DIGIT,
+    ACTION_OSC_PUT,
+    ACTION_OSC_DISPATCH,
+
+    // Flag: process the byte again in the next state instead of consuming it.
+    ACTION_REPROCESS = 0x80,
+};
+
+struct Escape_Transition {
+    uint8_t next;
+    uint8_t action;
+};
+
+// clang-format off
+static const uint8_t escape_classes[256] = {
+    // 0  1  2  3  4  5  6  7   8  9  a  b  c  d  e  f
+       0, 0, 0, 0, 0, 0, 0, 1,  0, 0, 2, 0, 0, 3, 0, 0,  // 0x00
+       0, 0, 0, 0, 0, 0, 0, 0,  0, 0, 0, 4, 0, 0, 0, 0,  // 0x10
+       5, 5, 5, 5, 5, 5, 5, 5,  5, 5, 5, 5, 5, 5, 5, 5,  // 0x20
+       6, 6, 6, 6, 6, 6, 6, 6,  6, 6, 7, 7, 8, 8, 8, 8,  // 0x30
+      12,12,12,12,12,12,12,12, 12,12,12,12,12,12,12,12,  // 0x40
+      12,12,12,12,12,12,12,12, 12,12,12, 9,11,10,12,12,  // 0x50
+      12,12,12,12,12,12,12,12, 12,12,12,12,12,12,12,12,  // 0x60
+      12,12,12,12,12,12,12,12, 12,12,12,12,12,12,12,13,  // 0x70
+      13,13,13,13,13,13,13,13, 13,13,13,13,13,13,13,13,  // 0x80
+      13,13,13,13,13,13,13,13, 13,13,13,13,13,13,13,13,  // 0x90
+      13,13,13,13,13,13,13,13, 13,13,13,13,13,13,13,13,  // 0xa0
+      13,13,13,13,13,13,13,13, 13,13,13,13,13,13,13,13,  // 0xb0
+      13,13,13,13,13,13,13,13, 13,13,13,13,13,13,13,13,  // 0xc0
+      13,13,13,13,13,13,13,13, 13,13,13,13,13,13,13,13,  // 0xd0
+      13,13,13,13,13,13,13,13, 13,13,13,13,13,13,13,13,  // 0xe0
+      13,13,13,13,13,13,13,13, 13,13,13,13,13,13,13,13,  // 0xf0
+};
+
+#define T(NEXT, ACTION) {ESCAPE_##NEXT, ACTION_##ACTION}
+#define TR(NEXT, ACTION) {ESCAPE_##NEXT, ACTION_##ACTION | ACTION_REPROCESS}
+
+// Note: control codes inside a sequence abort it and are then handled as normal text.
+static const Escape_Transition escape_transitions[ESCAPE_STATE_COUNT][CLASS_COUNT] = {
+    // ESCAPE_GROUND -- never looked up.
+    {},
+
+    // ESCAPE_CARRIAGE_RETURN
+    {
+        /* CONTROL      */ TR(GROUND, RETURN),
+        /* BELL         */ TR(GROUND, RETURN),
+        /* NEWLINE      */ T(GROUND, RETURN_NEWLINE),
+        /* RETURN       */ T(CARRIAGE_RETURN, NONE),  // Ignore consecutive '\r's.
+        /* ESCAPE       */ TR(GROUND, RETURN),
+        /* INTERMEDIATE */ TR(GROUND, RETURN),
+        /* DIGIT        */ TR(GROUND, RETURN),
+        /* SEPARATOR    */ TR(GROUND, RETURN),
+        /* PRIVATE      */ TR(GROUND, RETURN),
+        /* CSI          */ TR(GROUND, RETURN),
+        /* OSC          */ TR(GROUND, RETURN),
+        /* ST           */ TR(GROUND, RETURN),
+        /* FINAL        */ TR(GROUND, RETURN),
+        /* HIGH         */ TR(GROUND, RETURN),
+    },
+
+    // ESCAPE_ESCAPE
+    {
+        /* CONTROL      */ TR(GROUND, NONE),
+        /* BELL         */ TR(GROUND, NONE),
+        /* NEWLINE      */ TR(GROUND, NONE),
+        /* RETURN       */ TR(GROUND, NONE),
+        /* ESCAPE       */ T(ESCAPE, NONE),
+        /* INTERMEDIATE */ T(CHARSET, NONE),
+        /* DIGIT        */ T(GROUND, NONE),  // ESC 7, ESC 8 -- save / restore cursor.
+        /* SEPARATOR    */ T(GROUND, NONE),
+        /* PRIVATE      */ T(GROUND, NONE),  // ESC =, ESC > -- numlock.
+        /* CSI          */ T(CSI_PARAM, CSI_START),
+        /* OSC          */ T(OSC_COMMAND, OSC_START),
+        /* ST           */ T(GROUND, NONE),
+        /* FINAL        */ T(GROUND, NONE),  // ESC M, ESC H, etc.
+        /* HIGH         */ TR(GROUND, NONE),
+    },
+
+    // ESCAPE_CHARSET
+    {
+        /* CONTROL      */ TR(GROUND, NONE),
+        /* BELL         */ TR(GROUND, NONE),
+        /* NEWLINE      */ TR(GROUND, NONE),
+        /* RETURN       */ TR(GROUND, NONE),
+        /* ESCAPE       */ T(ESCAPE, NONE),
+        /* INTERMEDIATE */ T(CHARSET, NONE),
+        /* DIGIT        */ T(GROUND, NONE),
+        /* SEPARATOR    */ T(GROUND, NONE),
+        /* PRIVATE      */ T(GROUND, NONE),
+        /* CSI          */ T(GROUND, NONE),
+        /* OSC          */ T(GROUND, NONE),
+        /* ST           */ T(GROUND, NONE),
+        /* FINAL        */ T(GROUND, NONE),
+        /* HIGH         */ TR(GROUND, NONE),
+    },
+
+    // ESCAPE_CSI_PARAM
+    {
+        /* CONTROL      */ TR(GROUND, NONE),
+        /* BELL         */ TR(GROUND, NONE),
+        /* NEWLINE      */ TR(GROUND, NONE),
+        /* RETURN       */ TR(GROUND, NONE),
+        /* ESCAPE       */ T(ESCAPE, NONE),
+        /* INTERMEDIATE */ T(CSI_INTERMEDIATE, CSI_INTERMEDIATE),
+        /* DIGIT        */ T(CSI_PARAM, CSI_DIGIT),
+        /* SEPARATOR    */ T(CSI_PARAM, CSI_SEPARATOR),
+        /* PRIVATE      */ T(CSI_PARAM, CSI_PRIVATE),
+        /* CSI          */ T(GROUND, CSI_DISPATCH),
+        /* OSC          */ T(GROUND, CSI_DISPATCH),
+        /* ST           */ T(GROUND, CSI_DISPATCH),
+        /* FINAL        */ T(GROUND, CSI_DISPATCH),
+        /* HIGH         */ TR(GROUND, NONE),
+    },
+
+    // ESCAPE_CSI_INTERMEDIATE
+    {
+        /* CONTROL      */ TR(GROUND, NONE),
+        /* BELL         */ TR(GROUND, NONE),
+        /* NEWLINE      */ TR(GROUND, NONE),
+        /* RETURN       */ TR(GROUND, NONE),
+        /* ESCAPE       */ T(ESCAPE, NONE),
+        /* INTERMEDIATE */ T(CSI_INTERMEDIATE, CSI_INTERMEDIATE),
+        /* DIGIT        */ T(CSI_IGNORE, NONE),
+        /* SEPARATOR    */ T(CSI_IGNORE, NONE),
+        /* PRIVATE      */ T(CSI_IGNORE, NONE),
+        /* CSI          */ T(GROUND, CSI_DISPATCH),
+        /* OSC          */ T(GROUND, CSI_DISPATCH),
+        /* ST           */ T(GROUND, CSI_DISPATCH),
+        /* FINAL        */ T(GROUND, CSI_DISPATCH),
+        /* HIGH         */ TR(GROUND, NONE),
+    },
+
+    // ESCAPE_CSI_IGNORE
+    {
+        /* CONTROL      */ TR(GROUND, NONE),
+        /* BELL         */ TR(GROUND, NONE),
+        /* NEWLINE      */ TR(GROUND, NONE),
+        /* RETURN       */ TR(GROUND, NONE),
+        /* ESCAPE       */ T(ESCAPE, NONE),
+        /* INTERMEDIATE */ T(CSI_IGNORE, NONE),
+        /* DIGIT        */ T(CSI_IGNORE, NONE),
+        /* SEPARATOR    */ T(CSI_IGNORE, NONE),
+        /* PRIVATE      */ T(CSI_IGNORE, NONE),
+        /* CSI          */ T(GROUND, NONE),
+        /* OSC          */ T(GROUND, NONE),
+        /* ST           */ T(GROUND, NONE),
+        /* FINAL        */ T(GROUND, NONE),
+        /* HIGH         */ TR(GROUND, NONE),
+    },
+
+    // ESCAPE_OSC_COMMAND
+    {
+        /* CONTROL      */ T(OSC_STRING, NONE),
+        /* BELL         */ T(GROUND, OSC_DISPATCH),
+        /* NEWLINE      */ T(OSC_STRING, NONE),
+        /* RETURN       */ T(OSC_STRING, NONE),
+        /* ESCAPE       */ T(OSC_ESCAPE, NONE),
+        /* INTERMEDIATE */ T(OSC_STRING, NONE),
+        /* DIGIT        */ T(OSC_COMMAND, OSC_DIGIT),
+        /* SEPARATOR    */ T(OSC_STRING, NONE),
+        /* PRIVATE      */ T(OSC_STRING, NONE),
+        /* CSI          */ T(OSC_STRING, NONE),
+        /* OSC          */ T(OSC_STRING, NONE),
+        /* ST           */ T(OSC_STRING, NONE),
+        /* FINAL        */ T(OSC_STRING, NONE),
+        /* HIGH         */ T(OSC_STRING, NONE),
+    },
+
+    // ESCAPE_OSC_STRING
+    {
+        /* CONTROL      */ T(OSC_STRING, NONE),
+        /* BELL         */ T(GROUND, OSC_DISPATCH),
+        /* NEWLINE      */ T(OSC_STRING, NONE),
+        /* RETURN       */ T(OSC_STRING, NONE),
+        /* ESCAPE       */ T(OSC_ESCAPE, NONE),
+        /* INTERMEDIATE */ T(OSC_STRING, OSC_PUT),
+        /* DIGIT        */ T(OSC_STRING, OSC_PUT),
+        /* SEPARATOR    */ T(OSC_STRING, OSC_PUT),
+        /* PRIVATE      */ T(OSC_STRING, OSC_PUT),
+        /* CSI          */ T(OSC_STRING, OSC_PUT),
+        /* OSC          */ T(OSC_STRING, OSC_PUT),
+        /* ST           */ T(OSC_STRING, OSC_PUT),
+        /* FINAL        */ T(OSC_STRING, OSC_PUT),
+        /* HIGH         */ T(OSC_STRING, OSC_PUT),
+    },
+
+    // ESCAPE_OSC_ESCAPE
+    {
+        /* CONTROL      */ TR(ESCAPE, OSC_DISPATCH),
+        /* BELL         */ TR(ESCAPE, OSC_DISPATCH),
+        /* NEWLINE      */ TR(ESCAPE, OSC_DISPATCH),
+        /* RETURN       */ TR(ESCAPE, OSC_DISPATCH),
+        /* ESCAPE       */ TR(ESCAPE, OSC_DISPATCH),
+        /* INTERMEDIATE */ TR(ESCAPE, OSC_DISPATCH),
+        /* DIGIT        */ TR(ESCAPE, OSC_DISPATCH),
+        /* SEPARATOR    */ TR(ESCAPE, OSC_DISPATCH),
+        /* PRIVATE      */ TR(ESCAPE, OSC_DISPATCH),
+        /* CSI          */ TR(ESCAPE, OSC_DISPATCH),
+        /* OSC          */ TR(ESCAPE, OSC_DISPATCH),
+        /* ST           */ T(GROUND, OSC_DISPATCH),
+        /* FINAL        */ TR(ESCAPE, OSC_DISPATCH),
+        /* HIGH         */ TR(ESCAPE, OSC_DISPATCH),
+    },
+};
+
+#undef T
+#undef TR
+// clang-format on
 
-        // Args are separated by semicolons.
-        if (!semicolon)
-            break;
-        ++*it;
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - Escape sequences - Utility
+///////////////////////////////////////////////////////////////////////////////
+
+static void set_graphics_rendition(Backlog_State* backlog, const Backlog_Style& style) {
+    uint16_t id = backlog_intern_style(backlog, style);
+    backlog->style = style;
+
+    // A style that is replaced before any text is written doesn't need an event.
+    if (backlog->events.len > 0 && backlog->last_event_index == backlog->length &&
+        backlog->events.last().type == BACKLOG_EVENT_SET_GRAPHIC_RENDITION) {
+        backlog->events.last().payload = id;
+        return;
     }
-    return true;
+
+    backlog_push_event(backlog, backlog->length, BACKLOG_EVENT_SET_GRAPHIC_RENDITION, id);
 }
 
-static void set_graphics_rendition(Backlog_State* backlog, uint64_t graphics_rendition) {
-    Backlog_Event event = {};
-    event.index = backlog->length;
-    event.type = BACKLOG_EVENT_SET_GRAPHIC_RENDITION;
-    event.payload = graphics_rendition;
-    backlog->events.reserve(cz::heap_allocator(), 1);
-    backlog->events.push(event);
-    backlog->graphics_rendition = graphics_rendition;
+static void push_escape_param(Backlog_Escape_Parser* parser, int32_t param) {
+    // Extra parameters are dropped.
+    if (parser->num_params < BACKLOG_ESCAPE_MAX_PARAMS)
+        parser->params[parser->num_params++] = param;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Module Code - Escape sequences - Parsing complicated ones
 ///////////////////////////////////////////////////////////////////////////////
 
-static bool parse_extended_color(uint64_t* color, cz::Slice<int32_t> args, size_t* i) {
+static uint32_t color_component(int32_t arg) {
+    // Missing arguments are 0.
+    return (uint32_t)cz::max(0, cz::min(arg, 255));
+}
+
+/// Parse `38;5;<n>` (256 colors) or `38;2;<r>;<g>;<b>` (truecolor) starting at `*i`.
+static bool parse_extended_color(uint32_t* color, cz::Slice<int32_t> args, size_t* i) {
     if (*i + 2 >= args.len) {
         *i = args.len - 1;
         return false;
@@ -244,387 +1125,632 @@ static bool parse_extended_color(uint64_t* color, cz::Slice<int32_t> args, size_
             *i += 2;
             return false;
         }
-        *color = args[*i + 2];
+        *color = (uint32_t)args[*i + 2] & 0xff;
         *i += 2;
         return true;
     } else if (args[*i + 1] == 2) {
-        // r = i + 2
-        // g = i + 3
-        // b = i + 4
+        if (*i + 4 >= args.len) {
+            *i = args.len - 1;
+            return false;
+        }
+        uint32_t r = color_component(args[*i + 2]);
+        uint32_t g = color_component(args[*i + 3]);
+        uint32_t b = color_component(args[*i + 4]);
+        *color = STYLE_COLOR_RGB | (r << 16) | (g << 8) | b;
         *i += 4;
+        return true;
     }
     return false;
 }
 
-static uint64_t parse_graphics_rendition(cz::Slice<int32_t> args, uint64_t graphics_rendition) {
+static Backlog_Style parse_graphics_rendition(cz::Slice<int32_t> args, Backlog_Style style) {
     if (args.len == 0)
-        graphics_rendition = (7 << GR_FOREGROUND_SHIFT);
+        style = default_style;
 
     for (size_t i = 0; i < args.len; ++i) {
         if (args[i] == 0 || args[i] == -1) {
             // Reset everything.
-            graphics_rendition = (7 << GR_FOREGROUND_SHIFT);
+            style = default_style;
         } else if (args[i] == 1) {
-            graphics_rendition |= GR_BOLD;
+            style.flags |= STYLE_BOLD;
         } else if (args[i] == 21) {
-            graphics_rendition &= ~GR_BOLD;
+            style.flags &= ~STYLE_BOLD;
         } else if (args[i] == 4) {
-            graphics_rendition |= GR_UNDERLINE;
+            style.flags |= STYLE_UNDERLINE;
         } else if (args[i] == 24) {
-            graphics_rendition &= ~GR_UNDERLINE;
+            style.flags &= ~STYLE_UNDERLINE;
         } else if (args[i] == 7) {
-            graphics_rendition |= GR_REVERSE;
+            style.flags |= STYLE_REVERSE;
         } else if (args[i] == 27) {
-            graphics_rendition &= ~GR_REVERSE;
+            style.flags &= ~STYLE_REVERSE;
         } else if ((args[i] >= 30 && args[i] <= 39) || (args[i] >= 90 && args[i] <= 99)) {
             // Set foreground color.
             if (args[i] <= 39)
-                graphics_rendition &= ~GR_BRIGHT;
+                style.flags &= ~STYLE_BRIGHT;
             else
-                graphics_rendition |= GR_BRIGHT;
-            graphics_rendition &= ~GR_FOREGROUND_MASK;
-            uint64_t color = args[i] - 30;
+                style.flags |= STYLE_BRIGHT;
+            uint32_t color = args[i] - 30;
             if (color == 9)
                 color = 7;
             if (color == 8) {
                 if (!parse_extended_color(&color, args, &i))
                     color = 7;
             }
-            graphics_rendition |= (color << GR_FOREGROUND_SHIFT);
+            style.foreground = color;
         } else if ((args[i] >= 40 && args[i] <= 49) || (args[i] >= 100 && args[i] <= 109)) {
             // Set background color.
             if (args[i] <= 49)
-                graphics_rendition &= ~GR_BRIGHT;
+                style.flags &= ~STYLE_BRIGHT;
             else
-                graphics_rendition |= GR_BRIGHT;
-            graphics_rendition &= ~GR_BACKGROUND_MASK;
-            uint64_t color = args[i] - 40;
+                style.flags |= STYLE_BRIGHT;
+            uint32_t color = args[i] - 40;
             if (color == 9)
                 color = 0;
             if (color == 8) {
                 if (!parse_extended_color(&color, args, &i))
                     color = 0;
             }
-            graphics_rendition |= (color << GR_BACKGROUND_SHIFT);
+            style.background = color;
         } else {
             // Ignored.
         }
     }
 
-    return graphics_rendition;
+    return style;
 }
 
-static bool parse_hyperlink(Backlog_State* backlog, cz::Str fresh, size_t* skip) {
-    // ESC]8;; <HYPERLINK> \a <TEXT> ESC]8;;
-    // <TEXT> can have escape sequences in it and thus we preempt at the \a.
+static void dispatch_csi(Backlog_State* backlog, char final) {
+    Backlog_Escape_Parser* parser = &backlog->escape_parser;
 
-    cz::String* text = &backlog->escape_backlog;
-    if (!ensure_char(backlog, 3, fresh, skip))
-        return false;
-    if (!ensure_char(backlog, 4, fresh, skip))
-        return false;
-    if ((*text)[3] != ';' || (*text)[4] != ';')
-        CZ_PANIC("todo");
+    // Trailing arguments are only present if they are specified.
+    if (parser->param != -1)
+        push_escape_param(parser, parser->param);
+    cz::Slice<int32_t> args = {parser->params, parser->num_params};
 
-    Backlog_Event event = {};
-    event.index = backlog->length;
+    // Ignoring all private modes (ESC [ ? <n> h / ESC [ ? <n> l):
+    // 1 = numlock, 3 = 132/80 columns, 12 = blinking, 25 = show cursor,
+    // 1049 = alternate screen buffer, 2004 = bracketed paste, etc.
+    if (parser->private_marker)
+        return;
 
-    if (backlog->inside_hyperlink) {
-        event.type = BACKLOG_EVENT_END_HYPERLINK;
-    } else {
-        size_t it = 5;
-        while (1) {
-            if (!ensure_char(backlog, it, fresh, skip))
-                return false;
-            char ch = (*text)[it];
-            if (ch == '\a')
-                break;
-            ++it;
+    if (parser->intermediate) {
+        // ESC [ ! p            Soft Reset
+        if (parser->intermediate == '!' && final == 'p') {
+            set_graphics_rendition(backlog, default_style);
         }
-
-        cz::Str url = text->slice(5, text->len - 1);
-        event.payload = (uint64_t)url.clone_null_terminate(backlog->arena.allocator()).buffer;
-        event.type = BACKLOG_EVENT_START_HYPERLINK;
+        return;
     }
 
-    backlog->inside_hyperlink = !backlog->inside_hyperlink;
-    backlog->events.reserve(cz::heap_allocator(), 1);
-    backlog->events.push(event);
-    return true;
+    switch (final) {
+    // ESC [ <ns> m         Set Graphic Rendition (series of commands to change
+    //                      how future characters are rendered)
+    case 'm': {
+        Backlog_Style style = parse_graphics_rendition(args, backlog->style);
+        set_graphics_rendition(backlog, style);
+    } break;
+
+    // ESC [ <y> ; <x> H    Cursor Set Position
+    // ESC [ <y> ; <x> f    Cursor Set Position
+    case 'H':
+    case 'f': {
+        // Windows sends ESC [ H instead of CR so handle that.
+        if (args.len > 0)
+            break;
+        uint64_t line_start = current_line_start(backlog);
+        truncate_to(backlog, line_start);
+    } break;
+
+    // ESC [ <n> C          Cursor Forward
+    case 'C': {
+        // Instead of writing 12 spaces, conhost emits:
+        // ESC [ 12 X ESC [ 96 m ESC [ 12 C
+        // In other words, clear 12 characters, reset the rendition,
+        // then move forward 12 characters.  We just ignore the clear
+        // operation and count the "move forward" as inserting spaces.
+        if (args.len >= 1) {
+            for (int32_t i = 0; i < args[0]; ++i) {
+                append_chunk(backlog, " ");
+            }
+        }
+    } break;
+
+    // Everything else is ignored.  Notably:
+    //
+    // ESC [ s / ESC [ u    Save / Restore Cursor
+    // ESC [ <n> A B D E F  Cursor movement
+    // ESC [ <n> G d        Cursor Set Column / Row
+    // ESC [ <n> S T        Scroll Up / Down
+    // ESC [ <m> @ P X L M  Insert / Delete / Erase Characters / Lines
+    // ESC [ <o> J K        Erase in Display / Line
+    // ESC [ <n> g          Clear Tab Stop(s)
+    // ESC [ <n> ; <b> r    Set Scrolling Region
+    // ESC [ 6 n            Report Cursor Position (this is probably going to cause bugs)
+    // ESC [ 0 c            Report Device Attributes (this is probably going to cause bugs)
+    default:
+        break;
+    }
 }
 
-static bool parse_set_window_title(Backlog_State* backlog, cz::Str fresh, size_t* skip) {
-    // ESC]0; <TITLE> BEL
-    cz::String* text = &backlog->escape_backlog;
-    if (!ensure_char(backlog, 3, fresh, skip))
-        return false;
-    if ((*text)[3] != ';')
-        CZ_PANIC("todo");
+static void dispatch_osc(Backlog_State* backlog) {
+    Backlog_Escape_Parser* parser = &backlog->escape_parser;
 
-    size_t it = 4;
-    while (1) {
-        if (!ensure_char(backlog, it, fresh, skip))
-            return false;
-        char ch = (*text)[it];
-        if (ch == '\a') {
-            // Alarm is the end of this sequence.
-            text->remove(it);
-            break;
-        }
-        ++it;
+    // ESC ] 0 ; <TITLE> BEL is a window title; it and all other unknown commands are ignored.
+    if (parser->osc_command != 8)
+        return;
+
+    // ESC ] 8 ; <PARAMS> ; <URL> ST <TEXT> ESC ] 8 ; ; ST
+    // <TEXT> can have escape sequences in it.
+    cz::Str string = parser->osc_string;
+    const char* semicolon = string.find(';');
+    if (!semicolon)
+        return;
+    cz::Str url = string.slice_start(semicolon - string.buffer + 1);
+
+    if (backlog->inside_hyperlink) {
+        backlog_push_event(backlog, backlog->length, BACKLOG_EVENT_END_HYPERLINK, 0);
+        backlog->inside_hyperlink = false;
     }
 
-    // Ignore the event.
-    return true;
+    // Past the limit the text is left as is.
+    if (url.len > 0 && backlog->hyperlinks.len < BACKLOG_MAX_HYPERLINKS) {
+        backlog->hyperlinks.reserve(cz::heap_allocator(), 1);
+        backlog->hyperlinks.push(url.clone_null_terminate(backlog->arena.allocator()).buffer);
+        backlog_push_event(backlog, backlog->length, BACKLOG_EVENT_START_HYPERLINK,
+                           (uint32_t)(backlog->hyperlinks.len - 1));
+        backlog->inside_hyperlink = true;
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Module Code - Escape sequences - Wrapper and simple ones
+// Module Code - Escape sequences - State machine
 ///////////////////////////////////////////////////////////////////////////////
 
-/// Attempt to process an escape sequence.  Returns `true` if it
-/// was processed, `false` if we need more input to process it.
-static bool process_escape_sequence(Backlog_State* backlog, cz::Str fresh, size_t* skip) {
-    // Note(chris.gregory): At least right now we only care
-    // about color escape sequences.  The rest we will discard.
+/// Hyperlinks longer than this are truncated.
+#define OSC_STRING_MAX 4096
 
-    cz::String* text = &backlog->escape_backlog;
+static void run_escape_action(Backlog_State* backlog, uint8_t action, char ch) {
+    Backlog_Escape_Parser* parser = &backlog->escape_parser;
 
-    if (!ensure_char(backlog, 0, fresh, skip))
-        return false;
+    switch (action) {
+    case ACTION_NONE:
+        break;
 
-    if ((*text)[0] == '\r') {
-        while (1) {
-            if (!ensure_char(backlog, 1, fresh, skip))
-                return false;
+    case ACTION_RETURN_NEWLINE:
+        append_chunk(backlog, "\n");
+        break;
 
-            // Ignore consecutive '\r's.
-            if ((*text)[1] == '\r') {
-                text->pop();
-                continue;
-            }
+    case ACTION_RETURN: {
+        if (backlog->coalesce_progress) {
+            start_line_edit(backlog);
+            break;
+        }
 
-            if ((*text)[1] == '\n') {
-                // '\r\n' -> '\n'
-                append_chunk(backlog, "\n");
-            } else {
-                // '\rX' -> '\r' then process 'X'
-                // TODO: this isn't right -- this should only move the cursor
-                // and not change the line.  But in practice this works.
-                uint64_t line_start = backlog->lines.len > 0 ? backlog->lines.last() : 0;
-                truncate_to(backlog, line_start);
-                --*skip;
-            }
-            return true;
+        // TODO: this isn't right -- this should only move the cursor
+        // and not change the line.  But in practice this works.
+        uint64_t line_start = current_line_start(backlog);
+        truncate_to(backlog, line_start);
+    } break;
+
+    case ACTION_CSI_START:
+        parser->private_marker = 0;
+        parser->intermediate = 0;
+        parser->num_params = 0;
+        parser->param = -1;
+        break;
+
+    case ACTION_CSI_PRIVATE:
+        parser->private_marker = ch;
+        break;
+
+    case ACTION_CSI_INTERMEDIATE:
+        parser->intermediate = ch;
+        break;
+
+    case ACTION_CSI_DIGIT:
+        if (parser->param == -1)
+            parser->param = 0;
+        parser->param = cz::min(parser->param * 10 + (ch - '0'), 32767);
+        break;
+
+    case ACTION_CSI_SEPARATOR:
+        push_escape_param(parser, parser->param);
+        parser->param = -1;
+        break;
+
+    case ACTION_CSI_DISPATCH:
+        dispatch_csi(backlog, ch);
+        break;
+
+    case ACTION_OSC_START:
+        parser->osc_command = -1;
+        parser->osc_string.len = 0;
+        break;
+
+    case ACTION_OSC_DIGIT:
+        if (parser->osc_command == -1)
+            parser->osc_command = 0;
+        parser->osc_command = cz::min(parser->osc_command * 10 + (ch - '0'), 32767);
+        break;
+
+    case ACTION_OSC_PUT:
+        if (parser->osc_command == 8 && parser->osc_string.len < OSC_STRING_MAX) {
+            parser->osc_string.reserve(cz::heap_allocator(), 1);
+            parser->osc_string.push(ch);
         }
+        break;
+
+    case ACTION_OSC_DISPATCH:
+        dispatch_osc(backlog);
+        break;
+
+    default:
+        CZ_PANIC("unreachable");
     }
+}
 
-    CZ_DEBUG_ASSERT((*text)[0] == 0x1b);
+/// Run the escape sequence state machine until it returns to the ground
+/// state or `text` runs out.  Returns the number of bytes consumed.
+static size_t process_escape_sequence(Backlog_State* backlog, cz::Str text) {
+    Backlog_Escape_Parser* parser = &backlog->escape_parser;
+
+    size_t i = 0;
+    while (i < text.len && parser->state != ESCAPE_GROUND) {
+        char ch = text[i];
+        Escape_Transition transition = escape_transitions[parser->state][escape_classes[(uint8_t)ch]];
+        parser->state = transition.next;
+        run_escape_action(backlog, transition.action & ~ACTION_REPROCESS, ch);
+        if (!(transition.action & ACTION_REPROCESS))
+            ++i;
+    }
+    return i;
+}
 
-    if (!ensure_char(backlog, 1, fresh, skip))
-        return false;
+static void truncate_to(Backlog_State* backlog, uint64_t new_length) {
+    size_t outer_before = OUTER_INDEX(backlog->length);
+    backlog->length = new_length;
+    ++backlog->rewrites;
+    for (size_t i = outer_before + 1; i-- > OUTER_INDEX(backlog->length) + 1;) {
+        free_chunk(backlog, backlog->buffers.len - 1);
+        backlog->buffers.pop();
+        backlog->spill_slots.pop();
+        backlog->compressed.pop();
+        backlog->widths.pop();
+        backlog->filters.pop();
+    }
 
-    // Ignoring these messages.
-    // ESC M = Move up one line.
-    // ESC 7 = Save cursor, ESC 8 = Restore cursor.
-    // ESC = = Disable numlock, ESC > = Enable numlock.
-    // ESC H = Set tabstop at cursor's current column.
-    if ((*text)[1] == 'M' || (*text)[1] == '7' || (*text)[1] == '8' || (*text)[1] == '=' ||
-        (*text)[1] == '>' || (*text)[1] == 'H') {
-        return true;
+    clamp_events_to(backlog, new_length);
+
+    // We're going to write to the last chunk.
+    backlog_compress_restore(backlog, backlog->buffers.len - 1);
+    backlog_spill_restore(backlog, backlog->buffers.len - 1);
+
+    forget_widths_after(backlog, new_length);
+    backlog_index_truncate(backlog, new_length);
+
+    // Rewind the wrap index to the start of the line.  Stale
+    // points are discarded the next time the index is updated.
+    Backlog_Wrap_Index* wrap_index = &backlog->wrap_index;
+    if (wrap_index->indexed_until > new_length) {
+        uint64_t line_start = current_line_start(backlog);
+        CZ_DEBUG_ASSERT(line_start <= new_length);
+        wrap_index->indexed_until = line_start;
+        wrap_index->x = 0;
+        wrap_index->column = 0;
     }
+}
 
-    if ((*text)[1] == '[') {
-        if (!ensure_char(backlog, 2, fresh, skip))
-            return false;
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - Escape sequences - Line edits
+///////////////////////////////////////////////////////////////////////////////
 
-        if ((*text)[2] == '?') {
-            size_t it = 3;
-
-            // Parse code.
-            int32_t arg = -1;
-            if (!eat_number(backlog, &it, fresh, skip, &arg))
-                return false;
-
-            // Parse high or low flag.
-            if (!ensure_char(backlog, it, fresh, skip))
-                return false;
-            bool high = false;
-            if ((*text)[it] == 'h') {
-                high = true;
-            } else if ((*text)[it] == 'l') {
-                high = false;
-            } else {
-                append_chunk(backlog, text->slice_start(1));
-                return true;
-            }
+static void start_line_edit(Backlog_State* backlog) {
+    Backlog_Line_Edit* edit = &backlog->line_edit;
+    edit->active = true;
+    edit->after_return = false;
+    edit->state = ESCAPE_GROUND;
+    edit->text.len = 0;
+    edit->kept = 0;
+}
 
-            if (arg == 12) {
-                // Start/Stop Blinking
-                (void)high;
-            } else if (arg == 25) {
-                // Show/Hide Cursor
-            } else if (arg == 1) {
-                // Enable/Disable Numlock
-            } else if (arg == 3) {
-                // Set Columns to 132/80
-            } else if (arg == 1049) {
-                // Enable/Disable Alternate Screen Buffer
-            } else {
-                append_chunk(backlog, text->slice_start(1));
-            }
-            return true;
-        } else if ((*text)[2] == '!') {
-            if (!ensure_char(backlog, 3, fresh, skip))
-                return false;
-
-            if ((*text)[3] == 'p') {
-                uint64_t graphics_rendition = (7 << GR_FOREGROUND_SHIFT);
-                set_graphics_rendition(backlog, graphics_rendition);
-            } else {
-                // Undo skipping the unrecognized character.
-                CZ_DEBUG_ASSERT(*skip > 0);
-                --*skip;
-                append_chunk(backlog, "[!");
-            }
-            return true;
-        } else {
-            size_t it = 2;
-            cz::Vector<int32_t> args = {};
-            if (!parse_args(backlog, &it, fresh, skip, &args))
-                return false;
-
-            if (!ensure_char(backlog, it, fresh, skip))
-                return false;
-
-            // Ignoring these messages (this is probably fine).
-            // ESC [ s              Save Cursor
-            // ESC [ u              Restore Cursor
-            //
-            // ESC [ <n> A          Cursor Up
-            // ESC [ <n> B          Cursor Down
-            // ESC [ <n> D          Cursor Backward
-            // ESC [ <n> E          Cursor Down Lines
-            // ESC [ <n> F          Cursor Up Lines
-            // ESC [ <n> G          Cursor Set Column
-            // ESC [ <n> d          Cursor Set Row
-            // ESC [ <n> l          Cursor Forward to Tabstop
-            // ESC [ <n> Z          Cursor Backwards to Tabstop
-            // ESC [ <n> S          Scroll Up
-            // ESC [ <n> T          Scroll Down
-            //
-            // ESC [ <m> @          Insert Character (insert n spaces shifting to right text after)
-            // ESC [ <m> P          Delete Character (shift left n characters)
-            // ESC [ <m> X          Erase Character (overwrite n characters with space)
-            // ESC [ <m> L          Insert Line (shift down lines below n times)
-            // ESC [ <m> M          Delete Line (delete n lines and shift up lines below them)
-            // ESC [ <o> J          Erase in Display (the part specified by o)
-            // ESC [ <o> K          Erase in Line (the part specified by o)
-            //
-            // ESC [ 0 g            Clear Tab Stop at Column
-            // ESC [ 3 g            Clear All Tab Stops
-            //
-            // ESC [ <n> ; <b> r    Set Scrolling Region between n and b (row numbers).
-            if ((*text)[it] == 's' || (*text)[it] == 'u' || (*text)[it] == 'A' ||
-                (*text)[it] == 'B' || (*text)[it] == 'D' || (*text)[it] == 'E' ||
-                (*text)[it] == 'F' || (*text)[it] == 'G' || (*text)[it] == 'd' ||
-                (*text)[it] == 'l' || (*text)[it] == 'Z' || (*text)[it] == 'S' ||
-                (*text)[it] == 'T' || (*text)[it] == '@' || (*text)[it] == 'P' ||
-                (*text)[it] == 'X' || (*text)[it] == 'L' || (*text)[it] == 'M' ||
-                (*text)[it] == 'J' || (*text)[it] == 'K' || (*text)[it] == 'g' ||
-                (*text)[it] == 'r') {
-                return true;
-            }
+/// Replace the line with the redraw.
+static void commit_line_edit(Backlog_State* backlog) {
+    ZoneScoped;
 
-            // Ignoring these messages (this is probably going to cause bugs).
-            // ESC [ 6 n            Report Cursor Position (term should print ESC [ <y> ; <x> R)
-            // ESC [ 0 c            Report Device Attributes (term should print ESC [ ? 1 ; 0 c)
-            else if ((*text)[it] == 'n' || (*text)[it] == 'c') {
-                CZ_PANIC("todo");
-                return true;
-            }
+    Backlog_Line_Edit* edit = &backlog->line_edit;
+    edit->active = false;
+
+    // Like `ACTION_RETURN` but only once per batch of redraws.
+    uint64_t line_start = current_line_start(backlog);
+    truncate_to(backlog, line_start);
+    append_text(backlog, edit->text);
+
+    // Let the escape parser decide if the '\r' ends the line.
+    if (edit->after_return)
+        backlog->escape_parser.state = ESCAPE_CARRIAGE_RETURN;
+}
+
+/// Drop the current redraw because it was replaced.  Only the escape sequences that set
+/// state outliving the line are kept: styles (ESC [ m and ESC [ ! p) and OSC sequences.
+static void drop_redraw(Backlog_Line_Edit* edit) {
+    ++edit->dropped;
+
+    // Most redraws are plain text.
+    cz::Str redraw = edit->text.slice_start(edit->kept);
+    if (!redraw.find(0x1b)) {
+        edit->text.len = edit->kept;
+        return;
+    }
+
+    uint8_t state = ESCAPE_GROUND;
+    size_t out = edit->kept;
+    size_t sequence_start = out;
+    for (size_t i = edit->kept; i < edit->text.len;) {
+        if (state == ESCAPE_GROUND) {
+            // Skip the text up to the next sequence.
+            const char* escape = edit->text.slice_start(i).find(0x1b);
+            if (!escape)
+                break;
+            i = escape - edit->text.buffer + 1;
+            state = ESCAPE_ESCAPE;
+            sequence_start = out;
+            edit->text[out++] = 0x1b;
+            continue;
+        }
 
-            // ESC [ <ns> m         Set Graphic Rendition (series of commands to change
-            //                      how future characters are rendered)
-            else if ((*text)[it] == 'm') {
-                uint64_t graphics_rendition = backlog->graphics_rendition;
-                graphics_rendition = parse_graphics_rendition(args, graphics_rendition);
-                set_graphics_rendition(backlog, graphics_rendition);
-                return true;
+        char ch = edit->text[i];
+        Escape_Transition transition = escape_transitions[state][escape_classes[(uint8_t)ch]];
+        state = transition.next;
+        uint8_t action = transition.action & ~ACTION_REPROCESS;
+        if (transition.action & ACTION_REPROCESS) {
+            if (action == ACTION_OSC_DISPATCH) {
+                // The ESC that ended the OSC string starts the next sequence.
+                sequence_start = out - 1;
+            } else if (state == ESCAPE_GROUND) {
+                // Aborted.
+                out = sequence_start;
             }
+            continue;
+        }
+
+        edit->text[out++] = ch;
+        ++i;
+
+        if (state == ESCAPE_GROUND) {
+            bool keep = (action == ACTION_OSC_DISPATCH ||
+                         (action == ACTION_CSI_DISPATCH && (ch == 'm' || ch == 'p')));
+            if (!keep)
+                out = sequence_start;
+        }
+    }
 
-            // ESC [ <y> ; <x> H    Cursor Set Position
-            // ESC [ <y> ; <x> f    Cursor Set Position
-            else if ((*text)[it] == 'H' || (*text)[it] == 'f') {
-                // Windows sends ESC [ H instead of CR so handle that.
-                if (args.len > 0) {
-                    // CZ_PANIC("todo");
-                    return true;
-                }
-                uint64_t line_start = backlog->lines.len > 0 ? backlog->lines.last() : 0;
-                truncate_to(backlog, line_start);
-                return true;
+    CZ_DEBUG_ASSERT(state == ESCAPE_GROUND);
+    edit->text.len = out;
+    edit->kept = out;
+}
+
+/// Buffer `text` as part of the redraw.  Returns the number of bytes consumed.
+static size_t edit_line(Backlog_State* backlog, cz::Str text) {
+    Backlog_Line_Edit* edit = &backlog->line_edit;
+    edit->text.reserve(cz::heap_allocator(), text.len);
+
+    size_t i = 0;
+    while (i < text.len) {
+        char ch = text[i];
+        if (edit->after_return) {
+            if (ch == '\r') {
+                ++i;
+                continue;
             }
 
-            // ESC [ <n> C          Cursor Forward
-            else if ((*text)[it] == 'C') {
-                // Instead of writing 12 spaces, conhost emits:
-                // ESC [ 12 X ESC [ 96 m ESC [ 12 C
-                // In other words, clear 12 characters, reset the rendition,
-                // then move forward 12 characters.  We just ignore the clear
-                // operation and count the "move forward" as inserting spaces.
-                if (args.len >= 1) {
-                    for (int32_t i = 0; i < args[0]; ++i) {
-                        append_chunk(backlog, " ");
-                    }
-                }
-                return true;
+            // '\r\n' ends the line.  The escape parser turns it into '\n'.
+            if (ch == '\n') {
+                commit_line_edit(backlog);
+                return i;
             }
 
-            // ESC [ UNRECOGNIZED
-            else {
-                // Undo skipping the UNRECOGNIZED character.
-                CZ_DEBUG_ASSERT(*skip > 0);
-                --*skip;
-
-#if 0
-                // Pass ESC [ as raw.
-                append_chunk(backlog, text->slice_end(2));
-#else
-                append_chunk(backlog, "[");
-#endif
-                return true;
+            edit->after_return = false;
+            drop_redraw(edit);
+            if (edit->kept > BACKLOG_LINE_EDIT_MAX_KEPT) {
+                commit_line_edit(backlog);
+                start_line_edit(backlog);
             }
         }
-    } else if ((*text)[1] == '(') {
-        CZ_PANIC("todo");
-    } else if ((*text)[1] == ']') {
-        if (!ensure_char(backlog, 2, fresh, skip))
-            return false;
 
-        if ((*text)[2] == '8') {
-            return parse_hyperlink(backlog, fresh, skip);
-        } else if ((*text)[2] == '0') {
-            return parse_set_window_title(backlog, fresh, skip);
+        if (edit->state == ESCAPE_GROUND) {
+            if (ch == '\n') {
+                commit_line_edit(backlog);
+                return i;
+            }
+            if (ch == '\r') {
+                edit->after_return = true;
+                ++i;
+                continue;
+            }
+            if (ch != 0x1b) {
+                // Copy the whole run of text at once.
+                size_t end = i + 1;
+                while (end < text.len && text[end] != '\r' && text[end] != '\n' &&
+                       text[end] != 0x1b)
+                    ++end;
+                edit->text.append(text.slice(i, end));
+                i = end;
+                continue;
+            }
+            edit->state = ESCAPE_ESCAPE;
         } else {
-            CZ_PANIC("todo");
+            Escape_Transition transition =
+                escape_transitions[edit->state][escape_classes[(uint8_t)ch]];
+            edit->state = transition.next;
+            if (transition.action & ACTION_REPROCESS)
+                continue;
         }
+
+        edit->text.push(ch);
+        ++i;
+    }
+    return i;
+}
+
+void backlog_flush(Backlog_State* backlog) {
+    if (backlog->line_edit.active)
+        commit_line_edit(backlog);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - reading into the tail
+///////////////////////////////////////////////////////////////////////////////
+
+/// Clamp a read into the tail to what fits.  With ring retention the oldest output is only
+/// dropped once we know how much was read so reads are limited to a slice of the backlog.
+static size_t tail_room(Backlog_State* backlog, size_t max) {
+    if (backlog->ring_retention)
+        return cz::min(max, (size_t)(backlog->max_length / 8));
+    return cz::min(max, (size_t)(backlog->max_length - (backlog->length - backlog->discarded)));
+}
+
+Backlog_Tail_Space backlog_tail_space(Backlog_State* backlog, size_t max) {
+    Backlog_Tail_Space space = {};
+    max = tail_room(backlog, max);
+    if (max == 0)
+        return space;
+
+    uint64_t current_inner = INNER_INDEX(backlog->length);
+    space.first = {backlog->buffers.last() + current_inner,
+                   cz::min(max, (size_t)(BACKLOG_BUFFER_SIZE - current_inner))};
+    max -= space.first.len;
+
+    // Continue into the buffer that `backlog_push_buffer` will use next.
+    if (max > 0) {
+        if (!backlog->spare_buffer)
+            backlog->spare_buffer = backlog_pool_alloc();
+        space.second = {backlog->spare_buffer, cz::min(max, (size_t)BACKLOG_BUFFER_SIZE)};
+    }
+    return space;
+}
+
+/// Record text that is already in place.  Returns the number of bytes before a special
+/// character.  The special character and everything after it is not appended.
+static size_t commit_in_place(Backlog_State* backlog, cz::Str text) {
+    if (backlog->escape_parser.state != ESCAPE_GROUND || backlog->line_edit.active)
+        return 0;
+
+    size_t plain = scan_text(text, backlog->length, &backlog->lines);
+    backlog->length += plain;
+    measure_widths(backlog);
+
+    // Always need to have a buffer on hand if there is space to grow.
+    if (plain > 0 && INNER_INDEX(backlog->length) == 0 && has_space(backlog))
+        backlog_push_buffer(backlog);
+    return plain;
+}
+
+uint64_t backlog_commit_tail(Backlog_State* backlog, size_t len) {
+    ZoneScoped;
+
+    make_room(backlog, len);
+    Backlog_Tail_Space space = backlog_tail_space(backlog, len);
+    CZ_DEBUG_ASSERT(space.first.len + space.second.len == len);
+    cz::Str first = {space.first.elems, space.first.len};
+    cz::Str second = {space.second.elems, space.second.len};
+
+    // Fast path: normal text is already where it belongs.
+    size_t plain = commit_in_place(backlog, first);
+    if (plain == first.len) {
+        // `commit_in_place` made the spare buffer current.
+        plain = commit_in_place(backlog, second);
+        if (plain == second.len)
+            return len;
+        first = {};
+        second = second.slice_start(plain);
     } else {
-#if 0
-        // The other escape sequences are key values so just pass them through with the escape.
-        append_chunk(backlog, "\x1b");
-#endif
-        return true;
+        first = first.slice_start(plain);
     }
+
+    // Slow path: move the rest somewhere else because `append_text` rewrites the storage.
+    cz::String* rewrite = &backlog->rewrite_buffer;
+    rewrite->len = 0;
+    rewrite->reserve(cz::heap_allocator(), first.len + second.len);
+    rewrite->append(first);
+    rewrite->append(second);
+    append_text(backlog, *rewrite);
+    return len;
 }
 
-static void truncate_to(Backlog_State* backlog, uint64_t new_length) {
-    size_t outer_before = OUTER_INDEX(backlog->length);
-    backlog->length = new_length;
-    for (size_t i = outer_before + 1; i-- > OUTER_INDEX(backlog->length) + 1;) {
-        cz::heap_allocator().dealloc({backlog->buffers.last(), BACKLOG_BUFFER_SIZE});
-        backlog->buffers.pop();
+Backlog_Tail_Loan backlog_tail_loan(Backlog_State* backlog, size_t max) {
+    Backlog_Tail_Loan loan = {};
+    loan.offset = INNER_INDEX(backlog->length);
+    loan.max = tail_room(backlog, max);
+    return loan;
+}
+
+/// Make `chunk` the buffer `backlog_push_buffer` uses next.
+static void set_spare_buffer(Backlog_State* backlog, char* chunk) {
+    if (backlog->spare_buffer)
+        backlog_pool_free(backlog->spare_buffer);
+    backlog->spare_buffer = chunk;
+}
+
+uint64_t backlog_adopt_tail(Backlog_State* backlog,
+                            cz::Slice<char*> chunks,
+                            size_t offset,
+                            size_t len) {
+    ZoneScoped;
+
+    size_t end = offset + len;  // End of the text relative to `chunks[0]`.
+    CZ_DEBUG_ASSERT(offset < BACKLOG_BUFFER_SIZE);
+    CZ_DEBUG_ASSERT(chunks.len == (end + BACKLOG_BUFFER_SIZE - 1) / BACKLOG_BUFFER_SIZE);
+
+    size_t c = 0;           // Chunk the rest of the text starts in.
+    size_t start = offset;  // Start of the rest of the text in `chunks[c]`.
+    size_t owned = 0;       // `chunks` before this belong to the backlog.
+
+    // Fast path: the chunks replace the end of the backlog and normal text is scanned in place.
+    make_room(backlog, len);
+    if (INNER_INDEX(backlog->length) == offset &&
+        backlog->length - backlog->discarded + len <= backlog->max_length &&
+        backlog->escape_parser.state == ESCAPE_GROUND && !backlog->line_edit.active) {
+        // The last chunk is never compressed or spilled.
+        size_t last = backlog->buffers.len - 1;
+        CZ_DEBUG_ASSERT(OUTER_INDEX(backlog->length - backlog->discarded) == last);
+        CZ_DEBUG_ASSERT(!backlog->compressed[last]);
+        CZ_DEBUG_ASSERT(backlog->spill_slots[last] == BACKLOG_NOT_SPILLED);
+
+        // Fill in the start of the first chunk and swap it in.
+        memcpy(chunks[0], backlog->buffers[last], offset);
+        backlog_pool_free(backlog->buffers[last]);
+        backlog->buffers[last] = chunks[0];
+
+        for (;; ++c, start = 0) {
+            // `commit_in_place` makes the spare buffer current when this chunk fills up.
+            if (c + 1 < chunks.len)
+                set_spare_buffer(backlog, chunks[c + 1]);
+
+            size_t stop = cz::min(end - c * BACKLOG_BUFFER_SIZE, (size_t)BACKLOG_BUFFER_SIZE);
+            cz::Str text = {chunks[c] + start, stop - start};
+            size_t plain = commit_in_place(backlog, text);
+            if (plain < text.len) {
+                start += plain;
+                break;
+            }
+            if (c + 1 == chunks.len)
+                return len;
+        }
+        owned = cz::min(c + 2, chunks.len);
+    }
+
+    // Slow path: move the rest somewhere else because `append_text` rewrites the storage.
+    cz::String* rewrite = &backlog->rewrite_buffer;
+    rewrite->len = 0;
+    rewrite->reserve(cz::heap_allocator(), end - c * BACKLOG_BUFFER_SIZE - start);
+    for (; c < chunks.len; ++c, start = 0) {
+        size_t stop = cz::min(end - c * BACKLOG_BUFFER_SIZE, (size_t)BACKLOG_BUFFER_SIZE);
+        rewrite->append({chunks[c] + start, stop - start});
     }
+    for (size_t i = owned; i < chunks.len; ++i) {
+        backlog_pool_free(chunks[i]);
+    }
+    append_text(backlog, *rewrite);
+    return len;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -638,29 +1764,25 @@ uint64_t append_text(Backlog_State* backlog, cz::Str text) {
     const char del = 0x08;
     uint64_t done = 0;
 
-    // If we are inside an escape sequence then pump the text into that first.
-    if (backlog->escape_backlog.len != 0) {
-        size_t skip = 0;
-        if (!process_escape_sequence(backlog, text, &skip)) {
-            // All of the text was consumed.
-            return text.len;
+    while (done < text.len) {
+        // Buffer the redraw of a progress bar instead of writing it.
+        if (backlog->line_edit.active) {
+            done += edit_line(backlog, text.slice_start(done));
+            continue;
         }
 
-        backlog->escape_backlog.len = 0;
-        text = text.slice_start(skip);
-        done += skip;
-    }
+        // If we are inside an escape sequence then pump the text into that first.
+        if (backlog->escape_parser.state != ESCAPE_GROUND) {
+            done += process_escape_sequence(backlog, text.slice_start(done));
+            continue;
+        }
 
-    while (text.len > 0) {
-        // Find the first special character.
-        size_t chunk_len = text.len;
-        chunk_len = text.slice_end(chunk_len).find_index('\r');
-        chunk_len = text.slice_end(chunk_len).find_index(escape);
-        chunk_len = text.slice_end(chunk_len).find_index(del);
-        chunk_len = text.slice_end(chunk_len).find_index('\a');
+        // Find the first special character and log the line starts before it.
+        cz::Str remaining = text.slice_start(done);
+        size_t chunk_len = scan_text(remaining, backlog->length, &backlog->lines);
 
         // Append the normal text before it.
-        uint64_t result = append_chunk(backlog, text.slice_end(chunk_len));
+        uint64_t result = append_scanned_chunk(backlog, remaining.slice_end(chunk_len));
         done += result;
 
         // Output is truncated so just stop here.
@@ -668,43 +1790,34 @@ uint64_t append_text(Backlog_State* backlog, cz::Str text) {
             break;
 
         // No special character so stop.
-        if (chunk_len == text.len)
+        if (chunk_len == remaining.len)
             break;
 
         // Handle the special character.
-        switch (text[chunk_len]) {
+        switch (remaining[chunk_len]) {
         case del: {
             // TODO: this isn't right -- this should only move the cursor
             // and not change the line.  But in practice this works.
-            uint64_t line_start = backlog->lines.len > 0 ? backlog->lines.last() : 0;
+            uint64_t line_start = current_line_start(backlog);
             if (line_start < backlog->length)
                 truncate_to(backlog, backlog->length - 1);
-            text = text.slice_start(chunk_len + 1);
-            done++;
         } break;
 
             // We want to handle '\r\r\n' by ignoring the '\r's so we
             // need to pull out the big guns: escape sequence parsing.
         case '\r':
-        case escape: {
-            // Start processing an escape sequence.
-            cz::Str remaining = text.slice_start(chunk_len);
-            size_t skip = 0;
-            if (!process_escape_sequence(backlog, remaining, &skip)) {
-                return done + remaining.len;
-            }
+            backlog->escape_parser.state = ESCAPE_CARRIAGE_RETURN;
+            break;
 
-            backlog->escape_backlog.len = 0;
-            text = remaining.slice_start(skip);
-            done += skip;
-        } break;
+        case escape:
+            backlog->escape_parser.state = ESCAPE_ESCAPE;
+            break;
 
         case '\a': {
             // Ignore alarm characters.
-            text = text.slice_start(chunk_len + 1);
-            done++;
         } break;
         }
+        done++;
     }
 
     return done;
@@ -5,12 +5,118 @@
 #include <cz/buffer_array.hpp>
 #include <cz/string.hpp>
 #include <cz/vector.hpp>
+#include "line_index.hpp"
 
 struct Backlog_Event;
+enum Backlog_Event_Type : uint8_t;
 
 ///////////////////////////////////////////////////////////////////////////////
 
-#define BACKLOG_BUFFER_SIZE 4096
+// Backlogs are stored in chunks of `BACKLOG_BUFFER_SIZE` bytes.  The size must be a power of
+// two.  Configure with `-DTESH_BACKLOG_BUFFER_SHIFT=16` (64 KiB) when mostly streaming bulk output.
+#ifndef BACKLOG_BUFFER_SHIFT
+#define BACKLOG_BUFFER_SHIFT 12
+#endif
+#define BACKLOG_BUFFER_SIZE (1 << BACKLOG_BUFFER_SHIFT)
+
+#define BACKLOG_ESCAPE_MAX_PARAMS 16
+
+/// State of the escape sequence parser.  Kept between calls
+/// to `append_text` so sequences can be split across reads.
+struct Backlog_Escape_Parser {
+    uint8_t state;
+
+    // CSI sequences.
+    uint8_t private_marker;
+    uint8_t intermediate;
+    uint8_t num_params;
+    int32_t param;
+    int32_t params[BACKLOG_ESCAPE_MAX_PARAMS];
+
+    // OSC sequences.  The string is only recorded for commands we handle.
+    int32_t osc_command;
+    cz::String osc_string;
+};
+
+/// A visual row that starts because the previous row ran out of columns.
+struct Backlog_Wrap_Point {
+    uint64_t index;   // Index of the first character on the row.
+    uint64_t column;  // Column of that character in its physical line.
+};
+
+/// Where the backlog wraps when rendered `cols` wide.  Rows that start after a
+/// newline are already in `Backlog_State::lines` so only the wraps are stored.
+/// Maintained by `update_wrap_index` (see render.cpp).
+struct Backlog_Wrap_Index {
+    int cols;
+    int tab_width;
+
+    // Everything before `indexed_until` has been indexed.  `x` and `column`
+    // are the state of `coord_trans` at that point.  Points at or after
+    // `indexed_until` are provisional (the code point there is incomplete).
+    uint64_t indexed_until;
+    int x;
+    uint64_t column;
+
+    cz::Vector<Backlog_Wrap_Point> points;
+};
+
+/// A line being redrawn with '\r' (ie a progress bar).  Instead of truncating the backlog and
+/// appending each redraw, redraws are buffered here and only the last one is committed when
+/// the line ends or by `backlog_flush`.  Redraws that are replaced keep their escape sequences
+/// so the styles and hyperlinks they set still apply.
+struct Backlog_Line_Edit {
+    bool active;
+    bool after_return;  // The last byte was '\r'.
+    uint8_t state;      // State of the escape sequence parser at the end of `text`.
+    cz::String text;    // Escape sequences of replaced redraws then the current redraw.
+    size_t kept;        // Length of the escape sequences of replaced redraws.
+    uint64_t dropped;   // Number of redraws that were never committed.
+};
+
+/// Commit the line edit early if the escape sequences of replaced redraws get this long.
+#define BACKLOG_LINE_EDIT_MAX_KEPT 4096
+
+/// Events are stored in blocks of at most `BACKLOG_EVENT_CHECKPOINT_INTERVAL` events.  Each block
+/// starts with a checkpoint of the state set by the events before it so finding the state at a
+/// point in the backlog doesn't have to replay every event.
+#define BACKLOG_EVENT_CHECKPOINT_INTERVAL 64
+
+/// State after a prefix of the events.  Fields are indices into
+/// `Backlog_State::events` or `-1` if there is no such event.
+struct Backlog_Event_State {
+    uint64_t style_event;      // Last event that set the foreground color.
+    uint64_t hyperlink_event;  // Start of the hyperlink we are inside.
+};
+
+/// Events only store the distance from the previous event so each block
+/// also records the index of its first event.  A new block is started early
+/// if the distance doesn't fit.  See `Backlog_Event_Cursor`.
+struct Backlog_Event_Checkpoint {
+    uint64_t first_event;       // Position of the block in `Backlog_State::events`.
+    uint64_t index;             // Index of the first event.
+    Backlog_Event_State state;  // State before the first event.
+};
+
+// clang-format off
+#define STYLE_BOLD      0x1
+#define STYLE_UNDERLINE 0x2
+#define STYLE_REVERSE   0x4
+#define STYLE_BRIGHT    0x8
+
+/// Colors are an index into `cfg.theme` unless this bit is set.  Then the low 24 bits are 0xRRGGBB.
+#define STYLE_COLOR_RGB 0x01000000
+// clang-format on
+
+/// A set of graphic renditions.  Backlogs intern every style they use and events refer to them
+/// by id.  Once `BACKLOG_MAX_STYLES` have been interned new styles are replaced by the default.
+struct Backlog_Style {
+    uint32_t foreground;
+    uint32_t background;
+    uint32_t flags;
+};
+
+#define BACKLOG_MAX_STYLES (1 << 16)
 
 struct Backlog_State {
     uint64_t id;
@@ -19,13 +125,54 @@ struct Backlog_State {
     cz::Buffer_Array arena;
 
     uint64_t max_length;
+    /// When full, drop the oldest output instead of the newest.  Then
+    /// `max_length` must be at least `2 * BACKLOG_BUFFER_SIZE`.
+    bool ring_retention;
+    /// Stop reading the process's output.  See `backlog_flow`.
+    bool paused;
+
+    /// Indices are never rebased.  Everything before `discarded` has been dropped by ring
+    /// retention so `buffers[0]` holds `discarded` and `lines` only has line starts after it.
+    uint64_t discarded;        // Always a multiple of `BACKLOG_BUFFER_SIZE`.
+    uint64_t discarded_lines;  // Number of line starts dropped.
+
     cz::Vector<char*> buffers;
+    cz::Vector<uint64_t> spill_slots;  // Parallel to `buffers`.  See backlog_spill.hpp.
+    cz::Vector<char*> compressed;      // Parallel to `buffers`.  See backlog_compress.hpp.
+    uint64_t compressed_until;         // Chunks before this have been queued for compression.
+    /// Display widths of the code points in each chunk, measured as text is appended.  Parallel
+    /// to `buffers`.  Null if every code point in the chunk is one column wide.  Otherwise two
+    /// bits per byte, stored at the first byte of each code point.  See `width_at`.
+    cz::Vector<uint8_t*> widths;
+    uint64_t widths_until;  // Text before this has been measured.
+    /// Trigram filters of the chunks used to skip them when searching.  Parallel to `buffers`.
+    /// Null if the chunk isn't indexed.  See backlog_index.hpp.
+    cz::Vector<uint64_t*> filters;
+    uint64_t indexed_until;  // Chunks before this have been queued for indexing.
+    char* spare_buffer;  // Becomes the next buffer.  See `backlog_tail_space`.
+    /// Text read into the tail that has to be moved before `append_text` rewrites it.
+    /// See `backlog_commit_tail`.
+    cz::String rewrite_buffer;
     uint64_t length;
-    cz::Vector<uint64_t> lines;
+    uint64_t rewrites;  // Times the end of the output was truncated to be written again.
+    Line_Index lines;  // Start of each line after the first.  See line_index.hpp.
+    Backlog_Wrap_Index wrap_index;
 
     cz::Vector<Backlog_Event> events;
-    cz::String escape_backlog;
-    uint64_t graphics_rendition;
+    cz::Vector<Backlog_Event_Checkpoint> event_checkpoints;
+    Backlog_Event_State event_state;  // State after all events.
+    uint64_t last_event_index;        // Index of the last event.
+    Backlog_Escape_Parser escape_parser;
+    /// Coalesce lines that are redrawn with '\r'.  See `Backlog_Line_Edit`.
+    bool coalesce_progress;
+    Backlog_Line_Edit line_edit;
+
+    cz::Vector<Backlog_Style> styles;  // Interned styles.  Id 0 is the default style.
+    cz::Vector<uint32_t> style_table;  // Hash table of ids + 1 into `styles`.  0 is empty.
+    Backlog_Style style;               // Style set by the escape sequences so far.
+
+    /// Urls of hyperlink events.  Allocated in `arena`.
+    cz::Vector<const char*> hyperlinks;
     bool inside_hyperlink;
 
     std::chrono::system_clock::time_point start2;
@@ -37,18 +184,134 @@ struct Backlog_State {
     bool render_collapsed;
 
     char get(size_t index);
+    /// Get the chunk holding `index`.  Maps it in if it was spilled
+    /// or decompresses it if it was compressed.
+    char* buffer_at(size_t index);
+    /// Number of columns taken by the code point starting at `index`.  Only
+    /// meaningful at the start of a code point.  Newlines and tabs report 1.
+    int width_at(size_t index);
 };
 
 void init_backlog(Backlog_State* backlog, uint64_t id, uint64_t max_length);
 uint64_t append_text(Backlog_State* backlog, cz::Str text);
+/// Commit the line being redrawn.  Call before the backlog is read, ie once per frame.
 void backlog_flush(Backlog_State* backlog);
 void cleanup_backlog(cz::Slice<Backlog_State*> backlogs, Backlog_State* backlog);
+
+enum Backlog_Flow {
+    BACKLOG_FLOW_READING,
+    BACKLOG_FLOW_PAUSED,  // Paused by the user.
+    BACKLOG_FLOW_FULL,    // At `max_length` without ring retention.
+};
+
+/// Should the output of the backlog's process be read?  Output that isn't read is left in
+/// the pty so the process blocks in `write()` once the pty's buffer fills up.
+Backlog_Flow backlog_flow(Backlog_State* backlog);
+/// Raise `max_length` to at least `max_length`.  Never lowers it.
+void backlog_raise_max_length(Backlog_State* backlog, uint64_t max_length);
+/// Drop the oldest output from now on so a full backlog can be read again.
+void backlog_enable_ring_retention(Backlog_State* backlog);
 void backlog_dec_refcount(cz::Slice<Backlog_State*> backlogs, Backlog_State* backlog);
 cz::String dbg_stringify_backlog(Backlog_State* backlog);
 
+/// Iterates over `[start, end)` as contiguous runs that are each within a chunk.  Runs
+/// are taken off either end so a range can be walked forwards or backwards.  A run
+/// is valid for as long as a pointer from `Backlog_State::buffer_at` would be.
+struct Backlog_Spans {
+    Backlog_State* backlog;
+    uint64_t start;
+    uint64_t end;
+
+    /// Take the run at the start.  Returns `false` once the range is empty.
+    bool next(cz::Str* span);
+    /// Take the run at the end.  Returns `false` once the range is empty.
+    bool prev(cz::Str* span);
+};
+
+Backlog_Spans backlog_spans(Backlog_State* backlog, uint64_t start, uint64_t end);
+
+/// Copy `[start, end)` into `out`.
+void backlog_copy(Backlog_State* backlog, uint64_t start, uint64_t end, char* out);
+/// Append `[start, end)` to `string`.
+void backlog_append_range(Backlog_State* backlog,
+                          uint64_t start,
+                          uint64_t end,
+                          cz::Allocator allocator,
+                          cz::String* string);
+/// Find the first / last `ch` in `[start, end)`.
+bool backlog_find(Backlog_State* backlog, uint64_t start, uint64_t end, char ch, uint64_t* index);
+bool backlog_rfind(Backlog_State* backlog, uint64_t start, uint64_t end, char ch, uint64_t* index);
+/// Test if the text at `index` is `str`.  Text past the end doesn't match.
+bool backlog_matches(Backlog_State* backlog, uint64_t index, cz::Str str);
+
+/// Storage after the end of the backlog that output can be read into directly.
+/// `second` is only non-empty when `first` runs to the end of a chunk.
+struct Backlog_Tail_Space {
+    cz::Slice<char> first;
+    cz::Slice<char> second;
+};
+
+/// Get up to `max` bytes of storage after the end of the backlog.
+Backlog_Tail_Space backlog_tail_space(Backlog_State* backlog, size_t max);
+
+/// Append the first `len` bytes written to the storage returned by `backlog_tail_space`.  Normal
+/// text is scanned in place.  Bytes after a special character are moved through `append_text`.
+uint64_t backlog_commit_tail(Backlog_State* backlog, size_t len);
+
+/// Room for output that another thread reads into fresh pool chunks (see backlog_pool.hpp
+/// and tty_reader.hpp).  It starts at `offset` in the first chunk, which is where the end of
+/// the backlog is in its last chunk, so the chunks line up with the backlog's storage.
+struct Backlog_Tail_Loan {
+    size_t offset;
+    size_t max;  // Most bytes that fit.
+};
+
+/// Get room for up to `max` bytes to be read for the backlog on another thread.  With ring
+/// retention old output is only dropped by `backlog_adopt_tail` once the bytes arrive.
+Backlog_Tail_Loan backlog_tail_loan(Backlog_State* backlog, size_t max);
+
+/// Append the `len` bytes read into `chunks` starting at `offset` in the first chunk.  The
+/// backlog takes over the chunks.  If they still line up with the end of the backlog then they
+/// become its last chunks and normal text is scanned in place like `backlog_commit_tail`.
+uint64_t backlog_adopt_tail(Backlog_State* backlog,
+                            cz::Slice<char*> chunks,
+                            size_t offset,
+                            size_t len);
+
+/// Record an event at `index`.  `payload` is a style id or a position in `hyperlinks`.
+void backlog_push_event(Backlog_State* backlog,
+                        uint64_t index,
+                        Backlog_Event_Type type,
+                        uint32_t payload);
+/// Get the index of the event `event_index`.  Use `Backlog_Event_Cursor` to walk the events.
+uint64_t backlog_event_index(Backlog_State* backlog, size_t event_index);
+/// Find the first event whose index is `>= index`.
+size_t backlog_events_lower_bound(Backlog_State* backlog, uint64_t index);
+/// Find the first event whose index is `> index`.
+size_t backlog_events_upper_bound(Backlog_State* backlog, uint64_t index);
+/// Get the state after the first `event_index` events.
+Backlog_Event_State backlog_event_state_at(Backlog_State* backlog, size_t event_index);
+
+/// Walks the events in order, tracking the index of the current one.
+struct Backlog_Event_Cursor {
+    Backlog_State* backlog;
+    size_t event;       // Position in `events`.  `events.len` once done.
+    uint64_t index;     // Index of the current event.
+    size_t checkpoint;  // Block the current event is in.
+
+    bool done() const;
+    void next();
+};
+
+/// Start walking at the event `event_index`.
+Backlog_Event_Cursor backlog_event_cursor(Backlog_State* backlog, size_t event_index);
+
+/// Get the id of `style`, interning it if it is new.
+uint16_t backlog_intern_style(Backlog_State* backlog, const Backlog_Style& style);
+
 ///////////////////////////////////////////////////////////////////////////////
 
-enum Backlog_Event_Type {
+enum Backlog_Event_Type : uint8_t {
     BACKLOG_EVENT_START_INPUT = 0,
     BACKLOG_EVENT_START_PROCESS = 1,
     BACKLOG_EVENT_START_DIRECTORY = 2,
@@ -57,22 +320,12 @@ enum Backlog_Event_Type {
     BACKLOG_EVENT_END_HYPERLINK = 5,
 };
 
+/// Events are 8 bytes because there can be one for every few characters of coloured output.
 struct Backlog_Event {
-    uint64_t index;
-    Backlog_Event_Type type;
-    uint64_t payload;
+    uint32_t offset;        // Distance from the previous event in the block.
+    uint32_t type : 8;      // A `Backlog_Event_Type`.
+    uint32_t payload : 24;  // See `backlog_push_event`.
 };
 
-///////////////////////////////////////////////////////////////////////////////
-
-// clang-format off
-// Note: the payload restricts us to 62 bits.  @BacklogEventTypeBits
-#define GR_BOLD             ((uint64_t)0x0000000000000001)
-#define GR_UNDERLINE        ((uint64_t)0x0000000000000002)
-#define GR_REVERSE          ((uint64_t)0x0000000000000004)
-#define GR_BRIGHT           ((uint64_t)0x0000000000000008)
-#define GR_FOREGROUND_MASK  ((uint64_t)0x000000000ffffff0)
-#define GR_BACKGROUND_MASK  ((uint64_t)0x000ffffff0000000)
-#define GR_FOREGROUND_SHIFT 4
-#define GR_BACKGROUND_SHIFT 28
-// clang-format on
+/// The most hyperlinks a backlog records.  Limited by `Backlog_Event::payload`.
+#define BACKLOG_MAX_HYPERLINKS ((1 << 24) - 1)
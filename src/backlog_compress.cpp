@@ -0,0 +1,357 @@
+#include "backlog_compress.hpp"
+
+#include <string.h>
+#include <condition_variable>
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+#include <cz/vector.hpp>
+#include <mutex>
+#include <thread>
+#include <tracy/Tracy.hpp>
+#include "backlog.hpp"
+#include "backlog_pool.hpp"
+#include "backlog_spill.hpp"
+#include "compress.hpp"
+#include "event_loop.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Configuration
+///////////////////////////////////////////////////////////////////////////////
+
+#define OUTER_INDEX(index) ((index) >> BACKLOG_BUFFER_SHIFT)
+
+/// Most chunks that can be waiting to be compressed.  Bounds the memory used by the copies.
+#define MAX_PENDING_JOBS 256
+
+/// Chunks that don't shrink at least this much are left alone.
+#define MAX_BLOCK_LEN (BACKLOG_BUFFER_SIZE - BACKLOG_BUFFER_SIZE / 4)
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Data
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Compress_Job {
+    Backlog_State* backlog;
+    uint64_t index;  // Absolute index of the start of the chunk.
+    char* source;    // `buffers[outer]` when the job was queued.
+    char* input;     // Copy of the chunk owned by the job.
+    char* block;     // Output.  Null if the chunk didn't compress well.
+};
+
+struct Compressor {
+    std::mutex mutex;
+    std::condition_variable work;
+    std::condition_variable idle;
+
+    cz::Vector<Compress_Job> pending;
+    cz::Vector<Compress_Job> finished;
+
+    // The job the worker is running.
+    bool busy;
+    Backlog_State* current_backlog;
+    bool drop_current;
+};
+
+struct Cache_Entry {
+    Backlog_State* backlog;  // Null if the entry is unused.
+    uint64_t index;          // Absolute index of the start of the chunk.
+    char* buffer;
+};
+
+}
+
+/// Created with the worker thread the first time it is needed.  Never
+/// freed because the worker is detached and lives until the program exits.
+static Compressor* compressor;
+
+static Cache_Entry cache[BACKLOG_BLOCK_CACHE_SIZE];
+static size_t cache_next;
+
+static uint64_t compressed_chunks;
+static uint64_t compressed_bytes;
+static uint64_t decompressions;
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility
+///////////////////////////////////////////////////////////////////////////////
+
+/// Blocks are the compressed bytes prefixed by their length.
+static uint32_t block_len(const char* block) {
+    uint32_t len;
+    memcpy(&len, block, sizeof(len));
+    return len;
+}
+
+static void free_block(char* block) {
+    if (block)
+        cz::heap_allocator().dealloc({block, sizeof(uint32_t) + block_len(block)});
+}
+
+static void decompress_chunk(char* buffer, const char* block) {
+    bool ok = decompress_block(block + sizeof(uint32_t), block_len(block), buffer,
+                               BACKLOG_BUFFER_SIZE);
+    CZ_ASSERT(ok);
+}
+
+static void free_job(Compress_Job* job) {
+    if (job->input)
+        cz::heap_allocator().dealloc({job->input, BACKLOG_BUFFER_SIZE});
+    free_block(job->block);
+}
+
+static bool contains(cz::Slice<Backlog_State*> backlogs, Backlog_State* backlog) {
+    for (size_t i = 0; i < backlogs.len; ++i) {
+        if (backlogs[i] == backlog)
+            return true;
+    }
+    return false;
+}
+
+static void plot_compress() {
+    TracyPlot("backlog_compress_chunks", (int64_t)compressed_chunks);
+    TracyPlot("backlog_compress_bytes", (int64_t)compressed_bytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - worker thread
+///////////////////////////////////////////////////////////////////////////////
+
+static void run_compressor(Compressor* c) {
+    char* scratch =
+        (char*)cz::heap_allocator().alloc({compress_block_bound(BACKLOG_BUFFER_SIZE), 1});
+    CZ_ASSERT(scratch);
+
+    std::unique_lock<std::mutex> lock(c->mutex);
+    while (1) {
+        while (c->pending.len == 0)
+            c->work.wait(lock);
+
+        Compress_Job job = c->pending.pop();
+        c->busy = true;
+        c->current_backlog = job.backlog;
+        c->drop_current = false;
+        lock.unlock();
+
+        uint32_t len = (uint32_t)compress_block(job.input, BACKLOG_BUFFER_SIZE, scratch);
+        if (len <= MAX_BLOCK_LEN) {
+            job.block = (char*)cz::heap_allocator().alloc({sizeof(len) + len, 1});
+            CZ_ASSERT(job.block);
+            memcpy(job.block, &len, sizeof(len));
+            memcpy(job.block + sizeof(len), scratch, len);
+        }
+        cz::heap_allocator().dealloc({job.input, BACKLOG_BUFFER_SIZE});
+        job.input = nullptr;
+
+        lock.lock();
+        c->busy = false;
+        if (c->drop_current || !job.block) {
+            free_job(&job);
+        } else {
+            c->finished.reserve(cz::heap_allocator(), 1);
+            c->finished.push(job);
+        }
+
+        if (c->pending.len == 0) {
+            c->idle.notify_all();
+            event_loop_wake_from_thread();
+        }
+    }
+}
+
+static Compressor* start_compressor() {
+    if (!compressor) {
+        compressor = new Compressor;
+        compressor->pending = {};
+        compressor->finished = {};
+        compressor->busy = false;
+        compressor->current_backlog = nullptr;
+        compressor->drop_current = false;
+        std::thread(run_compressor, compressor).detach();
+    }
+    return compressor;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - queueing
+///////////////////////////////////////////////////////////////////////////////
+
+static void install_finished(Compressor* c) {
+    for (size_t i = 0; i < c->finished.len; ++i) {
+        Compress_Job* job = &c->finished[i];
+        Backlog_State* backlog = job->backlog;
+
+        // The chunk could have been dropped or spilled since it was queued.
+        bool valid = (job->index >= backlog->discarded);
+        size_t outer = (valid ? OUTER_INDEX(job->index - backlog->discarded) : 0);
+        valid = valid && outer + 1 < backlog->buffers.len &&
+                backlog->buffers[outer] == job->source &&
+                backlog->spill_slots[outer] == BACKLOG_NOT_SPILLED && !backlog->compressed[outer];
+        if (!valid) {
+            free_job(job);
+            continue;
+        }
+
+        backlog_pool_free(backlog->buffers[outer]);
+        backlog->buffers[outer] = nullptr;
+        backlog->compressed[outer] = job->block;
+        ++compressed_chunks;
+        compressed_bytes += sizeof(uint32_t) + block_len(job->block);
+    }
+    c->finished.len = 0;
+}
+
+static void queue_chunks(Compressor* c,
+                         cz::Slice<Backlog_State*> backlogs,
+                         cz::Slice<Backlog_State*> visible) {
+    size_t queued = 0;
+    for (size_t i = 0; i < backlogs.len && c->pending.len < MAX_PENDING_JOBS; ++i) {
+        Backlog_State* backlog = backlogs[i];
+        if (!backlog || !backlog->done || contains(visible, backlog))
+            continue;
+
+        // Never compress the last chunk so appending never has to decompress.
+        uint64_t index = cz::max(backlog->compressed_until, backlog->discarded);
+        uint64_t end =
+            backlog->discarded + (uint64_t)(backlog->buffers.len - 1) * BACKLOG_BUFFER_SIZE;
+        for (; index < end && c->pending.len < MAX_PENDING_JOBS; index += BACKLOG_BUFFER_SIZE) {
+            size_t outer = OUTER_INDEX(index - backlog->discarded);
+            char* buffer = backlog->buffers[outer];
+            if (!buffer || backlog->spill_slots[outer] != BACKLOG_NOT_SPILLED ||
+                backlog->compressed[outer])
+                continue;
+
+            Compress_Job job = {};
+            job.backlog = backlog;
+            job.index = index;
+            job.source = buffer;
+            job.input = (char*)cz::heap_allocator().alloc({BACKLOG_BUFFER_SIZE, 1});
+            CZ_ASSERT(job.input);
+            memcpy(job.input, buffer, BACKLOG_BUFFER_SIZE);
+            c->pending.reserve(cz::heap_allocator(), 1);
+            c->pending.push(job);
+            ++queued;
+        }
+        backlog->compressed_until = index;
+    }
+
+    if (queued > 0)
+        c->work.notify_one();
+}
+
+void backlog_compress_tick(cz::Slice<Backlog_State*> backlogs, cz::Slice<Backlog_State*> visible) {
+    ZoneScoped;
+
+    Compressor* c = start_compressor();
+    std::lock_guard<std::mutex> lock(c->mutex);
+    if (c->finished.len > 0) {
+        install_finished(c);
+        plot_compress();
+    }
+    queue_chunks(c, backlogs, visible);
+}
+
+void backlog_compress_wait() {
+    if (!compressor)
+        return;
+    std::unique_lock<std::mutex> lock(compressor->mutex);
+    while (compressor->pending.len > 0 || compressor->busy)
+        compressor->idle.wait(lock);
+}
+
+void backlog_compress_forget(Backlog_State* backlog) {
+    for (size_t i = 0; i < BACKLOG_BLOCK_CACHE_SIZE; ++i) {
+        if (cache[i].backlog == backlog)
+            cache[i].backlog = nullptr;
+    }
+
+    if (!compressor)
+        return;
+
+    std::lock_guard<std::mutex> lock(compressor->mutex);
+    cz::Vector<Compress_Job>* queues[] = {&compressor->pending, &compressor->finished};
+    for (cz::Vector<Compress_Job>* queue : queues) {
+        for (size_t i = queue->len; i-- > 0;) {
+            if ((*queue)[i].backlog == backlog) {
+                free_job(&(*queue)[i]);
+                queue->remove(i);
+            }
+        }
+    }
+    if (compressor->busy && compressor->current_backlog == backlog)
+        compressor->drop_current = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - decompression
+///////////////////////////////////////////////////////////////////////////////
+
+char* backlog_compress_load(Backlog_State* backlog, size_t outer) {
+    ZoneScoped;
+
+    char* block = backlog->compressed[outer];
+    CZ_ASSERT(block);
+    CZ_DEBUG_ASSERT(!backlog->buffers[outer]);
+
+    // Round robin is close enough to LRU because hits don't go through the cache.
+    Cache_Entry* entry = &cache[cache_next];
+    cache_next = (cache_next + 1) % BACKLOG_BLOCK_CACHE_SIZE;
+    if (entry->backlog) {
+        Backlog_State* owner = entry->backlog;
+        owner->buffers[OUTER_INDEX(entry->index - owner->discarded)] = nullptr;
+    }
+    if (!entry->buffer)
+        entry->buffer = backlog_pool_alloc();
+
+    decompress_chunk(entry->buffer, block);
+    entry->backlog = backlog;
+    entry->index = backlog->discarded + (uint64_t)outer * BACKLOG_BUFFER_SIZE;
+    backlog->buffers[outer] = entry->buffer;
+    ++decompressions;
+    return entry->buffer;
+}
+
+void backlog_compress_decompress(const char* block, char* buffer) {
+    decompress_chunk(buffer, block);
+}
+
+void backlog_compress_restore(Backlog_State* backlog, size_t outer) {
+    if (!backlog->compressed[outer])
+        return;
+
+    char* buffer = backlog_pool_alloc();
+    decompress_chunk(buffer, backlog->compressed[outer]);
+    backlog_compress_release(backlog, outer);
+    backlog->buffers[outer] = buffer;
+}
+
+void backlog_compress_release(Backlog_State* backlog, size_t outer) {
+    char* block = backlog->compressed[outer];
+    CZ_DEBUG_ASSERT(block);
+
+    if (backlog->buffers[outer]) {
+        for (size_t i = 0; i < BACKLOG_BLOCK_CACHE_SIZE; ++i) {
+            if (cache[i].buffer == backlog->buffers[outer])
+                cache[i].backlog = nullptr;
+        }
+    }
+
+    --compressed_chunks;
+    compressed_bytes -= sizeof(uint32_t) + block_len(block);
+    free_block(block);
+    backlog->compressed[outer] = nullptr;
+    backlog->buffers[outer] = nullptr;
+}
+
+Backlog_Compress_Stats backlog_compress_stats() {
+    Backlog_Compress_Stats stats = {};
+    stats.compressed_chunks = compressed_chunks;
+    stats.compressed_bytes = compressed_bytes;
+    stats.decompressions = decompressions;
+    if (compressor) {
+        std::lock_guard<std::mutex> lock(compressor->mutex);
+        stats.pending_chunks = compressor->pending.len + compressor->busy;
+    }
+    return stats;
+}
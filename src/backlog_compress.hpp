@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cz/slice.hpp>
+
+struct Backlog_State;
+
+/// Compresses the chunks of finished backlogs on a background thread (see compress.hpp).
+/// The worker only sees copies of chunks so the backlogs are still only touched by the
+/// main thread.  Compressed chunks are installed by `backlog_compress_tick`.
+///
+/// A compressed chunk has a block in `Backlog_State::compressed`.  Reading it through
+/// `Backlog_State::get` or `Backlog_State::buffer_at` decompresses it into a small cache
+/// and points `buffers` at the cached copy until it is evicted.  So a pointer to a
+/// compressed chunk is valid until `BACKLOG_BLOCK_CACHE_SIZE - 1` other blocks are read.
+
+#define BACKLOG_BLOCK_CACHE_SIZE 16
+
+struct Backlog_Compress_Stats {
+    uint64_t compressed_chunks;  // Chunks stored compressed.
+    uint64_t compressed_bytes;   // Size of their blocks.
+    uint64_t pending_chunks;     // Chunks being compressed.
+    uint64_t decompressions;     // Blocks loaded into the cache.
+};
+
+/// Install chunks that finished compressing and queue more chunks of
+/// finished `backlogs` that aren't `visible`.  Call once per frame.
+void backlog_compress_tick(cz::Slice<Backlog_State*> backlogs, cz::Slice<Backlog_State*> visible);
+
+/// Block until the queued chunks are compressed.  They still have to be installed by
+/// `backlog_compress_tick`.  Used by tests to make compression deterministic.
+void backlog_compress_wait();
+
+/// Decompress chunk `outer` into the cache.  Returns the new value of `buffers[outer]`.
+char* backlog_compress_load(Backlog_State* backlog, size_t outer);
+
+/// Decompress a block from `Backlog_State::compressed` into `buffer`, which must hold
+/// `BACKLOG_BUFFER_SIZE` bytes.  Touches neither the backlog nor the cache so any thread
+/// can call it while the main thread isn't dropping the block.
+void backlog_compress_decompress(const char* block, char* buffer);
+
+/// Decompress chunk `outer` into its own buffer so it can be written to.
+void backlog_compress_restore(Backlog_State* backlog, size_t outer);
+
+/// Forget a compressed chunk because the backlog dropped it.
+void backlog_compress_release(Backlog_State* backlog, size_t outer);
+
+/// Drop chunks of `backlog` that are still being compressed.  Call before freeing it.
+void backlog_compress_forget(Backlog_State* backlog);
+
+Backlog_Compress_Stats backlog_compress_stats();
@@ -0,0 +1,336 @@
+#include "backlog_index.hpp"
+
+#include <string.h>
+#include <condition_variable>
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+#include <mutex>
+#include <thread>
+#include <tracy/Tracy.hpp>
+#include "backlog.hpp"
+#include "event_loop.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Configuration
+///////////////////////////////////////////////////////////////////////////////
+
+#define OUTER_INDEX(index) ((index) >> BACKLOG_BUFFER_SHIFT)
+#define INNER_INDEX(index) ((index) & (BACKLOG_BUFFER_SIZE - 1))
+
+/// Most chunks that can be waiting to be indexed.  Bounds the memory used by the copies.
+#define MAX_PENDING_JOBS 256
+
+/// The trigrams starting in a chunk read this many bytes of the next one.
+#define OVERLAP 2
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Data
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Index_Job {
+    Backlog_State* backlog;
+    uint64_t index;    // Absolute index of the start of the chunk.
+    char* input;       // Copy of the chunk and `OVERLAP` bytes after it owned by the job.
+    uint64_t* filter;  // Output.
+};
+
+struct Indexer {
+    std::mutex mutex;
+    std::condition_variable work;
+    std::condition_variable idle;
+
+    cz::Vector<Index_Job> pending;
+    cz::Vector<Index_Job> finished;
+
+    // The job the worker is running.
+    bool busy;
+    Backlog_State* current_backlog;
+    uint64_t current_index;
+    bool drop_current;
+};
+
+}
+
+/// Created with the worker thread the first time it is needed.  Never
+/// freed because the worker is detached and lives until the program exits.
+static Indexer* indexer;
+
+static uint64_t indexed_chunks;
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility
+///////////////////////////////////////////////////////////////////////////////
+
+/// Pick the bit of a filter for the trigram starting at `text`.
+static uint32_t trigram_bit(const char* text) {
+    uint32_t trigram = ((uint32_t)(uint8_t)text[0] | (uint32_t)(uint8_t)text[1] << 8 |
+                        (uint32_t)(uint8_t)text[2] << 16);
+    // The filter has `BACKLOG_BUFFER_SIZE` bits so keep the top `BACKLOG_BUFFER_SHIFT` bits.
+    return (trigram * 2654435761u) >> (32 - BACKLOG_BUFFER_SHIFT);
+}
+
+static void free_filter(uint64_t* filter) {
+    if (filter)
+        cz::heap_allocator().dealloc({filter, BACKLOG_INDEX_FILTER_SIZE});
+}
+
+static void free_job(Index_Job* job) {
+    if (job->input)
+        cz::heap_allocator().dealloc({job->input, BACKLOG_BUFFER_SIZE + OVERLAP});
+    free_filter(job->filter);
+}
+
+static void plot_index() {
+    TracyPlot("backlog_index_bytes", (int64_t)(indexed_chunks * BACKLOG_INDEX_FILTER_SIZE));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - worker thread
+///////////////////////////////////////////////////////////////////////////////
+
+static void build_filter(const char* input, uint64_t* filter) {
+    memset(filter, 0, BACKLOG_INDEX_FILTER_SIZE);
+    for (size_t i = 0; i < BACKLOG_BUFFER_SIZE; ++i) {
+        uint32_t bit = trigram_bit(input + i);
+        filter[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
+
+static void run_indexer(Indexer* ix) {
+    std::unique_lock<std::mutex> lock(ix->mutex);
+    while (1) {
+        while (ix->pending.len == 0)
+            ix->work.wait(lock);
+
+        Index_Job job = ix->pending.pop();
+        ix->busy = true;
+        ix->current_backlog = job.backlog;
+        ix->current_index = job.index;
+        ix->drop_current = false;
+        lock.unlock();
+
+        job.filter = (uint64_t*)cz::heap_allocator().alloc({BACKLOG_INDEX_FILTER_SIZE, 8});
+        CZ_ASSERT(job.filter);
+        build_filter(job.input, job.filter);
+        cz::heap_allocator().dealloc({job.input, BACKLOG_BUFFER_SIZE + OVERLAP});
+        job.input = nullptr;
+
+        lock.lock();
+        ix->busy = false;
+        if (ix->drop_current) {
+            free_job(&job);
+        } else {
+            ix->finished.reserve(cz::heap_allocator(), 1);
+            ix->finished.push(job);
+        }
+
+        if (ix->pending.len == 0) {
+            ix->idle.notify_all();
+            event_loop_wake_from_thread();
+        }
+    }
+}
+
+static Indexer* start_indexer() {
+    if (!indexer) {
+        indexer = new Indexer;
+        indexer->pending = {};
+        indexer->finished = {};
+        indexer->busy = false;
+        indexer->current_backlog = nullptr;
+        indexer->current_index = 0;
+        indexer->drop_current = false;
+        std::thread(run_indexer, indexer).detach();
+    }
+    return indexer;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - queueing
+///////////////////////////////////////////////////////////////////////////////
+
+static void install_finished(Indexer* ix) {
+    for (size_t i = 0; i < ix->finished.len; ++i) {
+        Index_Job* job = &ix->finished[i];
+        Backlog_State* backlog = job->backlog;
+
+        // The chunk could have been dropped since it was queued.  Jobs
+        // for text that was truncated were dropped by `backlog_index_truncate`.
+        bool valid = (job->index >= backlog->discarded);
+        size_t outer = (valid ? OUTER_INDEX(job->index - backlog->discarded) : 0);
+        valid = valid && outer < backlog->filters.len && !backlog->filters[outer];
+        if (!valid) {
+            free_job(job);
+            continue;
+        }
+
+        backlog->filters[outer] = job->filter;
+        ++indexed_chunks;
+    }
+    ix->finished.len = 0;
+}
+
+static void queue_chunks(Indexer* ix, cz::Slice<Backlog_State*> backlogs, uint64_t budget) {
+    uint64_t max_chunks = budget / BACKLOG_INDEX_FILTER_SIZE;
+    uint64_t chunks = indexed_chunks + ix->pending.len + ix->finished.len + ix->busy;
+    size_t queued = 0;
+    for (size_t i = 0; i < backlogs.len && ix->pending.len < MAX_PENDING_JOBS; ++i) {
+        Backlog_State* backlog = backlogs[i];
+        if (!backlog)
+            continue;
+
+        // The trigrams at the end of a chunk need the start of the next one.
+        uint64_t index = cz::max(backlog->indexed_until, backlog->discarded);
+        for (; index + BACKLOG_BUFFER_SIZE + OVERLAP <= backlog->length &&
+               ix->pending.len < MAX_PENDING_JOBS && chunks < max_chunks;
+             index += BACKLOG_BUFFER_SIZE) {
+            size_t outer = OUTER_INDEX(index - backlog->discarded);
+            char* buffer = backlog->buffers[outer];
+            char* next = backlog->buffers[outer + 1];
+            if (!buffer || !next)
+                continue;
+
+            Index_Job job = {};
+            job.backlog = backlog;
+            job.index = index;
+            job.input = (char*)cz::heap_allocator().alloc({BACKLOG_BUFFER_SIZE + OVERLAP, 1});
+            CZ_ASSERT(job.input);
+            memcpy(job.input, buffer, BACKLOG_BUFFER_SIZE);
+            memcpy(job.input + BACKLOG_BUFFER_SIZE, next, OVERLAP);
+            ix->pending.reserve(cz::heap_allocator(), 1);
+            ix->pending.push(job);
+            ++queued;
+            ++chunks;
+        }
+        backlog->indexed_until = index;
+    }
+
+    if (queued > 0)
+        ix->work.notify_one();
+}
+
+void backlog_index_tick(cz::Slice<Backlog_State*> backlogs, uint64_t budget) {
+    ZoneScoped;
+
+    Indexer* ix = start_indexer();
+    std::lock_guard<std::mutex> lock(ix->mutex);
+    if (ix->finished.len > 0) {
+        install_finished(ix);
+        plot_index();
+    }
+    queue_chunks(ix, backlogs, budget);
+}
+
+void backlog_index_wait() {
+    if (!indexer)
+        return;
+    std::unique_lock<std::mutex> lock(indexer->mutex);
+    while (indexer->pending.len > 0 || indexer->busy)
+        indexer->idle.wait(lock);
+}
+
+/// Drop the jobs for chunks of `backlog` starting at or after `index`.
+static void drop_jobs(Indexer* ix, Backlog_State* backlog, uint64_t index) {
+    std::lock_guard<std::mutex> lock(ix->mutex);
+    cz::Vector<Index_Job>* queues[] = {&ix->pending, &ix->finished};
+    for (cz::Vector<Index_Job>* queue : queues) {
+        for (size_t i = queue->len; i-- > 0;) {
+            if ((*queue)[i].backlog == backlog && (*queue)[i].index >= index) {
+                free_job(&(*queue)[i]);
+                queue->remove(i);
+            }
+        }
+    }
+    if (ix->busy && ix->current_backlog == backlog && ix->current_index >= index)
+        ix->drop_current = true;
+}
+
+void backlog_index_truncate(Backlog_State* backlog, uint64_t new_length) {
+    // Chunks starting at `until` have trigrams that read text at or after `new_length`.
+    uint64_t until = 0;
+    if (new_length >= BACKLOG_BUFFER_SIZE + OVERLAP) {
+        uint64_t last = new_length - BACKLOG_BUFFER_SIZE - OVERLAP;
+        until = last - INNER_INDEX(last) + BACKLOG_BUFFER_SIZE;
+    }
+    until = cz::max(until, backlog->discarded);
+
+    // Usually only the last line is rewritten so nothing was indexed past it.
+    if (backlog->indexed_until <= until)
+        return;
+
+    for (size_t outer = OUTER_INDEX(until - backlog->discarded); outer < backlog->filters.len;
+         ++outer) {
+        if (backlog->filters[outer])
+            backlog_index_release(backlog, outer);
+    }
+    if (indexer)
+        drop_jobs(indexer, backlog, until);
+    backlog->indexed_until = until;
+}
+
+void backlog_index_forget(Backlog_State* backlog) {
+    if (indexer)
+        drop_jobs(indexer, backlog, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - querying
+///////////////////////////////////////////////////////////////////////////////
+
+void backlog_index_query(cz::Str query, cz::Vector<uint32_t>* bits) {
+    bits->len = 0;
+    if (query.len < 3)
+        return;
+
+    // Trigrams past the first chunk's worth of the query can start after the
+    // chunk following the match's so they aren't tested.
+    size_t count = cz::min(query.len - 2, (size_t)BACKLOG_BUFFER_SIZE);
+    bits->reserve_exact(cz::heap_allocator(), count);
+    for (size_t i = 0; i < count; ++i)
+        bits->push(trigram_bit(query.buffer + i));
+}
+
+bool backlog_index_may_match(Backlog_State* backlog, size_t outer, cz::Slice<const uint32_t> bits) {
+    if (bits.len == 0 || outer + 1 >= backlog->filters.len)
+        return true;
+
+    // A match starting in the chunk has its trigrams in it or the next chunk.
+    const uint64_t* first = backlog->filters[outer];
+    const uint64_t* second = backlog->filters[outer + 1];
+    if (!first || !second)
+        return true;
+
+    for (size_t i = 0; i < bits.len; ++i) {
+        uint32_t bit = bits[i];
+        uint64_t word = first[bit / 64] | second[bit / 64];
+        if (!(word & ((uint64_t)1 << (bit % 64))))
+            return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - memory
+///////////////////////////////////////////////////////////////////////////////
+
+void backlog_index_release(Backlog_State* backlog, size_t outer) {
+    uint64_t*& filter = backlog->filters[outer];
+    if (!filter)
+        return;
+    free_filter(filter);
+    filter = nullptr;
+    --indexed_chunks;
+}
+
+Backlog_Index_Stats backlog_index_stats() {
+    Backlog_Index_Stats stats = {};
+    stats.indexed_chunks = indexed_chunks;
+    stats.filter_bytes = indexed_chunks * BACKLOG_INDEX_FILTER_SIZE;
+    if (indexer) {
+        std::lock_guard<std::mutex> lock(indexer->mutex);
+        stats.pending_chunks = indexer->pending.len + indexer->busy;
+    }
+    return stats;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cz/slice.hpp>
+#include <cz/string.hpp>
+#include <cz/vector.hpp>
+
+struct Backlog_State;
+
+/// Lets searches skip chunks that can't hold a match.  Each full chunk gets a bloom filter of
+/// the trigrams (runs of three bytes) starting in it, including the two that run into the
+/// next chunk.  Filters are built on a background thread from copies of the chunks, like
+/// backlog_compress.hpp, and are installed by `backlog_index_tick`.
+///
+/// A filter is dropped with its chunk and when the text it covers is rewritten by truncating
+/// the backlog.  Chunks that were already compressed or spilled when they were reached are
+/// never indexed, and neither are chunks reached after the filters fill the budget.
+
+/// One bit per byte of the chunk.
+#define BACKLOG_INDEX_FILTER_SIZE (BACKLOG_BUFFER_SIZE / 8)
+
+struct Backlog_Index_Stats {
+    uint64_t indexed_chunks;  // Chunks with a filter.
+    uint64_t filter_bytes;    // Size of their filters.
+    uint64_t pending_chunks;  // Chunks being indexed.
+};
+
+/// Install filters that finished building and queue the chunks of `backlogs` that are
+/// newly full.  No more chunks are queued once the filters take `budget` bytes.
+/// Call once per frame.
+void backlog_index_tick(cz::Slice<Backlog_State*> backlogs, uint64_t budget);
+
+/// Block until the queued chunks are indexed.  They still have to be installed by
+/// `backlog_index_tick`.  Used by tests to make indexing deterministic.
+void backlog_index_wait();
+
+/// Hash the trigrams of `query` into `bits`.  Queries shorter than a trigram don't
+/// have any so they never skip a chunk.
+void backlog_index_query(cz::Str query, cz::Vector<uint32_t>* bits);
+
+/// Can a match of the query hashed to `bits` start in chunk `outer`?  Only
+/// `false` if the filters of the chunk and the one after it rule it out.
+bool backlog_index_may_match(Backlog_State* backlog, size_t outer, cz::Slice<const uint32_t> bits);
+
+/// Forget the filter of chunk `outer` because the backlog dropped it.
+void backlog_index_release(Backlog_State* backlog, size_t outer);
+
+/// Forget the filters that read text at or after `new_length`.  Call after truncating.
+void backlog_index_truncate(Backlog_State* backlog, uint64_t new_length);
+
+/// Drop chunks of `backlog` that are still being indexed.  Call before freeing it.
+void backlog_index_forget(Backlog_State* backlog);
+
+Backlog_Index_Stats backlog_index_stats();
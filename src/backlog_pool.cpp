@@ -0,0 +1,80 @@
+#include "backlog_pool.hpp"
+
+#include <cz/heap.hpp>
+#include <cz/vector.hpp>
+#include <tracy/Tracy.hpp>
+#include "backlog.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Configuration
+///////////////////////////////////////////////////////////////////////////////
+
+/// Free chunks beyond this are given back to the heap.
+#define BACKLOG_POOL_MAX_FREE_BYTES ((uint64_t)64 << 20)
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Data
+///////////////////////////////////////////////////////////////////////////////
+
+static cz::Vector<char*> free_chunks;
+static uint64_t allocated_chunks;
+static uint64_t hits;
+static uint64_t misses;
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code
+///////////////////////////////////////////////////////////////////////////////
+
+static void plot_pool() {
+    TracyPlot("backlog_pool_free", (int64_t)free_chunks.len);
+    TracyPlot("backlog_pool_allocated", (int64_t)allocated_chunks);
+}
+
+char* backlog_pool_alloc() {
+    char* chunk;
+    if (free_chunks.len > 0) {
+        chunk = free_chunks.pop();
+        ++hits;
+    } else {
+        chunk = (char*)cz::heap_allocator().alloc({BACKLOG_BUFFER_SIZE, 1});
+        CZ_ASSERT(chunk);
+        ++misses;
+    }
+
+    ++allocated_chunks;
+    plot_pool();
+    return chunk;
+}
+
+void backlog_pool_free(char* chunk) {
+    CZ_DEBUG_ASSERT(allocated_chunks > 0);
+    --allocated_chunks;
+
+    if (free_chunks.len < BACKLOG_POOL_MAX_FREE_BYTES / BACKLOG_BUFFER_SIZE) {
+        free_chunks.reserve(cz::heap_allocator(), 1);
+        free_chunks.push(chunk);
+    } else {
+        cz::heap_allocator().dealloc({chunk, BACKLOG_BUFFER_SIZE});
+    }
+
+    plot_pool();
+}
+
+void backlog_pool_trim() {
+    for (size_t i = 0; i < free_chunks.len; ++i) {
+        cz::heap_allocator().dealloc({free_chunks[i], BACKLOG_BUFFER_SIZE});
+    }
+    free_chunks.drop(cz::heap_allocator());
+    free_chunks = {};
+    plot_pool();
+}
+
+Backlog_Pool_Stats backlog_pool_stats() {
+    Backlog_Pool_Stats stats = {};
+    stats.chunk_size = BACKLOG_BUFFER_SIZE;
+    stats.free_chunks = free_chunks.len;
+    stats.allocated_chunks = allocated_chunks;
+    stats.hits = hits;
+    stats.misses = misses;
+    return stats;
+}
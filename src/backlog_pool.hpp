@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Process-wide pool of backlog chunks (`BACKLOG_BUFFER_SIZE` bytes each).
+/// Chunks freed by one backlog are reused by the next allocation
+/// from any backlog instead of going back to the heap.
+
+struct Backlog_Pool_Stats {
+    uint64_t chunk_size;
+    uint64_t free_chunks;       // Chunks sitting in the pool waiting to be reused.
+    uint64_t allocated_chunks;  // Chunks currently owned by backlogs.
+    uint64_t hits;              // Allocations served from the pool.
+    uint64_t misses;            // Allocations that went to the heap.
+};
+
+char* backlog_pool_alloc();
+void backlog_pool_free(char* chunk);
+
+/// Release all free chunks back to the heap.
+void backlog_pool_trim();
+
+Backlog_Pool_Stats backlog_pool_stats();
@@ -0,0 +1,331 @@
+#include "backlog_search.hpp"
+
+#include <string.h>
+#include <cz/util.hpp>
+#include <tracy/Tracy.hpp>
+#include "backlog.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define SEARCH_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if SEARCH_SSE2 && (defined(__GNUC__) || defined(__clang__))
+#define SEARCH_AVX2 1
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility
+///////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t count_trailing_zeros(uint32_t mask) {
+    CZ_DEBUG_ASSERT(mask != 0);
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/// Index of the highest bit set.
+static inline uint32_t highest_bit(uint32_t mask) {
+    CZ_DEBUG_ASSERT(mask != 0);
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return index;
+#else
+    return 31 - __builtin_clz(mask);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar
+///////////////////////////////////////////////////////////////////////////////
+
+const char* search_text_scalar(cz::Str text, cz::Str needle) {
+    if (needle.len == 0)
+        return text.buffer;
+    if (needle.len > text.len)
+        return nullptr;
+
+    // Jump between occurrences of the first byte.
+    size_t positions = text.len - needle.len + 1;
+    for (size_t i = 0; i < positions; ++i) {
+        const char* candidate = cz::Str{text.buffer + i, positions - i}.find(needle[0]);
+        if (!candidate)
+            return nullptr;
+        if (memcmp(candidate, needle.buffer, needle.len) == 0)
+            return candidate;
+        i = candidate - text.buffer;
+    }
+    return nullptr;
+}
+
+const char* search_text_reverse_scalar(cz::Str text, cz::Str needle) {
+    if (needle.len == 0)
+        return text.buffer + text.len;
+    if (needle.len > text.len)
+        return nullptr;
+
+    // Jump between occurrences of the first byte.
+    size_t positions = text.len - needle.len + 1;
+    while (positions > 0) {
+        const char* candidate = cz::Str{text.buffer, positions}.rfind(needle[0]);
+        if (!candidate)
+            return nullptr;
+        if (memcmp(candidate, needle.buffer, needle.len) == 0)
+            return candidate;
+        positions = candidate - text.buffer;
+    }
+    return nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SSE2
+///////////////////////////////////////////////////////////////////////////////
+
+#if SEARCH_SSE2
+static const char* search_text_sse2(cz::Str text, cz::Str needle) {
+    if (needle.len == 0 || needle.len > text.len)
+        return search_text_scalar(text, needle);
+
+    // Test the first and last bytes of 16 candidates at once.  Both loads stay inside
+    // `text` since the last candidate tested is at most `positions - 1`.
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle.len - 1]);
+    size_t positions = text.len - needle.len + 1;
+
+    size_t i = 0;
+    for (; i + 16 <= positions; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(text.buffer + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i*)(text.buffer + i + needle.len - 1));
+        __m128i both = _mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                                     _mm_cmpeq_epi8(block_last, last));
+        for (uint32_t mask = (uint32_t)_mm_movemask_epi8(both); mask; mask &= mask - 1) {
+            const char* candidate = text.buffer + i + count_trailing_zeros(mask);
+            if (memcmp(candidate, needle.buffer, needle.len) == 0)
+                return candidate;
+        }
+    }
+
+    return search_text_scalar(text.slice_start(i), needle);
+}
+
+static const char* search_text_reverse_sse2(cz::Str text, cz::Str needle) {
+    if (needle.len == 0 || needle.len > text.len)
+        return search_text_reverse_scalar(text, needle);
+
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle.len - 1]);
+    size_t positions = text.len - needle.len + 1;
+
+    for (; positions >= 16; positions -= 16) {
+        size_t i = positions - 16;
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(text.buffer + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i*)(text.buffer + i + needle.len - 1));
+        __m128i both = _mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                                     _mm_cmpeq_epi8(block_last, last));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(both);
+        while (mask) {
+            uint32_t bit = highest_bit(mask);
+            const char* candidate = text.buffer + i + bit;
+            if (memcmp(candidate, needle.buffer, needle.len) == 0)
+                return candidate;
+            mask &= ~((uint32_t)1 << bit);
+        }
+    }
+
+    return search_text_reverse_scalar(text.slice_end(positions + needle.len - 1), needle);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX2
+///////////////////////////////////////////////////////////////////////////////
+
+#if SEARCH_AVX2
+__attribute__((target("avx2"))) static const char* search_text_avx2(cz::Str text,
+                                                                    cz::Str needle) {
+    if (needle.len == 0 || needle.len > text.len)
+        return search_text_scalar(text, needle);
+
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle.len - 1]);
+    size_t positions = text.len - needle.len + 1;
+
+    size_t i = 0;
+    for (; i + 32 <= positions; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i*)(text.buffer + i));
+        __m256i block_last =
+            _mm256_loadu_si256((const __m256i*)(text.buffer + i + needle.len - 1));
+        __m256i both = _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+                                        _mm256_cmpeq_epi8(block_last, last));
+        for (uint32_t mask = (uint32_t)_mm256_movemask_epi8(both); mask; mask &= mask - 1) {
+            const char* candidate = text.buffer + i + count_trailing_zeros(mask);
+            if (memcmp(candidate, needle.buffer, needle.len) == 0)
+                return candidate;
+        }
+    }
+
+    return search_text_sse2(text.slice_start(i), needle);
+}
+
+__attribute__((target("avx2"))) static const char* search_text_reverse_avx2(cz::Str text,
+                                                                            cz::Str needle) {
+    if (needle.len == 0 || needle.len > text.len)
+        return search_text_reverse_scalar(text, needle);
+
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle.len - 1]);
+    size_t positions = text.len - needle.len + 1;
+
+    for (; positions >= 32; positions -= 32) {
+        size_t i = positions - 32;
+        __m256i block_first = _mm256_loadu_si256((const __m256i*)(text.buffer + i));
+        __m256i block_last =
+            _mm256_loadu_si256((const __m256i*)(text.buffer + i + needle.len - 1));
+        __m256i both = _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+                                        _mm256_cmpeq_epi8(block_last, last));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(both);
+        while (mask) {
+            uint32_t bit = highest_bit(mask);
+            const char* candidate = text.buffer + i + bit;
+            if (memcmp(candidate, needle.buffer, needle.len) == 0)
+                return candidate;
+            mask &= ~((uint32_t)1 << bit);
+        }
+    }
+
+    return search_text_reverse_sse2(text.slice_end(positions + needle.len - 1), needle);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Dispatch
+///////////////////////////////////////////////////////////////////////////////
+
+typedef const char* (*Search_Function)(cz::Str, cz::Str);
+
+static Search_Function pick_search_function(bool reverse) {
+#if SEARCH_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return reverse ? search_text_reverse_avx2 : search_text_avx2;
+#endif
+#if SEARCH_SSE2
+    return reverse ? search_text_reverse_sse2 : search_text_sse2;
+#else
+    return reverse ? search_text_reverse_scalar : search_text_scalar;
+#endif
+}
+
+const char* search_text(cz::Str text, cz::Str needle) {
+    static const Search_Function function = pick_search_function(/*reverse=*/false);
+    return function(text, needle);
+}
+
+const char* search_text_reverse(cz::Str text, cz::Str needle) {
+    static const Search_Function function = pick_search_function(/*reverse=*/true);
+    return function(text, needle);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Backlogs
+///////////////////////////////////////////////////////////////////////////////
+
+/// Matches starting in the last `needle.len - 1` bytes of a span continue into the next
+/// chunk so `search_text` can't see them.  Get the first index of those positions.
+static uint64_t crossing_start(uint64_t span_start, uint64_t span_end, cz::Str needle) {
+    if (span_end - span_start < needle.len - 1)
+        return span_start;
+    return span_end - (needle.len - 1);
+}
+
+bool backlog_search_forward(Backlog_State* backlog,
+                            uint64_t start,
+                            uint64_t end,
+                            cz::Str needle,
+                            uint64_t* index) {
+    ZoneScoped;
+    CZ_DEBUG_ASSERT(needle.len > 0);
+    if (start >= end || end - start < needle.len)
+        return false;
+
+    uint64_t last = end - needle.len + 1;  // Matches start before this.
+    Backlog_Spans spans = backlog_spans(backlog, start, end);
+    cz::Str span;
+    while (spans.next(&span)) {
+        uint64_t span_start = spans.start - span.len;
+
+        // Matches inside the span.
+        const char* ptr = search_text(span, needle);
+        if (ptr) {
+            *index = span_start + (ptr - span.buffer);
+            return true;
+        }
+
+        // Matches that cross into the next chunk.
+        uint64_t i = crossing_start(span_start, spans.start, needle);
+        uint64_t cross_end = cz::min(spans.start, last);
+        for (; i < cross_end; ++i) {
+            ptr = span.slice(i - span_start, cross_end - span_start).find(needle[0]);
+            if (!ptr)
+                break;
+            i = span_start + (ptr - span.buffer);
+            if (backlog_matches(backlog, i, needle)) {
+                *index = i;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool backlog_search_backward(Backlog_State* backlog,
+                             uint64_t start,
+                             uint64_t end,
+                             cz::Str needle,
+                             uint64_t* index) {
+    ZoneScoped;
+    CZ_DEBUG_ASSERT(needle.len > 0);
+    if (start >= end || end - start < needle.len)
+        return false;
+
+    uint64_t last = end - needle.len + 1;  // Matches start before this.
+    Backlog_Spans spans = backlog_spans(backlog, start, end);
+    cz::Str span;
+    while (spans.prev(&span)) {
+        uint64_t span_start = spans.end;
+        uint64_t span_end = span_start + span.len;
+
+        // Matches that cross into the next chunk come after the ones inside the span.
+        uint64_t cross_start = crossing_start(span_start, span_end, needle);
+        uint64_t i = cz::min(span_end, last);
+        while (i > cross_start) {
+            const char* ptr = span.slice(cross_start - span_start, i - span_start).rfind(needle[0]);
+            if (!ptr)
+                break;
+            i = span_start + (ptr - span.buffer);
+            if (backlog_matches(backlog, i, needle)) {
+                *index = i;
+                return true;
+            }
+        }
+
+        // Matches inside the span.
+        const char* ptr = search_text_reverse(span, needle);
+        if (ptr) {
+            *index = span_start + (ptr - span.buffer);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <cz/string.hpp>
+
+struct Backlog_State;
+
+/// Find the first occurrence of `needle` in `text`.  Returns null if there is none.
+///
+/// Candidates are found by comparing the first and last bytes of `needle` against 16 or
+/// 32 positions at a time with SSE2 or AVX2 and are then verified with `memcmp`.
+const char* search_text(cz::Str text, cz::Str needle);
+/// Find the last occurrence of `needle` in `text`.  Returns null if there is none.
+const char* search_text_reverse(cz::Str text, cz::Str needle);
+
+/// Portable versions of `search_text` and `search_text_reverse`.
+/// Exposed for the tests and benchmarks.
+const char* search_text_scalar(cz::Str text, cz::Str needle);
+const char* search_text_reverse_scalar(cz::Str text, cz::Str needle);
+
+/// Find the first / last occurrence of `needle` that is entirely inside `[start, end)`.
+/// Matches that cross chunk boundaries are found too.  `needle` must not be empty.
+bool backlog_search_forward(Backlog_State* backlog,
+                            uint64_t start,
+                            uint64_t end,
+                            cz::Str needle,
+                            uint64_t* index);
+bool backlog_search_backward(Backlog_State* backlog,
+                             uint64_t start,
+                             uint64_t end,
+                             cz::Str needle,
+                             uint64_t* index);
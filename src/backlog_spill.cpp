@@ -0,0 +1,249 @@
+#include "backlog_spill.hpp"
+
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+#include <cz/vector.hpp>
+#include <tracy/Tracy.hpp>
+#include "backlog.hpp"
+#include "backlog_compress.hpp"
+#include "backlog_pool.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Data
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+static int spill_fd = -1;
+static uint64_t slot_size;  // Chunks are page aligned in the file so they can be mapped.
+static uint64_t num_slots;  // Size of the file in slots.
+static cz::Vector<uint64_t> free_slots;
+#endif
+
+static uint64_t mapped_chunks;
+static uint64_t spills;
+static uint64_t faults;
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code
+///////////////////////////////////////////////////////////////////////////////
+
+static uint64_t resident_bytes() {
+    return (backlog_pool_stats().allocated_chunks + mapped_chunks) * BACKLOG_BUFFER_SIZE +
+           backlog_compress_stats().compressed_bytes;
+}
+
+#ifndef _WIN32
+
+static void plot_spill() {
+    TracyPlot("backlog_spill_mapped", (int64_t)mapped_chunks);
+    TracyPlot("backlog_spill_spills", (int64_t)spills);
+}
+
+static bool open_spill_file() {
+    if (spill_fd != -1)
+        return true;
+
+    const char* dir = getenv("TMPDIR");
+    if (!dir || !*dir)
+        dir = "/tmp";
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/tesh-spill-XXXXXX", dir);
+
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return false;
+    unlink(path);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    spill_fd = fd;
+    slot_size = cz::max((uint64_t)BACKLOG_BUFFER_SIZE, (uint64_t)sysconf(_SC_PAGESIZE));
+    return true;
+}
+
+static bool read_slot(char* buffer, uint64_t slot) {
+    ssize_t result = pread(spill_fd, buffer, BACKLOG_BUFFER_SIZE, slot * slot_size);
+    return result == BACKLOG_BUFFER_SIZE;
+}
+
+/// Free the memory holding chunk `outer`.  Returns false if it couldn't be written out.
+static bool spill_chunk(Backlog_State* backlog, size_t outer) {
+    char* buffer = backlog->buffers[outer];
+    uint64_t* slot = &backlog->spill_slots[outer];
+    CZ_DEBUG_ASSERT(buffer);
+
+    if (*slot != BACKLOG_NOT_SPILLED) {
+        // Already in the file so just unmap it.
+        munmap(buffer, slot_size);
+        --mapped_chunks;
+    } else {
+        uint64_t new_slot = (free_slots.len > 0 ? free_slots.pop() : num_slots++);
+        ssize_t result = pwrite(spill_fd, buffer, BACKLOG_BUFFER_SIZE, new_slot * slot_size);
+        if (result != BACKLOG_BUFFER_SIZE) {
+            free_slots.reserve(cz::heap_allocator(), 1);
+            free_slots.push(new_slot);
+            return false;
+        }
+
+        *slot = new_slot;
+        backlog_pool_free(buffer);
+        ++spills;
+    }
+
+    backlog->buffers[outer] = nullptr;
+    return true;
+}
+
+static bool contains(cz::Slice<Backlog_State*> backlogs, Backlog_State* backlog) {
+    for (size_t i = 0; i < backlogs.len; ++i) {
+        if (backlogs[i] == backlog)
+            return true;
+    }
+    return false;
+}
+
+void backlog_spill_enforce_budget(cz::Slice<Backlog_State*> backlogs,
+                                  cz::Slice<Backlog_State*> visible,
+                                  uint64_t budget) {
+    if (budget == 0 || resident_bytes() <= budget)
+        return;
+
+    ZoneScoped;
+
+    // Free chunks waiting in the pool take up memory too.
+    backlog_pool_trim();
+
+    if (!open_spill_file())
+        return;
+
+    // Go a bit under so we don't have to do this every frame.
+    uint64_t target = budget - budget / 8;
+
+    // Unmap chunks first since they are already in the file.  Then
+    // spill finished backlogs because they are less likely to be read.
+    for (int pass = 0; pass < 3; ++pass) {
+        for (size_t i = 0; i < backlogs.len; ++i) {
+            Backlog_State* backlog = backlogs[i];
+            if (!backlog || contains(visible, backlog))
+                continue;
+            if (pass == 1 && !backlog->done)
+                continue;
+
+            // Never spill the chunk being written to.
+            for (size_t outer = 0; outer + 1 < backlog->buffers.len; ++outer) {
+                // Compressed chunks are small and their buffer belongs to the block cache.
+                if (!backlog->buffers[outer] || backlog->compressed[outer])
+                    continue;
+                bool mapped = (backlog->spill_slots[outer] != BACKLOG_NOT_SPILLED);
+                if (mapped != (pass == 0))
+                    continue;
+
+                if (!spill_chunk(backlog, outer))
+                    goto finish;
+                if (resident_bytes() <= target)
+                    goto finish;
+            }
+        }
+    }
+
+finish:
+    plot_spill();
+}
+
+char* backlog_spill_fault(Backlog_State* backlog, size_t outer) {
+    ZoneScoped;
+
+    uint64_t slot = backlog->spill_slots[outer];
+    CZ_ASSERT(slot != BACKLOG_NOT_SPILLED);
+    CZ_DEBUG_ASSERT(!backlog->buffers[outer]);
+
+    void* address = mmap(nullptr, slot_size, PROT_READ, MAP_SHARED, spill_fd, slot * slot_size);
+    if (address == MAP_FAILED) {
+        // Out of mappings.  Bring it back the slow way.
+        backlog_spill_restore(backlog, outer);
+        return backlog->buffers[outer];
+    }
+
+    backlog->buffers[outer] = (char*)address;
+    ++mapped_chunks;
+    ++faults;
+    plot_spill();
+    return backlog->buffers[outer];
+}
+
+void backlog_spill_restore(Backlog_State* backlog, size_t outer) {
+    uint64_t slot = backlog->spill_slots[outer];
+    if (slot == BACKLOG_NOT_SPILLED)
+        return;
+
+    ZoneScoped;
+
+    char* buffer = backlog_pool_alloc();
+    if (backlog->buffers[outer]) {
+        memcpy(buffer, backlog->buffers[outer], BACKLOG_BUFFER_SIZE);
+    } else {
+        bool read = read_slot(buffer, slot);
+        CZ_ASSERT(read);
+    }
+
+    backlog_spill_release(backlog, outer);
+    backlog->buffers[outer] = buffer;
+}
+
+void backlog_spill_release(Backlog_State* backlog, size_t outer) {
+    uint64_t slot = backlog->spill_slots[outer];
+    CZ_DEBUG_ASSERT(slot != BACKLOG_NOT_SPILLED);
+
+    if (backlog->buffers[outer]) {
+        munmap(backlog->buffers[outer], slot_size);
+        --mapped_chunks;
+    }
+
+    free_slots.reserve(cz::heap_allocator(), 1);
+    free_slots.push(slot);
+    backlog->buffers[outer] = nullptr;
+    backlog->spill_slots[outer] = BACKLOG_NOT_SPILLED;
+}
+
+Backlog_Spill_Stats backlog_spill_stats() {
+    Backlog_Spill_Stats stats = {};
+    stats.resident_bytes = resident_bytes();
+    stats.spilled_bytes = (num_slots - free_slots.len) * BACKLOG_BUFFER_SIZE;
+    stats.mapped_bytes = mapped_chunks * BACKLOG_BUFFER_SIZE;
+    stats.spills = spills;
+    stats.faults = faults;
+    return stats;
+}
+
+#else
+
+void backlog_spill_enforce_budget(cz::Slice<Backlog_State*> backlogs,
+                                  cz::Slice<Backlog_State*> visible,
+                                  uint64_t budget) {}
+
+char* backlog_spill_fault(Backlog_State* backlog, size_t outer) {
+    CZ_PANIC("Spilling is unsupported");
+}
+
+void backlog_spill_restore(Backlog_State* backlog, size_t outer) {}
+
+void backlog_spill_release(Backlog_State* backlog, size_t outer) {
+    CZ_PANIC("Spilling is unsupported");
+}
+
+Backlog_Spill_Stats backlog_spill_stats() {
+    Backlog_Spill_Stats stats = {};
+    stats.resident_bytes = resident_bytes();
+    return stats;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cz/slice.hpp>
+
+struct Backlog_State;
+
+/// Keeps the backlog chunks in RAM under a budget.  Over the budget, full chunks of
+/// off-screen backlogs (finished ones first) are written to a spill file and freed.
+/// The spill file is unlinked as soon as it is created so it goes away with the process.
+///
+/// A spilled chunk has a null pointer in `Backlog_State::buffers`.  Reading it through
+/// `Backlog_State::get` or `Backlog_State::buffer_at` maps it back in with mmap.  Mapped
+/// chunks are read only and are only unmapped by `backlog_spill_enforce_budget` so
+/// pointers to them are valid until the end of the frame.
+///
+/// Spilling is unsupported on Windows so the budget is ignored there.
+
+#define BACKLOG_NOT_SPILLED ((uint64_t)-1)
+
+struct Backlog_Spill_Stats {
+    uint64_t resident_bytes;  // Chunks in RAM: owned by backlogs, mapped back in, or compressed.
+    uint64_t spilled_bytes;   // Chunks in the spill file.
+    uint64_t mapped_bytes;    // Subset of both that is mapped back in.
+    uint64_t spills;          // Chunks written to the spill file.
+    uint64_t faults;          // Chunks mapped back in.
+};
+
+/// Spill chunks of the `backlogs` that aren't `visible` until the resident
+/// bytes are comfortably under `budget`.  A `budget` of 0 means unlimited.
+void backlog_spill_enforce_budget(cz::Slice<Backlog_State*> backlogs,
+                                  cz::Slice<Backlog_State*> visible,
+                                  uint64_t budget);
+
+/// Map in a spilled chunk.  Returns the new value of `buffers[outer]`.
+char* backlog_spill_fault(Backlog_State* backlog, size_t outer);
+
+/// Copy a spilled chunk back into RAM so it can be written to.
+void backlog_spill_restore(Backlog_State* backlog, size_t outer);
+
+/// Forget a spilled chunk because the backlog dropped it.
+void backlog_spill_release(Backlog_State* backlog, size_t outer);
+
+Backlog_Spill_Stats backlog_spill_stats();
@@ -0,0 +1,240 @@
+#include "compositor.hpp"
+
+#include <string.h>
+#include <tracy/Tracy.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define COMPOSITE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if COMPOSITE_SSE2 && (defined(__GNUC__) || defined(__clang__))
+#define COMPOSITE_AVX2 1
+#include <immintrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar
+///////////////////////////////////////////////////////////////////////////////
+
+/// `(background * (255 - alpha) + foreground * alpha) / 255` rounded, for one channel.
+static inline uint32_t blend_channel(uint32_t background, uint32_t foreground, uint32_t alpha) {
+    uint32_t t = background * (255 - alpha) + foreground * alpha + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static inline uint32_t blend_pixel(uint32_t background, uint32_t foreground, uint32_t alpha) {
+    uint32_t pixel = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t bg = (background >> shift) & 0xff;
+        uint32_t fg = (foreground >> shift) & 0xff;
+        pixel |= blend_channel(bg, fg, alpha) << shift;
+    }
+    return pixel;
+}
+
+void composite_blend_scalar(uint32_t* pixels,
+                            const uint8_t* coverage,
+                            size_t count,
+                            uint32_t background,
+                            uint32_t foreground) {
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t alpha = coverage[i];
+        if (alpha == 0)
+            pixels[i] = background;
+        else if (alpha == 0xff)
+            pixels[i] = foreground;
+        else
+            pixels[i] = blend_pixel(background, foreground, alpha);
+    }
+}
+
+static void composite_fill_scalar(uint32_t* pixels, size_t count, uint32_t color) {
+    for (size_t i = 0; i < count; ++i) {
+        pixels[i] = color;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SSE2
+///////////////////////////////////////////////////////////////////////////////
+
+#if COMPOSITE_SSE2
+/// Blend channels stored as 16 bit lanes.  Same math as `blend_channel`.
+static inline __m128i blend_sse2(__m128i background, __m128i foreground, __m128i alpha) {
+    const __m128i max = _mm_set1_epi16(255);
+    const __m128i round = _mm_set1_epi16(128);
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(background, _mm_sub_epi16(max, alpha)),
+                              _mm_mullo_epi16(foreground, alpha));
+    t = _mm_add_epi16(t, round);
+    t = _mm_add_epi16(t, _mm_srli_epi16(t, 8));
+    return _mm_srli_epi16(t, 8);
+}
+
+static void composite_blend_sse2(uint32_t* pixels,
+                                 const uint8_t* coverage,
+                                 size_t count,
+                                 uint32_t background,
+                                 uint32_t foreground) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bg32 = _mm_set1_epi32((int)background);
+    const __m128i fg32 = _mm_set1_epi32((int)foreground);
+    const __m128i bg16 = _mm_unpacklo_epi8(bg32, zero);
+    const __m128i fg16 = _mm_unpacklo_epi8(fg32, zero);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint32_t alphas;
+        memcpy(&alphas, coverage + i, sizeof(alphas));
+
+        // Glyphs are mostly empty space so skip the math when we can.
+        __m128i result;
+        if (alphas == 0) {
+            result = bg32;
+        } else if (alphas == 0xffffffff) {
+            result = fg32;
+        } else {
+            // Spread each alpha over the four channels of its pixel.
+            __m128i alpha = _mm_cvtsi32_si128((int)alphas);
+            alpha = _mm_unpacklo_epi8(alpha, alpha);
+            alpha = _mm_unpacklo_epi16(alpha, alpha);
+            __m128i low = blend_sse2(bg16, fg16, _mm_unpacklo_epi8(alpha, zero));
+            __m128i high = blend_sse2(bg16, fg16, _mm_unpackhi_epi8(alpha, zero));
+            result = _mm_packus_epi16(low, high);
+        }
+        _mm_storeu_si128((__m128i*)(pixels + i), result);
+    }
+
+    composite_blend_scalar(pixels + i, coverage + i, count - i, background, foreground);
+}
+
+static void composite_fill_sse2(uint32_t* pixels, size_t count, uint32_t color) {
+    const __m128i color4 = _mm_set1_epi32((int)color);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128((__m128i*)(pixels + i), color4);
+    }
+    composite_fill_scalar(pixels + i, count - i, color);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX2
+///////////////////////////////////////////////////////////////////////////////
+
+#if COMPOSITE_AVX2
+__attribute__((target("avx2"))) static inline __m256i blend_avx2(__m256i background,
+                                                                 __m256i foreground,
+                                                                 __m256i alpha) {
+    const __m256i max = _mm256_set1_epi16(255);
+    const __m256i round = _mm256_set1_epi16(128);
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(background, _mm256_sub_epi16(max, alpha)),
+                                 _mm256_mullo_epi16(foreground, alpha));
+    t = _mm256_add_epi16(t, round);
+    t = _mm256_add_epi16(t, _mm256_srli_epi16(t, 8));
+    return _mm256_srli_epi16(t, 8);
+}
+
+__attribute__((target("avx2"))) static void composite_blend_avx2(uint32_t* pixels,
+                                                                 const uint8_t* coverage,
+                                                                 size_t count,
+                                                                 uint32_t background,
+                                                                 uint32_t foreground) {
+    const __m256i bg32 = _mm256_set1_epi32((int)background);
+    const __m256i fg32 = _mm256_set1_epi32((int)foreground);
+    const __m256i bg16 = _mm256_cvtepu8_epi16(_mm_set1_epi32((int)background));
+    const __m256i fg16 = _mm256_cvtepu8_epi16(_mm_set1_epi32((int)foreground));
+    const __m128i spread_low = _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+    const __m128i spread_high = _mm_setr_epi8(4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint64_t alphas;
+        memcpy(&alphas, coverage + i, sizeof(alphas));
+
+        __m256i result;
+        if (alphas == 0) {
+            result = bg32;
+        } else if (alphas == 0xffffffffffffffffull) {
+            result = fg32;
+        } else {
+            __m128i alpha = _mm_loadl_epi64((const __m128i*)(coverage + i));
+            __m256i low = blend_avx2(bg16, fg16,
+                                     _mm256_cvtepu8_epi16(_mm_shuffle_epi8(alpha, spread_low)));
+            __m256i high = blend_avx2(bg16, fg16,
+                                      _mm256_cvtepu8_epi16(_mm_shuffle_epi8(alpha, spread_high)));
+            // packus works within 128 bit lanes so put the pixels back in order.
+            result = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xd8);
+        }
+        _mm256_storeu_si256((__m256i*)(pixels + i), result);
+    }
+
+    // Avoid the AVX to SSE transition penalty.
+    _mm256_zeroupper();
+    composite_blend_sse2(pixels + i, coverage + i, count - i, background, foreground);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Dispatch
+///////////////////////////////////////////////////////////////////////////////
+
+typedef void (*Blend_Function)(uint32_t*, const uint8_t*, size_t, uint32_t, uint32_t);
+
+static Blend_Function pick_blend_function() {
+#if COMPOSITE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return composite_blend_avx2;
+#endif
+#if COMPOSITE_SSE2
+    return composite_blend_sse2;
+#else
+    return composite_blend_scalar;
+#endif
+}
+
+void composite_blend(uint32_t* pixels,
+                     const uint8_t* coverage,
+                     size_t count,
+                     uint32_t background,
+                     uint32_t foreground) {
+    static const Blend_Function function = pick_blend_function();
+    function(pixels, coverage, count, background, foreground);
+}
+
+void composite_fill(uint32_t* pixels, size_t count, uint32_t color) {
+#if COMPOSITE_SSE2
+    composite_fill_sse2(pixels, count, color);
+#else
+    composite_fill_scalar(pixels, count, color);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Rows
+///////////////////////////////////////////////////////////////////////////////
+
+void composite_row(uint8_t* pixels,
+                   size_t pitch,
+                   int first_line,
+                   int num_lines,
+                   int underline_line,
+                   cz::Slice<const Composite_Span> spans) {
+    ZoneScoped;
+
+    for (int line = first_line; line < first_line + num_lines; ++line, pixels += pitch) {
+        uint32_t* row = (uint32_t*)pixels;
+        for (size_t i = 0; i < spans.len; ++i) {
+            const Composite_Span& span = spans[i];
+            if (span.underline && line == underline_line) {
+                composite_fill(row + span.x, span.width, span.foreground);
+            } else if (span.mask) {
+                composite_blend(row + span.x, span.mask + (size_t)line * span.width, span.width,
+                                span.background, span.foreground);
+            } else {
+                composite_fill(row + span.x, span.width, span.background);
+            }
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cz/slice.hpp>
+
+/// Software compositor that draws rows of text straight into a pixel buffer.
+/// Pixels are 32 bits where every channel is one byte (ex. ARGB8888 or XRGB8888).
+/// Channels are blended byte by byte so the order of the channels doesn't matter.
+
+/// A run of pixels in a row of text.
+struct Composite_Span {
+    int x;                // Offset of the first pixel.
+    int width;            // Number of pixels.
+    const uint8_t* mask;  // Glyph coverage (`width` bytes per line) or null for a solid fill.
+    uint32_t background;
+    uint32_t foreground;
+    bool underline;
+};
+
+/// Draw lines `[first_line, first_line + num_lines)` of `spans`.  `pixels` points to the first
+/// line drawn and `pitch` is the size of a line in bytes.  Underlines are drawn on `underline_line`.
+void composite_row(uint8_t* pixels,
+                   size_t pitch,
+                   int first_line,
+                   int num_lines,
+                   int underline_line,
+                   cz::Slice<const Composite_Span> spans);
+
+/// Set each pixel to `background` blended with `foreground` by the corresponding `coverage`.
+/// Uses AVX2 or SSE2 when available, falling back to `composite_blend_scalar`.
+void composite_blend(uint32_t* pixels,
+                     const uint8_t* coverage,
+                     size_t count,
+                     uint32_t background,
+                     uint32_t foreground);
+
+/// Portable version of `composite_blend`.  Exposed for the tests and benchmarks.
+void composite_blend_scalar(uint32_t* pixels,
+                            const uint8_t* coverage,
+                            size_t count,
+                            uint32_t background,
+                            uint32_t foreground);
+
+void composite_fill(uint32_t* pixels, size_t count, uint32_t color);
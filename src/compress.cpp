@@ -0,0 +1,181 @@
+#include "compress.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <cz/util.hpp>
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Configuration
+///////////////////////////////////////////////////////////////////////////////
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+
+// Like LZ4, the last bytes of a block are always literals.
+#define LAST_LITERALS 5
+#define MATCH_SAFE_DISTANCE 12
+
+#define SKIP_SHIFT 6
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility
+///////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t read32(const uint8_t* ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static inline uint32_t hash4(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/// Write the part of a length that doesn't fit in the token.
+static inline uint8_t* write_length(uint8_t* op, size_t len) {
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t* write_sequence(uint8_t* op,
+                               const uint8_t* literals,
+                               size_t literal_len,
+                               size_t offset,
+                               size_t match_len) {
+    uint8_t* token = op++;
+    *token = (uint8_t)(cz::min(literal_len, (size_t)15) << 4);
+    if (literal_len >= 15)
+        op = write_length(op, literal_len - 15);
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    // The last sequence is only literals.
+    if (match_len == 0)
+        return op;
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    match_len -= MIN_MATCH;
+    *token |= (uint8_t)cz::min(match_len, (size_t)15);
+    if (match_len >= 15)
+        op = write_length(op, match_len - 15);
+    return op;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code
+///////////////////////////////////////////////////////////////////////////////
+
+size_t compress_block_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+size_t compress_block(const char* input, size_t len, char* output) {
+    const uint8_t* start = (const uint8_t*)input;
+    const uint8_t* end = start + len;
+    const uint8_t* ip = start;
+    const uint8_t* anchor = start;
+    uint8_t* op = (uint8_t*)output;
+
+    if (len >= MATCH_SAFE_DISTANCE + MIN_MATCH) {
+        uint32_t table[1 << HASH_BITS] = {};
+        const uint8_t* match_limit = end - MATCH_SAFE_DISTANCE;
+        const uint8_t* extend_limit = end - LAST_LITERALS;
+
+        // Position 0 can't be stored in the table because it means empty.
+        ++ip;
+
+        // Like LZ4, skip ahead faster the longer we go without a match
+        // so incompressible data doesn't cost a hash lookup per byte.
+        size_t misses = 0;
+        while (ip < match_limit) {
+            uint32_t sequence = read32(ip);
+            uint32_t* slot = &table[hash4(sequence)];
+            const uint8_t* candidate = start + *slot;
+            *slot = (uint32_t)(ip - start);
+
+            if (candidate == start || ip - candidate > MAX_OFFSET ||
+                read32(candidate) != sequence) {
+                ip += 1 + (misses++ >> SKIP_SHIFT);
+                continue;
+            }
+            misses = 0;
+
+            size_t match_len = MIN_MATCH;
+            while (ip + match_len < extend_limit && candidate[match_len] == ip[match_len])
+                ++match_len;
+
+            op = write_sequence(op, anchor, ip - anchor, ip - candidate, match_len);
+            ip += match_len;
+            anchor = ip;
+        }
+    }
+
+    op = write_sequence(op, anchor, end - anchor, 0, 0);
+    return op - (uint8_t*)output;
+}
+
+/// Read the part of a length that didn't fit in the token.
+static inline bool read_length(const uint8_t** ip, const uint8_t* end, size_t* len) {
+    uint8_t byte;
+    do {
+        if (*ip == end)
+            return false;
+        byte = *(*ip)++;
+        *len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool decompress_block(const char* input, size_t input_len, char* output, size_t output_len) {
+    const uint8_t* ip = (const uint8_t*)input;
+    const uint8_t* ip_end = ip + input_len;
+    uint8_t* op = (uint8_t*)output;
+    uint8_t* op_end = op + output_len;
+
+    while (ip < ip_end) {
+        uint8_t token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !read_length(&ip, ip_end, &literal_len))
+            return false;
+        if (literal_len > (size_t)(ip_end - ip) || literal_len > (size_t)(op_end - op))
+            return false;
+        memcpy(op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+
+        // The last sequence is only literals.
+        if (ip == ip_end)
+            break;
+
+        if (ip_end - ip < 2)
+            return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t*)output))
+            return false;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && !read_length(&ip, ip_end, &match_len))
+            return false;
+        match_len += MIN_MATCH;
+        if (match_len > (size_t)(op_end - op))
+            return false;
+
+        // Matches can overlap their output so copy forwards a byte at a time.
+        const uint8_t* match = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, match, match_len);
+            op += match_len;
+        } else {
+            for (size_t i = 0; i < match_len; ++i)
+                *op++ = match[i];
+        }
+    }
+
+    return op == op_end;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+
+/// A small LZ77 block codec using the LZ4 block format.  It trades ratio for speed:
+/// a single greedy pass with a hash table of the last position of each 4 byte prefix.
+/// Made for compressing backlog chunks so blocks are at most 64 KiB.
+
+/// The most bytes `compress_block` can output for `len` bytes of input.
+size_t compress_block_bound(size_t len);
+
+/// Compress `input` into `output`, which must have room for `compress_block_bound(len)`
+/// bytes.  Returns the number of bytes written.
+size_t compress_block(const char* input, size_t len, char* output);
+
+/// Decompress a block into exactly `output_len` bytes.  Returns
+/// false if the block is corrupt or doesn't decompress to that size.
+bool decompress_block(const char* input, size_t input_len, char* output, size_t output_len);
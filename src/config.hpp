@@ -14,6 +14,10 @@ struct Config_State {
     int default_font_size;
     int tab_width;
     uint64_t max_length;
+    bool ring_retention;  // Drop the oldest output instead of the newest at `max_length`.
+    uint64_t memory_budget;  // Backlog chunks over this are spilled to disk.  0 = unlimited.
+    uint64_t index_budget;   // Memory for search index filters.  0 = no index.
+    bool coalesce_progress;  // Only store the last redraw of lines redrawn with '\r'.
     bool windows_wide_terminal;
     bool case_sensitive_completion;
     bool control_delete_kill_process;
@@ -25,6 +29,7 @@ struct Config_State {
     // RGB colors.
     cz::Slice<SDL_Color> process_colors;
     SDL_Color selection_bg_color;
+    SDL_Color search_bg_color;  // Matches of the search other than the selected one.
 
     // 256 colors.
     const SDL_Color* theme;  // [256]
@@ -0,0 +1,340 @@
+#include "event_loop.hpp"
+
+#include <SDL.h>
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+#include <tracy/Tracy.hpp>
+
+#ifdef __linux__
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <mutex>
+#include <thread>
+#define EVENT_LOOP_EPOLL 1
+#endif
+
+static const uint32_t frame_length = 1000 / 60;
+
+///////////////////////////////////////////////////////////////////////////////
+// Watcher thread
+///////////////////////////////////////////////////////////////////////////////
+
+#if EVENT_LOOP_EPOLL
+struct Event_Loop_Ready {
+    int fd;
+    bool hung;
+};
+
+struct Event_Loop_Watcher {
+    int epoll_fd;
+    int wake_fd;
+    uint32_t sdl_event;
+    std::thread thread;
+
+    std::mutex mutex;
+    cz::Vector<Event_Loop_Ready> ready;
+    bool notified;  // An SDL event was pushed that the main thread hasn't seen yet.
+    bool quit;
+};
+
+/// Written to wake up the watcher from signal handlers and other threads.
+static int global_wake_fd = -1;
+
+static void on_sigchld(int) {
+    int saved_errno = errno;
+    uint64_t one = 1;
+    ssize_t result = write(global_wake_fd, &one, sizeof(one));
+    (void)result;
+    errno = saved_errno;
+}
+
+static void run_watcher(Event_Loop_Watcher* watcher) {
+    epoll_event events[64];
+    while (1) {
+        int count = epoll_wait(watcher->epoll_fd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(watcher->mutex);
+        if (watcher->quit)
+            return;
+
+        for (int i = 0; i < count; ++i) {
+            Event_Loop_Ready ready = {};
+            if (events[i].data.fd == watcher->wake_fd) {
+                // Woken by a signal or another thread.  Record it with fd -1.
+                uint64_t value;
+                ssize_t result = read(watcher->wake_fd, &value, sizeof(value));
+                (void)result;
+                ready.fd = -1;
+            } else {
+                ready.fd = events[i].data.fd;
+                ready.hung = (events[i].events & (EPOLLHUP | EPOLLERR)) &&
+                             !(events[i].events & EPOLLIN);
+            }
+            watcher->ready.reserve(cz::heap_allocator(), 1);
+            watcher->ready.push(ready);
+        }
+
+        if (!watcher->notified) {
+            SDL_Event event = {};
+            event.type = watcher->sdl_event;
+            SDL_PushEvent(&event);
+            watcher->notified = true;
+        }
+    }
+}
+
+static Event_Loop_Watcher* start_watcher() {
+    uint32_t sdl_event = SDL_RegisterEvents(1);
+    if (sdl_event == (uint32_t)-1)
+        return nullptr;
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        return nullptr;
+
+    int wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd < 0) {
+        close(epoll_fd);
+        return nullptr;
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0) {
+        close(wake_fd);
+        close(epoll_fd);
+        return nullptr;
+    }
+
+    // Wake up when child processes exit so we can join them.
+    global_wake_fd = wake_fd;
+    struct sigaction action = {};
+    action.sa_handler = on_sigchld;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, nullptr);
+
+    Event_Loop_Watcher* watcher = new Event_Loop_Watcher;
+    watcher->epoll_fd = epoll_fd;
+    watcher->wake_fd = wake_fd;
+    watcher->sdl_event = sdl_event;
+    watcher->ready = {};
+    watcher->notified = false;
+    watcher->quit = false;
+    watcher->thread = std::thread(run_watcher, watcher);
+    return watcher;
+}
+
+static void stop_watcher(Event_Loop_Watcher* watcher) {
+    signal(SIGCHLD, SIG_DFL);
+    global_wake_fd = -1;
+
+    {
+        std::lock_guard<std::mutex> lock(watcher->mutex);
+        watcher->quit = true;
+    }
+    uint64_t one = 1;
+    ssize_t result = write(watcher->wake_fd, &one, sizeof(one));
+    (void)result;
+    watcher->thread.join();
+
+    close(watcher->wake_fd);
+    close(watcher->epoll_fd);
+    watcher->ready.drop(cz::heap_allocator());
+    delete watcher;
+}
+
+/// Register, rearm, or unregister files so the watcher matches `loop->watching`.
+static void sync_watcher(Event_Loop* loop) {
+    Event_Loop_Watcher* watcher = loop->watcher;
+
+    // Files that fired are disarmed (`EPOLLONESHOT`) until we rearm them.
+    bool fired = false;
+    {
+        std::lock_guard<std::mutex> lock(watcher->mutex);
+        for (size_t i = 0; i < watcher->ready.len; ++i) {
+            const Event_Loop_Ready& ready = watcher->ready[i];
+            for (size_t j = 0; j < loop->files.len; ++j) {
+                if (loop->files[j].fd == ready.fd) {
+                    loop->files[j].armed = false;
+                    loop->files[j].hung |= ready.hung;
+                    break;
+                }
+            }
+        }
+        fired = (watcher->ready.len > 0);
+        watcher->ready.len = 0;
+        watcher->notified = false;
+    }
+
+    for (size_t j = 0; j < loop->files.len; ++j) {
+        Event_Loop_File* file = &loop->files[j];
+        bool wanted = false;
+        for (size_t i = 0; i < loop->watching.len; ++i) {
+            if (loop->watching[i] == file->fd) {
+                wanted = true;
+                break;
+            }
+        }
+        if (!wanted) {
+            // Fails harmlessly if the file was already closed.
+            epoll_ctl(watcher->epoll_fd, EPOLL_CTL_DEL, file->fd, nullptr);
+            loop->files.remove(j);
+            --j;
+        }
+    }
+
+    for (size_t i = 0; i < loop->watching.len; ++i) {
+        int fd = loop->watching[i];
+        Event_Loop_File* file = nullptr;
+        for (size_t j = 0; j < loop->files.len; ++j) {
+            if (loop->files[j].fd == fd) {
+                file = &loop->files[j];
+                break;
+            }
+        }
+
+        if (file && file->always_ready) {
+            loop->busy = true;
+            continue;
+        }
+        if (file && (file->armed || file->hung))
+            continue;
+
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.fd = fd;
+        if (file) {
+            // The descriptor may have been closed and reused since it was added.
+            if (epoll_ctl(watcher->epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0 && errno == ENOENT)
+                epoll_ctl(watcher->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+            file->armed = true;
+        } else {
+            Event_Loop_File new_file = {};
+            new_file.fd = fd;
+            new_file.armed = (epoll_ctl(watcher->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0);
+            // Regular files can't be waited on because they are always ready.
+            new_file.always_ready = !new_file.armed;
+            if (new_file.always_ready)
+                loop->busy = true;
+            loop->files.reserve(cz::heap_allocator(), 1);
+            loop->files.push(new_file);
+        }
+    }
+
+    if (fired)
+        ++loop->wakeups;
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code
+///////////////////////////////////////////////////////////////////////////////
+
+bool init_event_loop(Event_Loop* loop) {
+    *loop = {};
+    loop->frame_start = SDL_GetTicks();
+#if EVENT_LOOP_EPOLL
+    loop->watcher = start_watcher();
+    if (!loop->watcher)
+        return false;
+#endif
+    return true;
+}
+
+void drop_event_loop(Event_Loop* loop) {
+#if EVENT_LOOP_EPOLL
+    if (loop->watcher)
+        stop_watcher(loop->watcher);
+#endif
+    loop->files.drop(cz::heap_allocator());
+    loop->watching.drop(cz::heap_allocator());
+    *loop = {};
+}
+
+void event_loop_watch(Event_Loop* loop, cz::Input_File file) {
+#if EVENT_LOOP_EPOLL
+    if (!file.is_open())
+        return;
+    for (size_t i = 0; i < loop->watching.len; ++i) {
+        if (loop->watching[i] == file.handle)
+            return;
+    }
+    loop->watching.reserve(cz::heap_allocator(), 1);
+    loop->watching.push(file.handle);
+#else
+    // Poll instead.
+    (void)file;
+    loop->busy = true;
+#endif
+}
+
+void event_loop_wake_at(Event_Loop* loop, std::chrono::steady_clock::time_point time) {
+    if (!loop->has_deadline || time < loop->deadline) {
+        loop->has_deadline = true;
+        loop->deadline = time;
+    }
+}
+
+void event_loop_mark_busy(Event_Loop* loop) {
+    loop->busy = true;
+}
+
+void event_loop_wake_from_thread() {
+#if EVENT_LOOP_EPOLL
+    if (global_wake_fd == -1)
+        return;
+    uint64_t one = 1;
+    ssize_t result = write(global_wake_fd, &one, sizeof(one));
+    (void)result;
+#endif
+}
+
+void event_loop_wait(Event_Loop* loop) {
+    ZoneScoped;
+
+    bool throttle = loop->busy;
+#if EVENT_LOOP_EPOLL
+    uint64_t wakeups = loop->wakeups;
+    sync_watcher(loop);
+    if (loop->wakeups != wakeups)
+        throttle = true;
+    // Registering a file can mark us as busy.
+    throttle |= loop->busy;
+#endif
+
+    if (throttle) {
+        // Don't spend more than 60fps worth of time on continuous output.
+        uint32_t wanted_end = loop->frame_start + frame_length;
+        uint32_t now = SDL_GetTicks();
+        if (wanted_end > now)
+            SDL_Delay(wanted_end - now);
+    }
+
+    if (!loop->busy) {
+        ++loop->idle_waits;
+        if (loop->has_deadline) {
+            using namespace std::chrono;
+            steady_clock::duration remaining = loop->deadline - steady_clock::now();
+            int64_t millis = duration_cast<milliseconds>(remaining).count() + 1;
+            if (millis > 0)
+                SDL_WaitEventTimeout(NULL, (int)cz::min(millis, (int64_t)INT32_MAX));
+        } else {
+            SDL_WaitEvent(NULL);
+        }
+    }
+
+    loop->watching.len = 0;
+    loop->busy = false;
+    loop->has_deadline = false;
+    loop->frame_start = SDL_GetTicks();
+}
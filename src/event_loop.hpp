@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <cz/process.hpp>
+#include <cz/vector.hpp>
+
+/// Decides when the main loop wakes up.  While a frame runs, everything that is waiting
+/// tells the event loop what it is waiting for: a file to become readable
+/// (`event_loop_watch`), a point in time (`event_loop_wake_at`), or nothing at all because
+/// it has more work to do right away (`event_loop_mark_busy`).  `event_loop_wait` then
+/// sleeps until one of those happens or there is an SDL event.
+///
+/// On Linux a background thread waits on the files with epoll and pushes an SDL event when
+/// any are ready.  Child processes exiting wake it via SIGCHLD and an eventfd.  On other
+/// platforms we fall back to ticking at 60fps while anything is being waited on.
+
+struct Event_Loop_Watcher;
+
+struct Event_Loop_File {
+    int fd;
+    bool armed;  // Will the watcher tell us when it is readable?
+    bool hung;   // Hung up so there is no point waiting on it anymore.
+    bool always_ready;  // Can't be waited on (ex. a regular file).
+};
+
+struct Event_Loop {
+    Event_Loop_Watcher* watcher;
+
+    /// The files registered with the watcher.
+    cz::Vector<Event_Loop_File> files;
+
+    /// What the current frame is waiting on.
+    cz::Vector<int> watching;
+    bool busy;
+    bool has_deadline;
+    std::chrono::steady_clock::time_point deadline;
+
+    /// When the current frame started (`SDL_GetTicks`).
+    uint32_t frame_start;
+
+    /// Statistics.
+    uint64_t wakeups;
+    uint64_t idle_waits;
+};
+
+bool init_event_loop(Event_Loop* loop);
+void drop_event_loop(Event_Loop* loop);
+
+/// Wake up when `file` has data to read or is closed.
+void event_loop_watch(Event_Loop* loop, cz::Input_File file);
+
+/// Wake up at or after `time`.
+void event_loop_wake_at(Event_Loop* loop, std::chrono::steady_clock::time_point time);
+
+/// Don't go to sleep because there is more work to do.
+void event_loop_mark_busy(Event_Loop* loop);
+
+/// Wake up the main thread.  Safe to call from any thread.
+void event_loop_wake_from_thread();
+
+/// Finish the frame: sleep until there is something to do, then start the next frame.
+/// Busy frames and frames that were woken by files are capped to 60fps.
+void event_loop_wait(Event_Loop* loop);
@@ -0,0 +1,171 @@
+#include "glyph_atlas.hpp"
+
+#include <string.h>
+#include <cz/heap.hpp>
+#include <tracy/Tracy.hpp>
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - hash table
+///////////////////////////////////////////////////////////////////////////////
+
+#define NO_SLOT ((uint32_t)-1)
+
+static size_t hash_key(uint64_t key, size_t table_len) {
+    // Fibonacci hashing.  `table_len` is a power of two.
+    return (size_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & (table_len - 1);
+}
+
+/// Find the table index that holds `key` or the empty index where it would go.
+static size_t probe(Glyph_Atlas* atlas, uint64_t key) {
+    size_t mask = atlas->table.len - 1;
+    size_t index = hash_key(key, atlas->table.len);
+    while (atlas->table[index] != 0) {
+        if (atlas->slots[atlas->table[index] - 1].key == key)
+            break;
+        index = (index + 1) & mask;
+    }
+    return index;
+}
+
+/// Remove the entry at `index` by shifting back the entries after it (linear probing).
+static void table_remove(Glyph_Atlas* atlas, size_t index) {
+    size_t mask = atlas->table.len - 1;
+    size_t hole = index;
+    for (size_t next = (hole + 1) & mask; atlas->table[next] != 0; next = (next + 1) & mask) {
+        size_t home = hash_key(atlas->slots[atlas->table[next] - 1].key, atlas->table.len);
+        // Move the entry into the hole if the hole is between its home and its current position.
+        bool movable = (hole <= next ? (home <= hole || home > next) : (home <= hole && home > next));
+        if (movable) {
+            atlas->table[hole] = atlas->table[next];
+            hole = next;
+        }
+    }
+    atlas->table[hole] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - LRU list
+///////////////////////////////////////////////////////////////////////////////
+
+static void lru_unlink(Glyph_Atlas* atlas, uint32_t index) {
+    Glyph_Atlas_Slot* slot = &atlas->slots[index];
+    if (slot->prev != NO_SLOT)
+        atlas->slots[slot->prev].next = slot->next;
+    else
+        atlas->most_recent = slot->next;
+    if (slot->next != NO_SLOT)
+        atlas->slots[slot->next].prev = slot->prev;
+    else
+        atlas->least_recent = slot->prev;
+}
+
+static void lru_push_front(Glyph_Atlas* atlas, uint32_t index) {
+    Glyph_Atlas_Slot* slot = &atlas->slots[index];
+    slot->prev = NO_SLOT;
+    slot->next = atlas->most_recent;
+    if (atlas->most_recent != NO_SLOT)
+        atlas->slots[atlas->most_recent].prev = index;
+    else
+        atlas->least_recent = index;
+    atlas->most_recent = index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code
+///////////////////////////////////////////////////////////////////////////////
+
+void glyph_atlas_init(Glyph_Atlas* atlas, int width, int height, size_t max_bytes) {
+    *atlas = {};
+    atlas->width = width;
+    atlas->height = height;
+    size_t slot_bytes = cz::max((size_t)width * height, (size_t)1);
+    atlas->max_slots = cz::max(max_bytes / slot_bytes, (size_t)1);
+    atlas->most_recent = NO_SLOT;
+    atlas->least_recent = NO_SLOT;
+}
+
+static size_t page_bytes(Glyph_Atlas* atlas) {
+    return (size_t)atlas->width * atlas->height * GLYPH_ATLAS_PAGE_SLOTS;
+}
+
+static uint8_t* slot_mask(Glyph_Atlas* atlas, uint32_t index) {
+    uint8_t* page = atlas->pages[index / GLYPH_ATLAS_PAGE_SLOTS];
+    return page + (size_t)(index % GLYPH_ATLAS_PAGE_SLOTS) * atlas->width * atlas->height;
+}
+
+void glyph_atlas_drop(Glyph_Atlas* atlas) {
+    for (size_t i = 0; i < atlas->pages.len; ++i) {
+        cz::heap_allocator().dealloc({atlas->pages[i], page_bytes(atlas)});
+    }
+    atlas->pages.drop(cz::heap_allocator());
+    atlas->slots.drop(cz::heap_allocator());
+    atlas->table.drop(cz::heap_allocator());
+}
+
+uint64_t glyph_atlas_key(uint32_t code_point, int style) {
+    return ((uint64_t)style << 32) | code_point;
+}
+
+const uint8_t* glyph_atlas_find(Glyph_Atlas* atlas, uint64_t key) {
+    if (atlas->table.len > 0) {
+        uint32_t entry = atlas->table[probe(atlas, key)];
+        if (entry != 0) {
+            uint32_t index = entry - 1;
+            if (atlas->most_recent != index) {
+                lru_unlink(atlas, index);
+                lru_push_front(atlas, index);
+            }
+            ++atlas->hits;
+            return slot_mask(atlas, index);
+        }
+    }
+    ++atlas->misses;
+    return nullptr;
+}
+
+static void grow_table(Glyph_Atlas* atlas) {
+    size_t new_len = cz::max(atlas->table.len * 2, (size_t)64);
+    atlas->table.drop(cz::heap_allocator());
+    atlas->table.reserve_exact(cz::heap_allocator(), new_len);
+    atlas->table.len = new_len;
+    memset(atlas->table.elems, 0, new_len * sizeof(uint32_t));
+
+    for (size_t i = 0; i < atlas->slots.len; ++i) {
+        atlas->table[probe(atlas, atlas->slots[i].key)] = (uint32_t)(i + 1);
+    }
+}
+
+uint8_t* glyph_atlas_insert(Glyph_Atlas* atlas, uint64_t key) {
+    uint32_t index;
+    if (atlas->slots.len < atlas->max_slots) {
+        // Keep the load factor at most one half.
+        if ((atlas->slots.len + 1) * 2 > atlas->table.len)
+            grow_table(atlas);
+
+        index = (uint32_t)atlas->slots.len;
+        atlas->slots.reserve(cz::heap_allocator(), 1);
+        atlas->slots.push({key, NO_SLOT, NO_SLOT});
+
+        if (index % GLYPH_ATLAS_PAGE_SLOTS == 0) {
+            uint8_t* page = (uint8_t*)cz::heap_allocator().alloc({page_bytes(atlas), 1});
+            CZ_ASSERT(page);
+            atlas->pages.reserve(cz::heap_allocator(), 1);
+            atlas->pages.push(page);
+        }
+    } else {
+        // Evict the least recently used glyph.
+        index = atlas->least_recent;
+        lru_unlink(atlas, index);
+        table_remove(atlas, probe(atlas, atlas->slots[index].key));
+        atlas->slots[index].key = key;
+        ++atlas->evictions;
+    }
+
+    size_t entry = probe(atlas, key);
+    CZ_DEBUG_ASSERT(atlas->table[entry] == 0);
+    atlas->table[entry] = index + 1;
+    lru_push_front(atlas, index);
+
+    TracyPlot("glyph_atlas_slots", (int64_t)atlas->slots.len);
+    return slot_mask(atlas, index);
+}
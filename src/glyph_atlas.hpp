@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <cz/vector.hpp>
+
+/// Cache of rasterized glyphs shared by every color.  Glyphs are stored as
+/// 8 bit coverage masks and the color is applied when they are drawn.
+///
+/// Every glyph gets a fixed size slot of `width * height` bytes (one cell).
+/// Once `max_slots` glyphs are stored the least recently used one is evicted.
+
+struct Glyph_Atlas_Slot {
+    uint64_t key;
+    uint32_t prev;  // Towards the most recently used slot.
+    uint32_t next;  // Towards the least recently used slot.
+};
+
+struct Glyph_Atlas {
+    int width;
+    int height;
+    size_t max_slots;
+
+    cz::Vector<uint8_t*> pages;  // Masks for `GLYPH_ATLAS_PAGE_SLOTS` slots each.
+    cz::Vector<Glyph_Atlas_Slot> slots;
+    cz::Vector<uint32_t> table;  // Open addressing.  Slot index + 1 or 0 if empty.
+    uint32_t most_recent;
+    uint32_t least_recent;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+/// Default memory cap for the masks.
+#define GLYPH_ATLAS_MAX_BYTES ((size_t)16 << 20)
+
+/// Masks are allocated in pages so they never move.
+#define GLYPH_ATLAS_PAGE_SLOTS 256
+
+void glyph_atlas_init(Glyph_Atlas* atlas, int width, int height, size_t max_bytes);
+void glyph_atlas_drop(Glyph_Atlas* atlas);
+
+uint64_t glyph_atlas_key(uint32_t code_point, int style);
+
+/// Find the mask for `key` and mark it as recently used.  Returns `nullptr` if it isn't cached.
+/// The mask stays valid until it is evicted.
+const uint8_t* glyph_atlas_find(Glyph_Atlas* atlas, uint64_t key);
+
+/// Add a glyph, evicting the least recently used one if the atlas is full.
+/// Returns the mask for the caller to fill in.  `key` must not already be cached.
+uint8_t* glyph_atlas_insert(Glyph_Atlas* atlas, uint64_t key);
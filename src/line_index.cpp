@@ -0,0 +1,116 @@
+#include "line_index.hpp"
+
+#include <cz/heap.hpp>
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Configuration
+///////////////////////////////////////////////////////////////////////////////
+
+#define BLOCK_OF(position) ((position) >> LINE_INDEX_BLOCK_SHIFT)
+#define OFFSET_OF(position) ((position) & (LINE_INDEX_BLOCK_SIZE - 1))
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code
+///////////////////////////////////////////////////////////////////////////////
+
+void Line_Index::drop() {
+    block_starts.drop(cz::heap_allocator());
+    offsets.drop(cz::heap_allocator());
+}
+
+uint64_t Line_Index::get(size_t i) const {
+    CZ_DEBUG_ASSERT(i < offsets.len);
+
+    // Find the last block that starts at or before `i`.  Empty blocks start at the
+    // same index as the block after them so this skips over them.
+    size_t start = 0;
+    size_t end = block_starts.len;
+    while (end - start > 1) {
+        size_t mid = start + (end - start) / 2;
+        if (block_starts[mid] <= i)
+            start = mid;
+        else
+            end = mid;
+    }
+
+    return ((first_block + start) << LINE_INDEX_BLOCK_SHIFT) + offsets[i];
+}
+
+size_t Line_Index::upper_bound(uint64_t position) const {
+    if (block_starts.len == 0)
+        return 0;
+
+    uint64_t block = BLOCK_OF(position);
+    if (block < first_block)
+        return 0;
+    if (block - first_block >= block_starts.len)
+        return offsets.len;
+
+    // The block is found directly so only its offsets are searched.
+    size_t outer = block - first_block;
+    size_t start = block_starts[outer];
+    size_t end = (outer + 1 < block_starts.len ? block_starts[outer + 1] : offsets.len);
+    uint16_t offset = (uint16_t)OFFSET_OF(position);
+    while (start < end) {
+        size_t mid = start + (end - start) / 2;
+        if (offsets[mid] <= offset)
+            start = mid + 1;
+        else
+            end = mid;
+    }
+    return start;
+}
+
+void Line_Index::push(uint64_t start) {
+    uint64_t block = BLOCK_OF(start);
+    if (block_starts.len == 0)
+        first_block = block;
+    CZ_DEBUG_ASSERT(block - first_block + 1 >= block_starts.len);
+    CZ_DEBUG_ASSERT(block - first_block + 1 > block_starts.len ||
+                    block_starts.last() == offsets.len ||
+                    OFFSET_OF(start) > offsets.last());
+    if (block - first_block >= block_starts.len) {
+        size_t extra = block - first_block + 1 - block_starts.len;
+        block_starts.reserve(cz::heap_allocator(), extra);
+        for (size_t i = 0; i < extra; ++i)
+            block_starts.push(offsets.len);
+    }
+
+    offsets.reserve(cz::heap_allocator(), 1);
+    offsets.push((uint16_t)OFFSET_OF(start));
+}
+
+void Line_Index::pop() {
+    offsets.pop();
+
+    // Remove the blocks that are now empty so an earlier block can be pushed to.
+    while (block_starts.len > 0 && block_starts.last() >= offsets.len)
+        block_starts.pop();
+}
+
+void Line_Index::remove_front(size_t n) {
+    CZ_DEBUG_ASSERT(n <= offsets.len);
+    if (n == 0)
+        return;
+    if (n == offsets.len) {
+        offsets.len = 0;
+        block_starts.len = 0;
+        return;
+    }
+
+    offsets.remove_range(0, n);
+
+    // Drop the blocks whose line starts were all removed.
+    size_t dropped = 0;
+    while (dropped + 1 < block_starts.len && block_starts[dropped + 1] <= n)
+        ++dropped;
+    block_starts.remove_range(0, dropped);
+    first_block += dropped;
+
+    for (size_t i = 0; i < block_starts.len; ++i)
+        block_starts[i] = (block_starts[i] > n ? block_starts[i] - n : 0);
+}
+
+size_t Line_Index::memory_usage() const {
+    return block_starts.cap * sizeof(block_starts[0]) + offsets.cap * sizeof(offsets[0]);
+}
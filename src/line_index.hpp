@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cz/vector.hpp>
+
+/// Sorted set of line starts stored as a two-level index.  Positions are split into
+/// blocks of `LINE_INDEX_BLOCK_SIZE` bytes.  Each line start is stored as a 16 bit
+/// offset into its block and each block stores where its line starts begin.  This
+/// costs 2 bytes per line plus 8 bytes per 64 KiB instead of 8 bytes per line.
+///
+/// Line starts must be pushed in increasing order.
+
+#define LINE_INDEX_BLOCK_SHIFT 16
+#define LINE_INDEX_BLOCK_SIZE ((uint64_t)1 << LINE_INDEX_BLOCK_SHIFT)
+
+struct Line_Index {
+    uint64_t first_block;  // Block number of `block_starts[0]`.
+    /// For each block from `first_block` to the block of the last line start, the
+    /// index in `offsets` of its first line start.  Empty blocks are included.
+    cz::Vector<uint64_t> block_starts;
+    cz::Vector<uint16_t> offsets;  // Line starts relative to their block.
+
+    void drop();
+
+    size_t count() const { return offsets.len; }
+
+    /// Get the `i`th line start.
+    uint64_t get(size_t i) const;
+    uint64_t last() const { return get(offsets.len - 1); }
+
+    /// Index of the first line start after `position`.  So
+    /// `upper_bound(position) - 1` is the line containing `position`.
+    size_t upper_bound(uint64_t position) const;
+
+    /// Add a line start.  Must be after `last()`.
+    void push(uint64_t start);
+    /// Remove the last line start.
+    void pop();
+    /// Remove the first `n` line starts.
+    void remove_front(size_t n);
+
+    /// Bytes allocated by the index.
+    size_t memory_usage() const;
+};
@@ -4,7 +4,6 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <cz/binary_search.hpp>
 #include <cz/date.hpp>
 #include <cz/dedup.hpp>
 #include <cz/defer.hpp>
@@ -31,6 +30,10 @@
 #endif
 
 #include "backlog.hpp"
+#include "backlog_compress.hpp"
+#include "backlog_index.hpp"
+#include "backlog_search.hpp"
+#include "backlog_spill.hpp"
 #include "config.hpp"
 #include "global.hpp"
 #include "prompt.hpp"
@@ -157,17 +160,11 @@ static void render_frame(Tesh_State* tesh) {
         if (rend->attached_outer != -1)
             ensure_prompt_on_screen(rend);
 
-        // TODO remove this
-        rend->complete_redraw = true;
-
         ////////////////////////////////////////////////////
 
-        if (rend->complete_redraw) {
-            ZoneScopedN("draw_background");
-            SDL_FillRect(window_surface, &grid_rect,
-                         SDL_MapRGB(window_surface->format, 0x00, 0x00, 0x00));
-            rend->backlog_end = rend->backlog_start;
-        }
+        // The whole pane is composed every frame but only the rows that changed are drawn.
+        begin_frame(window_surface, grid_rect, rend);
+        rend->backlog_end = rend->backlog_start;
 
         if (!rend->grid_is_valid) {
             rend->grid.len = 0;
@@ -179,10 +176,13 @@ static void render_frame(Tesh_State* tesh) {
         memset(rend->grid.elems, 0, sizeof(Visual_Tile) * rend->grid.len);
         rend->selection.bg_color = SDL_MapRGB(window_surface->format, cfg.selection_bg_color.r,
                                               cfg.selection_bg_color.g, cfg.selection_bg_color.b);
+        rend->search_bg_color = SDL_MapRGB(window_surface->format, cfg.search_bg_color.r,
+                                           cfg.search_bg_color.g, cfg.search_bg_color.b);
 
+        Search_State* search = (pane->search.is_searching ? &pane->search : nullptr);
         for (size_t i = rend->backlog_start.outer; i < rend->visbacklogs.len; ++i) {
             if (!render_backlog(window_surface, grid_rect, rend, shell, &pane->command_prompt,
-                                pane->backlogs, now, rend->visbacklogs[i], i)) {
+                                pane->backlogs, now, rend->visbacklogs[i], i, search)) {
                 break;
             }
         }
@@ -193,16 +193,18 @@ static void render_frame(Tesh_State* tesh) {
         }
 
         if (pane->search.is_searching) {
+            // Pick up the matches in new output.
+            search_refresh(&pane->search, rend->visbacklogs, pane->search.prompt.text);
             render_prompt(window_surface, grid_rect, rend, &pane->command_prompt, &pane->search,
                           pane->backlogs, shell);
         }
 
-        rend->complete_redraw = false;
+        draw_frame(window_surface, grid_rect, rend, &updated_rects);
 
-        updated_rects.push(grid_rect);
+        rend->complete_redraw = false;
     }
 
-    {
+    if (updated_rects.len > 0) {
         ZoneScopedN("update_window_surface");
         SDL_UpdateWindowSurfaceRects(tesh->window.sdl, updated_rects.elems, (int)updated_rects.len);
     }
@@ -254,14 +256,35 @@ bool read_process_data(Tesh_State* tesh,
             // Wait for one second after the process ends so the pipes flush.
             using namespace std::chrono;
             steady_clock::duration elapsed = (steady_clock::now() - backlog->end);
-            if (duration_cast<milliseconds>(elapsed).count() >= 1000) {
+            // A paused backlog holds on to its output until it is resumed.  A full
+            // one will never read the rest so it is dropped like before.
+            Backlog_Flow flow = backlog_flow(backlog);
+            bool unparsed = (flow == BACKLOG_FLOW_PAUSED ||
+                             (flow == BACKLOG_FLOW_READING && script->tty.reader &&
+                              tty_reader_has_output(script->tty.reader)));
+            if (duration_cast<milliseconds>(elapsed).count() >= 1000 && !unparsed) {
                 recycle_process(shell, script);
                 finish_hyperlink(backlog);
                 backlog_dec_refcount(backlogs, backlog);
 
                 changes = true;
                 --i;
+                continue;
             }
+            if (flow != BACKLOG_FLOW_PAUSED)
+                event_loop_wake_at(&tesh->loop, backlog->end + seconds(1));
+        }
+
+        // Wake up when the script outputs something.  The reader thread wakes us up itself.
+        // Blocked backlogs don't read so watching them would wake us up constantly.
+        if (!script->tty.reader && backlog_flow(backlog) == BACKLOG_FLOW_READING) {
+#ifdef _WIN32
+            cz::Input_File tty_out = script->tty.out;
+#else
+            cz::Input_File tty_out;
+            tty_out.handle = script->tty.parent_bi;
+#endif
+            event_loop_watch(&tesh->loop, tty_out);
         }
 
         if (backlog->length != starting_length)
@@ -279,22 +302,25 @@ static void scroll_down1(Render_State* rend, int lines) {
     if (start->outer < rend->visbacklogs.len) {
         int desired_y = start->y + lines;
         Backlog_State* backlog = rend->visbacklogs[start->outer];
+        update_wrap_index(backlog, rend->grid_cols);
         uint64_t end = render_length(backlog);
         while (1) {
             if (start->inner >= end) {
-                if (start->inner == end && end > 0 && backlog->get(end - 1) != '\n') {
-                    coord_trans(start, rend->grid_cols, '\n');
+                if (start->inner == end && end > backlog->discarded &&
+                    backlog->get(end - 1) != '\n') {
+                    coord_trans(start, rend->grid_cols, '\n', 1);
                     if (start->y >= desired_y)
                         break;
                 }
 
-                coord_trans(start, rend->grid_cols, '\n');
+                coord_trans(start, rend->grid_cols, '\n', 1);
 
                 start->outer++;
                 start->inner = 0;
                 if (start->outer == rend->visbacklogs.len)
                     break;
                 backlog = rend->visbacklogs[start->outer];
+                update_wrap_index(backlog, rend->grid_cols);
                 end = render_length(backlog);
 
                 if (start->y >= desired_y)
@@ -302,21 +328,20 @@ static void scroll_down1(Render_State* rend, int lines) {
                 continue;
             }
 
-            Visual_Point sp = *start;
-
-            char seq[5] = {backlog->get(start->inner)};
-            make_backlog_code_point(seq, backlog, start->inner);
-            coord_trans(start, rend->grid_cols, seq[0]);
-            start->inner += strlen(seq) - 1;
+            // Jump to the start of the next visual row.
+            uint64_t row_start, column;
+            if (!find_next_visual_row(backlog, start->inner, end, &row_start, &column)) {
+                // The rest of the backlog fits on this row.
+                start->inner = end;
+                continue;
+            }
 
-            if (start->y >= desired_y) {
-                if (start->x > 0) {
-                    *start = sp;
-                    start->y++;
-                    start->x = 0;
-                }
+            start->inner = row_start;
+            start->column = column;
+            start->x = 0;
+            start->y++;
+            if (start->y >= desired_y)
                 break;
-            }
         }
     }
 }
@@ -326,8 +351,6 @@ static void scroll_down(Render_State* rend, int lines) {
 }
 
 static void scroll_up(Render_State* rend, int lines) {
-    uint64_t* visual_line_starts = temp_allocator.alloc<uint64_t>(lines);
-
     Visual_Point* point = &rend->backlog_start;
 
     // If the prompt is at the top of the screen then reset the
@@ -339,88 +362,60 @@ static void scroll_up(Render_State* rend, int lines) {
         Backlog_State* backlog = rend->visbacklogs[point->outer];
         uint64_t end = render_length(backlog);
         point->inner = end + 1;
-        if (end > 0 && backlog->get(end - 1) != '\n')
+        if (end > backlog->discarded && backlog->get(end - 1) != '\n')
             point->inner++;
     }
 
     while (1) {
         Backlog_State* backlog = rend->visbacklogs[point->outer];
         uint64_t end = render_length(backlog);
-        uint64_t cursor = point->inner;
+        uint64_t cursor = cz::max(point->inner, backlog->discarded);
+        uint64_t column = 0;
 
         // Deal with fake newline and spacer newline.
-        if (lines > 0 && cursor >= end && end > 0) {
+        if (lines > 0 && cursor >= end && end > backlog->discarded) {
             if (cursor > 0)
                 --cursor;
-            while (lines > 0 && cursor >= end && end > 0) {
+            while (lines > 0 && cursor >= end && end > backlog->discarded) {
                 cursor--;
                 lines--;
             }
             cursor++;
 
             // Fake newlines get double counted above so undo that.
-            if (cursor == end && end > 0 && backlog->get(end - 1) != '\n')
+            if (cursor == end && end > backlog->discarded && backlog->get(end - 1) != '\n')
                 lines++;
         }
 
         // Deal with actual buffer contents.
-        while (lines > 0 && cursor > 0 && end > 0) {
+        if (lines > 0 && cursor > backlog->discarded && end > backlog->discarded)
+            update_wrap_index(backlog, rend->grid_cols);
+        while (lines > 0 && cursor > backlog->discarded && end > backlog->discarded) {
             // Find start of physical line.
-            size_t line_index;
-            if (cz::binary_search(backlog->lines.as_slice(), cursor - 1, &line_index))
-                ++line_index;  // Go after the match.
-            uint64_t line_start = (line_index == 0 ? 0 : backlog->lines[line_index - 1]);
-
-            size_t vlsi = 0;
-            int visual_line_count = 0;
-            {
-                // First visual line start is at the physical line start.
-                visual_line_starts[vlsi++] = line_start;
-                if (vlsi == lines)
-                    vlsi = 0;
-                visual_line_count++;
-            }
-
-            // The following algorithm has an off by one error
-            // if we start in the middle of a physical line.
-            if (cursor > line_start)
-                --cursor;
+            size_t line_index = backlog->lines.upper_bound(cursor - 1);
+            uint64_t line_start =
+                (line_index == 0 ? backlog->discarded : backlog->lines.get(line_index - 1));
 
-            uint64_t visual_column = 0;
-            uint64_t actual_column = 0;
-            for (uint64_t iter = line_start;;) {
-                // Advance to next character.
-                char seq[5] = {backlog->get(iter)};
-                iter += make_backlog_code_point(seq, backlog, iter);
-                if (iter >= cursor)
-                    break;
-
-                // Advance columns.
-                uint64_t delta = 1;
-                if (seq[0] == '\t') {
-                    delta = cfg.tab_width - (actual_column % cfg.tab_width);
-                }
-                visual_column += delta;
-                actual_column += delta;
-
-                // If trip line boundary then record it.
-                if (visual_column >= rend->grid_cols) {
-                    visual_column -= rend->grid_cols;
-                    visual_line_starts[vlsi++] = iter;
-                    if (vlsi == lines)
-                        vlsi = 0;
-                    visual_line_count++;
-                }
-            }
+            // Count the visual rows in this physical line that start before the cursor.
+            size_t first_wrap = wrap_index_lower_bound(backlog, line_start + 1);
+            size_t cursor_wrap = wrap_index_lower_bound(backlog, cursor);
+            int visual_line_count = (int)(cursor_wrap - first_wrap) + 1;
 
             if (lines <= visual_line_count) {
-                cursor = visual_line_starts[vlsi];
+                size_t row = visual_line_count - lines;
+                if (row == 0) {
+                    cursor = line_start;
+                } else {
+                    Backlog_Wrap_Point wrap = backlog->wrap_index.points[first_wrap + row - 1];
+                    cursor = wrap.index;
+                    column = wrap.column;
+                }
                 lines = 0;
                 break;
             }
             lines -= visual_line_count;
 
-            if (line_start == 0)
+            if (line_start == backlog->discarded)
                 break;
 
             cursor = line_start;  // put cursor after the '\n'
@@ -428,7 +423,7 @@ static void scroll_up(Render_State* rend, int lines) {
 
         if (lines == 0) {
             point->inner = cursor;
-            // TODO set column
+            point->column = column;
             break;
         }
 
@@ -438,7 +433,7 @@ static void scroll_up(Render_State* rend, int lines) {
         backlog = rend->visbacklogs[point->outer];
         end = render_length(backlog);
         point->inner = end + 1;
-        if (end > 0 && backlog->get(end - 1) != '\n')
+        if (end > backlog->discarded && backlog->get(end - 1) != '\n')
             point->inner++;
     }
 
@@ -447,6 +442,17 @@ static void scroll_up(Render_State* rend, int lines) {
 }
 
 void clear_screen(Render_State* rend, Shell_State* shell, Prompt_State* prompt, bool in_script) {
+    // The old output is out of sight so resume reading running processes.
+    // Full backlogs start dropping their oldest output to make room.
+    for (size_t i = 0; i < rend->visbacklogs.len; ++i) {
+        Backlog_State* backlog = rend->visbacklogs[i];
+        if (backlog->done)
+            continue;
+        backlog->paused = false;
+        if (backlog_flow(backlog) == BACKLOG_FLOW_FULL)
+            backlog_enable_ring_retention(backlog);
+    }
+
     rend->backlog_start = {};
     rend->backlog_start.outer = rend->visbacklogs.len;
     if (in_script)
@@ -1131,22 +1137,20 @@ static bool handle_prompt_manipulation_commands(Shell_State* shell,
         run_paste(prompt);
     } else if (mod == (KMOD_CTRL | KMOD_SHIFT) && key == SDLK_d) {
         // _d_uplicate the selected line's prompt and paste it at the cursor.
-        if (rend->selected_outer != -1) {
+        // The prompt is gone if ring retention dropped the start of the backlog.
+        if (rend->selected_outer != -1 &&
+            rend->visbacklogs[rend->selected_outer]->discarded == 0) {
             Backlog_State* backlog = rend->visbacklogs[rend->selected_outer];
             // @PromptBacklogEventIndex
-            Backlog_Event* start = &backlog->events[2];
-            Backlog_Event* end = &backlog->events[3];
-            CZ_DEBUG_ASSERT(start->type == BACKLOG_EVENT_START_INPUT);
-            CZ_DEBUG_ASSERT(end->type == BACKLOG_EVENT_START_PROCESS);
+            CZ_DEBUG_ASSERT(backlog->events[2].type == BACKLOG_EVENT_START_INPUT);
+            CZ_DEBUG_ASSERT(backlog->events[3].type == BACKLOG_EVENT_START_PROCESS);
+            uint64_t start = backlog_event_index(backlog, 2);
+            uint64_t end = backlog_event_index(backlog, 3);
 
             // Copy the entire thing to a separate string for simplicity reasons.
-            // TODO: copy pieces out of the backlog at a time without temporary allocations.
             cz::String string = {};
             CZ_DEFER(string.drop(cz::heap_allocator()));
-            string.reserve_exact(cz::heap_allocator(), end->index - start->index);
-            for (uint64_t i = start->index; i < end->index; ++i) {
-                string.push(backlog->get(i));
-            }
+            backlog_append_range(backlog, start, end, cz::heap_allocator(), &string);
 
             insert_before(prompt, prompt->cursor, string);
         }
@@ -1345,6 +1349,10 @@ static bool handle_scroll_commands(Shell_State* shell,
         // Goto end of selected process.
         scroll_to_end_of_selected_process(rend, rend->selected_outer);
         scroll_mode = AUTO_SCROLL;
+
+        // Following the output again resumes reading it.
+        if (rend->selected_outer != -1)
+            rend->visbacklogs[rend->selected_outer]->paused = false;
     } else if (mod == (KMOD_CTRL | KMOD_ALT) && key == SDLK_b) {
         if (rend->scroll_mode == MANUAL_SCROLL &&
             !is_selected_backlog_on_screen(rend, rend->selected_outer)) {
@@ -1451,11 +1459,8 @@ static bool handle_scroll_commands(Shell_State* shell,
 }
 
 static void push_backlog_event(Backlog_State* backlog, Backlog_Event_Type event_type) {
-    Backlog_Event event = {};
-    event.index = backlog->length;
-    event.type = event_type;
-    backlog->events.reserve(cz::heap_allocator(), 1);
-    backlog->events.push(event);
+    backlog_flush(backlog);
+    backlog_push_event(backlog, backlog->length, event_type, 0);
 }
 
 static void finish_hyperlink(Backlog_State* backlog) {
@@ -1490,19 +1495,16 @@ static void set_clipboard_contents_to_selection(Render_State* rend,
         if (outer - 1 < rend->visbacklogs.len) {
             Backlog_State* backlog = rend->visbacklogs.get(outer - 1);
 
-            size_t inner_start = 0;
+            size_t inner_start = backlog->discarded;
             size_t inner_end = backlog->length;
             if (outer == rend->selection.start.outer)
-                inner_start = rend->selection.start.inner;
+                inner_start = cz::max(rend->selection.start.inner, backlog->discarded);
             if (outer == rend->selection.end.outer)
-                inner_end = rend->selection.end.inner;
+                inner_end = cz::max(rend->selection.end.inner, inner_start);
 
             clip.reserve(temp_allocator, inner_end - inner_start + 2);
-
-            // TODO: make this append a bucket at a time
-            for (size_t inner = inner_start; inner < inner_end; ++inner) {
-                clip.push(backlog->get(inner));
-            }
+            backlog_append_range(backlog, inner_start, cz::min(inner_end, (size_t)backlog->length),
+                                 temp_allocator, &clip);
 
             if (inner_end >= backlog->length) {
                 clip.reserve(temp_allocator, inner_end + 1 - backlog->length + 1);
@@ -1585,7 +1587,7 @@ static void expand_selection(Render_State* rend, Shell_State* shell, Prompt_Stat
 
             // Skip until we find a different category.
             int category = -1;
-            while (*inner > 0) {
+            while (*inner > backlog->discarded) {
                 char ch = backlog->get(*inner - 1);
                 if (ch == '\n') {
                     if (category == -1)
@@ -1670,10 +1672,12 @@ static void expand_selection(Render_State* rend, Shell_State* shell, Prompt_Stat
         uint64_t* inner = &selection->start.inner;
         if (selection->start.outer - 1 < rend->visbacklogs.len) {
             Backlog_State* backlog = rend->visbacklogs[selection->start.outer - 1];
-            while (*inner > 0) {
-                if (backlog->get(*inner - 1) == '\n')
-                    break;
-                --*inner;
+            uint64_t newline;
+            if (*inner > backlog->discarded &&
+                backlog_rfind(backlog, backlog->discarded, *inner, '\n', &newline)) {
+                *inner = newline + 1;
+            } else {
+                *inner = cz::min(*inner, backlog->discarded);
             }
         } else {
             while (*inner > 0) {
@@ -1687,10 +1691,9 @@ static void expand_selection(Render_State* rend, Shell_State* shell, Prompt_Stat
         inner = &selection->end.inner;
         if (selection->end.outer - 1 < rend->visbacklogs.len) {
             Backlog_State* backlog = rend->visbacklogs[selection->end.outer - 1];
-            while (*inner < backlog->length) {
-                if (backlog->get(*inner) == '\n')
-                    break;
-                ++*inner;
+            if (*inner < backlog->length &&
+                !backlog_find(backlog, *inner, backlog->length, '\n', inner)) {
+                *inner = backlog->length;
             }
         } else {
             while (*inner < prompt_buffer.len) {
@@ -1730,6 +1733,17 @@ static void expand_selection_to(Render_State* rend,
     rend->complete_redraw = true;
 }
 
+/// Get the start of the output of the process.  If ring retention
+/// dropped it then get the start of the oldest output that is left.
+static uint64_t process_output_start(Backlog_State* backlog) {
+    if (backlog->discarded > 0)
+        return backlog->discarded;
+
+    // @PromptBacklogEventIndex
+    CZ_DEBUG_ASSERT(backlog->events[3].type == BACKLOG_EVENT_START_PROCESS);
+    return std::min(backlog_event_index(backlog, 3) + 1, backlog->length);
+}
+
 static bool write_selected_backlog_to_file(Shell_State* shell,
                                            Prompt_State* prompt,
                                            Render_State* rend,
@@ -1742,33 +1756,17 @@ static bool write_selected_backlog_to_file(Shell_State* shell,
     if (rend->selected_outer != -1) {
         Backlog_State* backlog = rend->visbacklogs[rend->selected_outer];
 
-        // @PromptBacklogEventIndex
-        Backlog_Event* start = &backlog->events[3];
-        CZ_DEBUG_ASSERT(start->type == BACKLOG_EVENT_START_PROCESS);
-
-        uint64_t start_index = start->index + 1;
-
-        uint64_t outer_start = start_index / BACKLOG_BUFFER_SIZE;
-        uint64_t inner_start = start_index % BACKLOG_BUFFER_SIZE;
-        for (uint64_t outer = outer_start; outer + 1 < backlog->buffers.len; ++outer) {
-            cz::Str buffer = {backlog->buffers[outer] + inner_start,
-                              BACKLOG_BUFFER_SIZE - inner_start};
-            int64_t result = file.write(buffer);
-            if (result != buffer.len)
+        uint64_t start_index = process_output_start(backlog);
+        Backlog_Spans spans = backlog_spans(backlog, start_index, backlog->length);
+        cz::Str span;
+        while (spans.next(&span)) {
+            int64_t result = file.write(span);
+            if (result != span.len)
                 return false;
-            inner_start = 0;
         }
 
-        if (outer_start < backlog->buffers.len &&
-            inner_start < backlog->length % BACKLOG_BUFFER_SIZE) {
-            cz::Str buffer = {backlog->buffers.last() + inner_start,
-                              backlog->length % BACKLOG_BUFFER_SIZE - inner_start};
-            int64_t result = file.write(buffer);
-            if (result != buffer.len)
-                return false;
-            if (backlog->get(backlog->length - 1) != '\n')
-                file.write("\n");
-        }
+        if (start_index < backlog->length && backlog->get(backlog->length - 1) != '\n')
+            file.write("\n");
     } else {
         int64_t result = file.write(prompt->text);
         if (result != prompt->text.len)
@@ -1916,52 +1914,133 @@ static int visual_point_compare(const Visual_Point& left, const Visual_Point& ri
     return (int)(left.inner - right.inner);
 }
 
+/// Regex matches aren't recorded so scan the backlogs for the next or previous one.
+/// Sets `*length` to the length of the match that was found.
+static bool find_next_regex_result(Search_State* search,
+                                   Render_State* rend,
+                                   bool is_forward,
+                                   uint64_t* length) {
+    if (!search_update_regex(search, search->prompt.text))
+        return false;
+
+    Regex* regex = &search->regex;
+    uint64_t start, end;
+    if (is_forward) {
+        uint64_t inner = search->inner + 1;
+        for (uint64_t o = search->outer; o < rend->visbacklogs.len; ++o, inner = 0) {
+            Backlog_State* backlog = rend->visbacklogs[o];
+            if (regex_search_forward(regex, backlog, cz::max(inner, backlog->discarded),
+                                     backlog->length, &start, &end)) {
+                search->outer = o;
+                search->inner = start;
+                *length = end - start;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint64_t o = search->outer;
+    uint64_t inner = search->inner;
+    if (o == rend->visbacklogs.len) {
+        if (o == 0)
+            return false;
+        o--;
+        inner = rend->visbacklogs[o]->length;
+    }
+
+    while (1) {
+        // Matches have to start before `inner`.
+        Backlog_State* backlog = rend->visbacklogs[o];
+        if (regex_search_backward(regex, backlog, backlog->discarded,
+                                  cz::min(inner, backlog->length), &start, &end)) {
+            search->outer = o;
+            search->inner = start;
+            *length = end - start;
+            return true;
+        }
+
+        if (o == 0)
+            return false;
+        o--;
+        inner = rend->visbacklogs[o]->length;
+    }
+}
+
 static void find_next_search_result(Search_State* search, Render_State* rend, bool is_forward) {
     ZoneScoped;
 
     Prompt_State* prompt = &search->prompt;
     bool found_result = false;
+    uint64_t match_length = prompt->text.len;
 
     search->default_forwards = is_forward;
 
+    if (search->is_regex) {
+        if (prompt->text.len == 0) {
+            set_initial_search_position(search, rend, is_forward);
+            goto finish_search;
+        }
+
+        uint64_t outer = search->outer;
+        uint64_t inner = search->inner;
+        uint64_t length;
+        if (find_next_regex_result(search, rend, is_forward, &length)) {
+            match_length = length;
+            found_result = true;
+        } else if (search->regex_error == nullptr && outer < rend->visbacklogs.len) {
+            // Keep the current result if it still matches.
+            Backlog_State* backlog = rend->visbacklogs[outer];
+            uint64_t start, end;
+            if (inner >= backlog->discarded &&
+                regex_search_forward(&search->regex, backlog, inner,
+                                     cz::min(inner + 1, backlog->length), &start, &end)) {
+                match_length = end - start;
+                found_result = true;
+            }
+        }
+        goto finish_search;
+    }
+
     /////////////////////////////////////////////
     // Test if current result matches.
     /////////////////////////////////////////////
 
     if (search->outer < rend->visbacklogs.len) {
         Backlog_State* backlog = rend->visbacklogs[search->outer];
-        if (search->inner + prompt->text.len <= backlog->length) {
-            uint64_t j = 0;
-            for (; j < prompt->text.len; ++j) {
-                if (backlog->get(search->inner + j) != prompt->text[j])
-                    break;
-            }
-            if (j == prompt->text.len)
-                found_result = true;
-        }
+        if (backlog_matches(backlog, search->inner, prompt->text))
+            found_result = true;
     }
 
     /////////////////////////////////////////////
     // Look for next result.
     /////////////////////////////////////////////
 
+    search_refresh(search, rend->visbacklogs, prompt->text);
+
     if (prompt->text.len > 0) {
+        // Step through the list of matches.  Only scan the backlogs directly
+        // if there were too many matches to record them all.
+        uint64_t outer = search->outer;
+        uint64_t inner = search->inner;
+        if (search_step(search, is_forward, &outer, &inner)) {
+            search->outer = outer;
+            search->inner = inner;
+            found_result = true;
+            goto finish_search;
+        }
+        if (!search->truncated)
+            goto finish_search;
+
         // TODO: if we allow reordering backlogs while searching the search->outer/inner
         // will be invalidated, causing this to access memory out of bounds.
         if (is_forward) {
             uint64_t inner = search->inner + 1;
             for (uint64_t o = search->outer; o < rend->visbacklogs.len; ++o, inner = 0) {
                 Backlog_State* backlog = rend->visbacklogs[o];
-                // TODO: optimize via memchr.
-                for (uint64_t i = inner; i + prompt->text.len < backlog->length; ++i) {
-                    uint64_t j = 0;
-                    for (; j < prompt->text.len; ++j) {
-                        if (backlog->get(i + j) != prompt->text[j])
-                            break;
-                    }
-                    if (j != prompt->text.len)
-                        continue;
-
+                uint64_t i;
+                if (backlog_search_forward(backlog, cz::max(inner, backlog->discarded),
+                                           backlog->length, prompt->text, &i)) {
                     // Found a match.
                     search->outer = o;
                     search->inner = i;
@@ -1972,25 +2051,19 @@ static void find_next_search_result(Search_State* search, Render_State* rend, bo
         } else {
             uint64_t o = search->outer;
             uint64_t inner = search->inner;
-            if (o == rend->visbacklogs.len && o > 0) {
+            if (o == rend->visbacklogs.len) {
+                if (o == 0)
+                    goto finish_search;
                 o--;
                 inner = rend->visbacklogs[o]->length;
             }
 
-            for (; o > 0; o--) {
+            while (1) {
+                // Matches have to start before `inner`.
                 Backlog_State* backlog = rend->visbacklogs[o];
-                // TODO: optimize via memrchr.
-                for (uint64_t i = inner; i-- > 0;) {
-                    if (i + prompt->text.len > backlog->length)
-                        continue;
-                    uint64_t j = 0;
-                    for (; j < prompt->text.len; ++j) {
-                        if (backlog->get(i + j) != prompt->text[j])
-                            break;
-                    }
-                    if (j != prompt->text.len)
-                        continue;
-
+                uint64_t end = cz::min(inner + prompt->text.len - 1, backlog->length);
+                uint64_t i;
+                if (backlog_search_backward(backlog, backlog->discarded, end, prompt->text, &i)) {
                     // Found a match.
                     search->outer = o;
                     search->inner = i;
@@ -1998,6 +2071,9 @@ static void find_next_search_result(Search_State* search, Render_State* rend, bo
                     goto finish_search;
                 }
 
+                if (o == 0)
+                    break;
+                o--;
                 inner = rend->visbacklogs[o]->length;
             }
         }
@@ -2012,7 +2088,9 @@ static void find_next_search_result(Search_State* search, Render_State* rend, bo
 finish_search:
     if (found_result && prompt->text.len > 0) {
         Visual_Tile start = {search->outer + 1, search->inner};
-        Visual_Tile end = {search->outer + 1, search->inner + prompt->text.len - 1};
+        // Empty regex matches still select a character.
+        uint64_t length = cz::max(match_length, (uint64_t)1);
+        Visual_Tile end = {search->outer + 1, search->inner + length - 1};
         rend->selection.type = SELECT_FINISHED;
         rend->selection.down = start;
         rend->selection.current = end;
@@ -2137,13 +2215,17 @@ static int process_events(Tesh_State* tesh) {
             // Search commands
             ///////////////////////////////////////////////////////////////////////
 
-            if ((mod == KMOD_CTRL || mod == KMOD_ALT) && key == SDLK_s) {
-                bool is_forward = (mod == KMOD_ALT);
+            // Shift searches for a regular expression instead.
+            int search_mod = (mod & ~KMOD_SHIFT);
+            if ((search_mod == KMOD_CTRL || search_mod == KMOD_ALT) && key == SDLK_s) {
+                bool is_forward = (search_mod == KMOD_ALT);
 
                 // Start searching if not.
                 if (!search->is_searching) {
                     search->is_searching = true;
+                    search->is_regex = (mod & KMOD_SHIFT);
                     prompt = &search->prompt;
+                    prompt->prefix = (search->is_regex ? "REGEX> " : "SEARCH> ");
                     rend->selection.type = SELECT_DISABLED;
 
                     if (prompt->text.len > 0)
@@ -2343,21 +2425,13 @@ static int process_events(Tesh_State* tesh) {
                 } else {
                     // Copy the selected backlog.
                     Backlog_State* backlog = rend->visbacklogs[rend->selected_outer];
-
-                    // @PromptBacklogEventIndex
-                    Backlog_Event* start = &backlog->events[3];
-                    CZ_DEBUG_ASSERT(start->type == BACKLOG_EVENT_START_PROCESS);
-
-                    uint64_t start_index = std::min(start->index + 1, backlog->length);
+                    uint64_t start_index = process_output_start(backlog);
 
                     cz::String clip = {};
                     CZ_DEFER(clip.drop(cz::heap_allocator()));
                     clip.reserve_exact(cz::heap_allocator(), backlog->length - start_index + 1);
-
-                    // TODO: optimize via appending chunks.
-                    for (uint64_t i = start_index; i < backlog->length; ++i) {
-                        clip.push(backlog->get(i));
-                    }
+                    backlog_append_range(backlog, start_index, backlog->length,
+                                         cz::heap_allocator(), &clip);
                     clip.null_terminate();
 
                     (void)SDL_SetClipboardText(clip.buffer);
@@ -2943,6 +3017,10 @@ static void load_default_configuration() {
 #endif
 
     cfg.max_length = ((uint64_t)1 << 30);  // 1GB
+    cfg.ring_retention = false;
+    cfg.coalesce_progress = true;
+    cfg.memory_budget = ((uint64_t)1 << 30);  // 1GB
+    cfg.index_budget = ((uint64_t)1 << 27);  // 128MB, enough for 1GB of output.
 
     cfg.windows_wide_terminal = false;
     cfg.case_sensitive_completion = false;
@@ -2963,6 +3041,7 @@ static void load_default_configuration() {
     cfg.info_running_fg_color = 201;
     cfg.selection_fg_color = 7;
     cfg.selection_bg_color = {0x66, 0x00, 0x66, 0xff};
+    cfg.search_bg_color = {0x55, 0x44, 0x00, 0xff};
     cfg.selected_completion_fg_color = 201;
 }
 
@@ -3063,6 +3142,10 @@ int actual_main(int argc, char** argv) {
         return 1;
     CZ_DEFER(destroy_window(&tesh.window));
 
+    if (!init_event_loop(&tesh.loop))
+        return 1;
+    CZ_DEFER(drop_event_loop(&tesh.loop));
+
     ////////////////////////////////////////////////////////
     // Create a pane
     ////////////////////////////////////////////////////////
@@ -3076,8 +3159,6 @@ int actual_main(int argc, char** argv) {
     ////////////////////////////////////////////////////////
 
     while (1) {
-        uint32_t start_frame = SDL_GetTicks();
-
         temp_arena.clear();
 
         try {
@@ -3106,32 +3187,36 @@ int actual_main(int argc, char** argv) {
 
             if (redraw)
                 render_frame(&tesh);
-        } catch (cz::PanicReachedException& ex) {
-            fprintf(stderr, "Fatal error: %s\n", ex.what());
-            return 1;
-        }
 
-        bool any_scripts_running = false;
-        for (Pane_State* pane : tesh.panes) {
-            if (pane->shell.scripts.len > 0) {
-                any_scripts_running = true;
-                break;
+            // Index new output for searching.  Compress finished backlogs that aren't
+            // on screen and spill them if we're still using too much memory.
+            for (Pane_State* pane : tesh.panes) {
+                Render_State* rend = &pane->rend;
+                size_t start = cz::min(rend->backlog_start.outer, rend->visbacklogs.len);
+                size_t end = cz::min(rend->backlog_end.outer + 1, rend->visbacklogs.len);
+                cz::Slice<Backlog_State*> visible =
+                    rend->visbacklogs.slice(start, cz::max(start, end));
+                backlog_index_tick(pane->backlogs, cfg.index_budget);
+                backlog_compress_tick(pane->backlogs, visible);
+                backlog_spill_enforce_budget(pane->backlogs, visible, cfg.memory_budget);
             }
-        }
 
-        if (any_scripts_running) {
-            // Keep 60fps while any scripts are running.
-            const uint32_t frame_length = 1000 / 60;
-            uint32_t wanted_end = start_frame + frame_length;
-            uint32_t end_frame = SDL_GetTicks();
-            if (wanted_end > end_frame) {
-                SDL_Delay(wanted_end - end_frame);
+            // Keep the dots and timers of running scripts ticking.
+            for (Pane_State* pane : tesh.panes) {
+                if (pane->rend.info_animating) {
+                    using namespace std::chrono;
+                    event_loop_wake_at(&tesh.loop, steady_clock::now() + milliseconds(250));
+                    break;
+                }
             }
-        } else {
-            // If nothing is running then just wait for the next input event.
-            SDL_WaitEvent(NULL);
+        } catch (cz::PanicReachedException& ex) {
+            fprintf(stderr, "Fatal error: %s\n", ex.what());
+            return 1;
         }
 
+        // Sleep until a script outputs something, a process exits, or there is input.
+        event_loop_wait(&tesh.loop);
+
         FrameMark;
     }
 
@@ -3270,6 +3355,8 @@ static Backlog_State* push_backlog(Shell_State* shell, cz::Vector<Backlog_State*
     *backlog = {};
 
     init_backlog(backlog, backlogs->len, cfg.max_length);
+    backlog->ring_retention = cfg.ring_retention;
+    backlog->coalesce_progress = cfg.coalesce_progress;
 
     backlogs->reserve(cz::heap_allocator(), 1);
     backlogs->push(backlog);
@@ -3282,16 +3369,24 @@ static const char* get_hyperlink_at(Render_State* rend, Visual_Tile tile) {
     if ((SDL_GetModState() & KMOD_CTRL) && tile.outer > 0 &&
         tile.outer - 1 < rend->visbacklogs.len) {
         Backlog_State* backlog = rend->visbacklogs[tile.outer - 1];
-        for (size_t event_index = 0; event_index < backlog->events.len; ++event_index) {
-            Backlog_Event* event = &backlog->events[event_index];
-            if (event->index > tile.inner)
+
+        // Restore the state before the tile then go through the events at the tile.
+        size_t event_index = backlog_events_lower_bound(backlog, tile.inner);
+        Backlog_Event_State state = backlog_event_state_at(backlog, event_index);
+        if (state.hyperlink_event != (uint64_t)-1)
+            hyperlink = backlog->hyperlinks[backlog->events[state.hyperlink_event].payload];
+
+        for (Backlog_Event_Cursor cursor = backlog_event_cursor(backlog, event_index);
+             !cursor.done(); cursor.next()) {
+            Backlog_Event* event = &backlog->events[cursor.event];
+            if (cursor.index > tile.inner)
                 break;
 
             if (event->type == BACKLOG_EVENT_START_HYPERLINK) {
-                hyperlink = (const char*)event->payload;
+                hyperlink = backlog->hyperlinks[event->payload];
             } else if (event->type == BACKLOG_EVENT_END_HYPERLINK) {
                 hyperlink = nullptr;
-                if (event->index == tile.inner)
+                if (cursor.index == tile.inner)
                     break;
             }
         }
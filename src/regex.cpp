@@ -0,0 +1,1432 @@
+#include "regex.hpp"
+
+#include <string.h>
+#include <cz/assert.hpp>
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/sort.hpp>
+#include <cz/util.hpp>
+#include <tracy/Tracy.hpp>
+#include "backlog.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Configuration
+///////////////////////////////////////////////////////////////////////////////
+
+/// Limits that keep a pattern like `(a{1000}){1000}` from using all the memory.
+#define REGEX_MAX_REPEAT 1000
+#define REGEX_MAX_NFA_STATES 100000
+#define REGEX_MAX_DEPTH 1000
+
+/// Bytes of states each DFA can have before its cache is thrown away.
+#define REGEX_DFA_CACHE_SIZE (4 << 20)
+
+/// Walking through the matches on a line rescans up to a block of it per match.
+/// The cache of the line takes 5 bytes per block.
+#define LINE_BLOCK_SIZE 256
+
+#define REGEX_DFA_ACCEPTING 1
+#define REGEX_DFA_DEAD 2
+
+#define NONE ((uint32_t)-1)
+#define NO_POSITION ((uint64_t)-1)
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Data
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+enum Node_Kind {
+    NODE_SET,
+    NODE_CONCAT,
+    NODE_ALTERNATE,
+    NODE_REPEAT,
+};
+
+/// A node of the syntax tree.  Children are linked through `next`.
+struct Node {
+    Node_Kind kind;
+    uint32_t set;
+    uint32_t child;
+    uint32_t next;
+    uint32_t min, max;  // `max` is `NONE` if unbounded.
+};
+
+struct Parser {
+    cz::Str pattern;
+    size_t index;
+    bool fold_case;
+    size_t depth;
+    cz::Vector<Node> nodes;
+    cz::Vector<Regex_Set>* sets;
+    const char* error;
+};
+
+struct Compiler {
+    Regex* regex;
+    cz::Slice<Node> nodes;
+    bool reverse;
+    bool too_big;
+};
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - sets
+///////////////////////////////////////////////////////////////////////////////
+
+static bool set_has(const Regex_Set& set, uint32_t symbol) {
+    return (set.bits[symbol >> 6] >> (symbol & 63)) & 1;
+}
+
+static void set_add(Regex_Set* set, uint32_t symbol) {
+    set->bits[symbol >> 6] |= (uint64_t)1 << (symbol & 63);
+}
+
+static void set_add_range(Regex_Set* set, uint32_t first, uint32_t last) {
+    for (uint32_t symbol = first; symbol <= last; ++symbol)
+        set_add(set, symbol);
+}
+
+/// Invert the bytes in the set.  Newlines are never matched.
+static void set_invert_bytes(Regex_Set* set) {
+    for (size_t i = 0; i < 256 / 64; ++i)
+        set->bits[i] = ~set->bits[i];
+    set->bits['\n' >> 6] &= ~((uint64_t)1 << ('\n' & 63));
+}
+
+static void set_fold_case(Regex_Set* set) {
+    for (uint32_t lower = 'a'; lower <= 'z'; ++lower) {
+        uint32_t upper = lower - 'a' + 'A';
+        if (set_has(*set, lower) || set_has(*set, upper)) {
+            set_add(set, lower);
+            set_add(set, upper);
+        }
+    }
+}
+
+static void set_add_class(Regex_Set* set, char name) {
+    Regex_Set add = {};
+    switch (name | 0x20) {
+    case 'd':
+        set_add_range(&add, '0', '9');
+        break;
+    case 'w':
+        set_add_range(&add, '0', '9');
+        set_add_range(&add, 'a', 'z');
+        set_add_range(&add, 'A', 'Z');
+        set_add(&add, '_');
+        break;
+    case 's':
+        set_add(&add, ' ');
+        set_add_range(&add, '\t', '\r');
+        break;
+    }
+    // Upper case names are the inverse.
+    if (name >= 'A' && name <= 'Z')
+        set_invert_bytes(&add);
+    add.bits['\n' >> 6] &= ~((uint64_t)1 << ('\n' & 63));
+
+    for (size_t i = 0; i < CZ_DIM(set->bits); ++i)
+        set->bits[i] |= add.bits[i];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - parsing
+///////////////////////////////////////////////////////////////////////////////
+
+static uint32_t add_node(Parser* parser, Node_Kind kind) {
+    Node node = {};
+    node.kind = kind;
+    node.set = NONE;
+    node.child = NONE;
+    node.next = NONE;
+    parser->nodes.reserve(cz::heap_allocator(), 1);
+    parser->nodes.push(node);
+    return (uint32_t)(parser->nodes.len - 1);
+}
+
+static uint32_t add_set_node(Parser* parser, Regex_Set set) {
+    uint32_t node = add_node(parser, NODE_SET);
+    parser->nodes[node].set = (uint32_t)parser->sets->len;
+    parser->sets->reserve(cz::heap_allocator(), 1);
+    parser->sets->push(set);
+    return node;
+}
+
+static bool at(Parser* parser, char ch) {
+    return parser->index < parser->pattern.len && parser->pattern[parser->index] == ch;
+}
+
+static int hex_digit(char ch) {
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'f')
+        return (ch | 0x20) - 'a' + 10;
+    return -1;
+}
+
+/// Parse the escape after a `\`.  Classes like `\d` are added to `set` and return -1.
+/// Otherwise returns the byte.
+static int parse_escape(Parser* parser, Regex_Set* set) {
+    if (parser->index >= parser->pattern.len) {
+        parser->error = "Trailing backslash";
+        return -1;
+    }
+
+    char ch = parser->pattern[parser->index++];
+    switch (ch) {
+    case 'd':
+    case 'D':
+    case 'w':
+    case 'W':
+    case 's':
+    case 'S':
+        set_add_class(set, ch);
+        return -1;
+    case 't':
+        return '\t';
+    case 'n':
+        return '\n';
+    case 'r':
+        return '\r';
+    case 'f':
+        return '\f';
+    case 'v':
+        return '\v';
+    case 'x': {
+        int high = -1, low = -1;
+        if (parser->index + 2 <= parser->pattern.len) {
+            high = hex_digit(parser->pattern[parser->index]);
+            low = hex_digit(parser->pattern[parser->index + 1]);
+        }
+        if (high < 0 || low < 0) {
+            parser->error = "Expected two hex digits after \\x";
+            return -1;
+        }
+        parser->index += 2;
+        return high * 16 + low;
+    }
+    }
+
+    // Letters and digits are reserved for escapes we don't support like `\b`.
+    if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9')) {
+        parser->error = "Unsupported escape";
+        return -1;
+    }
+    return (uint8_t)ch;
+}
+
+static uint32_t parse_class(Parser* parser) {
+    Regex_Set set = {};
+    bool negate = false;
+    if (at(parser, '^')) {
+        negate = true;
+        ++parser->index;
+    }
+
+    // A `]` at the start is a literal.
+    for (bool first = true;; first = false) {
+        if (parser->index >= parser->pattern.len) {
+            parser->error = "Unterminated [";
+            return NONE;
+        }
+        char ch = parser->pattern[parser->index++];
+        if (ch == ']' && !first)
+            break;
+
+        int low = (uint8_t)ch;
+        if (ch == '\\') {
+            low = parse_escape(parser, &set);
+            if (parser->error)
+                return NONE;
+            if (low < 0)
+                continue;
+        }
+
+        int high = low;
+        if (at(parser, '-') && parser->index + 1 < parser->pattern.len &&
+            parser->pattern[parser->index + 1] != ']') {
+            ++parser->index;
+            ch = parser->pattern[parser->index++];
+            high = (uint8_t)ch;
+            if (ch == '\\') {
+                Regex_Set ignored = {};
+                high = parse_escape(parser, &ignored);
+                if (parser->error)
+                    return NONE;
+            }
+            if (high < low) {
+                parser->error = "Invalid range in []";
+                return NONE;
+            }
+        }
+        set_add_range(&set, low, high);
+    }
+
+    // Fold before inverting so `[^a]` excludes `A` too.
+    if (parser->fold_case)
+        set_fold_case(&set);
+    if (negate)
+        set_invert_bytes(&set);
+    return add_set_node(parser, set);
+}
+
+static bool parse_number(Parser* parser, uint32_t* number) {
+    size_t start = parser->index;
+    uint64_t value = 0;
+    while (parser->index < parser->pattern.len && parser->pattern[parser->index] >= '0' &&
+           parser->pattern[parser->index] <= '9') {
+        value = cz::min(value * 10 + (parser->pattern[parser->index] - '0'), (uint64_t)NONE - 1);
+        ++parser->index;
+    }
+    *number = (uint32_t)value;
+    return parser->index > start;
+}
+
+/// Parse `{n}`, `{n,}`, or `{n,m}`.  Anything else is a literal `{`.
+static bool parse_count(Parser* parser, uint32_t* min, uint32_t* max) {
+    size_t start = parser->index;
+    ++parser->index;
+    if (!parse_number(parser, min))
+        goto literal;
+    *max = *min;
+    if (at(parser, ',')) {
+        ++parser->index;
+        if (!parse_number(parser, max))
+            *max = NONE;
+    }
+    if (!at(parser, '}'))
+        goto literal;
+    ++parser->index;
+
+    if ((*max != NONE && *max < *min) || *min > REGEX_MAX_REPEAT ||
+        (*max != NONE && *max > REGEX_MAX_REPEAT)) {
+        parser->error = "Invalid repetition count";
+        return false;
+    }
+    return true;
+
+literal:
+    parser->index = start;
+    return false;
+}
+
+static uint32_t parse_alternation(Parser* parser);
+
+static uint32_t parse_atom(Parser* parser) {
+    char ch = parser->pattern[parser->index++];
+    Regex_Set set = {};
+    switch (ch) {
+    case '(': {
+        if (++parser->depth > REGEX_MAX_DEPTH) {
+            parser->error = "Too many nested groups";
+            return NONE;
+        }
+        if (at(parser, '?')) {
+            if (parser->index + 1 < parser->pattern.len &&
+                parser->pattern[parser->index + 1] == ':') {
+                parser->index += 2;
+            } else {
+                parser->error = "Unsupported group";
+                return NONE;
+            }
+        }
+        uint32_t node = parse_alternation(parser);
+        if (parser->error)
+            return NONE;
+        if (!at(parser, ')')) {
+            parser->error = "Unmatched (";
+            return NONE;
+        }
+        ++parser->index;
+        --parser->depth;
+        return node;
+    }
+
+    case '[':
+        return parse_class(parser);
+
+    case '.':
+        set_invert_bytes(&set);
+        return add_set_node(parser, set);
+
+    case '^':
+        set_add(&set, REGEX_LINE_START);
+        return add_set_node(parser, set);
+
+    case '$':
+        set_add(&set, REGEX_LINE_END);
+        return add_set_node(parser, set);
+
+    case '*':
+    case '+':
+    case '?':
+        parser->error = "Nothing to repeat";
+        return NONE;
+
+    case '\\': {
+        int byte = parse_escape(parser, &set);
+        if (parser->error)
+            return NONE;
+        if (byte >= 0)
+            set_add(&set, byte);
+    } break;
+
+    default:
+        set_add(&set, (uint8_t)ch);
+        break;
+    }
+
+    if (parser->fold_case)
+        set_fold_case(&set);
+    return add_set_node(parser, set);
+}
+
+static uint32_t parse_repetition(Parser* parser) {
+    uint32_t node = parse_atom(parser);
+    if (parser->error)
+        return NONE;
+
+    while (parser->index < parser->pattern.len) {
+        uint32_t min, max;
+        char ch = parser->pattern[parser->index];
+        if (ch == '*') {
+            min = 0;
+            max = NONE;
+        } else if (ch == '+') {
+            min = 1;
+            max = NONE;
+        } else if (ch == '?') {
+            min = 0;
+            max = 1;
+        } else if (ch == '{') {
+            if (!parse_count(parser, &min, &max))
+                break;
+            --parser->index;
+        } else {
+            break;
+        }
+        ++parser->index;
+
+        // Lazy repetition is accepted but the longest match is used anyway.
+        if (at(parser, '?'))
+            ++parser->index;
+
+        uint32_t repeat = add_node(parser, NODE_REPEAT);
+        parser->nodes[repeat].child = node;
+        parser->nodes[repeat].min = min;
+        parser->nodes[repeat].max = max;
+        node = repeat;
+    }
+    return node;
+}
+
+static uint32_t parse_concatenation(Parser* parser) {
+    uint32_t concat = add_node(parser, NODE_CONCAT);
+    uint32_t last = NONE;
+    while (parser->index < parser->pattern.len && !at(parser, '|') && !at(parser, ')')) {
+        uint32_t node = parse_repetition(parser);
+        if (parser->error)
+            return NONE;
+        if (last == NONE)
+            parser->nodes[concat].child = node;
+        else
+            parser->nodes[last].next = node;
+        last = node;
+    }
+    return concat;
+}
+
+static uint32_t parse_alternation(Parser* parser) {
+    uint32_t first = parse_concatenation(parser);
+    if (parser->error || !at(parser, '|'))
+        return first;
+
+    uint32_t alternate = add_node(parser, NODE_ALTERNATE);
+    parser->nodes[alternate].child = first;
+    uint32_t last = first;
+    while (at(parser, '|')) {
+        ++parser->index;
+        uint32_t node = parse_concatenation(parser);
+        if (parser->error)
+            return NONE;
+        parser->nodes[last].next = node;
+        last = node;
+    }
+    return alternate;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - compiling to an NFA
+///////////////////////////////////////////////////////////////////////////////
+
+static uint32_t add_nfa_state(Compiler* compiler,
+                              Regex_Nfa_Kind kind,
+                              uint32_t set,
+                              uint32_t out,
+                              uint32_t out1) {
+    cz::Vector<Regex_Nfa_State>* nfa = &compiler->regex->nfa;
+    if (nfa->len >= REGEX_MAX_NFA_STATES)
+        compiler->too_big = true;
+    Regex_Nfa_State state = {kind, set, out, out1};
+    nfa->reserve(cz::heap_allocator(), 1);
+    nfa->push(state);
+    return (uint32_t)(nfa->len - 1);
+}
+
+/// Compile `node` so that it continues to `next` once it matches.  Returns where it starts.
+/// When reversed the pattern matches the reversed text so the children of a concatenation
+/// are compiled in the opposite order.
+static uint32_t compile_node(Compiler* compiler, uint32_t index, uint32_t next) {
+    if (compiler->too_big)
+        return next;
+
+    Node node = compiler->nodes[index];
+    switch (node.kind) {
+    case NODE_SET:
+        return add_nfa_state(compiler, REGEX_NFA_SET, node.set, next, NONE);
+
+    case NODE_CONCAT: {
+        if (compiler->reverse) {
+            for (uint32_t child = node.child; child != NONE; child = compiler->nodes[child].next)
+                next = compile_node(compiler, child, next);
+            return next;
+        }
+
+        // Continuations are built backwards so compile the last child first.
+        cz::Vector<uint32_t> children = {};
+        CZ_DEFER(children.drop(cz::heap_allocator()));
+        for (uint32_t child = node.child; child != NONE; child = compiler->nodes[child].next) {
+            children.reserve(cz::heap_allocator(), 1);
+            children.push(child);
+        }
+        for (size_t i = children.len; i-- > 0;)
+            next = compile_node(compiler, children[i], next);
+        return next;
+    }
+
+    case NODE_ALTERNATE: {
+        uint32_t start = NONE;
+        for (uint32_t child = node.child; child != NONE; child = compiler->nodes[child].next) {
+            uint32_t branch = compile_node(compiler, child, next);
+            start = (start == NONE ? branch
+                                   : add_nfa_state(compiler, REGEX_NFA_SPLIT, NONE, branch, start));
+        }
+        return start;
+    }
+
+    case NODE_REPEAT: {
+        uint32_t start = next;
+        if (node.max == NONE) {
+            // Loop back to a split between another copy and leaving.
+            uint32_t split = add_nfa_state(compiler, REGEX_NFA_SPLIT, NONE, NONE, next);
+            uint32_t body = compile_node(compiler, node.child, split);
+            compiler->regex->nfa[split].out = body;
+            start = split;
+        } else {
+            // Each optional copy can be followed by more or can leave.
+            for (uint32_t i = node.min; i < node.max && !compiler->too_big; ++i) {
+                uint32_t body = compile_node(compiler, node.child, start);
+                start = add_nfa_state(compiler, REGEX_NFA_SPLIT, NONE, body, next);
+            }
+        }
+        for (uint32_t i = 0; i < node.min && !compiler->too_big; ++i)
+            start = compile_node(compiler, node.child, start);
+        return start;
+    }
+    }
+
+    CZ_PANIC("Invalid node kind");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - symbol classes
+///////////////////////////////////////////////////////////////////////////////
+
+/// Split the classes so symbols in `set` don't share one with symbols outside of it.
+static void split_classes(Regex* regex, const Regex_Set& set) {
+    uint16_t inside[REGEX_SYMBOLS];
+    uint16_t outside[REGEX_SYMBOLS];
+    memset(inside, 0xff, sizeof(inside));
+    memset(outside, 0xff, sizeof(outside));
+
+    uint32_t count = 0;
+    for (uint32_t symbol = 0; symbol < REGEX_SYMBOLS; ++symbol) {
+        uint16_t* map = (set_has(set, symbol) ? inside : outside);
+        uint16_t* klass = &regex->classes[symbol];
+        if (map[*klass] == 0xffff)
+            map[*klass] = (uint16_t)count++;
+        *klass = map[*klass];
+    }
+    regex->num_classes = count;
+}
+
+static void make_classes(Regex* regex) {
+    memset(regex->classes, 0, sizeof(regex->classes));
+    regex->num_classes = 1;
+
+    const uint32_t own_class[] = {'\n', REGEX_LINE_START, REGEX_LINE_END};
+    for (size_t i = 0; i < CZ_DIM(own_class); ++i) {
+        Regex_Set set = {};
+        set_add(&set, own_class[i]);
+        split_classes(regex, set);
+    }
+    for (size_t i = 0; i < regex->sets.len; ++i)
+        split_classes(regex, regex->sets[i]);
+
+    for (uint32_t symbol = REGEX_SYMBOLS; symbol-- > 0;)
+        regex->class_symbols[regex->classes[symbol]] = (uint16_t)symbol;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - compiling
+///////////////////////////////////////////////////////////////////////////////
+
+static void dfa_init(Regex_Dfa* dfa,
+                     uint32_t start,
+                     bool unanchored,
+                     bool resets,
+                     uint32_t enter,
+                     uint32_t leave) {
+    dfa->start = start;
+    dfa->unanchored = unanchored;
+    dfa->resets = resets;
+    dfa->enter = enter;
+    dfa->leave = leave;
+    dfa->start_state = -1;
+    dfa->line_start_state = -1;
+    dfa->dead_state = -1;
+}
+
+static void dfa_drop(Regex_Dfa* dfa) {
+    dfa->nfa_states.drop(cz::heap_allocator());
+    dfa->nfa_offsets.drop(cz::heap_allocator());
+    dfa->flags.drop(cz::heap_allocator());
+    dfa->transitions.drop(cz::heap_allocator());
+    dfa->table.drop(cz::heap_allocator());
+}
+
+bool regex_compile(Regex* regex, cz::Str pattern, uint32_t flags, const char** error) {
+    ZoneScoped;
+
+    regex_drop(regex);
+    *regex = {};
+
+    Parser parser = {};
+    parser.pattern = pattern;
+    parser.fold_case = (flags & REGEX_CASE_INSENSITIVE);
+    parser.sets = &regex->sets;
+    CZ_DEFER(parser.nodes.drop(cz::heap_allocator()));
+
+    if (pattern.starts_with("(?i)")) {
+        parser.fold_case = true;
+        parser.index = 4;
+    }
+
+    uint32_t root = parse_alternation(&parser);
+    if (!parser.error && parser.index < parser.pattern.len)
+        parser.error = "Unmatched )";
+    if (parser.error) {
+        *error = parser.error;
+        return false;
+    }
+
+    Compiler compiler = {};
+    compiler.regex = regex;
+    compiler.nodes = parser.nodes;
+    regex->match = add_nfa_state(&compiler, REGEX_NFA_MATCH, NONE, NONE, NONE);
+    uint32_t start = compile_node(&compiler, root, regex->match);
+    compiler.reverse = true;
+    uint32_t reverse_start = compile_node(&compiler, root, regex->match);
+    if (compiler.too_big) {
+        *error = "Pattern is too big";
+        return false;
+    }
+
+    make_classes(regex);
+
+    // Going backwards a line is entered at its end.
+    dfa_init(&regex->forward, start, /*unanchored=*/true, /*resets=*/true, REGEX_LINE_START,
+             REGEX_LINE_END);
+    dfa_init(&regex->reverse, reverse_start, /*unanchored=*/true, /*resets=*/true,
+             REGEX_LINE_END, REGEX_LINE_START);
+    dfa_init(&regex->anchored, start, /*unanchored=*/false, /*resets=*/false, REGEX_LINE_START,
+             REGEX_LINE_END);
+
+    regex->marks.reserve_exact(cz::heap_allocator(), regex->nfa.len);
+    regex->marks.len = regex->nfa.len;
+    memset(regex->marks.elems, 0, regex->marks.len * sizeof(uint32_t));
+    return true;
+}
+
+void regex_drop(Regex* regex) {
+    regex->sets.drop(cz::heap_allocator());
+    regex->nfa.drop(cz::heap_allocator());
+    dfa_drop(&regex->forward);
+    dfa_drop(&regex->reverse);
+    dfa_drop(&regex->anchored);
+    regex->line_cache.states.drop(cz::heap_allocator());
+    regex->line_cache.starts.drop(cz::heap_allocator());
+    regex->current.drop(cz::heap_allocator());
+    regex->scratch.drop(cz::heap_allocator());
+    regex->stack.drop(cz::heap_allocator());
+    regex->marks.drop(cz::heap_allocator());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - building DFA states
+///////////////////////////////////////////////////////////////////////////////
+
+/// Start building a set of NFA states in `regex->scratch`.
+static void begin_set(Regex* regex) {
+    regex->scratch.len = 0;
+    if (++regex->mark == 0) {
+        memset(regex->marks.elems, 0, regex->marks.len * sizeof(uint32_t));
+        regex->mark = 1;
+    }
+}
+
+/// Add the states reachable from `state` without reading a symbol.  Splits are followed
+/// instead of being added since only the states that read symbols or match matter.
+static void add_closure(Regex* regex, uint32_t state) {
+    regex->stack.len = 0;
+    regex->stack.reserve(cz::heap_allocator(), 1);
+    regex->stack.push(state);
+    while (regex->stack.len > 0) {
+        uint32_t s = regex->stack.pop();
+        if (regex->marks[s] == regex->mark)
+            continue;
+        regex->marks[s] = regex->mark;
+
+        const Regex_Nfa_State& nfa_state = regex->nfa[s];
+        if (nfa_state.kind == REGEX_NFA_SPLIT) {
+            regex->stack.reserve(cz::heap_allocator(), 2);
+            regex->stack.push(nfa_state.out1);
+            regex->stack.push(nfa_state.out);
+        } else {
+            regex->scratch.reserve(cz::heap_allocator(), 1);
+            regex->scratch.push(s);
+        }
+    }
+}
+
+/// Read `symbol` from every state in `regex->current` into `regex->scratch`.
+static void step_set(Regex* regex, Regex_Dfa* dfa, uint32_t symbol, bool keep) {
+    begin_set(regex);
+    for (size_t i = 0; i < regex->current.len; ++i) {
+        uint32_t s = regex->current[i];
+        if (keep)
+            add_closure(regex, s);
+        const Regex_Nfa_State& nfa_state = regex->nfa[s];
+        if (nfa_state.kind == REGEX_NFA_SET && set_has(regex->sets[nfa_state.set], symbol))
+            add_closure(regex, nfa_state.out);
+    }
+    if (!keep && dfa->unanchored)
+        add_closure(regex, dfa->start);
+    cz::sort(regex->scratch.slice_start(0));
+}
+
+/// Zero width symbols don't have to be read so the states are kept.  Repeat
+/// until nothing changes so patterns like `^^a` match at the start of a line.
+static void step_zero_width(Regex* regex, Regex_Dfa* dfa, uint32_t symbol) {
+    while (1) {
+        step_set(regex, dfa, symbol, /*keep=*/true);
+        if (regex->scratch.len == regex->current.len)
+            break;
+        regex->current.len = 0;
+        regex->current.reserve(cz::heap_allocator(), regex->scratch.len);
+        regex->current.append(regex->scratch);
+    }
+}
+
+static uint32_t hash_set(cz::Slice<uint32_t> set) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < set.len; ++i)
+        hash = (hash ^ set[i]) * 16777619u;
+    return hash;
+}
+
+static cz::Slice<uint32_t> dfa_state_set(Regex_Dfa* dfa, uint32_t state) {
+    uint32_t start = dfa->nfa_offsets[state];
+    return {dfa->nfa_states.elems + start, dfa->nfa_offsets[state + 1] - start};
+}
+
+static void table_insert(Regex_Dfa* dfa, uint32_t state) {
+    size_t mask = dfa->table.len - 1;
+    for (size_t i = hash_set(dfa_state_set(dfa, state)) & mask;; i = (i + 1) & mask) {
+        if (dfa->table[i] == 0) {
+            dfa->table[i] = state + 1;
+            return;
+        }
+    }
+}
+
+static size_t dfa_states(Regex_Dfa* dfa) {
+    return dfa->flags.len;
+}
+
+/// Throw away every state.  Scanning continues from whatever state is built next.
+static void dfa_flush(Regex_Dfa* dfa) {
+    dfa->nfa_states.len = 0;
+    dfa->nfa_offsets.len = 0;
+    dfa->flags.len = 0;
+    dfa->transitions.len = 0;
+    memset(dfa->table.elems, 0, dfa->table.len * sizeof(uint32_t));
+    dfa->start_state = -1;
+    dfa->line_start_state = -1;
+    dfa->dead_state = -1;
+    ++dfa->flushes;
+}
+
+/// Find or add the state for the NFA states in `regex->scratch`.
+static int32_t find_or_add_state(Regex* regex, Regex_Dfa* dfa) {
+    cz::Slice<uint32_t> set = regex->scratch;
+    if (dfa->table.len > 0) {
+        size_t mask = dfa->table.len - 1;
+        for (size_t i = hash_set(set) & mask; dfa->table[i] != 0; i = (i + 1) & mask) {
+            cz::Slice<uint32_t> other = dfa_state_set(dfa, dfa->table[i] - 1);
+            if (other.len == set.len && memcmp(other.elems, set.elems, set.len * 4) == 0)
+                return (int32_t)(dfa->table[i] - 1);
+        }
+    }
+
+    size_t bytes = (dfa->transitions.len + dfa->nfa_states.len + dfa->table.len) * 4;
+    if (dfa_states(dfa) > 0 && bytes > REGEX_DFA_CACHE_SIZE)
+        dfa_flush(dfa);
+
+    uint32_t state = (uint32_t)dfa_states(dfa);
+    if (dfa->nfa_offsets.len == 0) {
+        dfa->nfa_offsets.reserve(cz::heap_allocator(), 1);
+        dfa->nfa_offsets.push(0);
+    }
+    dfa->nfa_states.reserve(cz::heap_allocator(), set.len);
+    dfa->nfa_states.append(set);
+    dfa->nfa_offsets.reserve(cz::heap_allocator(), 1);
+    dfa->nfa_offsets.push((uint32_t)dfa->nfa_states.len);
+
+    uint8_t flags = (set.len == 0 ? REGEX_DFA_DEAD : 0);
+    for (size_t i = 0; i < set.len; ++i) {
+        if (set[i] == regex->match)
+            flags |= REGEX_DFA_ACCEPTING;
+    }
+    dfa->flags.reserve(cz::heap_allocator(), 1);
+    dfa->flags.push(flags);
+
+    dfa->transitions.reserve(cz::heap_allocator(), regex->num_classes);
+    memset(dfa->transitions.elems + dfa->transitions.len, 0xff, regex->num_classes * 4);
+    dfa->transitions.len += regex->num_classes;
+
+    // Keep the table at most half full.
+    if (dfa_states(dfa) * 2 > dfa->table.len) {
+        size_t size = cz::max(dfa->table.len * 2, (size_t)64);
+        dfa->table.len = 0;
+        dfa->table.reserve_exact(cz::heap_allocator(), size);
+        dfa->table.len = size;
+        memset(dfa->table.elems, 0, size * sizeof(uint32_t));
+        for (uint32_t s = 0; s < dfa_states(dfa); ++s)
+            table_insert(dfa, s);
+    } else {
+        table_insert(dfa, state);
+    }
+    return (int32_t)state;
+}
+
+/// States are referred to by their offset into `transitions` so scanning doesn't multiply.
+static int32_t state_offset(Regex* regex, int32_t state) {
+    return state * (int32_t)regex->num_classes;
+}
+
+/// Transitions to accepting states are stored as `-2 - offset` so scanning
+/// catches them with the same check as transitions that aren't built yet.
+static int32_t encode_transition(Regex* regex, Regex_Dfa* dfa, int32_t state) {
+    int32_t offset = state_offset(regex, state);
+    return (dfa->flags[state] & REGEX_DFA_ACCEPTING) ? -2 - offset : offset;
+}
+
+static bool accepting(Regex* regex, Regex_Dfa* dfa, int32_t offset) {
+    return dfa->flags[offset / regex->num_classes] & REGEX_DFA_ACCEPTING;
+}
+
+/// Load the start state's NFA states into `regex->current`.
+static void load_start(Regex* regex, Regex_Dfa* dfa) {
+    begin_set(regex);
+    add_closure(regex, dfa->start);
+    cz::sort(regex->scratch.slice_start(0));
+    regex->current.len = 0;
+    regex->current.reserve(cz::heap_allocator(), regex->scratch.len);
+    regex->current.append(regex->scratch);
+}
+
+static int32_t dfa_start(Regex* regex, Regex_Dfa* dfa) {
+    if (dfa->start_state < 0) {
+        load_start(regex, dfa);
+        int32_t state = find_or_add_state(regex, dfa);
+        dfa->start_state = state_offset(regex, state);
+    }
+    return dfa->start_state;
+}
+
+/// The start state at the start of a line.
+static int32_t dfa_line_start(Regex* regex, Regex_Dfa* dfa) {
+    if (dfa->line_start_state < 0) {
+        load_start(regex, dfa);
+        step_zero_width(regex, dfa, dfa->enter);
+        int32_t state = find_or_add_state(regex, dfa);
+        dfa->line_start_state = state_offset(regex, state);
+    }
+    return dfa->line_start_state;
+}
+
+/// Build the transition out of the state at `offset` and return it encoded.
+static int32_t dfa_build_transition(Regex* regex, Regex_Dfa* dfa, int32_t offset, uint32_t klass) {
+    uint64_t flushes = dfa->flushes;
+
+    cz::Slice<uint32_t> set = dfa_state_set(dfa, offset / regex->num_classes);
+    regex->current.len = 0;
+    regex->current.reserve(cz::heap_allocator(), set.len);
+    regex->current.append(set);
+
+    uint32_t symbol = regex->class_symbols[klass];
+    int32_t next;
+    if (dfa->resets && symbol == '\n') {
+        // Leave the line.  If that doesn't match then start over on the next line.  The
+        // transition only accepts if leaving matched, even if the next line's start does.
+        step_zero_width(regex, dfa, dfa->leave);
+        int32_t state = find_or_add_state(regex, dfa);
+        if (dfa->flags[state] & REGEX_DFA_ACCEPTING)
+            next = encode_transition(regex, dfa, state);
+        else
+            next = dfa_line_start(regex, dfa);
+    } else {
+        if (symbol >= 256)
+            step_zero_width(regex, dfa, symbol);
+        else
+            step_set(regex, dfa, symbol, /*keep=*/false);
+        int32_t state = find_or_add_state(regex, dfa);
+        if (dfa->flags[state] & REGEX_DFA_DEAD)
+            dfa->dead_state = state_offset(regex, state);
+        next = encode_transition(regex, dfa, state);
+    }
+
+    // If the cache was flushed then the state at `offset` is gone.
+    if (dfa->flushes == flushes)
+        dfa->transitions[offset + klass] = next;
+    return next;
+}
+
+/// Follow the transition on `klass` from `*state`.  Returns whether the new state accepts.
+/// Runs on every byte so the common case is a single load.
+static inline bool dfa_step(Regex* regex, Regex_Dfa* dfa, int32_t* state, uint32_t klass) {
+    int32_t next = dfa->transitions.elems[*state + klass];
+    if (next < 0) {
+        if (next == -1)
+            next = dfa_build_transition(regex, dfa, *state, klass);
+        if (next < 0) {
+            *state = -2 - next;
+            return true;
+        }
+    }
+    *state = next;
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - scanning
+///////////////////////////////////////////////////////////////////////////////
+
+/// Run `span` forwards until a state accepts.  Sets `*at` to the byte that was read last.
+/// This is where searches spend their time so the common case is kept in locals.
+static bool scan_forward(Regex* regex, Regex_Dfa* dfa, cz::Str span, int32_t* state, size_t* at) {
+    const uint16_t* classes = regex->classes;
+    const int32_t* transitions = dfa->transitions.elems;
+    int32_t s = *state;
+    for (size_t i = 0; i < span.len; ++i) {
+        uint32_t klass = classes[(uint8_t)span[i]];
+        int32_t next = transitions[s + klass];
+        if (next >= 0) {
+            s = next;
+            continue;
+        }
+
+        bool accepted = dfa_step(regex, dfa, &s, klass);
+        transitions = dfa->transitions.elems;
+        if (accepted) {
+            *state = s;
+            *at = i;
+            return true;
+        }
+    }
+    *state = s;
+    return false;
+}
+
+/// Run the first `*at` bytes of `span` backwards until a state accepts.
+/// Sets `*at` to the byte that was read last.
+static bool scan_backward(Regex* regex, Regex_Dfa* dfa, cz::Str span, int32_t* state, size_t* at) {
+    const uint16_t* classes = regex->classes;
+    const int32_t* transitions = dfa->transitions.elems;
+    int32_t s = *state;
+    for (size_t i = *at; i-- > 0;) {
+        uint32_t klass = classes[(uint8_t)span[i]];
+        int32_t next = transitions[s + klass];
+        if (next >= 0) {
+            s = next;
+            continue;
+        }
+
+        bool accepted = dfa_step(regex, dfa, &s, klass);
+        transitions = dfa->transitions.elems;
+        if (accepted) {
+            *state = s;
+            *at = i;
+            return true;
+        }
+    }
+    *state = s;
+    *at = 0;
+    return false;
+}
+
+static uint64_t line_start_of(Backlog_State* backlog, uint64_t position) {
+    size_t line = backlog->lines.upper_bound(position);
+    return (line == 0 ? backlog->discarded : backlog->lines.get(line - 1));
+}
+
+/// The newline ending the line holding `position` or the end of the backlog.
+static uint64_t line_end_of(Backlog_State* backlog, uint64_t position) {
+    size_t line = backlog->lines.upper_bound(position);
+    return (line < backlog->lines.count() ? backlog->lines.get(line) - 1 : backlog->length);
+}
+
+/// Find the first line in `[start, end)` with a match.  Sets `*hit` to a position in it.
+/// `end` must be the end of a line unless `cut`.  Then the text after it isn't read.
+static bool find_first_line(Regex* regex,
+                            Backlog_State* backlog,
+                            uint64_t start,
+                            uint64_t end,
+                            bool cut,
+                            uint64_t* hit) {
+    Regex_Dfa* dfa = &regex->forward;
+    int32_t state = (line_start_of(backlog, start) == start ? dfa_line_start(regex, dfa)
+                                                            : dfa_start(regex, dfa));
+    if (accepting(regex, dfa, state)) {
+        *hit = start;
+        return true;
+    }
+
+    // Newlines only accept if the line before them matches.  So if every line
+    // start matches then only look for a match before the start of the next line.
+    uint64_t stop = end;
+    if (accepting(regex, dfa, dfa_line_start(regex, dfa)))
+        stop = cz::min(stop, line_end_of(backlog, start));
+
+    Backlog_Spans spans = backlog_spans(backlog, start, stop);
+    uint64_t index = start;
+    for (cz::Str span; spans.next(&span); index += span.len) {
+        size_t at;
+        if (scan_forward(regex, dfa, span, &state, &at)) {
+            *hit = index + at;
+            return true;
+        }
+    }
+
+    if (stop == end && cut)
+        return false;
+    if (dfa_step(regex, dfa, &state, regex->classes[REGEX_LINE_END])) {
+        *hit = stop;
+        return true;
+    }
+    *hit = stop + 1;
+    return stop < end;
+}
+
+/// Find the last match start in `[start, end)`.  `top` is the end
+/// of the line holding `end - 1`.  Matches can't start past it.
+static bool find_last_start(Regex* regex,
+                            Backlog_State* backlog,
+                            uint64_t start,
+                            uint64_t end,
+                            uint64_t top,
+                            uint64_t* first) {
+    Regex_Dfa* dfa = &regex->reverse;
+    int32_t state = dfa_line_start(regex, dfa);
+    if (accepting(regex, dfa, state) && top < end) {
+        *first = top;
+        return true;
+    }
+
+    // Like in `find_first_line`, if every line end matches then only
+    // look for a match after the end of the previous line.
+    uint64_t bottom = start;
+    if (accepting(regex, dfa, state))
+        bottom = cz::max(start, line_start_of(backlog, top));
+
+    Backlog_Spans spans = backlog_spans(backlog, bottom, top);
+    for (cz::Str span; spans.prev(&span);) {
+        uint64_t index = spans.end;  // Where `span` starts.
+        size_t at = span.len;
+        while (scan_backward(regex, dfa, span, &state, &at)) {
+            // A newline accepts when the line after it starts with a match.
+            bool newline = (span[at] == '\n');
+            uint64_t position = index + at + newline;
+            if (position < end) {
+                *first = position;
+                return true;
+            }
+            if (newline)
+                state = dfa_line_start(regex, dfa);
+        }
+    }
+
+    if (bottom > start) {
+        *first = bottom - 1;
+        return true;
+    }
+    if (line_start_of(backlog, start) != start)
+        return false;
+    *first = start;
+    return dfa_step(regex, dfa, &state, regex->classes[REGEX_LINE_START]);
+}
+
+/// Run the reversed pattern from `*state` over `[lo, hi)` backwards.  Returns the lowest
+/// position where a match starts.  Stops early at the first position below `below`.
+static uint64_t scan_starts(Regex* regex,
+                            Backlog_State* backlog,
+                            uint64_t lo,
+                            uint64_t hi,
+                            uint64_t below,
+                            int32_t* state) {
+    Regex_Dfa* dfa = &regex->reverse;
+    uint64_t first = NO_POSITION;
+    Backlog_Spans spans = backlog_spans(backlog, lo, hi);
+    for (cz::Str span; spans.prev(&span);) {
+        size_t at = span.len;
+        while (scan_backward(regex, dfa, span, state, &at)) {
+            first = spans.end + at;
+            if (first < below && below != NO_POSITION)
+                return first;
+        }
+    }
+    return first;
+}
+
+/// Make the cache hold the line ending at `to` scanned down to `from`.  If `cut` then
+/// the line continues past `to` but the text after it is ignored.
+static void fill_line_cache(Regex* regex,
+                            Backlog_State* backlog,
+                            uint64_t from,
+                            uint64_t to,
+                            bool cut) {
+    Regex_Dfa* dfa = &regex->reverse;
+    Regex_Line_Cache* cache = &regex->line_cache;
+    if (cache->backlog != backlog || cache->id != backlog->id ||
+        cache->rewrites != backlog->rewrites || cache->line_end != to || cache->cut != cut ||
+        cache->flushes != dfa->flushes) {
+        cache->backlog = backlog;
+        cache->id = backlog->id;
+        cache->rewrites = backlog->rewrites;
+        cache->line_end = to;
+        cache->cut = cut;
+        cache->bottom = to;
+        cache->state = (cut ? dfa_start(regex, dfa) : dfa_line_start(regex, dfa));
+        cache->flushes = dfa->flushes;
+        cache->states.len = 0;
+        cache->starts.len = 0;
+    }
+
+    while (cache->bottom > from) {
+        size_t block = (to - cache->bottom) / LINE_BLOCK_SIZE;
+        if (cache->states.len == block) {
+            cache->states.reserve(cz::heap_allocator(), 1);
+            cache->starts.reserve(cz::heap_allocator(), 1);
+            cache->states.push(cache->state);
+            cache->starts.push(false);
+        }
+
+        uint64_t lo = from;
+        if (to - from > (block + 1) * LINE_BLOCK_SIZE)
+            lo = to - (block + 1) * LINE_BLOCK_SIZE;
+        uint64_t first = scan_starts(regex, backlog, lo, cache->bottom, NO_POSITION, &cache->state);
+        if (first != NO_POSITION)
+            cache->starts[block] = true;
+        cache->bottom = lo;
+    }
+}
+
+/// Rescan block `block` of the cached line from its top down to `from`.
+static uint64_t rescan_block(Regex* regex,
+                             Backlog_State* backlog,
+                             size_t block,
+                             uint64_t from,
+                             uint64_t below) {
+    Regex_Line_Cache* cache = &regex->line_cache;
+    if (!cache->starts[block])
+        return NO_POSITION;
+    uint64_t hi = cache->line_end - block * LINE_BLOCK_SIZE;
+    uint64_t lo = (hi - from > LINE_BLOCK_SIZE ? hi - LINE_BLOCK_SIZE : from);
+    int32_t state = cache->states[block];
+    return scan_starts(regex, backlog, lo, hi, below, &state);
+}
+
+/// Does a match start at `from`, the start of the line, by matching the start of the line?
+/// The cache must be scanned down to `from`.
+static bool line_start_starts(Regex* regex) {
+    int32_t state = regex->line_cache.state;
+    return dfa_step(regex, &regex->reverse, &state, regex->classes[REGEX_LINE_START]);
+}
+
+/// Does an empty match start at the end of the cached line?
+static bool line_end_starts(Regex* regex) {
+    Regex_Dfa* dfa = &regex->reverse;
+    int32_t state = (regex->line_cache.cut ? dfa_start(regex, dfa) : dfa_line_start(regex, dfa));
+    return accepting(regex, dfa, state);
+}
+
+/// The states are gone if building new ones flushed the DFA.
+static void check_line_cache(Regex* regex) {
+    if (regex->line_cache.flushes != regex->reverse.flushes)
+        regex->line_cache.backlog = nullptr;
+}
+
+/// Find the first match start in `[from, to]`, which is part of a line that ends at `to`
+/// unless `cut`.
+static uint64_t find_first_start(Regex* regex,
+                                 Backlog_State* backlog,
+                                 uint64_t from,
+                                 uint64_t to,
+                                 bool line_start,
+                                 bool cut) {
+    fill_line_cache(regex, backlog, from, to, cut);
+
+    uint64_t first = NO_POSITION;
+    if (line_start && line_start_starts(regex))
+        first = from;
+
+    // Rescan the block holding `from` then the first block above it where a match starts.
+    size_t blocks = (from < to ? (to - 1 - from) / LINE_BLOCK_SIZE + 1 : 0);
+    for (size_t block = blocks; first == NO_POSITION && block-- > 0;)
+        first = rescan_block(regex, backlog, block, from, NO_POSITION);
+
+    if (first == NO_POSITION && line_end_starts(regex))
+        first = to;
+    check_line_cache(regex);
+    return first;
+}
+
+/// Find the last match start in `[from, end)`, which is part of a line that ends at `to`.
+/// `end` is at most `to + 1`.  Returns `NO_POSITION` if there isn't one.
+static uint64_t find_last_start_in_line(Regex* regex,
+                                        Backlog_State* backlog,
+                                        uint64_t from,
+                                        uint64_t end,
+                                        uint64_t to,
+                                        bool line_start) {
+    fill_line_cache(regex, backlog, from, to, /*cut=*/false);
+
+    uint64_t last = NO_POSITION;
+    if (end > to && line_end_starts(regex))
+        last = to;
+
+    // Rescan the block holding `end - 1` then the blocks below it.
+    uint64_t below = cz::min(end, to);
+    if (from < below) {
+        size_t blocks = (to - 1 - from) / LINE_BLOCK_SIZE + 1;
+        size_t block = (to - below) / LINE_BLOCK_SIZE;
+        for (; last == NO_POSITION && block < blocks; ++block) {
+            uint64_t start = rescan_block(regex, backlog, block, from, below);
+            if (start < below)
+                last = start;
+        }
+    }
+
+    if (last == NO_POSITION && line_start && line_start_starts(regex))
+        last = from;
+    check_line_cache(regex);
+    return last;
+}
+
+/// Find the end of the longest match starting at `start` in a line ending at `to` unless `cut`.
+static uint64_t find_longest_end(Regex* regex,
+                                 Backlog_State* backlog,
+                                 uint64_t start,
+                                 uint64_t to,
+                                 bool line_start,
+                                 bool cut) {
+    Regex_Dfa* dfa = &regex->anchored;
+    int32_t state = (line_start ? dfa_line_start(regex, dfa) : dfa_start(regex, dfa));
+    uint64_t end = (accepting(regex, dfa, state) ? start : NO_POSITION);
+
+    Backlog_Spans spans = backlog_spans(backlog, start, to);
+    uint64_t index = start;
+    for (cz::Str span; spans.next(&span); index += span.len) {
+        for (size_t i = 0; i < span.len; ++i) {
+            if (dfa_step(regex, dfa, &state, regex->classes[(uint8_t)span[i]]))
+                end = index + i + 1;
+            else if (state == dfa->dead_state)
+                goto done;
+        }
+    }
+
+    if (!cut && dfa_step(regex, dfa, &state, regex->classes[REGEX_LINE_END]))
+        end = to;
+
+done:
+    CZ_DEBUG_ASSERT(end != NO_POSITION);
+    return end;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - searching
+///////////////////////////////////////////////////////////////////////////////
+
+static bool search_forward(Regex* regex,
+                           Backlog_State* backlog,
+                           uint64_t start,
+                           uint64_t end,
+                           uint64_t limit,
+                           uint64_t* match_start,
+                           uint64_t* match_end) {
+    if (start >= end || start >= limit)
+        return false;
+
+    // The forward scan finds the first line where a match ends.  Then the reversed pattern
+    // is ran backwards over that line to find where the first match starts.
+    uint64_t hit;
+    uint64_t top = line_end_of(backlog, end - 1);
+    if (!find_first_line(regex, backlog, start, cz::min(top, limit), limit < top, &hit))
+        return false;
+
+    uint64_t line_start = line_start_of(backlog, hit);
+    uint64_t line_end = line_end_of(backlog, hit);
+    bool cut = (limit < line_end);
+    line_end = cz::min(line_end, limit);
+    uint64_t from = cz::max(line_start, start);
+    uint64_t first = find_first_start(regex, backlog, from, line_end, from == line_start, cut);
+    CZ_DEBUG_ASSERT(first != NO_POSITION);
+    if (first >= end)
+        return false;
+
+    *match_start = first;
+    *match_end = find_longest_end(regex, backlog, first, line_end, first == line_start, cut);
+    return true;
+}
+
+bool regex_search_forward(Regex* regex,
+                          Backlog_State* backlog,
+                          uint64_t start,
+                          uint64_t end,
+                          uint64_t* match_start,
+                          uint64_t* match_end) {
+    ZoneScoped;
+    return search_forward(regex, backlog, start, end, NO_POSITION, match_start, match_end);
+}
+
+bool regex_search_forward_before(Regex* regex,
+                                 Backlog_State* backlog,
+                                 uint64_t start,
+                                 uint64_t end,
+                                 uint64_t limit,
+                                 uint64_t* match_start,
+                                 uint64_t* match_end) {
+    ZoneScoped;
+    return search_forward(regex, backlog, start, end, limit, match_start, match_end);
+}
+
+bool regex_search_backward(Regex* regex,
+                           Backlog_State* backlog,
+                           uint64_t start,
+                           uint64_t end,
+                           uint64_t* match_start,
+                           uint64_t* match_end) {
+    ZoneScoped;
+
+    if (start >= end)
+        return false;
+
+    // Walking backwards through the matches on a long line reuses its cached scan.
+    uint64_t first;
+    uint64_t top = line_end_of(backlog, end - 1);
+    uint64_t bottom = line_start_of(backlog, end - 1);
+    uint64_t from = cz::max(bottom, start);
+    first = find_last_start_in_line(regex, backlog, from, end, top, from == bottom);
+    if (first == NO_POSITION) {
+        if (from == start)
+            return false;
+        if (!find_last_start(regex, backlog, start, bottom, bottom - 1, &first))
+            return false;
+    }
+
+    uint64_t line_start = line_start_of(backlog, first);
+    uint64_t line_end = line_end_of(backlog, first);
+    *match_start = first;
+    *match_end =
+        find_longest_end(regex, backlog, first, line_end, first == line_start, /*cut=*/false);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - backtracking
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+struct Backtracker {
+    Regex* regex;
+    cz::Str line;
+    cz::Vector<size_t> visiting;  // Position + 1 each state is being tried at.
+    bool found;
+    size_t end;
+};
+}
+
+static void backtrack(Backtracker* backtracker, uint32_t state, size_t position) {
+    // Splits can loop back without reading anything.
+    size_t* visiting = &backtracker->visiting[state];
+    if (*visiting == position + 1)
+        return;
+    size_t old_visiting = *visiting;
+    *visiting = position + 1;
+
+    const Regex_Nfa_State& nfa_state = backtracker->regex->nfa[state];
+    switch (nfa_state.kind) {
+    case REGEX_NFA_MATCH:
+        if (!backtracker->found || position > backtracker->end) {
+            backtracker->found = true;
+            backtracker->end = position;
+        }
+        break;
+
+    case REGEX_NFA_SPLIT:
+        backtrack(backtracker, nfa_state.out, position);
+        backtrack(backtracker, nfa_state.out1, position);
+        break;
+
+    case REGEX_NFA_SET: {
+        const Regex_Set& set = backtracker->regex->sets[nfa_state.set];
+        cz::Str line = backtracker->line;
+        if (position < line.len && set_has(set, (uint8_t)line[position]))
+            backtrack(backtracker, nfa_state.out, position + 1);
+        if ((position == 0 && set_has(set, REGEX_LINE_START)) ||
+            (position == line.len && set_has(set, REGEX_LINE_END))) {
+            backtrack(backtracker, nfa_state.out, position);
+        }
+    } break;
+    }
+
+    *visiting = old_visiting;
+}
+
+bool regex_match_backtracking(Regex* regex, cz::Str line, size_t start, size_t* end) {
+    Backtracker backtracker = {};
+    backtracker.regex = regex;
+    backtracker.line = line;
+    backtracker.visiting.reserve_exact(cz::heap_allocator(), regex->nfa.len);
+    backtracker.visiting.len = regex->nfa.len;
+    memset(backtracker.visiting.elems, 0, regex->nfa.len * sizeof(size_t));
+    CZ_DEFER(backtracker.visiting.drop(cz::heap_allocator()));
+
+    backtrack(&backtracker, regex->forward.start, start);
+    *end = backtracker.end;
+    return backtracker.found;
+}
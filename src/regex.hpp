@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cz/string.hpp>
+#include <cz/vector.hpp>
+
+struct Backlog_State;
+
+/// Regular expressions that are matched against backlogs a line at a time.
+///
+/// The pattern is compiled to an NFA that is turned into a DFA lazily: a DFA state is made
+/// the first time a search reaches it and is kept for later searches.  So searching takes
+/// time linear in the length of the text no matter the pattern, and the text is read in
+/// place instead of being copied.  If a pattern makes too many states the cache is thrown
+/// away and rebuilt as the search goes.
+///
+/// Syntax: literals, `.`, `[a-z]`, `[^...]`, `\d \w \s \D \W \S`, `\t \r \f \v \xHH`,
+/// `* + ?`, `{n} {n,} {n,m}`, `|`, `(...)`, `(?:...)`, and `^` and `$`, which match at the
+/// start and end of a line.  A leading `(?i)` makes the pattern case insensitive.
+///
+/// Bytes are matched, not code points, so `.` matches one byte of a multibyte character.
+/// Matches never span lines.  Of the matches starting at a position the longest is used.
+
+/// Symbols are the bytes plus the start and end of a line, which are zero width.
+#define REGEX_LINE_START 256
+#define REGEX_LINE_END 257
+#define REGEX_SYMBOLS 258
+
+/// Flags for `regex_compile`.
+#define REGEX_CASE_INSENSITIVE 1
+
+struct Regex_Set {
+    uint64_t bits[(REGEX_SYMBOLS + 63) / 64];
+};
+
+enum Regex_Nfa_Kind {
+    REGEX_NFA_SET,    // Read a symbol in `set` then go to `out`.
+    REGEX_NFA_SPLIT,  // Go to both `out` and `out1`.
+    REGEX_NFA_MATCH,
+};
+
+struct Regex_Nfa_State {
+    Regex_Nfa_Kind kind;
+    uint32_t set;  // Index into `Regex::sets`.
+    uint32_t out;
+    uint32_t out1;
+};
+
+/// A lazily built DFA.  Each state is a sorted set of NFA states.
+struct Regex_Dfa {
+    uint32_t start;   // NFA state matches start at.
+    bool unanchored;  // Matches can start after the scan starts.
+    /// Newlines are fed as `leave`.  If that doesn't match then the scan
+    /// starts over at the next line.  Otherwise newlines aren't expected.
+    bool resets;
+    uint32_t enter;  // Symbol at the start of a line in the direction of the scan.
+    uint32_t leave;  // Symbol at the end of a line in the direction of the scan.
+
+    cz::Vector<uint32_t> nfa_states;   // The NFA states of every DFA state.
+    cz::Vector<uint32_t> nfa_offsets;  // State `s` has `nfa_offsets[s]` to `nfa_offsets[s + 1]`.
+    cz::Vector<uint8_t> flags;         // `REGEX_DFA_ACCEPTING` and `REGEX_DFA_DEAD`.
+    /// `Regex::num_classes` per state.  States are referred to by the offset of their
+    /// transitions.  Transitions to accepting states are stored as `-2 - offset`.
+    /// Transitions that haven't been built yet are -1.
+    cz::Vector<int32_t> transitions;
+    cz::Vector<uint32_t> table;  // Hash table of states + 1.  0 is empty.
+    uint64_t flushes;            // Times the cache was thrown away.
+
+    // Offsets of special states.  -1 if not built yet.
+    int32_t start_state;
+    int32_t line_start_state;  // The start state after `enter`.
+    int32_t dead_state;        // Has no NFA states so it can't match.
+};
+
+/// The reversed pattern's scan of the last line a forward search found a match in.  Finding
+/// where the first match starts has to scan the rest of the line backwards.  The state at the
+/// top of each block of the line is kept so walking through every match on a long line only
+/// rescans a block per match.  Blocks count down from the end of the line.
+struct Regex_Line_Cache {
+    Backlog_State* backlog;  // Null if empty.
+    uint64_t id;
+    uint64_t rewrites;
+    uint64_t line_end;
+    bool cut;          // The line continues past `line_end` but the rest is ignored.
+    uint64_t flushes;  // Of the reverse DFA.  States are gone once it is flushed.
+
+    uint64_t bottom;  // The line was scanned down to here.
+    int32_t state;    // State at `bottom`.
+    cz::Vector<int32_t> states;  // State at the top of each block.
+    cz::Vector<bool> starts;     // Does a match start in the scanned part of the block?
+};
+
+struct Regex {
+    cz::Vector<Regex_Set> sets;
+    cz::Vector<Regex_Nfa_State> nfa;
+    uint32_t match;  // The NFA state that accepts.
+
+    /// Symbols that no set tells apart share a class so the DFA only has a transition per
+    /// class.  The newline and the zero width symbols always have classes of their own.
+    uint16_t classes[REGEX_SYMBOLS];
+    uint16_t class_symbols[REGEX_SYMBOLS];  // A symbol in each class.
+    uint32_t num_classes;
+
+    Regex_Dfa forward;   // Finds the first line with a match.
+    Regex_Dfa reverse;   // Runs the reversed pattern backwards to find where matches start.
+    Regex_Dfa anchored;  // Finds where a match ends.
+    Regex_Line_Cache line_cache;
+
+    // Scratch space for building DFA states.
+    cz::Vector<uint32_t> current;
+    cz::Vector<uint32_t> scratch;
+    cz::Vector<uint32_t> stack;
+    cz::Vector<uint32_t> marks;
+    uint32_t mark;
+};
+
+/// Compile `pattern`.  On failure returns `false` and sets `*error` to a description of the
+/// problem.  `regex` may hold an older pattern, which is replaced either way.
+bool regex_compile(Regex* regex, cz::Str pattern, uint32_t flags, const char** error);
+void regex_drop(Regex* regex);
+
+/// Find the first / last match starting in `[start, end)`.  The match can continue past
+/// `end` until the end of its line.  `end` can be one after the end of the backlog to
+/// include empty matches at the end.  `*match_end` can equal `*match_start`.
+bool regex_search_forward(Regex* regex,
+                          Backlog_State* backlog,
+                          uint64_t start,
+                          uint64_t end,
+                          uint64_t* match_start,
+                          uint64_t* match_end);
+/// Like `regex_search_forward` but text at or after `limit` isn't read.  A line that runs
+/// past `limit` is treated as if it ended there except that `$` doesn't match at the cut.
+/// So matches that run past it are shortened or missed.  Lets a window of a long line be
+/// searched without reading the rest of it.
+bool regex_search_forward_before(Regex* regex,
+                                 Backlog_State* backlog,
+                                 uint64_t start,
+                                 uint64_t end,
+                                 uint64_t limit,
+                                 uint64_t* match_start,
+                                 uint64_t* match_end);
+bool regex_search_backward(Regex* regex,
+                           Backlog_State* backlog,
+                           uint64_t start,
+                           uint64_t end,
+                           uint64_t* match_start,
+                           uint64_t* match_end);
+
+/// Find the longest match starting at `start` in `line` by trying every path through the NFA.
+/// `line` is a whole line without its newline.  Takes exponential time on patterns like
+/// `(a|aa)*b`.  Exposed for the tests and benchmarks.
+bool regex_match_backtracking(Regex* regex, cz::Str line, size_t start, size_t* end);
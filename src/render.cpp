@@ -2,10 +2,10 @@
 
 #include <SDL_image.h>
 #include <inttypes.h>
-#include <cz/binary_search.hpp>
 #include <cz/date.hpp>
 #include <cz/format.hpp>
 #include <cz/string.hpp>
+#include <cz/util.hpp>
 #include <tracy/Tracy.hpp>
 
 #include "backlog.hpp"
@@ -67,16 +67,8 @@ void init_font(Font_State* font, double dpi_scale) {
 
 void close_font(Font_State* font) {
     ZoneScoped;
-    for (int ch = 0; ch < CZ_DIM(font->caches); ch++) {
-        Surface_Cache* cache = &font->caches[ch];
-        for (int i = 0; i < cache->surfaces.len; i++) {
-            SDL_Surface** surface = &cache->surfaces.get(i);
-            SDL_FreeSurface(*surface);
-            *surface = NULL;
-        }
-        cache->code_points.len = 0;
-        cache->surfaces.len = 0;
-    }
+    glyph_atlas_drop(&font->atlas);
+    font->atlas = {};
     TTF_CloseFont(font->sdl);
 }
 
@@ -102,6 +94,7 @@ void resize_font(int font_size, double dpi_scale, Font_State* font) {
             cz::max(TTF_FontLineSkip(font->sdl), (int)(TTF_FontHeight(font->sdl) * 1.05f));
         // TODO: handle failure
         TTF_GlyphMetrics(font->sdl, ' ', nullptr, nullptr, nullptr, nullptr, &font->width);
+        font->ascent = TTF_FontAscent(font->sdl);
     }
 }
 
@@ -118,36 +111,82 @@ static SDL_Surface* rasterize_code_point(const char* text,
     return TTF_RenderUTF8_Blended(font, text, fgc);
 }
 
-static SDL_Surface* rasterize_code_point_cached(Font_State* font,
-                                                const char seq[5],
-                                                uint8_t color256) {
-    uint32_t code_point = unicode::utf8_code_point((const uint8_t*)seq);
+/// Copy the coverage of a rasterized glyph starting `x_offset` pixels
+/// in into a mask, clipping it to the mask's size.
+static void copy_coverage(SDL_Surface* surface,
+                          int x_offset,
+                          uint8_t* mask,
+                          int width,
+                          int height) {
+    memset(mask, 0, (size_t)width * height);
+
+    if (SDL_MUSTLOCK(surface))
+        SDL_LockSurface(surface);
+
+    const SDL_PixelFormat* format = surface->format;
+    int rows = cz::min(surface->h, height);
+    int cols = cz::min(surface->w - x_offset, width);
+    if (format->BytesPerPixel == 4 && format->Amask) {
+        for (int y = 0; y < rows; ++y) {
+            const uint32_t* pixels =
+                (const uint32_t*)((const uint8_t*)surface->pixels + y * surface->pitch) + x_offset;
+            for (int x = 0; x < cols; ++x) {
+                mask[y * width + x] = (uint8_t)((pixels[x] & format->Amask) >> format->Ashift);
+            }
+        }
+    }
 
-    // Check the cache.
-    Surface_Cache* cache = &font->caches[color256];
-    size_t index;
-    if (cz::binary_search(cache->code_points.as_slice(), code_point, &index))
-        return cache->surfaces[index];  // Cache hit.
+    if (SDL_MUSTLOCK(surface))
+        SDL_UnlockSurface(surface);
+}
+
+/// Get the coverage mask of a glyph (`font->width * font->height` bytes).  Glyphs that are
+/// two columns wide are cached as two masks.  `half` is 1 or 2 to get the left or right one.
+static const uint8_t* rasterize_code_point_cached(Font_State* font,
+                                                  const char seq[5],
+                                                  uint8_t half) {
+    Glyph_Atlas* atlas = &font->atlas;
+    if (atlas->width != font->width || atlas->height != font->height) {
+        glyph_atlas_drop(atlas);
+        glyph_atlas_init(atlas, font->width, font->height, GLYPH_ATLAS_MAX_BYTES);
+    }
+
+    uint32_t code_point = unicode::utf8_code_point((const uint8_t*)seq);
+    uint64_t key = glyph_atlas_key(code_point, TTF_STYLE_NORMAL | (half << 8));
+    const uint8_t* mask = glyph_atlas_find(atlas, key);
+    if (mask)
+        return mask;  // Cache hit.
 
-    // Cache miss.  Rasterize and add to the cache.
-    SDL_Surface* surface = rasterize_code_point(seq, font->sdl, 0, cfg.theme[color256]);
+    // Cache miss.  Rasterize in white and keep the coverage.
+    SDL_Color white = {0xff, 0xff, 0xff, 0xff};
+    SDL_Surface* surface = rasterize_code_point(seq, font->sdl, TTF_STYLE_NORMAL, white);
 
     // I've seen this case actually come up before so re-render as an invalid character.
     if (!surface) {
-        if (!strcmp(seq, "\1"))
+        surface = rasterize_code_point("\1", font->sdl, TTF_STYLE_NORMAL, white);
+        if (!surface)
             CZ_PANIC("Failed to render");
-        return rasterize_code_point_cached(font, "\1", color256);
     }
 
-    cache->code_points.reserve(cz::heap_allocator(), 1);
-    cache->code_points.insert(index, code_point);
-    cache->surfaces.reserve(cz::heap_allocator(), 1);
-    cache->surfaces.insert(index, surface);
+    uint8_t* new_mask = glyph_atlas_insert(atlas, key);
+    int x_offset = (half == 2 ? font->width : 0);
+    copy_coverage(surface, x_offset, new_mask, atlas->width, atlas->height);
+    SDL_FreeSurface(surface);
+    return new_mask;
+}
 
-    return surface;
+/// The compositor blends channels byte by byte so every channel has to be its own byte.
+static bool is_byte_aligned_format(const SDL_PixelFormat* format) {
+    if (format->BytesPerPixel != 4)
+        return false;
+    if (format->Rshift % 8 != 0 || format->Gshift % 8 != 0 || format->Bshift % 8 != 0)
+        return false;
+    return format->Rmask == (0xffu << format->Rshift) &&
+           format->Gmask == (0xffu << format->Gshift) &&
+           format->Bmask == (0xffu << format->Bshift);
 }
 
-int coord_trans(Visual_Point* point, int num_cols, char ch) {
+int coord_trans(Visual_Point* point, int num_cols, char ch, int width) {
     ++point->inner;
 
     if (ch == '\n') {
@@ -157,7 +196,6 @@ int coord_trans(Visual_Point* point, int num_cols, char ch) {
         return 0;
     }
 
-    int width = 1;
     if (ch == '\t') {
         uint64_t lcol2 = point->column;
         lcol2 += cfg.tab_width;
@@ -176,17 +214,58 @@ int coord_trans(Visual_Point* point, int num_cols, char ch) {
     return width;
 }
 
-bool render_code_point(SDL_Surface* window_surface,
-                       const SDL_Rect& grid_rect,
-                       Render_State* rend,
-                       Visual_Point* point,
-                       uint32_t background,
-                       uint8_t foreground,
-                       bool underline,
-                       const char seq[5],
-                       bool set_tile) {
+static Visual_Cell* cell_at(Render_State* rend, int x, int y) {
+    if (x < 0 || x >= rend->grid_cols || y < 0 || y >= (int)rend->rows.len)
+        return nullptr;
+    return &rend->cells[(size_t)y * rend->grid_cols + x];
+}
+
+/// Fill the rest of row `y` starting at column `x`.
+static void fill_row_end(Render_State* rend, int x, int y, uint32_t background) {
+    if (y < 0 || y >= (int)rend->rows.len)
+        return;
+    for (; x < rend->grid_cols; ++x) {
+        *cell_at(rend, x, y) = {{}, background, 0, false, 0};
+    }
+    rend->rows[y].tail_background = background;
+}
+
+static void set_cursor(Render_State* rend, const Visual_Point& point, uint32_t color) {
+    if (point.y < 0 || point.y >= (int)rend->rows.len)
+        return;
+    rend->rows[point.y].cursor_x = point.x;
+    rend->rows[point.y].cursor_color = color;
+}
+
+/// Like `render_code_point` but with the display width already known.
+static bool render_code_point_width(SDL_Surface* window_surface,
+                                    const SDL_Rect& grid_rect,
+                                    Render_State* rend,
+                                    Visual_Point* point,
+                                    uint32_t background,
+                                    uint32_t foreground,
+                                    bool underline,
+                                    const char seq[5],
+                                    int width,
+                                    bool set_tile) {
+    bool special = (seq[0] == '\n' || seq[0] == '\t');
+
+    // Combining marks and other zero width code points aren't drawn.
+    if (width == 0 && !special) {
+        point->inner += strlen(seq);
+        return true;
+    }
+
     if (set_tile) {
-        size_t index = point->y * rend->grid_cols + point->x;
+        // Wide characters that don't fit are moved to the next row.
+        int tile_x = point->x;
+        int tile_y = point->y;
+        if (!special && tile_x + width > rend->grid_cols) {
+            tile_x = 0;
+            ++tile_y;
+        }
+
+        size_t index = tile_y * rend->grid_cols + tile_x;
         if (index < rend->grid.len) {
             Visual_Tile* tile = &rend->grid[index];
             tile->outer = point->outer + 1;
@@ -208,6 +287,10 @@ bool render_code_point(SDL_Surface* window_surface,
                     tile->outer = point->outer + 1;
                     tile->inner = point->inner;
                 }
+            } else if (width == 2 && index + 1 < rend->grid.len) {
+                ++tile;
+                tile->outer = point->outer + 1;
+                tile->inner = point->inner;
             }
         }
 
@@ -225,19 +308,13 @@ bool render_code_point(SDL_Surface* window_surface,
         }
     }
 
-    SDL_Rect rect = {grid_rect.x + point->x * rend->font.width,
-                     grid_rect.y + point->y * rend->font.height, 0, 0};
-    uint64_t old_y = point->y;
-    int width = coord_trans(point, rend->grid_cols, seq[0]);
+    int old_y = point->y;
+    int old_x = point->x;
+    width = coord_trans(point, rend->grid_cols, seq[0], width);
     point->inner += strlen(seq) - 1;
 
     if (point->y != old_y) {
-        rect.w = grid_rect.w - (rect.x - grid_rect.x);
-        rect.h = rend->font.height;
-        SDL_FillRect(window_surface, &rect, background);
-
-        rect.x = grid_rect.x;
-        rect.y += rend->font.height;
+        fill_row_end(rend, old_x, old_y, background);
 
         // Beyond bottom of screen.
         if (point->y >= rend->grid_rows_ru)
@@ -248,37 +325,284 @@ bool render_code_point(SDL_Surface* window_surface,
             return true;
     }
 
-    ZoneScopedN("blit_character");
+    int x = point->x - width;
     if (seq[0] == '\t') {
-        rect.w = width * rend->font.width;
-        rect.h = rend->font.height;
-        SDL_FillRect(window_surface, &rect, background);
+        for (int i = 0; i < width; ++i) {
+            Visual_Cell* cell = cell_at(rend, x + i, point->y);
+            if (cell)
+                *cell = {{}, background, foreground, underline, 0};
+        }
     } else {
-        const char binseq[5] = {1};
-        const char* seq2 = (seq[0] != '\0' ? seq : binseq);
-        SDL_Surface* s = rasterize_code_point_cached(&rend->font, seq2, foreground);
-        rect.w = rend->font.width;
-        rect.h = rend->font.height;
-        SDL_FillRect(window_surface, &rect, background);
-        SDL_BlitSurface(s, NULL, window_surface, &rect);
-    }
-
-    if (underline) {
-        // TODO cache
-        int baseline = TTF_FontAscent(rend->font.sdl) + 1;
-        SDL_Rect ur = {};
-        ur.x = rect.x;
-        ur.y = rect.y + baseline;
-        ur.w = rect.w;
-        ur.h = 1;
-        SDL_Color fgc = cfg.theme[foreground];
-        uint32_t fg32 = SDL_MapRGB(window_surface->format, fgc.r, fgc.g, fgc.b);
-        SDL_FillRect(window_surface, &ur, fg32);
+        for (int i = 0; i < width; ++i) {
+            Visual_Cell* cell = cell_at(rend, x + i, point->y);
+            if (!cell)
+                continue;
+            uint8_t wide = (width == 2 ? (uint8_t)(i + 1) : 0);
+            *cell = {{}, background, foreground, underline, wide};
+            if (seq[0] == '\0') {
+                cell->seq[0] = 1;
+            } else {
+                memcpy(cell->seq, seq, strlen(seq));
+            }
+        }
     }
 
     return true;
 }
 
+/// Display width of a code point from a string.  Backlogs measure
+/// their text when it is appended so this is only used for short strings.
+static int string_code_point_width(const char seq[5]) {
+    if ((uint8_t)seq[0] < 0x80)
+        return 1;
+    uint32_t code_point;
+    size_t len = unicode::utf8_decode(seq, strlen(seq), &code_point);
+    if (len == 0 || code_point == UNICODE_INVALID)
+        return 1;
+    return unicode::code_point_width(code_point);
+}
+
+bool render_code_point(SDL_Surface* window_surface,
+                       const SDL_Rect& grid_rect,
+                       Render_State* rend,
+                       Visual_Point* point,
+                       uint32_t background,
+                       uint32_t foreground,
+                       bool underline,
+                       const char seq[5],
+                       bool set_tile) {
+    return render_code_point_width(window_surface, grid_rect, rend, point, background, foreground,
+                                   underline, seq, string_code_point_width(seq), set_tile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Damage tracking
+///////////////////////////////////////////////////////////////////////////////
+
+static bool same_rect(const SDL_Rect& left, const SDL_Rect& right) {
+    return left.x == right.x && left.y == right.y && left.w == right.w && left.h == right.h;
+}
+
+void begin_frame(SDL_Surface* window_surface, const SDL_Rect& grid_rect, Render_State* rend) {
+    size_t num_cells = (size_t)rend->grid_rows_ru * rend->grid_cols;
+    if (rend->cells.len != num_cells || rend->rows.len != rend->grid_rows_ru ||
+        !rend->grid_is_valid || !same_rect(grid_rect, rend->drawn_rect)) {
+        rend->cells.len = 0;
+        rend->cells.reserve_exact(cz::heap_allocator(), num_cells);
+        rend->cells.len = num_cells;
+        rend->rows.len = 0;
+        rend->rows.reserve_exact(cz::heap_allocator(), rend->grid_rows_ru);
+        rend->rows.len = rend->grid_rows_ru;
+
+        // Force everything to be redrawn.
+        rend->drawn_cells.len = 0;
+        rend->drawn_rows.len = 0;
+        rend->drawn_rect = grid_rect;
+    }
+
+    rend->info_animating = false;
+
+    uint32_t black = SDL_MapRGB(window_surface->format, 0x00, 0x00, 0x00);
+    Visual_Cell empty = {{}, black, 0, false, 0};
+    for (size_t i = 0; i < rend->cells.len; ++i) {
+        rend->cells[i] = empty;
+    }
+    for (size_t i = 0; i < rend->rows.len; ++i) {
+        rend->rows[i] = {black, -1, 0};
+    }
+}
+
+static bool same_row(Render_State* rend, int y) {
+    const Visual_Row& row = rend->rows[y];
+    const Visual_Row& drawn_row = rend->drawn_rows[y];
+    if (row.tail_background != drawn_row.tail_background || row.cursor_x != drawn_row.cursor_x ||
+        (row.cursor_x != -1 && row.cursor_color != drawn_row.cursor_color)) {
+        return false;
+    }
+
+    size_t start = (size_t)y * rend->grid_cols;
+    for (size_t i = start; i < start + rend->grid_cols; ++i) {
+        const Visual_Cell& cell = rend->cells[i];
+        const Visual_Cell& drawn_cell = rend->drawn_cells[i];
+        if (memcmp(cell.seq, drawn_cell.seq, sizeof(cell.seq)) != 0 ||
+            cell.background != drawn_cell.background ||
+            cell.foreground != drawn_cell.foreground || cell.underline != drawn_cell.underline ||
+            cell.wide != drawn_cell.wide) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Resolve a color from a `Backlog_Style` (see `STYLE_COLOR_RGB`).
+static SDL_Color style_color(uint32_t color) {
+    if (color & STYLE_COLOR_RGB) {
+        SDL_Color rgb = {(uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)color, 0xff};
+        return rgb;
+    }
+    return cfg.theme[color & 0xff];
+}
+
+/// Convert a color to the pixel format the row is composited in.
+static uint32_t map_color(const SDL_PixelFormat* format, bool direct, SDL_Color color) {
+    if (direct)
+        return SDL_MapRGB(format, color.r, color.g, color.b);
+    return 0xff000000 | ((uint32_t)color.r << 16) | ((uint32_t)color.g << 8) | color.b;
+}
+
+static uint32_t map_pixel(const SDL_PixelFormat* format, bool direct, uint32_t pixel) {
+    if (direct)
+        return pixel;
+    SDL_Color color = {};
+    SDL_GetRGB(pixel, format, &color.r, &color.g, &color.b);
+    return map_color(format, direct, color);
+}
+
+static void draw_row(SDL_Surface* window_surface,
+                     const SDL_Rect& grid_rect,
+                     Render_State* rend,
+                     int y) {
+    const Visual_Row& row = rend->rows[y];
+    Visual_Cell* cells = &rend->cells[(size_t)y * rend->grid_cols];
+    int top = grid_rect.y + y * rend->font.height;
+
+    SDL_Rect surface_rect = {0, 0, window_surface->w, window_surface->h};
+    SDL_Rect clip;
+    if (!SDL_IntersectRect(&grid_rect, &surface_rect, &clip))
+        return;
+    int first_line = cz::max(clip.y - top, 0);
+    int end_line = cz::min(clip.y + clip.h - top, rend->font.height);
+    if (first_line >= end_line)
+        return;
+
+    // Normally we composite straight into the window.  Unusual pixel formats are
+    // composited in ARGB8888 and then converted by SDL_BlitSurface.
+    const SDL_PixelFormat* format = window_surface->format;
+    bool direct = is_byte_aligned_format(format) && clip.x == grid_rect.x && clip.w == grid_rect.w;
+
+    // Convert the cells to spans.  Runs of blank cells become a single fill.
+    cz::Vector<Composite_Span>* spans = &rend->spans;
+    spans->len = 0;
+    spans->reserve(cz::heap_allocator(), rend->grid_cols + 1);
+    for (int x = 0; x < rend->grid_cols; ++x) {
+        const Visual_Cell& cell = cells[x];
+        Composite_Span span = {};
+        span.x = x * rend->font.width;
+        span.width = rend->font.width;
+        span.background = map_pixel(format, direct, cell.background);
+        span.underline = cell.underline;
+
+        bool blank = (cell.seq[0] == '\0' || cell.seq[0] == ' ');
+        if (blank && !cell.underline && spans->len > 0) {
+            Composite_Span* last = &spans->last();
+            if (!last->mask && !last->underline && last->background == span.background) {
+                last->width += span.width;
+                continue;
+            }
+        }
+
+        if (!blank) {
+            ZoneScopedN("draw_glyph");
+            char seq[5] = {};
+            memcpy(seq, cell.seq, sizeof(cell.seq));
+            span.mask = rasterize_code_point_cached(&rend->font, seq, cell.wide);
+        }
+        if (!blank || cell.underline)
+            span.foreground = map_color(format, direct, style_color(cell.foreground));
+        spans->push(span);
+    }
+
+    // Fill the pixels that don't make up a full column.
+    int tail_x = rend->grid_cols * rend->font.width;
+    if (grid_rect.w > tail_x) {
+        Composite_Span tail = {};
+        tail.x = tail_x;
+        tail.width = grid_rect.w - tail_x;
+        tail.background = map_pixel(format, direct, row.tail_background);
+        spans->push(tail);
+    }
+
+    int underline_line = rend->font.ascent + 1;
+    if (direct) {
+        size_t pitch = window_surface->pitch;
+        uint8_t* pixels = (uint8_t*)window_surface->pixels + (size_t)(top + first_line) * pitch +
+                          (size_t)grid_rect.x * sizeof(uint32_t);
+        if (SDL_MUSTLOCK(window_surface))
+            SDL_LockSurface(window_surface);
+        composite_row(pixels, pitch, first_line, end_line - first_line, underline_line, *spans);
+        if (SDL_MUSTLOCK(window_surface))
+            SDL_UnlockSurface(window_surface);
+    } else {
+        int num_pixels = grid_rect.w * rend->font.height;
+        cz::Vector<uint32_t>* row_pixels = &rend->row_pixels;
+        row_pixels->len = 0;
+        row_pixels->reserve_exact(cz::heap_allocator(), num_pixels);
+        row_pixels->len = num_pixels;
+
+        size_t pitch = grid_rect.w * sizeof(uint32_t);
+        composite_row((uint8_t*)row_pixels->elems, pitch, 0, rend->font.height, underline_line,
+                      *spans);
+
+        SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom(
+            row_pixels->elems, grid_rect.w, rend->font.height, 32, (int)pitch,
+            SDL_PIXELFORMAT_ARGB8888);
+        if (surface) {
+            SDL_Rect dest = {grid_rect.x, top, grid_rect.w, rend->font.height};
+            SDL_SetClipRect(window_surface, &clip);
+            SDL_BlitSurface(surface, nullptr, window_surface, &dest);
+            SDL_SetClipRect(window_surface, nullptr);
+            SDL_FreeSurface(surface);
+        }
+    }
+
+    if (row.cursor_x != -1) {
+        SDL_Rect cursor = {grid_rect.x + row.cursor_x * rend->font.width - 1, top, 2,
+                           rend->font.height};
+        SDL_Rect clipped;
+        if (SDL_IntersectRect(&cursor, &clip, &clipped))
+            SDL_FillRect(window_surface, &clipped, row.cursor_color);
+    }
+}
+
+void draw_frame(SDL_Surface* window_surface,
+                const SDL_Rect& grid_rect,
+                Render_State* rend,
+                cz::Vector<SDL_Rect>* updated_rects) {
+    ZoneScoped;
+
+    bool redraw_all = (rend->drawn_cells.len != rend->cells.len);
+    bool extend_last = false;
+    for (int y = 0; y < (int)rend->rows.len; ++y) {
+        if (!redraw_all && same_row(rend, y)) {
+            extend_last = false;
+            continue;
+        }
+
+        draw_row(window_surface, grid_rect, rend, y);
+
+        SDL_Rect row_rect = {grid_rect.x, grid_rect.y + y * rend->font.height, grid_rect.w,
+                             rend->font.height};
+        SDL_Rect clipped;
+        if (!SDL_IntersectRect(&row_rect, &grid_rect, &clipped))
+            continue;
+        if (extend_last) {
+            updated_rects->last().h += clipped.h;
+        } else {
+            updated_rects->reserve(cz::heap_allocator(), 1);
+            updated_rects->push(clipped);
+            extend_last = true;
+        }
+    }
+
+    // Remember what is on screen.
+    cz::swap(rend->cells, rend->drawn_cells);
+    cz::swap(rend->rows, rend->drawn_rows);
+    rend->cells.reserve_exact(cz::heap_allocator(), rend->drawn_cells.len - rend->cells.len);
+    rend->cells.len = rend->drawn_cells.len;
+    rend->rows.reserve_exact(cz::heap_allocator(), rend->drawn_rows.len - rend->rows.len);
+    rend->rows.len = rend->drawn_rows.len;
+}
+
 size_t find_visbacklog(Render_State* rend, uint64_t the_id) {
     for (size_t i = 0; i < rend->visbacklogs.len; ++i) {
         Backlog_State* backlog = rend->visbacklogs[i];
@@ -328,13 +652,12 @@ static void make_info(cz::String* info,
         end = now;
 
     // Find the line number.
-    size_t first_line_number = 0;
-    if (cz::binary_search(backlog->lines.as_slice(), first_line_index, &first_line_number))
-        ++first_line_number;  // Go after the match.
+    size_t first_line_number = backlog->lines.upper_bound(first_line_index);
+    first_line_number += backlog->discarded_lines;
     // Find the max number of lines.  There's a free newline after the
     // prompt so we subtract 1 if there is no auto trailing newline.
-    size_t max_lines = backlog->lines.len;
-    if (backlog->length > 0 && backlog->get(backlog->length - 1) == '\n')
+    size_t max_lines = backlog->discarded_lines + backlog->lines.count();
+    if (backlog->length > backlog->discarded && backlog->get(backlog->length - 1) == '\n')
         max_lines--;
     cz::append(temp_allocator, info, 'L', first_line_number, '/', max_lines, ' ');
 
@@ -344,8 +667,14 @@ static void make_info(cz::String* info,
     if (backlog->done) {
         cz::append(temp_allocator, info, '(', backlog->exit_code, ") ");
     } else {
+        rend->info_animating = true;
         uint64_t abs_millis = millis % 2000;
-        if (abs_millis <= 666)
+        Backlog_Flow flow = backlog_flow(backlog);
+        if (flow == BACKLOG_FLOW_PAUSED)
+            cz::append(temp_allocator, info, "PAUSED ");
+        else if (flow == BACKLOG_FLOW_FULL)
+            cz::append(temp_allocator, info, "FULL ");
+        else if (abs_millis <= 666)
             cz::append(temp_allocator, info, ".   ");
         else if (abs_millis <= 1333)
             cz::append(temp_allocator, info, "..  ");
@@ -400,17 +729,13 @@ static size_t make_string_code_point(char sequence[5], cz::Str info, size_t star
 
 size_t make_backlog_code_point(char sequence[5], Backlog_State* backlog, size_t start) {
     size_t width = cz::min(unicode::utf8_width(sequence[0]), (size_t)backlog->length - start);
-    for (size_t off = 1; off < width; ++off) {
-        char ch = backlog->get(start + off);
-        if (!unicode::utf8_is_continuation(ch)) {
-            // Invalid utf8 so treat the char as a single byte.
-            width = 1;
-            memset(sequence + 1, 0, 4);
-            break;
-        }
-        sequence[off] = ch;
-    }
-    return width;
+    if (width == 1)
+        return 1;
+
+    // The code point may straddle two chunks.
+    char bytes[4];
+    backlog_copy(backlog, start, start + width, bytes);
+    return make_string_code_point(sequence, {bytes, width}, 0);
 }
 
 static bool render_string(SDL_Surface* window_surface,
@@ -418,7 +743,7 @@ static bool render_string(SDL_Surface* window_surface,
                           Render_State* rend,
                           Visual_Point* info_start,
                           uint32_t background,
-                          uint8_t foreground,
+                          uint32_t foreground,
                           cz::Str info,
                           bool set_tile) {
     for (size_t i = 0; i < info.len;) {
@@ -466,11 +791,150 @@ static void render_info(SDL_Surface* window_surface,
 }
 
 uint64_t render_length(Backlog_State* backlog) {
-    if (backlog->render_collapsed && backlog->lines.len > 0)
-        return backlog->lines[0];
+    if (backlog->render_collapsed && backlog->lines.count() > 0)
+        return backlog->lines.get(0);
     return backlog->length;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Wrap index
+///////////////////////////////////////////////////////////////////////////////
+
+void update_wrap_index(Backlog_State* backlog, int num_cols) {
+    Backlog_Wrap_Index* index = &backlog->wrap_index;
+    if (index->cols != num_cols || index->tab_width != cfg.tab_width) {
+        index->cols = num_cols;
+        index->tab_width = cfg.tab_width;
+        index->indexed_until = backlog->discarded;
+        index->x = 0;
+        index->column = 0;
+        index->points.len = 0;
+    }
+
+    // Discard provisional points and points past a truncation.
+    while (index->points.len > 0 && index->points.last().index >= index->indexed_until) {
+        index->points.pop();
+    }
+
+    if (index->indexed_until == backlog->length)
+        return;
+
+    ZoneScoped;
+
+    Visual_Point point = {};
+    point.x = index->x;
+    point.column = index->column;
+    point.inner = index->indexed_until;
+    bool complete = true;
+
+    while (point.inner < backlog->length) {
+        // Fast path for runs of single byte, single column characters.
+        const char* buffer = backlog->buffer_at(point.inner);
+        uint64_t buffer_start = point.inner - point.inner % BACKLOG_BUFFER_SIZE;
+        uint64_t buffer_end = cz::min(backlog->length, buffer_start + BACKLOG_BUFFER_SIZE);
+        for (; point.inner < buffer_end; ++point.inner) {
+            uint8_t ch = buffer[point.inner - buffer_start];
+            if (ch >= 0x80 || ch == '\t' || ch == '\n')
+                break;
+            if (point.x + 1 > num_cols) {
+                index->points.reserve(cz::heap_allocator(), 1);
+                index->points.push({point.inner, point.column});
+                point.x = 0;
+            }
+            ++point.x;
+            ++point.column;
+        }
+        if (point.inner == buffer_end)
+            continue;
+
+        uint64_t start = point.inner;
+        char seq[5] = {buffer[start - buffer_start]};
+        if (complete && start + unicode::utf8_width(seq[0]) > backlog->length) {
+            // The rest of this code point hasn't been written yet.  Index the
+            // rest provisionally and redo it once more text is appended.
+            complete = false;
+            index->indexed_until = start;
+            index->x = point.x;
+            index->column = point.column;
+        }
+
+        size_t len = make_backlog_code_point(seq, backlog, start);
+        uint64_t column = point.column;
+        int y = point.y;
+        coord_trans(&point, num_cols, seq[0], backlog->width_at(start));
+        point.inner = start + len;
+
+        if (point.y != y && seq[0] != '\n') {
+            index->points.reserve(cz::heap_allocator(), 1);
+            index->points.push({start, column});
+        }
+    }
+
+    if (complete) {
+        index->indexed_until = point.inner;
+        index->x = point.x;
+        index->column = point.column;
+    }
+}
+
+size_t wrap_index_lower_bound(Backlog_State* backlog, uint64_t inner) {
+    cz::Slice<Backlog_Wrap_Point> points = backlog->wrap_index.points;
+    size_t start = 0;
+    size_t end = points.len;
+    while (start < end) {
+        size_t mid = start + (end - start) / 2;
+        if (points[mid].index < inner)
+            start = mid + 1;
+        else
+            end = mid;
+    }
+    return start;
+}
+
+bool find_next_visual_row(Backlog_State* backlog,
+                          uint64_t inner,
+                          uint64_t end,
+                          uint64_t* row_start,
+                          uint64_t* column) {
+    bool found = false;
+
+    // Line starts are recorded after the newline so a line start at `end` counts.
+    size_t line_index = backlog->lines.upper_bound(inner);
+    if (line_index < backlog->lines.count() && backlog->lines.get(line_index) <= end) {
+        *row_start = backlog->lines.get(line_index);
+        *column = 0;
+        found = true;
+    }
+
+    size_t wrap_index = wrap_index_lower_bound(backlog, inner + 1);
+    if (wrap_index < backlog->wrap_index.points.len) {
+        Backlog_Wrap_Point point = backlog->wrap_index.points[wrap_index];
+        if (point.index < end && (!found || point.index < *row_start)) {
+            *row_start = point.index;
+            *column = point.column;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/// Get the foreground color set by an event that changes the style.
+static uint32_t event_foreground(Backlog_State* backlog, const Backlog_Event* event) {
+    switch (event->type) {
+    case BACKLOG_EVENT_START_PROCESS:
+        return cfg.backlog_fg_color;
+    case BACKLOG_EVENT_START_INPUT:
+        return cfg.prompt_fg_color;
+    case BACKLOG_EVENT_START_DIRECTORY:
+        return cfg.directory_fg_color;
+    case BACKLOG_EVENT_SET_GRAPHIC_RENDITION:
+        return backlog->styles[event->payload].foreground;
+    default:
+        CZ_PANIC("unreachable");
+    }
+}
+
 bool render_backlog(SDL_Surface* window_surface,
                     const SDL_Rect& grid_rect,
                     Render_State* rend,
@@ -479,7 +943,8 @@ bool render_backlog(SDL_Surface* window_surface,
                     cz::Slice<Backlog_State*> backlogs,
                     std::chrono::steady_clock::time_point now,
                     Backlog_State* backlog,
-                    size_t visindex) {
+                    size_t visindex,
+                    Search_State* search) {
     ZoneScoped;
     Visual_Point* point = &rend->backlog_end;
     uint64_t i = 0;
@@ -490,6 +955,12 @@ bool render_backlog(SDL_Surface* window_surface,
         point->inner = 0;
     }
 
+    // The start may have been dropped by ring retention.
+    if (i < backlog->discarded) {
+        i = backlog->discarded;
+        point->inner = i;
+    }
+
     CZ_ASSERT(point->y >= 0);
     if (point->y >= rend->grid_rows_ru)
         return false;
@@ -509,43 +980,71 @@ bool render_backlog(SDL_Surface* window_surface,
     int info_y = point->y;
     int info_x_start = (int)(rend->grid_cols - info.len);
 
-    uint8_t fg_color = cfg.backlog_fg_color;
+    uint32_t fg_color = cfg.backlog_fg_color;
+
+    // Restore the state set by the events before the first character drawn.
+    size_t event_index = backlog_events_upper_bound(backlog, i);
+    Backlog_Event_State event_state = backlog_event_state_at(backlog, event_index);
+    if (event_state.style_event != (uint64_t)-1)
+        fg_color = event_foreground(backlog, &backlog->events[event_state.style_event]);
+    bool inside_hyperlink = (event_state.hyperlink_event != (uint64_t)-1);
+    Backlog_Event_Cursor events = backlog_event_cursor(backlog, event_index);
 
-    size_t event_index = 0;
+    // Every match of the search is highlighted.  They are found as the rows are drawn.
+    bool highlighting = (search && search_highlight_start(search, backlog, i));
+    uint64_t match_start = 0, match_end = 0;
 
     uint64_t end = render_length(backlog);
-    bool inside_hyperlink = false;
+    Backlog_Spans spans = backlog_spans(backlog, i, end);
+    cz::Str span = {};
+    uint64_t span_start = i;
     while (i < end) {
-        while (event_index < backlog->events.len && backlog->events[event_index].index <= i) {
-            Backlog_Event* event = &backlog->events[event_index];
-            if (event->type == BACKLOG_EVENT_START_PROCESS) {
-                fg_color = cfg.backlog_fg_color;
-            } else if (event->type == BACKLOG_EVENT_START_INPUT) {
-                fg_color = cfg.prompt_fg_color;
-            } else if (event->type == BACKLOG_EVENT_START_DIRECTORY) {
-                fg_color = cfg.directory_fg_color;
-            } else if (event->type == BACKLOG_EVENT_SET_GRAPHIC_RENDITION) {
-                uint64_t gr = event->payload;
-                fg_color = (uint8_t)((gr & GR_FOREGROUND_MASK) >> GR_FOREGROUND_SHIFT);
-            } else if (event->type == BACKLOG_EVENT_START_HYPERLINK) {
+        for (; !events.done() && events.index <= i; events.next()) {
+            Backlog_Event* event = &backlog->events[events.event];
+            if (event->type == BACKLOG_EVENT_START_HYPERLINK) {
                 inside_hyperlink = true;
             } else if (event->type == BACKLOG_EVENT_END_HYPERLINK) {
                 inside_hyperlink = false;
             } else {
-                CZ_PANIC("unreachable");
+                fg_color = event_foreground(backlog, event);
             }
-            ++event_index;
         }
 
         Visual_Point old_point = *point;
 
+        uint32_t cp_background = background;
+        if (highlighting) {
+            if (i >= match_end) {
+                search_highlight_next(search, backlog, i, &match_start, &match_end);
+
+                // Finding the matches can load compressed chunks, which
+                // can evict the one holding `span`.  So get it again.
+                spans = backlog_spans(backlog, i, end);
+                span = {};
+                span_start = i;
+            }
+            if (i >= match_start && i < match_end)
+                cp_background = rend->search_bg_color;
+        }
+
+        // Step through the chunks a run at a time instead of going through `get`.
+        if (i >= span_start + span.len) {
+            span_start = spans.start;
+            spans.next(&span);
+        }
+
         // Get the chars that compose this code point.
-        char seq[5] = {backlog->get(i)};
-        i += make_backlog_code_point(seq, backlog, i);
+        size_t offset = i - span_start;
+        char seq[5] = {span[offset]};
+        int width = ((uint8_t)seq[0] < 0x80 ? 1 : backlog->width_at(i));
+        if (offset + unicode::utf8_width(seq[0]) <= span.len)
+            i += make_string_code_point(seq, span, offset);
+        else
+            i += make_backlog_code_point(seq, backlog, i);
 
         bool underline = (SDL_GetModState() & KMOD_CTRL) != 0 && inside_hyperlink;
-        if (!render_code_point(window_surface, grid_rect, rend, point, background, fg_color,
-                               underline, seq, true)) {
+        if (!render_code_point_width(window_surface, grid_rect, rend, point, cp_background,
+                                     fg_color, underline, seq, width, true)) {
             break;
         }
 
@@ -561,7 +1060,8 @@ bool render_backlog(SDL_Surface* window_surface,
 
     if (rend->attached_outer == visindex) {
         render_prompt(window_surface, grid_rect, rend, prompt, /*search=*/nullptr, backlogs, shell);
-    } else if (rend->backlog_end.inner == backlog->length && backlog->length > 0 &&
+    } else if (rend->backlog_end.inner == backlog->length &&
+               backlog->length > backlog->discarded &&
                backlog->get(backlog->length - 1) != '\n') {
         Visual_Point old_point = *point;
 
@@ -635,6 +1135,14 @@ void render_prompt(SDL_Surface* window_surface,
     uint32_t background = SDL_MapRGB(window_surface->format, bg_color.r, bg_color.g, bg_color.b);
 
     if (is_searching) {
+        if (search->query.len > 0 || (search->is_regex && search->regex_error)) {
+            cz::String status = {};
+            search_append_status(search, temp_allocator, &status);
+            status.reserve(temp_allocator, 1);
+            status.push(' ');
+            render_string(window_surface, grid_rect, rend, point, background,
+                          cfg.backlog_fg_color, status, true);
+        }
         render_string(window_surface, grid_rect, rend, point, background, cfg.directory_fg_color,
                       prompt->prefix, true);
     } else if (rend->attached_outer == -1) {
@@ -649,12 +1157,8 @@ void render_prompt(SDL_Surface* window_surface,
     uint32_t cursor_color =
         SDL_MapRGB(window_surface->format, prompt_fg_color.r, prompt_fg_color.g, prompt_fg_color.b);
     for (size_t i = 0; i < prompt->text.len;) {
-        bool draw_cursor = (!drawn_cursor && i >= prompt->cursor);
-        SDL_Rect cursor_rect;
-        if (draw_cursor) {
-            cursor_rect = {grid_rect.x + point->x * rend->font.width - 1,
-                           grid_rect.y + point->y * rend->font.height, 2, rend->font.height};
-            SDL_FillRect(window_surface, &cursor_rect, cursor_color);
+        if (!drawn_cursor && i >= prompt->cursor) {
+            set_cursor(rend, *point, cursor_color);
             drawn_cursor = true;
         }
 
@@ -665,11 +1169,6 @@ void render_prompt(SDL_Surface* window_surface,
         // Render this code point.
         render_code_point(window_surface, grid_rect, rend, point, background, cfg.prompt_fg_color,
                           false, seq, true);
-
-        // Draw cursor.
-        if (draw_cursor && point->x != 0) {
-            SDL_FillRect(window_surface, &cursor_rect, cursor_color);
-        }
     }
 
     // Fill rest of line.
@@ -678,10 +1177,7 @@ void render_prompt(SDL_Surface* window_surface,
                       false, "\n", true);
 
     if (prompt->cursor == prompt->text.len) {
-        // Draw cursor.
-        SDL_Rect cursor_rect = {grid_rect.x + eol.x * rend->font.width - 1,
-                                grid_rect.y + eol.y * rend->font.height, 2, rend->font.height};
-        SDL_FillRect(window_surface, &cursor_rect, cursor_color);
+        set_cursor(rend, eol, cursor_color);
     }
 
     if (prompt->history_searching) {
@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <chrono>
 #include <cz/vector.hpp>
+#include "compositor.hpp"
+#include "glyph_atlas.hpp"
 
 struct Shell_State;
 struct Prompt_State;
@@ -30,6 +32,22 @@ enum Selection_Type {
     SELECT_FINISHED,
 };
 
+/// What is drawn in a cell.  Frames are composed into `Render_State::cells`
+/// and then only the rows that changed since the last frame are drawn.
+struct Visual_Cell {
+    char seq[4];  // UTF-8 sequence to draw, zero padded.  Empty if only the background is drawn.
+    uint32_t background;
+    uint32_t foreground;  // Color from a `Backlog_Style`.
+    bool underline;
+    uint8_t wide;  // 1 / 2 if this is the left / right half of a two column glyph.
+};
+
+struct Visual_Row {
+    uint32_t tail_background;  // Background right of the last column.
+    int cursor_x;              // Column of the prompt cursor or -1.
+    uint32_t cursor_color;
+};
+
 struct Selection {
     Selection_Type type;
     Visual_Tile down, current;
@@ -39,11 +57,6 @@ struct Selection {
     bool expand_line : 1;
 };
 
-struct Surface_Cache {
-    cz::Vector<uint32_t> code_points;
-    cz::Vector<SDL_Surface*> surfaces;
-};
-
 enum Scroll_Mode {
     AUTO_PAGE,
     AUTO_SCROLL,
@@ -59,8 +72,9 @@ struct Font_State {
     int size;
     int width;
     int height;
+    int ascent;
 
-    Surface_Cache caches[256];
+    Glyph_Atlas atlas;
 };
 
 struct Window_State {
@@ -82,14 +96,29 @@ struct Render_State {
     bool grid_is_valid;
     cz::Vector<Visual_Tile> grid;
 
+    // The frame being composed and the frame on screen.
+    cz::Vector<Visual_Cell> cells;
+    cz::Vector<Visual_Row> rows;
+    cz::Vector<Visual_Cell> drawn_cells;
+    cz::Vector<Visual_Row> drawn_rows;
+    SDL_Rect drawn_rect;
+
+    // Scratch space for drawing a row.
+    cz::Vector<Composite_Span> spans;
+    cz::Vector<uint32_t> row_pixels;
+
     bool complete_redraw;
 
+    // The info line of a running script is on screen.
+    bool info_animating;
+
     Visual_Point backlog_start;  // First point that was drawn
     Visual_Point backlog_end;    // Last point that was drawn
 
     Scroll_Mode scroll_mode;
 
     Selection selection;
+    uint32_t search_bg_color;  // Background of the search matches that aren't selected.
 
     // We want to be able to change the order to be different than the
     // order the processes were ran in.  So store the visual order here,
@@ -105,14 +134,24 @@ void init_font(Font_State* font, double dpi_scale);
 void close_font(Font_State* font);
 void resize_font(int font_size, double dpi_scale, Font_State* font);
 
-int coord_trans(Visual_Point* point, int num_cols, char ch);
+/// Advance `point` past a code point starting with `ch`.  `width` is its
+/// display width (see `Backlog_State::width_at`) and is ignored for tabs and newlines.
+int coord_trans(Visual_Point* point, int num_cols, char ch, int width);
+
+/// Start composing a frame.  Everything is redrawn if the pane moved or was resized.
+void begin_frame(SDL_Surface* window_surface, const SDL_Rect& grid_rect, Render_State* rend);
+/// Draw the rows that changed since the last frame and add their rectangles to `updated_rects`.
+void draw_frame(SDL_Surface* window_surface,
+                const SDL_Rect& grid_rect,
+                Render_State* rend,
+                cz::Vector<SDL_Rect>* updated_rects);
 
 bool render_code_point(SDL_Surface* window_surface,
                        const SDL_Rect& grid_rect,
                        Render_State* rend,
                        Visual_Point* point,
                        uint32_t background,
-                       uint8_t foreground,
+                       uint32_t foreground,
                        bool underline,
                        const char seq[5],
                        bool set_tile);
@@ -132,7 +171,8 @@ bool render_backlog(SDL_Surface* window_surface,
                     cz::Slice<Backlog_State*> backlogs,
                     std::chrono::steady_clock::time_point now,
                     Backlog_State* backlog,
-                    size_t visindex);
+                    size_t visindex,
+                    Search_State* search);
 void render_prompt(SDL_Surface* window_surface,
                    const SDL_Rect& grid_rect,
                    Render_State* rend,
@@ -143,3 +183,16 @@ void render_prompt(SDL_Surface* window_surface,
 
 size_t make_backlog_code_point(char sequence[5], Backlog_State* backlog, size_t start);
 uint64_t render_length(Backlog_State* backlog);
+
+/// Bring `backlog->wrap_index` up to date for the given width.  The index
+/// is rebuilt from scratch when the width or `cfg.tab_width` changes.
+void update_wrap_index(Backlog_State* backlog, int num_cols);
+/// Find the first wrap point at or after `inner`.
+size_t wrap_index_lower_bound(Backlog_State* backlog, uint64_t inner);
+/// Find the start of the first visual row after `inner` that starts at or before `end`.
+/// `column` is set to the column of the first character on that row.
+bool find_next_visual_row(Backlog_State* backlog,
+                          uint64_t inner,
+                          uint64_t end,
+                          uint64_t* row_start,
+                          uint64_t* column);
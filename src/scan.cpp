@@ -0,0 +1,205 @@
+#include "scan.hpp"
+
+#include <cz/heap.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define SCAN_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if SCAN_SSE2 && (defined(__GNUC__) || defined(__clang__))
+#define SCAN_AVX2 1
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility
+///////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t count_trailing_zeros(uint32_t mask) {
+    CZ_DEBUG_ASSERT(mask != 0);
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static inline uint32_t count_ones(uint32_t mask) {
+#ifdef _MSC_VER
+    uint32_t count = 0;
+    for (; mask; mask &= mask - 1)
+        ++count;
+    return count;
+#else
+    return __builtin_popcount(mask);
+#endif
+}
+
+/// Push a line start for each bit set in `newlines`.
+static inline void push_lines(Line_Index* lines, uint64_t base, uint32_t newlines) {
+    if (!newlines)
+        return;
+    lines->offsets.reserve(cz::heap_allocator(), count_ones(newlines));
+    for (; newlines; newlines &= newlines - 1) {
+        lines->push(base + count_trailing_zeros(newlines) + 1);
+    }
+}
+
+/// Mask of bits below the first bit set in `special`.
+static inline uint32_t mask_before(uint32_t special) {
+    return (special & (0 - special)) - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar
+///////////////////////////////////////////////////////////////////////////////
+
+enum : uint8_t {
+    SCAN_NORMAL = 0,
+    SCAN_NEWLINE = 1,
+    SCAN_SPECIAL = 2,
+};
+
+// clang-format off
+static const uint8_t scan_classes[256] = {
+    //  0  1  2  3  4  5  6  7   8  9  a  b  c  d  e  f
+        0, 0, 0, 0, 0, 0, 0, 2,  2, 0, 1, 0, 0, 2, 0, 0,  // 0x00
+        0, 0, 0, 0, 0, 0, 0, 0,  0, 0, 0, 2, 0, 0, 0, 0,  // 0x10
+};
+// clang-format on
+
+size_t scan_text_scalar(cz::Str text, uint64_t base, Line_Index* lines) {
+    const uint8_t* buffer = (const uint8_t*)text.buffer;
+    for (size_t i = 0; i < text.len; ++i) {
+        uint8_t cls = scan_classes[buffer[i]];
+        if (cls == SCAN_NORMAL)
+            continue;
+        if (cls == SCAN_SPECIAL)
+            return i;
+        lines->push(base + i + 1);
+    }
+    return text.len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SSE2
+///////////////////////////////////////////////////////////////////////////////
+
+#if SCAN_SSE2
+static size_t scan_text_sse2(cz::Str text, uint64_t base, Line_Index* lines) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i carriage_return = _mm_set1_epi8('\r');
+    const __m128i escape = _mm_set1_epi8(0x1b);
+    const __m128i backspace = _mm_set1_epi8(0x08);
+    const __m128i alarm = _mm_set1_epi8('\a');
+
+    size_t i = 0;
+    for (; i + 16 <= text.len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(text.buffer + i));
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, carriage_return), _mm_cmpeq_epi8(block, escape)),
+            _mm_or_si128(_mm_cmpeq_epi8(block, backspace), _mm_cmpeq_epi8(block, alarm)));
+        uint32_t special_mask = (uint32_t)_mm_movemask_epi8(special);
+        uint32_t newline_mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+
+        if (special_mask) {
+            push_lines(lines, base + i, newline_mask & mask_before(special_mask));
+            return i + count_trailing_zeros(special_mask);
+        }
+        push_lines(lines, base + i, newline_mask);
+    }
+
+    return i + scan_text_scalar(text.slice_start(i), base + i, lines);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX2
+///////////////////////////////////////////////////////////////////////////////
+
+#if SCAN_AVX2
+__attribute__((target("avx2"))) static size_t scan_text_avx2(cz::Str text,
+                                                             uint64_t base,
+                                                             Line_Index* lines) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i carriage_return = _mm256_set1_epi8('\r');
+    const __m256i escape = _mm256_set1_epi8(0x1b);
+    const __m256i backspace = _mm256_set1_epi8(0x08);
+    const __m256i alarm = _mm256_set1_epi8('\a');
+
+    size_t i = 0;
+    for (; i + 32 <= text.len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(text.buffer + i));
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, carriage_return),
+                            _mm256_cmpeq_epi8(block, escape)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, backspace), _mm256_cmpeq_epi8(block, alarm)));
+        uint32_t special_mask = (uint32_t)_mm256_movemask_epi8(special);
+        uint32_t newline_mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline));
+
+        if (special_mask) {
+            push_lines(lines, base + i, newline_mask & mask_before(special_mask));
+            return i + count_trailing_zeros(special_mask);
+        }
+        push_lines(lines, base + i, newline_mask);
+    }
+
+    return i + scan_text_sse2(text.slice_start(i), base + i, lines);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Dispatch
+///////////////////////////////////////////////////////////////////////////////
+
+typedef size_t (*Scan_Function)(cz::Str, uint64_t, Line_Index*);
+
+static Scan_Function pick_scan_function() {
+#if SCAN_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return scan_text_avx2;
+#endif
+#if SCAN_SSE2
+    return scan_text_sse2;
+#else
+    return scan_text_scalar;
+#endif
+}
+
+size_t scan_text(cz::Str text, uint64_t base, Line_Index* lines) {
+    static const Scan_Function function = pick_scan_function();
+    return function(text, base, lines);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ASCII runs
+///////////////////////////////////////////////////////////////////////////////
+
+size_t scan_ascii(cz::Str text) {
+    const uint8_t* buffer = (const uint8_t*)text.buffer;
+    size_t i = 0;
+
+#if SCAN_SSE2
+    // The high bit of each byte is set iff it isn't ASCII.
+    for (; i + 16 <= text.len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(buffer + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(block);
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+#endif
+
+    for (; i < text.len; ++i) {
+        if (buffer[i] & 0x80)
+            return i;
+    }
+    return text.len;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <cz/string.hpp>
+#include "line_index.hpp"
+
+/// Scan `text` for the first byte that `append_text` has to handle specially
+/// (`\r`, `ESC`, `\b`, or `\a`).  Every `\n` before that byte is recorded by
+/// pushing the index of the start of the next line (`base + offset + 1`) to `lines`.
+///
+/// Returns the offset of the special byte or `text.len` if there isn't one.
+///
+/// Uses AVX2 or SSE2 when available, falling back to `scan_text_scalar`.
+size_t scan_text(cz::Str text, uint64_t base, Line_Index* lines);
+
+/// Portable version of `scan_text`.  Exposed for the tests and benchmarks.
+size_t scan_text_scalar(cz::Str text, uint64_t base, Line_Index* lines);
+
+/// Length of the run of ASCII bytes at the start of `text`.  Uses SSE2 when available.
+size_t scan_ascii(cz::Str text);
@@ -0,0 +1,724 @@
+#include "search.hpp"
+
+#include <string.h>
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+#include <tracy/Tracy.hpp>
+#include "backlog.hpp"
+#include "backlog_compress.hpp"
+#include "backlog_index.hpp"
+#include "backlog_search.hpp"
+#include "work_pool.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Configuration
+///////////////////////////////////////////////////////////////////////////////
+
+#define OUTER_INDEX(index) ((index) >> BACKLOG_BUFFER_SHIFT)
+#define INNER_INDEX(index) ((index) & (BACKLOG_BUFFER_SIZE - 1))
+
+/// Matches starting in this many bytes are found by each task.
+#define SEARCH_TASK_SIZE ((uint64_t)1 << 20)
+
+/// Matches to highlight are found in windows of this many bytes.
+#define HIGHLIGHT_WINDOW 1024
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Data
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+/// Where the workers read a chunk from.  The backlogs themselves are only touched by the
+/// main thread, which is blocked in `work_pool_run` while the workers read these.
+struct Search_Chunk {
+    const char* buffer;  // Null if the chunk is compressed.
+    const char* block;
+    bool skip;  // The index rules out matches starting in the chunk.
+};
+
+/// The part of a backlog that hasn't been searched yet.
+struct Search_Source {
+    uint64_t first;  // Absolute index of the start of `chunks[0]`.
+    uint64_t length;
+    cz::Vector<Search_Chunk> chunks;
+};
+
+struct Search_Task {
+    size_t source;
+    uint64_t start;  // Find the matches starting in `[start, end)`.
+    uint64_t end;
+    cz::Vector<uint64_t> found;
+    bool truncated;
+};
+
+struct Search_Scratch {
+    cz::String text;
+    char* chunk;  // Compressed chunks are decompressed here.
+};
+
+struct Search_Job {
+    cz::Str query;
+    cz::Slice<Search_Source> sources;
+    cz::Slice<Search_Task> tasks;
+    cz::Slice<Search_Scratch> scratch;  // One per thread.
+};
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - worker
+///////////////////////////////////////////////////////////////////////////////
+
+/// Get the text of a chunk.  Compressed chunks are decompressed into `scratch->chunk`.
+static const char* chunk_text(Search_Chunk chunk, Search_Scratch* scratch) {
+    if (chunk.buffer)
+        return chunk.buffer;
+    if (!scratch->chunk)
+        scratch->chunk = (char*)cz::heap_allocator().alloc({BACKLOG_BUFFER_SIZE, 1});
+    CZ_ASSERT(scratch->chunk);
+    backlog_compress_decompress(chunk.block, scratch->chunk);
+    return scratch->chunk;
+}
+
+/// Copy `[start, end)` into `scratch->text`.
+static void copy_source(Search_Source* source,
+                        uint64_t start,
+                        uint64_t end,
+                        Search_Scratch* scratch) {
+    scratch->text.len = 0;
+    scratch->text.reserve(cz::heap_allocator(), end - start);
+    for (uint64_t index = start; index < end;) {
+        Search_Chunk chunk = source->chunks[OUTER_INDEX(index - source->first)];
+        size_t inner = INNER_INDEX(index);
+        size_t len = cz::min((uint64_t)(BACKLOG_BUFFER_SIZE - inner), end - index);
+        scratch->text.append({chunk_text(chunk, scratch) + inner, len});
+        index += len;
+    }
+}
+
+/// Record the matches in `text`, which starts at `base`, that start before `end`.
+/// Returns `false` if the task has found too many matches.
+static bool find_matches(Search_Task* task,
+                         cz::Str text,
+                         uint64_t base,
+                         uint64_t end,
+                         cz::Str query) {
+    for (size_t offset = 0;;) {
+        const char* match = search_text(text.slice_start(offset), query);
+        if (!match)
+            return true;
+        size_t at = match - text.buffer;
+        if (base + at >= end)
+            return true;
+
+        if (task->found.len == SEARCH_MAX_MATCHES) {
+            task->truncated = true;
+            return false;
+        }
+        task->found.reserve(cz::heap_allocator(), 1);
+        task->found.push(base + at);
+        offset = at + 1;
+    }
+}
+
+static void run_search_task(void* context, size_t t, size_t thread) {
+    ZoneScoped;
+
+    Search_Job* job = (Search_Job*)context;
+    Search_Task* task = &job->tasks[t];
+    Search_Source* source = &job->sources[task->source];
+    Search_Scratch* scratch = &job->scratch[thread];
+    cz::Str query = job->query;
+
+    for (uint64_t index = task->start; index < task->end;) {
+        uint64_t chunk_end = cz::min(index - INNER_INDEX(index) + BACKLOG_BUFFER_SIZE,
+                                     source->length);
+        uint64_t end = cz::min(chunk_end, task->end);
+
+        Search_Chunk chunk = source->chunks[OUTER_INDEX(index - source->first)];
+        if (chunk.skip) {
+            index = end;
+            continue;
+        }
+
+        // Matches inside the chunk are searched for in place.
+        const char* buffer = chunk_text(chunk, scratch) + INNER_INDEX(index);
+        cz::Str text = {buffer, (size_t)(chunk_end - index)};
+        if (!find_matches(task, text, index, end, query))
+            return;
+
+        // Matches that cross into the next chunk are searched for in a copy.
+        uint64_t cross = index;
+        if (chunk_end - index > query.len - 1)
+            cross = chunk_end - (query.len - 1);
+        if (cross < end) {
+            copy_source(source, cross, cz::min(end + query.len - 1, source->length), scratch);
+            if (!find_matches(task, scratch->text, cross, end, query))
+                return;
+        }
+
+        index = end;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - refreshing
+///////////////////////////////////////////////////////////////////////////////
+
+static void drop_matches(Search_Matches* matches) {
+    matches->indices.drop(cz::heap_allocator());
+}
+
+static uint64_t last_line_start(Backlog_State* backlog) {
+    return (backlog->lines.count() > 0 ? backlog->lines.last() : backlog->discarded);
+}
+
+void search_drop_matches(Search_State* search) {
+    for (size_t i = 0; i < search->matches.len; ++i)
+        drop_matches(&search->matches[i]);
+    search->matches.drop(cz::heap_allocator());
+    search->query.drop(cz::heap_allocator());
+    search->total_matches = 0;
+    search->truncated = false;
+}
+
+static bool matches_line_up(Search_State* search, cz::Slice<Backlog_State*> visbacklogs) {
+    if (search->matches.len != visbacklogs.len)
+        return false;
+    for (size_t i = 0; i < visbacklogs.len; ++i) {
+        if (search->matches[i].backlog != visbacklogs[i] ||
+            search->matches[i].id != visbacklogs[i]->id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Put the matches in the same order as `visbacklogs`.  Backlogs that
+/// were searched before keep their matches.  New ones start empty.
+static void line_up_matches(Search_State* search, cz::Slice<Backlog_State*> visbacklogs) {
+    cz::Vector<Search_Matches> old = search->matches;
+    search->matches = {};
+    search->matches.reserve_exact(cz::heap_allocator(), visbacklogs.len);
+
+    for (size_t i = 0; i < visbacklogs.len; ++i) {
+        Backlog_State* backlog = visbacklogs[i];
+        Search_Matches matches = {};
+        matches.backlog = backlog;
+        matches.id = backlog->id;
+        matches.rewrites = backlog->rewrites;
+        matches.line_start = last_line_start(backlog);
+        for (size_t j = 0; j < old.len; ++j) {
+            if (old[j].backlog == backlog && old[j].id == backlog->id) {
+                matches = old[j];
+                old[j].backlog = nullptr;
+                old[j].indices = {};
+                break;
+            }
+        }
+        search->matches.push(matches);
+    }
+
+    for (size_t j = 0; j < old.len; ++j)
+        drop_matches(&old[j]);
+    old.drop(cz::heap_allocator());
+}
+
+/// Resolve the chunks holding `[start, backlog->length)` for the workers.  `bits` are
+/// the trigrams of the query (see `backlog_index_query`) used to mark chunks to skip.
+static void make_source(Backlog_State* backlog,
+                        uint64_t start,
+                        cz::Slice<const uint32_t> bits,
+                        Search_Source* source) {
+    source->first = start - INNER_INDEX(start);
+    source->length = backlog->length;
+    source->chunks = {};
+    size_t first_outer = OUTER_INDEX(source->first - backlog->discarded);
+    size_t end_outer = OUTER_INDEX(backlog->length - 1 - backlog->discarded) + 1;
+    source->chunks.reserve_exact(cz::heap_allocator(), end_outer - first_outer);
+    for (size_t outer = first_outer; outer < end_outer; ++outer) {
+        Search_Chunk chunk = {};
+        chunk.skip = !backlog_index_may_match(backlog, outer, bits);
+        chunk.buffer = backlog->buffers[outer];
+        if (!chunk.buffer) {
+            if (backlog->compressed[outer]) {
+                chunk.block = backlog->compressed[outer];
+            } else {
+                // Map in the spilled chunk.  Mapped chunks stay valid until the end of the frame.
+                uint64_t index = backlog->discarded + (uint64_t)outer * BACKLOG_BUFFER_SIZE;
+                chunk.buffer = backlog->buffer_at(index);
+            }
+        }
+        source->chunks.push(chunk);
+    }
+}
+
+void search_refresh(Search_State* search, cz::Slice<Backlog_State*> visbacklogs, cz::Str query) {
+    // Regex matches are found as the search steps instead.
+    if (search->is_regex)
+        query = {};
+
+    ZoneScoped;
+
+    // A new query starts over.
+    if (search->query != query) {
+        search_drop_matches(search);
+        search->query = query.clone(cz::heap_allocator());
+    }
+    if (query.len == 0)
+        return;
+
+    if (!matches_line_up(search, visbacklogs))
+        line_up_matches(search, visbacklogs);
+
+    for (size_t i = 0; i < search->matches.len; ++i) {
+        Search_Matches* matches = &search->matches[i];
+        Backlog_State* backlog = matches->backlog;
+
+        // Forget the matches that touch rewritten output and search it again.
+        if (matches->rewrites != backlog->rewrites) {
+            uint64_t from = matches->line_start - cz::min(matches->line_start, query.len - 1);
+            while (matches->indices.len > 0 && matches->indices.last() >= from)
+                matches->indices.pop();
+            matches->searched_until = cz::min(matches->searched_until, from);
+        }
+        matches->rewrites = backlog->rewrites;
+        matches->line_start = last_line_start(backlog);
+
+        // Forget the matches in output that ring retention dropped.
+        uint64_t discarded = backlog->discarded;
+        size_t dropped = 0;
+        while (dropped < matches->indices.len && matches->indices[dropped] < discarded)
+            ++dropped;
+        matches->indices.remove_range(0, dropped);
+        matches->searched_until = cz::max(matches->searched_until, discarded);
+    }
+
+    // Split the new output into tasks.  Matches can't start in the last
+    // `query.len - 1` bytes so they are left for when there is more output.
+    cz::Vector<Search_Source> sources = {};
+    cz::Vector<Search_Task> tasks = {};
+    cz::Vector<size_t> source_matches = {};  // The `matches` each source is for.
+    cz::Vector<uint32_t> bits = {};
+    backlog_index_query(query, &bits);
+    if (!search->truncated) {
+        for (size_t i = 0; i < search->matches.len; ++i) {
+            Search_Matches* matches = &search->matches[i];
+            Backlog_State* backlog = matches->backlog;
+            if (backlog->length < query.len)
+                continue;
+            uint64_t until = backlog->length - query.len + 1;
+            if (matches->searched_until >= until)
+                continue;
+
+            Search_Source source;
+            make_source(backlog, matches->searched_until, bits, &source);
+            sources.reserve(cz::heap_allocator(), 1);
+            sources.push(source);
+            source_matches.reserve(cz::heap_allocator(), 1);
+            source_matches.push(i);
+
+            for (uint64_t start = matches->searched_until; start < until;) {
+                Search_Task task = {};
+                task.source = sources.len - 1;
+                task.start = start;
+                task.end = cz::min(start + SEARCH_TASK_SIZE, until);
+                tasks.reserve(cz::heap_allocator(), 1);
+                tasks.push(task);
+                start = task.end;
+            }
+        }
+    }
+
+    if (tasks.len > 0) {
+        cz::Vector<Search_Scratch> scratch = {};
+        scratch.reserve_exact(cz::heap_allocator(), work_pool_threads());
+        for (size_t i = 0; i < work_pool_threads(); ++i)
+            scratch.push({});
+
+        Search_Job job;
+        job.query = query;
+        job.sources = sources;
+        job.tasks = tasks;
+        job.scratch = scratch;
+        work_pool_run(tasks.len, run_search_task, &job);
+
+        for (size_t i = 0; i < scratch.len; ++i) {
+            scratch[i].text.drop(cz::heap_allocator());
+            if (scratch[i].chunk)
+                cz::heap_allocator().dealloc({scratch[i].chunk, BACKLOG_BUFFER_SIZE});
+        }
+        scratch.drop(cz::heap_allocator());
+    }
+
+    // The tasks are in order so the matches just have to be appended.  Once the
+    // list is truncated the matches after it are dropped so it is still in order.
+    for (size_t t = 0; t < tasks.len; ++t) {
+        Search_Task* task = &tasks[t];
+        Search_Matches* matches = &search->matches[source_matches[task->source]];
+        if (!search->truncated) {
+            size_t room = SEARCH_MAX_MATCHES - search->total_matches;
+            size_t count = cz::min(task->found.len, room);
+            matches->indices.reserve(cz::heap_allocator(), count);
+            matches->indices.append(task->found.slice_end(count));
+            search->total_matches += count;
+            matches->searched_until = task->end;
+            if (task->truncated || count < task->found.len) {
+                // Only the matches up to the last one kept have been found.
+                search->truncated = true;
+                matches->searched_until = (count > 0 ? task->found[count - 1] + 1 : task->start);
+            }
+        }
+        task->found.drop(cz::heap_allocator());
+    }
+
+    for (size_t i = 0; i < sources.len; ++i)
+        sources[i].chunks.drop(cz::heap_allocator());
+    sources.drop(cz::heap_allocator());
+    tasks.drop(cz::heap_allocator());
+    source_matches.drop(cz::heap_allocator());
+    bits.drop(cz::heap_allocator());
+
+    // Matches could have been dropped above so recount.
+    search->total_matches = 0;
+    for (size_t i = 0; i < search->matches.len; ++i)
+        search->total_matches += search->matches[i].indices.len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - stepping
+///////////////////////////////////////////////////////////////////////////////
+
+/// Find the first index in `indices` that is `>= index`.
+static size_t lower_bound(const cz::Vector<uint64_t>& indices, uint64_t index) {
+    size_t start = 0;
+    size_t end = indices.len;
+    while (start < end) {
+        size_t mid = start + (end - start) / 2;
+        if (indices[mid] < index)
+            start = mid + 1;
+        else
+            end = mid;
+    }
+    return start;
+}
+
+/// Has every match starting before `index` been found?
+static bool searched_before(const Search_Matches* matches, size_t query_len, uint64_t index) {
+    Backlog_State* backlog = matches->backlog;
+    uint64_t until = (backlog->length >= query_len ? backlog->length - query_len + 1 : 0);
+    return matches->searched_until >= cz::min(index, until);
+}
+
+bool search_step(Search_State* search, bool is_forward, uint64_t* outer, uint64_t* inner) {
+    size_t query_len = search->query.len;
+    if (is_forward) {
+        for (uint64_t o = *outer; o < search->matches.len; ++o) {
+            const Search_Matches* matches = &search->matches[o];
+            size_t i = (o == *outer ? lower_bound(matches->indices, *inner + 1) : 0);
+            if (i < matches->indices.len) {
+                *outer = o;
+                *inner = matches->indices[i];
+                return true;
+            }
+            if (!searched_before(matches, query_len, (uint64_t)-1))
+                return false;
+        }
+        return false;
+    }
+
+    for (uint64_t o = cz::min(*outer + 1, (uint64_t)search->matches.len); o-- > 0;) {
+        const Search_Matches* matches = &search->matches[o];
+        uint64_t limit = (o == *outer ? *inner : (uint64_t)-1);
+        if (!searched_before(matches, query_len, limit))
+            return false;
+        size_t i = lower_bound(matches->indices, limit);
+        if (i > 0) {
+            *outer = o;
+            *inner = matches->indices[i - 1];
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t search_match_number(Search_State* search, uint64_t outer, uint64_t inner) {
+    if (outer >= search->matches.len)
+        return 0;
+
+    size_t number = 0;
+    for (size_t o = 0; o < outer; ++o)
+        number += search->matches[o].indices.len;
+
+    const cz::Vector<uint64_t>& indices = search->matches[outer].indices;
+    size_t i = lower_bound(indices, inner);
+    if (i == indices.len || indices[i] != inner)
+        return 0;
+    return number + i + 1;
+}
+
+/// Append `number` with commas between every three digits.
+static void append_number(cz::Allocator allocator, cz::String* string, size_t number) {
+    char digits[32];
+    size_t len = 0;
+    do {
+        if (len % 4 == 3)
+            digits[len++] = ',';
+        digits[len++] = '0' + number % 10;
+        number /= 10;
+    } while (number > 0);
+
+    string->reserve(allocator, len);
+    while (len > 0)
+        string->push(digits[--len]);
+}
+
+static void append_str(cz::Allocator allocator, cz::String* string, cz::Str str) {
+    string->reserve(allocator, str.len);
+    string->append(str);
+}
+
+void search_append_status(Search_State* search, cz::Allocator allocator, cz::String* string) {
+    if (search->is_regex) {
+        if (search->regex_error)
+            append_str(allocator, string, search->regex_error);
+        return;
+    }
+
+    size_t number = search_match_number(search, search->outer, search->inner);
+    if (number > 0) {
+        append_str(allocator, string, "match ");
+        append_number(allocator, string, number);
+        append_str(allocator, string, " / ");
+    }
+    append_number(allocator, string, search->total_matches);
+    if (search->truncated)
+        append_str(allocator, string, "+");
+    if (number == 0)
+        append_str(allocator, string, search->total_matches == 1 ? " match" : " matches");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - regex
+///////////////////////////////////////////////////////////////////////////////
+
+bool search_update_regex(Search_State* search, cz::Str pattern) {
+    if (search->regex_pattern.len > 0 && search->regex_pattern == pattern)
+        return !search->regex_error;
+
+    search->regex_pattern.len = 0;
+    search->regex_pattern.reserve_exact(cz::heap_allocator(), pattern.len);
+    search->regex_pattern.append(pattern);
+
+    search->regex_error = nullptr;
+    return regex_compile(&search->regex, pattern, 0, &search->regex_error);
+}
+
+void search_drop_regex(Search_State* search) {
+    regex_drop(&search->regex);
+    search->regex_pattern.drop(cz::heap_allocator());
+    search->regex_error = nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - highlighting
+///////////////////////////////////////////////////////////////////////////////
+
+static void drop_highlights(Search_Highlights* highlights) {
+    highlights->ranges.drop(cz::heap_allocator());
+}
+
+void search_drop_highlights(Search_State* search) {
+    for (size_t i = 0; i < search->highlights.len; ++i)
+        drop_highlights(&search->highlights[i]);
+    search->highlights.drop(cz::heap_allocator());
+    search->highlight_query.drop(cz::heap_allocator());
+}
+
+/// Start over if the query changed.  Returns `false` if there is nothing to highlight.
+static bool update_highlight_query(Search_State* search) {
+    cz::Str query = search->prompt.text;
+    if (search->highlight_query != query || search->highlight_regex != search->is_regex) {
+        for (size_t i = 0; i < search->highlights.len; ++i)
+            drop_highlights(&search->highlights[i]);
+        search->highlights.len = 0;
+        search->highlight_query.len = 0;
+        search->highlight_query.reserve_exact(cz::heap_allocator(), query.len);
+        search->highlight_query.append(query);
+        search->highlight_regex = search->is_regex;
+    }
+
+    if (query.len == 0)
+        return false;
+    return !search->is_regex || search_update_regex(search, query);
+}
+
+static void reset_highlights(Search_Highlights* highlights,
+                             Backlog_State* backlog,
+                             uint64_t start) {
+    highlights->rewrites = backlog->rewrites;
+    highlights->length = backlog->length;
+    highlights->start = start;
+    highlights->until = start;
+    highlights->scanned = start;
+    highlights->ranges.len = 0;
+    highlights->cursor = 0;
+}
+
+static Search_Highlights* find_highlights(Search_State* search, Backlog_State* backlog) {
+    for (size_t i = 0; i < search->highlights.len; ++i) {
+        Search_Highlights* highlights = &search->highlights[i];
+        if (highlights->backlog == backlog && highlights->id == backlog->id)
+            return highlights;
+    }
+
+    Search_Highlights highlights = {};
+    highlights.backlog = backlog;
+    highlights.id = backlog->id;
+    reset_highlights(&highlights, backlog, backlog->discarded);
+    search->highlights.reserve(cz::heap_allocator(), 1);
+    search->highlights.push(highlights);
+    return &search->highlights.last();
+}
+
+/// Where to look for the matches that could cover `index`.
+static uint64_t highlight_scan_start(Search_State* search,
+                                     Backlog_State* backlog,
+                                     uint64_t index) {
+    uint64_t back;
+    if (search->is_regex) {
+        // Regex matches don't span lines.  Long lines are only looked back on a window.
+        size_t line = backlog->lines.upper_bound(index);
+        uint64_t line_start = (line == 0 ? 0 : backlog->lines.get(line - 1));
+        back = cz::min(index - cz::min(line_start, index), (uint64_t)HIGHLIGHT_WINDOW);
+    } else {
+        back = cz::min(index, (uint64_t)search->highlight_query.len - 1);
+    }
+    return cz::max(index - back, backlog->discarded);
+}
+
+/// Add a match.  Overlapping and touching matches are merged.
+static void add_highlight(Search_Highlights* highlights, uint64_t start, uint64_t end) {
+    // Empty regex matches aren't drawn.
+    if (start == end)
+        return;
+
+    if (highlights->ranges.len > 0 && start <= highlights->ranges.last().end) {
+        Search_Range* last = &highlights->ranges.last();
+        last->end = cz::max(last->end, end);
+        return;
+    }
+
+    highlights->ranges.reserve(cz::heap_allocator(), 1);
+    highlights->ranges.push({start, end});
+}
+
+/// Find the matches starting in the next window of text.
+static void scan_highlights(Search_State* search,
+                            Search_Highlights* highlights,
+                            Backlog_State* backlog) {
+    ZoneScoped;
+
+    cz::Str query = search->highlight_query;
+    uint64_t from = highlights->scanned;
+    uint64_t to = cz::min(from + HIGHLIGHT_WINDOW, backlog->length);
+    uint64_t limit;  // Matches starting before this can't change.
+    if (search->is_regex) {
+        // Regex matches can run to the end of their line.  Like the look back in
+        // `highlight_scan_start`, only read a window past the matches on long lines.
+        Regex* regex = &search->regex;
+        uint64_t stop = cz::min(to + HIGHLIGHT_WINDOW, backlog->length);
+        uint64_t start, end;
+        for (uint64_t index = from;
+             index < to &&
+             regex_search_forward_before(regex, backlog, index, to, stop, &start, &end);
+             index = cz::max(end, start + 1)) {
+            add_highlight(highlights, start, end);
+        }
+
+        // Matches in the last line can grow until it ends.
+        limit = backlog->length;
+        if (!backlog->done && backlog->lines.count() > 0)
+            limit = cz::min(limit, backlog->lines.last());
+        else if (!backlog->done)
+            limit = backlog->discarded;
+    } else {
+        uint64_t index;
+        for (uint64_t start = from;
+             start < to && backlog_search_forward(backlog, start,
+                                                  cz::min(to + query.len - 1, backlog->length),
+                                                  query, &index);
+             start = index + 1) {
+            add_highlight(highlights, index, index + query.len);
+        }
+
+        // Matches that continue into output that hasn't been read yet aren't found.
+        limit = (backlog->length >= query.len ? backlog->length - query.len + 1 : 0);
+    }
+
+    if (highlights->until == from)
+        highlights->until = cz::max(from, cz::min(to, limit));
+    highlights->scanned = to;
+    highlights->length = backlog->length;
+}
+
+bool search_highlight_start(Search_State* search, Backlog_State* backlog, uint64_t index) {
+    if (!update_highlight_query(search))
+        return false;
+
+    Search_Highlights* highlights = find_highlights(search, backlog);
+    uint64_t from = highlight_scan_start(search, backlog, index);
+    if (highlights->rewrites != backlog->rewrites || from < highlights->start ||
+        from > highlights->scanned) {
+        reset_highlights(highlights, backlog, from);
+        return true;
+    }
+
+    // New output can change the matches at the end.
+    if (highlights->length != backlog->length) {
+        cz::Vector<Search_Range>* ranges = &highlights->ranges;
+        while (ranges->len > 0 && ranges->last().start >= highlights->until)
+            ranges->pop();
+        highlights->scanned = highlights->until;
+        highlights->length = backlog->length;
+    }
+
+    // Forget the matches that scrolled off the top of the screen.
+    size_t above = 0;
+    while (above < highlights->ranges.len && highlights->ranges[above].end <= index)
+        ++above;
+    highlights->ranges.remove_range(0, above);
+    highlights->start = from;
+    highlights->cursor = 0;
+    return true;
+}
+
+void search_highlight_next(Search_State* search,
+                           Backlog_State* backlog,
+                           uint64_t index,
+                           uint64_t* start,
+                           uint64_t* end) {
+    Search_Highlights* highlights = find_highlights(search, backlog);
+    while (1) {
+        for (; highlights->cursor < highlights->ranges.len; ++highlights->cursor) {
+            Search_Range range = highlights->ranges[highlights->cursor];
+            if (range.end > index) {
+                *start = range.start;
+                *end = range.end;
+                return;
+            }
+        }
+
+        // Every match starting before `scanned` has been found.
+        if (highlights->scanned >= backlog->length) {
+            *start = *end = (uint64_t)-1;
+            return;
+        }
+        if (index < highlights->scanned) {
+            *start = *end = highlights->scanned;
+            return;
+        }
+        scan_highlights(search, highlights, backlog);
+    }
+}
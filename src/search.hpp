@@ -1,5 +1,54 @@
 #pragma once
 
+#include <stdint.h>
+#include <cz/slice.hpp>
+#include <cz/string.hpp>
+#include <cz/vector.hpp>
+#include "prompt.hpp"
+#include "regex.hpp"
+
+struct Backlog_State;
+
+/// Stop recording matches after this many.  Bounds the memory used by searching for `e`.
+#define SEARCH_MAX_MATCHES (1 << 20)
+
+/// The matches of the query in one backlog.
+struct Search_Matches {
+    Backlog_State* backlog;
+    uint64_t id;
+    uint64_t searched_until;        // Every match starting before this has been found.
+    cz::Vector<uint64_t> indices;  // Sorted.
+
+    /// Output is only rewritten (ie by '\r') back to the start of the line being written.
+    /// So when `Backlog_State::rewrites` changes, the text from `line_start` on is searched
+    /// again.
+    uint64_t rewrites;    // `Backlog_State::rewrites` when the matches were updated.
+    uint64_t line_start;  // Start of the last line when the matches were updated.
+};
+
+/// A run of text inside matches.
+struct Search_Range {
+    uint64_t start;
+    uint64_t end;
+};
+
+/// The matches in the part of a backlog that is on screen.  They are found as the rows are
+/// drawn and kept between frames so text that stays on screen isn't scanned again.
+struct Search_Highlights {
+    Backlog_State* backlog;
+    uint64_t id;
+    uint64_t rewrites;  // `Backlog_State::rewrites` when the text was scanned.
+    uint64_t length;    // `Backlog_State::length` when the text was scanned.
+
+    /// Every match starting in `[start, until)` is in `ranges`.  Matches starting in
+    /// `[until, scanned)` can still change so they are found again once there is more output.
+    uint64_t start;
+    uint64_t until;
+    uint64_t scanned;
+    cz::Vector<Search_Range> ranges;  // Sorted and disjoint.  Overlapping matches are merged.
+    size_t cursor;                    // First range `search_highlight_next` can return.
+};
+
 struct Search_State {
     bool is_searching;
     bool default_forwards;
@@ -7,4 +56,67 @@ struct Search_State {
     Prompt_State prompt;
 
     uint64_t outer, inner;
+
+    /// Every match of `query` in the visible backlogs, in the same order as
+    /// `Render_State::visbacklogs`.  Kept up to date by `search_refresh`.
+    cz::String query;
+    cz::Vector<Search_Matches> matches;
+    size_t total_matches;
+    /// Hit `SEARCH_MAX_MATCHES` so no more output is searched.  `search_step`
+    /// fails where it runs into output that wasn't searched.
+    bool truncated;
+
+    /// The query is a regular expression.  Regex matches aren't recorded so `matches` is
+    /// empty and the backlogs are scanned each time the search steps.
+    bool is_regex;
+    Regex regex;
+    cz::String regex_pattern;  // The pattern `regex` was compiled from.
+    const char* regex_error;   // Why `regex_pattern` didn't compile.  Null if it did.
+
+    /// Every match of the prompt's text on screen is highlighted, not just the current one.
+    cz::String highlight_query;  // Query the highlights were found for.
+    bool highlight_regex;
+    cz::Vector<Search_Highlights> highlights;
 };
+
+/// Find the matches of `query` in `visbacklogs`.  Unless `query` changed, only output that is
+/// new since the last call is searched.  The output is split into tasks that are searched in
+/// parallel on the work pool (see work_pool.hpp) so a long search blocks for a fraction of
+/// the time it would take on the main thread.  Chunks that backlog_index.hpp rules out are
+/// skipped.
+void search_refresh(Search_State* search, cz::Slice<Backlog_State*> visbacklogs, cz::Str query);
+
+/// Find the first match after or the last match before `(*outer, *inner)`.  Fails if
+/// there isn't one or if it would have to skip over output that wasn't searched.
+bool search_step(Search_State* search, bool is_forward, uint64_t* outer, uint64_t* inner);
+
+/// Get the position of the match at `(outer, inner)` in the list, starting at 1.
+/// Returns 0 if there isn't a match there.
+size_t search_match_number(Search_State* search, uint64_t outer, uint64_t inner);
+
+/// Describe the matches like `match 37 / 12,408`.
+void search_append_status(Search_State* search, cz::Allocator allocator, cz::String* string);
+
+void search_drop_matches(Search_State* search);
+
+/// Compile `pattern` into `search->regex` unless it already was.  Returns `false` if it
+/// doesn't compile, in which case `search->regex_error` says why.
+bool search_update_regex(Search_State* search, cz::Str pattern);
+void search_drop_regex(Search_State* search);
+
+/// Start highlighting the matches in `backlog` from `index` on.  Call each frame before
+/// its rows are drawn.  Matches from earlier frames before `index` are dropped.  Returns
+/// `false` if there is nothing to highlight because the query is empty or invalid.
+bool search_highlight_start(Search_State* search, Backlog_State* backlog, uint64_t index);
+
+/// Get the first match in `backlog` that ends after `index`, which can't go backwards
+/// between calls in the same frame.  Text is scanned a window at a time so if no match
+/// starts in the window then `*start` and `*end` are both its end.  So drawing a frame
+/// scans about as much text as is on screen no matter how big the backlog is.
+void search_highlight_next(Search_State* search,
+                           Backlog_State* backlog,
+                           uint64_t index,
+                           uint64_t* start,
+                           uint64_t* end);
+
+void search_drop_highlights(Search_State* search);
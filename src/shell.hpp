@@ -10,6 +10,7 @@
 #include "error.hpp"
 #include "rcstr.hpp"
 #include "render.hpp"
+#include "tty_reader.hpp"
 
 struct Parse_Line;
 struct Parse_Program;
@@ -169,6 +170,9 @@ struct Pseudo_Terminal {
     /// The parent state.
     int parent_bi;
 #endif
+
+    /// Reads the output on a background thread.  Null if it is read on the main thread.
+    Tty_Reader* reader;
 };
 
 bool create_pseudo_terminal(Pseudo_Terminal* tty, int width, int height);
@@ -255,6 +259,8 @@ enum Builtin_Command {
     TESH_SET_VAR,
     BUILTIN,
     MKTEMP,
+    PAUSE,
+    MEMDUMP,
 };
 
 struct Running_Builtin {
@@ -7,6 +7,10 @@
 #include <cz/parse.hpp>
 #include <cz/path.hpp>
 #include <tracy/Tracy.hpp>
+#include "backlog_pool.hpp"
+#include "backlog_compress.hpp"
+#include "backlog_index.hpp"
+#include "backlog_spill.hpp"
 #include "config.hpp"
 #include "global.hpp"
 #include "prompt.hpp"
@@ -39,6 +43,9 @@ static const Builtin level0[] = {
     {"dump_func", Builtin_Command::FUNCDUMP},
     {"aliasdump", Builtin_Command::ALIASDUMP},
     {"dump_alias", Builtin_Command::ALIASDUMP},
+    {"pause", Builtin_Command::PAUSE},
+    {"memdump", Builtin_Command::MEMDUMP},
+    {"dump_mem", Builtin_Command::MEMDUMP},
     {"shift", Builtin_Command::SHIFT},
     {"history", Builtin_Command::HISTORY},
     {"__tesh_set_var", Builtin_Command::TESH_SET_VAR},
@@ -154,6 +161,9 @@ bool tick_builtin(Tesh_State* tesh,
 
     Running_Builtin* builtin = &program->v.builtin;
 
+    // Set when the event loop knows when to wake us up.
+    bool waiting = false;
+
     switch (builtin->command) {
     case Builtin_Command::INVALID: {
         auto& st = builtin->st.invalid;
@@ -169,7 +179,7 @@ bool tick_builtin(Tesh_State* tesh,
         for (; st.outer < builtin->args.len; ++st.outer) {
             // Rate limit to prevent hanging.
             if (rounds++ == 1024)
-                return false;
+                goto still_running;
 
             // Write this arg.
             cz::Str arg = builtin->args[st.outer];
@@ -217,7 +227,7 @@ bool tick_builtin(Tesh_State* tesh,
         while (st.file.file.is_open() || st.outer < builtin->args.len) {
             // Rate limit to prevent hanging.
             if (rounds++ == 1024)
-                return false;
+                goto still_running;
 
             // Write remaining buffer.
             if (st.offset != st.len) {
@@ -252,8 +262,11 @@ bool tick_builtin(Tesh_State* tesh,
             // Read a new buffer.
             result = st.file.read_text(st.buffer, 4096, &st.carry);
             if (result <= 0) {
-                if (result < 0)
+                if (result < 0) {
+                    event_loop_watch(&tesh->loop, st.file.file);
+                    waiting = true;
                     break;
+                }
                 if (st.file.file.handle != builtin->in.file.handle)
                     st.file.file.close();
                 st.file = {};
@@ -447,6 +460,16 @@ font_size      SIZE  -- Set the font size.\n\
 builtin_level  LEVEL -- Set the builtin level (see builtin --help).\n\
 wide_terminal  1/0   -- Turn on or off wide terminal mode.  This will lock the terminal's width\n\
                         at 1000 characters instead of the actual width.\n\
+max_length     MIB   -- Maximum length of each backlog.  Raises the limit of existing backlogs\n\
+                        so full ones resume reading.\n\
+ring_retention 1/0   -- When a backlog is full, drop its oldest output instead of new output.\n\
+                        Applies to backlogs created afterwards.\n\
+memory_budget  MIB   -- Spill backlogs that aren't on screen to disk when they use more\n\
+                        memory than this.  0 means unlimited.  See memdump.\n\
+index_budget   MIB   -- Memory for the filters that let searches skip chunks of output.\n\
+                        0 turns indexing off.  See memdump.\n\
+coalesce_cr    1/0   -- Only store the last redraw of lines that are redrawn with '\\r'\n\
+                        (ie progress bars).  Applies to backlogs created afterwards.\n\
 ");
             goto finish_builtin;
         }
@@ -491,6 +514,38 @@ wide_terminal  1/0   -- Turn on or off wide terminal mode.  This will lock the t
             } else {
                 cfg.windows_wide_terminal = value;
             }
+        } else if (option == "memory_budget") {
+            if (value < 0) {
+                (void)builtin->err.write("configure: Invalid memory budget.\n");
+            } else {
+                cfg.memory_budget = (uint64_t)value << 20;
+            }
+        } else if (option == "index_budget") {
+            if (value < 0) {
+                (void)builtin->err.write("configure: Invalid index budget.\n");
+            } else {
+                cfg.index_budget = (uint64_t)value << 20;
+            }
+        } else if (option == "max_length") {
+            if (value <= 0) {
+                (void)builtin->err.write("configure: Invalid maximum length.\n");
+            } else {
+                cfg.max_length = (uint64_t)value << 20;
+                for (size_t i = 0; i < rend->visbacklogs.len; ++i)
+                    backlog_raise_max_length(rend->visbacklogs[i], cfg.max_length);
+            }
+        } else if (option == "ring_retention") {
+            if (value < 0 || value > 1) {
+                (void)builtin->err.write("configure: Invalid boolean value.\n");
+            } else {
+                cfg.ring_retention = value;
+            }
+        } else if (option == "coalesce_cr") {
+            if (value < 0 || value > 1) {
+                (void)builtin->err.write("configure: Invalid boolean value.\n");
+            } else {
+                cfg.coalesce_progress = value;
+            }
         } else {
             (void)builtin->err.write(
                 cz::format(temp_allocator, "configure: Unrecognized option ", option, '\n'));
@@ -644,6 +699,8 @@ wide_terminal  1/0   -- Turn on or off wide terminal mode.  This will lock the t
         uint64_t actual = std::chrono::duration_cast<std::chrono::seconds>(now - st.start).count();
         if (actual >= max)
             goto finish_builtin;
+        event_loop_wake_at(&tesh->loop, st.start + std::chrono::seconds(max));
+        waiting = true;
     } break;
 
     case Builtin_Command::ATTACH: {
@@ -671,6 +728,31 @@ wide_terminal  1/0   -- Turn on or off wide terminal mode.  This will lock the t
         goto finish_builtin;
     } break;
 
+    case Builtin_Command::PAUSE: {
+        // Toggle the selected process or else the last one that is still running.
+        Backlog_State* target = nullptr;
+        if (rend->selected_outer != -1) {
+            target = rend->visbacklogs[rend->selected_outer];
+        } else {
+            for (size_t i = rend->visbacklogs.len; i-- > 0;) {
+                Backlog_State* other = rend->visbacklogs[i];
+                if (!other->done && other->id != backlog->id) {
+                    target = other;
+                    break;
+                }
+            }
+        }
+
+        if (!target || target->done || target->id == backlog->id) {
+            builtin->exit_code = 1;
+            (void)builtin->err.write("pause: No running process to pause\n");
+            goto finish_builtin;
+        }
+
+        target->paused = !target->paused;
+        goto finish_builtin;
+    } break;
+
     case Builtin_Command::ARGDUMP: {
         for (size_t i = 1; i < builtin->args.len; ++i) {
             (void)builtin->out.write(builtin->args[i]);
@@ -731,6 +813,28 @@ wide_terminal  1/0   -- Turn on or off wide terminal mode.  This will lock the t
         goto finish_builtin;
     } break;
 
+    case Builtin_Command::MEMDUMP: {
+        Backlog_Pool_Stats pool = backlog_pool_stats();
+        Backlog_Spill_Stats spill = backlog_spill_stats();
+        Backlog_Compress_Stats compress = backlog_compress_stats();
+        Backlog_Index_Stats index = backlog_index_stats();
+        const uint64_t mib = 1 << 20;
+        (void)builtin->out.write(cz::format(
+            temp_allocator, "budget:     ", cfg.memory_budget / mib, " MiB\n",  //
+            "resident:   ", spill.resident_bytes / mib, " MiB\n",             //
+            "mapped:     ", spill.mapped_bytes / mib, " MiB\n",               //
+            "spilled:    ", spill.spilled_bytes / mib, " MiB\n",              //
+            "pooled:     ", pool.free_chunks * pool.chunk_size / mib, " MiB\n",  //
+            "compressed: ", compress.compressed_chunks * pool.chunk_size / mib, " MiB -> ",
+            compress.compressed_bytes / mib, " MiB\n",           //
+            "indexed:    ", index.indexed_chunks * pool.chunk_size / mib, " MiB -> ",
+            index.filter_bytes / mib, " MiB\n",                  //
+            "spills:     ", spill.spills, "\n",                   //
+            "faults:     ", spill.faults, "\n",                   //
+            "decompressions: ", compress.decompressions, "\n"));
+        goto finish_builtin;
+    } break;
+
     case Builtin_Command::SHIFT: {
         if (local->args.len > 0)
             local->args.remove(0);
@@ -792,6 +896,8 @@ wide_terminal  1/0   -- Turn on or off wide terminal mode.  This will lock the t
                 st.value.drop(cz::heap_allocator());
                 goto finish_builtin;
             } else {
+                event_loop_watch(&tesh->loop, builtin->in.file);
+                waiting = true;
                 break;
             }
         }
@@ -846,6 +952,9 @@ wide_terminal  1/0   -- Turn on or off wide terminal mode.  This will lock the t
         CZ_PANIC("unreachable");
     }
 
+still_running:
+    if (!waiting)
+        event_loop_mark_busy(&tesh->loop);
     return false;
 
 finish_builtin:
@@ -364,7 +364,7 @@ static Error start_execute_line(Shell_State* shell,
 
     // Don't do this on Windows to avoid a race condition because the pipe gets flushed post exit.
 #ifndef _WIN32
-    if (backlog->length > 0 && backlog->get(backlog->length - 1) != '\n') {
+    if (backlog->length > backlog->discarded && backlog->get(backlog->length - 1) != '\n') {
         append_text(backlog, "\n");
     }
 #endif
@@ -1,13 +1,22 @@
 #include "shell.hpp"
 
+#include <cz/util.hpp>
 #include <tracy/Tracy.hpp>
 #include "prompt.hpp"
+#include "tesh.hpp"
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 // Forward declarations
 ///////////////////////////////////////////////////////////////////////////////
 
-static void read_tty_output(Backlog_State* backlog, Pseudo_Terminal* tty, bool cap_read_calls);
+static void read_tty_output(Tesh_State* tesh,
+                            Backlog_State* backlog,
+                            Pseudo_Terminal* tty,
+                            bool cap_read_calls);
 
 static void tick_pipeline(Tesh_State* tesh,
                           Shell_State* shell,
@@ -57,7 +66,7 @@ bool tick_running_node(Tesh_State* tesh,
     if (*force_quit)
         return true;
 
-    read_tty_output(backlog, tty, /*cap_read_calls=*/true);
+    read_tty_output(tesh, backlog, tty, /*cap_read_calls=*/true);
 
     if (node->fg.programs.len == 0 && !node->fg_finished) {
         bool started = finish_line(shell, *tty, node, backlog, &node->fg,
@@ -107,10 +116,52 @@ static void tick_pipeline(Tesh_State* tesh,
 
 ///////////////////////////////////////////////////////////////////////////////
 
-static void read_tty_output(Backlog_State* backlog, Pseudo_Terminal* tty, bool cap_read_calls) {
+/// Milliseconds per frame spent parsing output.  The rest is left over for input and rendering.
+static const uint32_t ingest_budget = 8;
+
+/// Parse the output the reader thread has read and lend it the end of the backlog again.
+static void ingest_tty_output(Tesh_State* tesh, Backlog_State* backlog, Tty_Reader* reader) {
+    while (backlog_flow(backlog) == BACKLOG_FLOW_READING) {
+        // Note: CRLF is stripped in append_text.  If the backlog fills up then the
+        // reader isn't lent anything so the process blocks on the rest of the output.
+        Tty_Reader_Output output = tty_reader_collect(reader);
+        if (output.len > 0)
+            backlog_adopt_tail(backlog, output.chunks, output.offset, output.len);
+
+        if (backlog_flow(backlog) == BACKLOG_FLOW_READING) {
+            Backlog_Tail_Loan loan = backlog_tail_loan(backlog, TTY_READER_MAX_LEND);
+            tty_reader_lend(reader, loan.offset, loan.max);
+        }
+
+        if (output.len == 0)
+            break;
+
+        if (SDL_GetTicks() - tesh->loop.frame_start >= ingest_budget) {
+            // Finish next frame.
+            if (tty_reader_has_output(reader))
+                event_loop_mark_busy(&tesh->loop);
+            break;
+        }
+    }
+}
+
+static void read_tty_output(Tesh_State* tesh,
+                            Backlog_State* backlog,
+                            Pseudo_Terminal* tty,
+                            bool cap_read_calls) {
     ZoneScoped;
 
-    static char buffer[4096];
+    // Leave the output in the pty so the process blocks.
+    if (backlog_flow(backlog) != BACKLOG_FLOW_READING) {
+        backlog_flush(backlog);
+        return;
+    }
+
+    if (tty->reader) {
+        ingest_tty_output(tesh, backlog, tty->reader);
+        backlog_flush(backlog);
+        return;
+    }
 
 #ifdef _WIN32
     cz::Input_File parent_out = tty->out;
@@ -124,21 +175,32 @@ static void read_tty_output(Backlog_State* backlog, Pseudo_Terminal* tty, bool c
             if (cap_read_calls && rounds == 1024)
                 break;
 
-#ifndef NDEBUG
-            memset(buffer, 0xcd, sizeof(buffer));
-#endif
-
-            // Note: CRLF is stripped in append_text.
-            result = parent_out.read(buffer, sizeof(buffer));
-            if (result <= 0)
+            // Read straight into the backlog's storage.
+            Backlog_Tail_Space space = backlog_tail_space(backlog, 64 << 10);
+            // The backlog is full.  Stop reading until it is raised or cleared.
+            if (space.first.len == 0)
                 break;
 
-            // TODO: allow expanding max dynamically (don't close script->out here)
-            result = append_text(backlog, {buffer, (size_t)result});
+#ifdef _WIN32
+            result = parent_out.read(space.first.elems, space.first.len);
+#else
+            struct iovec iov[2] = {};
+            iov[0].iov_base = space.first.elems;
+            iov[0].iov_len = space.first.len;
+            iov[1].iov_base = space.second.elems;
+            iov[1].iov_len = space.second.len;
+            result = readv(parent_out.handle, iov, space.second.len > 0 ? 2 : 1);
+#endif
             if (result <= 0)
                 break;
+
+            // Note: CRLF is stripped in append_text.
+            backlog_commit_tail(backlog, result);
         }
     }
+
+    // Progress bars are redrawn at most once per frame.
+    backlog_flush(backlog);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -163,11 +225,14 @@ static bool tick_program(Tesh_State* tesh,
     case Running_Program::SUB: {
         Running_Node* node = &program->v.sub;
         // TODO better rate limiting
-        for (int rounds = 0; rounds < 128; ++rounds) {
+        int rounds = 0;
+        for (; rounds < 128; ++rounds) {
             if (!tick_running_node(tesh, shell, rend, prompt, node, tty, backlog, force_quit)) {
                 break;
             }
         }
+        if (rounds == 128)
+            event_loop_mark_busy(&tesh->loop);
 
         // TODO merge bg jobs up???
         if (node->fg_finished && node->bg.len == 0) {
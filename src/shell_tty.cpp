@@ -119,6 +119,9 @@ bool create_pseudo_terminal(Pseudo_Terminal* tty, int width, int height) {
         return false;
     }
 
+    // If this fails we fall back to reading on the main thread.
+    tty->reader = start_tty_reader(tty->parent_bi);
+
     return true;
 #endif
 }
@@ -131,6 +134,10 @@ void destroy_pseudo_terminal(Pseudo_Terminal* tty) {
     DisconnectNamedPipe(tty->in.handle);
     DisconnectNamedPipe(tty->out.handle);
 #else
+    if (tty->reader) {
+        stop_tty_reader(tty->reader);
+        tty->reader = nullptr;
+    }
     close(tty->child_bi);
     close(tty->parent_bi);
 #endif
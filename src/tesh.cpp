@@ -16,4 +16,7 @@ void Pane_State::init() {
 
 void Pane_State::drop() {
     cleanup_processes(&shell);
+    search_drop_matches(&search);
+    search_drop_regex(&search);
+    search_drop_highlights(&search);
 }
@@ -2,6 +2,7 @@
 
 #include <cz/vector.hpp>
 #include "backlog.hpp"
+#include "event_loop.hpp"
 #include "prompt.hpp"
 #include "render.hpp"
 #include "search.hpp"
@@ -22,4 +23,5 @@ struct Tesh_State {
     Window_State window;
     cz::Vector<Pane_State*> panes;
     size_t selected_pane;
+    Event_Loop loop;
 };
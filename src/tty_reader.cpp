@@ -0,0 +1,249 @@
+#include "tty_reader.hpp"
+
+#include <cz/assert.hpp>
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+#include <cz/vector.hpp>
+#include "backlog.hpp"
+#include "backlog_pool.hpp"
+#include "event_loop.hpp"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#ifndef _WIN32
+
+/// Most chunks filled by one call to `readv`.  A pty hands out
+/// a few KiB at a time so this rarely limits anything.
+#define TTY_READER_MAX_IOVECS 16
+
+struct Tty_Reader {
+    int fd;
+    int stop_pipe[2];
+    std::thread thread;
+    std::atomic<bool> stop;
+
+    /// The loan.  Output is read into `chunks` starting at `offset` in the first chunk.  The
+    /// reader has read `filled` of the `limit` bytes it may read.  Guarded by `mutex`, which
+    /// is only held to update these so neither thread waits on the other's system calls.
+    std::mutex mutex;
+    cz::Vector<char*> chunks;
+    size_t offset;
+    size_t limit;
+    size_t filled;
+
+    /// A `readv` into the loan is in flight so it can't be collected yet.  Then
+    /// `collect_requested` is set and the reader wakes the main thread once it is done.
+    bool reading;
+    bool collect_requested;
+
+    /// The reader thread sleeps on `lent` when the loan is full.
+    std::condition_variable lent;
+
+    /// Chunks at the start of `chunks` given away by `tty_reader_collect`.  Main thread only.
+    size_t collected;
+};
+
+/// Block until there is room in the loan.  Returns false if we should stop.
+static bool wait_for_loan(Tty_Reader* reader) {
+    std::unique_lock<std::mutex> lock(reader->mutex);
+    while (!reader->stop && (reader->filled == reader->limit || reader->collect_requested)) {
+        reader->lent.wait(lock);
+    }
+    return !reader->stop;
+}
+
+/// Claim the rest of the loan for a read.  Returns the number of iovecs filled in.
+static int start_read(Tty_Reader* reader, struct iovec* iov) {
+    std::lock_guard<std::mutex> lock(reader->mutex);
+    // The loan was collected while we were polling.
+    if (reader->filled == reader->limit || reader->collect_requested)
+        return 0;
+
+    int count = 0;
+    size_t position = reader->offset + reader->filled;
+    size_t end = reader->offset + reader->limit;
+    while (position < end && count < TTY_READER_MAX_IOVECS) {
+        size_t inner = position & (BACKLOG_BUFFER_SIZE - 1);
+        size_t len = cz::min(end - position, (size_t)(BACKLOG_BUFFER_SIZE - inner));
+        iov[count].iov_base = reader->chunks[position >> BACKLOG_BUFFER_SHIFT] + inner;
+        iov[count].iov_len = len;
+        ++count;
+        position += len;
+    }
+    reader->reading = true;
+    return count;
+}
+
+static void finish_read(Tty_Reader* reader, size_t len) {
+    std::lock_guard<std::mutex> lock(reader->mutex);
+    reader->reading = false;
+
+    // If the main thread already collected everything or tried
+    // to collect during the read then it might be asleep.
+    if ((len > 0 && reader->filled == 0) || reader->collect_requested)
+        event_loop_wake_from_thread();
+    reader->filled += len;
+}
+
+/// Read into the rest of the loan.  Returns false if we should stop.
+static bool read_into_loan(Tty_Reader* reader) {
+    struct iovec iov[TTY_READER_MAX_IOVECS];
+    int count = start_read(reader, iov);
+    if (count == 0)
+        return true;
+
+    // Read straight into the chunks.  The lock isn't held so the main thread isn't blocked.
+    ssize_t result = readv(reader->fd, iov, count);
+    finish_read(reader, cz::max(result, (ssize_t)0));
+    if (result < 0)
+        return errno == EAGAIN || errno == EINTR;
+    return result > 0;
+}
+
+static void run_reader(Tty_Reader* reader) {
+    while (!reader->stop) {
+        if (!wait_for_loan(reader))
+            return;
+
+        struct pollfd fds[2] = {};
+        fds[0].fd = reader->fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = reader->stop_pipe[0];
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (fds[1].revents)
+            return;
+
+        if (!read_into_loan(reader))
+            return;
+    }
+}
+
+Tty_Reader* start_tty_reader(int fd) {
+    Tty_Reader* reader = new Tty_Reader;
+    reader->fd = fd;
+    if (pipe(reader->stop_pipe) < 0) {
+        delete reader;
+        return nullptr;
+    }
+    reader->stop = false;
+    reader->chunks = {};
+    reader->offset = 0;
+    reader->limit = 0;
+    reader->filled = 0;
+    reader->reading = false;
+    reader->collect_requested = false;
+    reader->collected = 0;
+    reader->thread = std::thread(run_reader, reader);
+    return reader;
+}
+
+void stop_tty_reader(Tty_Reader* reader) {
+    reader->stop = true;
+    char byte = 0;
+    ssize_t result = write(reader->stop_pipe[1], &byte, 1);
+    (void)result;
+    {
+        std::lock_guard<std::mutex> lock(reader->mutex);
+        reader->lent.notify_one();
+    }
+    reader->thread.join();
+
+    close(reader->stop_pipe[0]);
+    close(reader->stop_pipe[1]);
+    for (size_t i = reader->collected; i < reader->chunks.len; ++i) {
+        backlog_pool_free(reader->chunks[i]);
+    }
+    reader->chunks.drop(cz::heap_allocator());
+    delete reader;
+}
+
+/// Stop listing the chunks the last call to `tty_reader_collect` gave away.
+static void forget_collected(Tty_Reader* reader) {
+    reader->chunks.remove_range(0, reader->collected);
+    reader->collected = 0;
+}
+
+void tty_reader_lend(Tty_Reader* reader, size_t offset, size_t max) {
+    CZ_DEBUG_ASSERT(offset < BACKLOG_BUFFER_SIZE);
+    std::lock_guard<std::mutex> lock(reader->mutex);
+
+    // The last loan couldn't be collected because it is being read into.
+    if (reader->collect_requested)
+        return;
+    CZ_DEBUG_ASSERT(reader->filled == 0 && !reader->reading);
+
+    // Chunks that weren't filled are lent again.
+    forget_collected(reader);
+    size_t needed = (offset + max + BACKLOG_BUFFER_SIZE - 1) >> BACKLOG_BUFFER_SHIFT;
+    reader->chunks.reserve(cz::heap_allocator(), needed);
+    while (reader->chunks.len < needed) {
+        reader->chunks.push(backlog_pool_alloc());
+    }
+
+    reader->offset = offset;
+    reader->limit = max;
+    reader->lent.notify_one();
+}
+
+Tty_Reader_Output tty_reader_collect(Tty_Reader* reader) {
+    Tty_Reader_Output output = {};
+    std::lock_guard<std::mutex> lock(reader->mutex);
+    forget_collected(reader);
+
+    // Leave the loan alone until the read finishes.  The reader wakes us up then.
+    if (reader->reading) {
+        reader->collect_requested = true;
+        return output;
+    }
+
+    if (reader->filled > 0) {
+        size_t end = reader->offset + reader->filled;
+        reader->collected = (end + BACKLOG_BUFFER_SIZE - 1) >> BACKLOG_BUFFER_SHIFT;
+        output.chunks = reader->chunks.slice_end(reader->collected);
+        output.offset = reader->offset;
+        output.len = reader->filled;
+    }
+    reader->limit = 0;
+    reader->filled = 0;
+    reader->collect_requested = false;
+    return output;
+}
+
+bool tty_reader_has_output(Tty_Reader* reader) {
+    std::lock_guard<std::mutex> lock(reader->mutex);
+    return reader->filled > 0;
+}
+
+#else
+
+Tty_Reader* start_tty_reader(int fd) {
+    return nullptr;
+}
+
+void stop_tty_reader(Tty_Reader* reader) {}
+
+void tty_reader_lend(Tty_Reader* reader, size_t offset, size_t max) {}
+
+Tty_Reader_Output tty_reader_collect(Tty_Reader* reader) {
+    return {};
+}
+
+bool tty_reader_has_output(Tty_Reader* reader) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <cz/slice.hpp>
+
+/// Reads the output of a pseudo terminal on a background thread so the main thread never
+/// waits on `read`.  The main thread lends the reader backlog chunks (see `tty_reader_lend`)
+/// and the reader reads straight into them.  Then the backlog adopts the chunks (see
+/// `backlog_adopt_tail`) so output isn't copied on its way into the backlog.  When nothing
+/// is lent or the lent chunks are full the reader stops reading, which makes the program
+/// writing the output block until we catch up.
+///
+/// Parsing (`append_text`) stays on the main thread because it owns the backlogs.
+
+/// Most bytes lent to the reader at once.
+#define TTY_READER_MAX_LEND (1 << 20)
+
+struct Tty_Reader;
+
+/// Output that has been read.  It is `len` bytes starting at `offset` in the first chunk.
+struct Tty_Reader_Output {
+    cz::Slice<char*> chunks;
+    size_t offset;
+    size_t len;
+};
+
+/// Start reading `fd`.  Nothing is read until chunks are lent to the reader.
+/// Returns null if threads aren't supported on this platform.
+Tty_Reader* start_tty_reader(int fd);
+
+/// Stop the thread.  Output that wasn't collected is discarded.  Doesn't close `fd`.
+void stop_tty_reader(Tty_Reader* reader);
+
+/// Let the reader read up to `max` bytes into chunks from backlog_pool.hpp, starting at
+/// `offset` in the first chunk.  Replaces the last loan unless it couldn't be collected.
+void tty_reader_lend(Tty_Reader* reader, size_t offset, size_t max);
+
+/// Take the output read since the last loan and end the loan.  The caller owns the returned
+/// chunks, which are only listed until the next call to `tty_reader_lend`.  If a read into
+/// the loan is in flight then nothing is taken and the event loop is woken once it is done.
+Tty_Reader_Output tty_reader_collect(Tty_Reader* reader);
+
+/// Has the reader read output that hasn't been collected?
+bool tty_reader_has_output(Tty_Reader* reader);
@@ -5,8 +5,20 @@
 
 namespace unicode {
 
+/// Returned by `utf8_decode` for bytes that aren't valid UTF-8.
+#define UNICODE_INVALID ((uint32_t)-1)
+
 size_t utf8_width(uint8_t ch);
 bool utf8_is_continuation(uint8_t ch);
 uint32_t utf8_code_point(const uint8_t* seq);
 
+/// Validate and decode the sequence at the start of `text`.  Returns the number of bytes
+/// in it or 0 if `text` stops partway through it.  Invalid sequences set `code_point` to
+/// `UNICODE_INVALID` and are split the same way `make_backlog_code_point` splits them.
+size_t utf8_decode(const char* text, size_t len, uint32_t* code_point);
+
+/// Number of columns `code_point` takes up: 2 for East Asian Wide and Fullwidth characters,
+/// 0 for combining marks and other characters that extend the previous grapheme, else 1.
+int code_point_width(uint32_t code_point);
+
 }
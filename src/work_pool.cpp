@@ -0,0 +1,188 @@
+#include "work_pool.hpp"
+
+#include <stdint.h>
+#include <condition_variable>
+#include <cz/assert.hpp>
+#include <cz/util.hpp>
+#include <mutex>
+#include <thread>
+#include <tracy/Tracy.hpp>
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Configuration
+///////////////////////////////////////////////////////////////////////////////
+
+/// Most threads to run tasks on.  Searching is bound by memory bandwidth well before this.
+#define MAX_THREADS 8
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Data
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Work_Queue {
+    std::mutex mutex;
+    uint64_t batch;  // Batch the tasks are from.
+    size_t front;    // Tasks `[front, back)` haven't been taken.
+    size_t back;
+};
+
+struct Work_Pool {
+    size_t threads;  // Including the thread running the batch.
+    Work_Queue queues[MAX_THREADS];
+
+    std::mutex mutex;
+    std::condition_variable work;
+    std::condition_variable done;
+
+    uint64_t batch;  // Incremented when a batch starts.
+    Work_Function function;
+    void* context;
+    size_t unfinished;  // Tasks of the batch that haven't finished.
+};
+
+}
+
+/// Created with the worker threads the first time a batch is ran.  Never
+/// freed because the workers are detached and live until the program exits.
+static Work_Pool* pool;
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - taking tasks
+///////////////////////////////////////////////////////////////////////////////
+
+static bool take_own_task(Work_Queue* queue, uint64_t batch, size_t* task) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->batch != batch || queue->front == queue->back)
+        return false;
+    *task = queue->front++;
+    return true;
+}
+
+static bool steal_task(Work_Queue* queue, uint64_t batch, size_t* task) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->batch != batch || queue->front == queue->back)
+        return false;
+    *task = --queue->back;
+    return true;
+}
+
+/// A worker can wake up after its batch has finished and the next one has started.  So
+/// only take tasks from `batch` since `function` and `context` are for that batch.
+static bool take_task(Work_Pool* p, uint64_t batch, size_t thread, size_t* task) {
+    if (take_own_task(&p->queues[thread], batch, task))
+        return true;
+    for (size_t i = 1; i < p->threads; ++i) {
+        if (steal_task(&p->queues[(thread + i) % p->threads], batch, task))
+            return true;
+    }
+    return false;
+}
+
+/// Run tasks until there are none left to take.  Returns the number ran.
+static size_t run_tasks(Work_Pool* p,
+                        uint64_t batch,
+                        size_t thread,
+                        Work_Function function,
+                        void* context) {
+    size_t ran = 0;
+    size_t task;
+    while (take_task(p, batch, thread, &task)) {
+        function(context, task, thread);
+        ++ran;
+    }
+    return ran;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - worker threads
+///////////////////////////////////////////////////////////////////////////////
+
+static void run_worker(Work_Pool* p, size_t thread) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(p->mutex);
+    while (1) {
+        while (p->batch == seen)
+            p->work.wait(lock);
+        seen = p->batch;
+        Work_Function function = p->function;
+        void* context = p->context;
+        lock.unlock();
+
+        size_t ran = run_tasks(p, seen, thread, function, context);
+
+        lock.lock();
+        p->unfinished -= ran;
+        if (p->unfinished == 0)
+            p->done.notify_all();
+    }
+}
+
+static Work_Pool* start_pool() {
+    if (!pool) {
+        pool = new Work_Pool;
+        pool->threads = cz::max(cz::min((size_t)std::thread::hardware_concurrency(),
+                                        (size_t)MAX_THREADS),
+                                (size_t)1);
+        for (size_t i = 0; i < MAX_THREADS; ++i) {
+            pool->queues[i].batch = 0;
+            pool->queues[i].front = 0;
+            pool->queues[i].back = 0;
+        }
+        pool->batch = 0;
+        pool->function = nullptr;
+        pool->context = nullptr;
+        pool->unfinished = 0;
+
+        // Thread 0 is whoever runs the batch.
+        for (size_t i = 1; i < pool->threads; ++i)
+            std::thread(run_worker, pool, i).detach();
+    }
+    return pool;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - batches
+///////////////////////////////////////////////////////////////////////////////
+
+void work_pool_run(size_t tasks, Work_Function function, void* context) {
+    ZoneScoped;
+
+    if (tasks == 0)
+        return;
+
+    Work_Pool* p = start_pool();
+    uint64_t batch;
+
+    {
+        std::lock_guard<std::mutex> lock(p->mutex);
+        CZ_ASSERT(p->unfinished == 0);
+        p->function = function;
+        p->context = context;
+        p->unfinished = tasks;
+
+        batch = ++p->batch;
+
+        // Give each thread a contiguous range so neighboring tasks stay on one thread.
+        for (size_t i = 0; i < p->threads; ++i) {
+            std::lock_guard<std::mutex> queue_lock(p->queues[i].mutex);
+            p->queues[i].batch = batch;
+            p->queues[i].front = tasks * i / p->threads;
+            p->queues[i].back = tasks * (i + 1) / p->threads;
+        }
+    }
+    p->work.notify_all();
+
+    size_t ran = run_tasks(p, batch, 0, function, context);
+
+    // Wait for the tasks the workers took.
+    std::unique_lock<std::mutex> lock(p->mutex);
+    p->unfinished -= ran;
+    while (p->unfinished > 0)
+        p->done.wait(lock);
+}
+
+size_t work_pool_threads() {
+    return start_pool()->threads;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+/// Runs batches of tasks on a pool of worker threads.  The tasks of a batch are split
+/// evenly between the threads.  Each thread takes tasks from the front of its own queue
+/// and once that is empty steals from the back of the other queues, so a few slow tasks
+/// don't leave the other threads idle.
+///
+/// The worker threads are created the first time a batch is ran and live until the
+/// program exits.  The thread running the batch works on it too.
+
+/// Run task `task` on thread `thread`.  `thread` is below `work_pool_threads()`
+/// so it can be used to index per thread scratch space.
+typedef void (*Work_Function)(void* context, size_t task, size_t thread);
+
+/// Run tasks `[0, tasks)` and block until all of them have finished.  Only
+/// one batch can run at a time so this must only be called by one thread.
+void work_pool_run(size_t tasks, Work_Function function, void* context);
+
+/// Number of threads that run tasks, including the caller of `work_pool_run`.
+size_t work_pool_threads();
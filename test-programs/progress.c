@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Redraw a progress bar with '\r' like cargo, pip, and curl do.
+// Usage: progress [redraws] [color]
+int main(int argc, char** argv) {
+    long redraws = 1000000;
+    if (argc >= 2)
+        redraws = atol(argv[1]);
+    int color = (argc >= 3 && strcmp(argv[2], "color") == 0);
+
+    char bar[41];
+    for (long i = 0; i <= redraws; ++i) {
+        long filled = i * 40 / (redraws ? redraws : 1);
+        memset(bar, '=', filled);
+        memset(bar + filled, ' ', 40 - filled);
+        bar[40] = '\0';
+        if (color)
+            printf("\r\x1b[K\x1b[1;32m   Building\x1b[0m [%s] %ld/%ld", bar, i, redraws);
+        else
+            printf("\r   Building [%s] %ld/%ld", bar, i, redraws);
+    }
+    printf("\n");
+}
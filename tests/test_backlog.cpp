@@ -1,8 +1,15 @@
 #include <czt/test_base.hpp>
 
+#include <stdio.h>
 #include <cz/defer.hpp>
 #include <cz/file.hpp>
+#include <cz/format.hpp>
 #include "backlog.hpp"
+#include "backlog_compress.hpp"
+#include "backlog_index.hpp"
+#include "backlog_pool.hpp"
+#include "backlog_spill.hpp"
+#include "scan.hpp"
 
 #define BBS BACKLOG_BUFFER_SIZE
 
@@ -29,3 +36,940 @@ TEST_CASE("backlog append_text handle huge write") {
     CZ_DEFER(output.drop(cz::heap_allocator()));
     CHECK(output == data.slice_end(BBS * 2 + BBS / 8));
 }
+
+TEST_CASE("backlog append_text records line starts") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+
+    append_text(&backlog, "abc\ndef\r\nghi\x1b[31m\nj\n");
+
+    cz::String output = dbg_stringify_backlog(&backlog);
+    CZ_DEFER(output.drop(cz::heap_allocator()));
+    CHECK(output == "abc\ndef\nghi\nj\n");
+    REQUIRE(backlog.lines.count() == 4);
+    CHECK(backlog.lines.get(0) == 4);
+    CHECK(backlog.lines.get(1) == 8);
+    CHECK(backlog.lines.get(2) == 12);
+    CHECK(backlog.lines.get(3) == 14);
+}
+
+TEST_CASE("scan_text matches scan_text_scalar") {
+    char buffer[300];
+    const char specials[] = {'\n', '\r', 0x1b, 0x08, '\a'};
+    for (size_t position = 0; position < sizeof(buffer); position += 7) {
+        for (size_t special = 0; special < sizeof(specials); ++special) {
+            for (size_t i = 0; i < sizeof(buffer); ++i) {
+                buffer[i] = (i % 13 == 0 ? '\n' : 'a' + i % 26);
+            }
+            buffer[position] = specials[special];
+
+            Line_Index lines1 = {};
+            Line_Index lines2 = {};
+            CZ_DEFER(lines1.drop());
+            CZ_DEFER(lines2.drop());
+            cz::Str text = {buffer, sizeof(buffer)};
+            size_t end1 = scan_text(text, 100, &lines1);
+            size_t end2 = scan_text_scalar(text, 100, &lines2);
+            CHECK(end1 == end2);
+            REQUIRE(lines1.count() == lines2.count());
+            for (size_t i = 0; i < lines1.count(); ++i) {
+                CHECK(lines1.get(i) == lines2.get(i));
+            }
+        }
+    }
+}
+
+TEST_CASE("Line_Index matches a vector of line starts") {
+    Line_Index index = {};
+    CZ_DEFER(index.drop());
+    cz::Vector<uint64_t> expected = {};
+    CZ_DEFER(expected.drop(cz::heap_allocator()));
+
+    // Dense lines, a gap of empty blocks, and line starts on block boundaries.
+    uint64_t start = 0;
+    for (size_t i = 0; i < 20000; ++i) {
+        if (i == 5000)
+            start += 5 * LINE_INDEX_BLOCK_SIZE + 17;
+        else if (i % 3000 == 0)
+            start = (start / LINE_INDEX_BLOCK_SIZE + 1) * LINE_INDEX_BLOCK_SIZE;
+        else
+            start += 1 + (i * 7) % 40;
+        index.push(start);
+        expected.reserve(cz::heap_allocator(), 1);
+        expected.push(start);
+    }
+
+    auto check = [&]() {
+        REQUIRE(index.count() == expected.len);
+        for (size_t i = 0; i < expected.len; ++i) {
+            CHECK(index.get(i) == expected[i]);
+        }
+        for (size_t i = 0; i < expected.len; i += 97) {
+            CHECK(index.upper_bound(expected[i] - 1) == i);
+            CHECK(index.upper_bound(expected[i]) == i + 1);
+        }
+        CHECK(index.upper_bound(0) == (expected.len > 0 && expected[0] == 0));
+        CHECK(index.upper_bound(start + LINE_INDEX_BLOCK_SIZE * 10) == expected.len);
+    };
+    check();
+
+    // 2 bytes per line plus a little per block.
+    CHECK(index.offsets.len * sizeof(uint16_t) < expected.len * sizeof(uint64_t) / 3);
+
+    // Pop back into an earlier block and push again.
+    while (expected.last() > start - 2 * LINE_INDEX_BLOCK_SIZE) {
+        index.pop();
+        expected.pop();
+    }
+    start = expected.last() + 3;
+    index.push(start);
+    expected.push(start);
+    check();
+
+    // Remove from the front, including the whole first block.
+    index.remove_front(4000);
+    expected.remove_range(0, 4000);
+    check();
+    index.remove_front(1);
+    expected.remove_range(0, 1);
+    check();
+
+    index.remove_front(index.count());
+    expected.len = 0;
+    check();
+    index.push(start + 1);
+    CHECK(index.get(0) == start + 1);
+}
+
+TEST_CASE("backlog append_text escape sequences split across writes") {
+    cz::Str input =
+        "a\x1b[1;31mb\x1b[0mc\r\n"
+        "\x1b(Bd\x1b[6ne\x1b[cf\x1b]133;A\a"
+        "g\x1b]0;title\x1b\\h\x1b[?2004hi\n"
+        "progress\rdone\n";
+
+    Backlog_State backlog1 = {};
+    init_backlog(&backlog1, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    append_text(&backlog1, input);
+
+    // Feed the same input one byte at a time.
+    Backlog_State backlog2 = {};
+    init_backlog(&backlog2, /*id=*/1, /*max_length=*/1ull << 30 /*1GB*/);
+    for (size_t i = 0; i < input.len; ++i) {
+        append_text(&backlog2, input.slice(i, i + 1));
+    }
+
+    cz::String output1 = dbg_stringify_backlog(&backlog1);
+    CZ_DEFER(output1.drop(cz::heap_allocator()));
+    cz::String output2 = dbg_stringify_backlog(&backlog2);
+    CZ_DEFER(output2.drop(cz::heap_allocator()));
+    CHECK(output1 == "abc\ndefghi\ndone\n");
+    CHECK(output2 == "abc\ndefghi\ndone\n");
+
+    REQUIRE(backlog1.events.len == 2);
+    REQUIRE(backlog2.events.len == 2);
+    for (size_t i = 0; i < 2; ++i) {
+        CHECK(backlog_event_index(&backlog1, i) == backlog_event_index(&backlog2, i));
+        CHECK(backlog1.events[i].payload == backlog2.events[i].payload);
+    }
+    CHECK(backlog_event_index(&backlog1, 0) == 1);
+    Backlog_Style bold_red = backlog1.styles[backlog1.events[0].payload];
+    CHECK(bold_red.flags == STYLE_BOLD);
+    CHECK(bold_red.foreground == 1);
+    CHECK(backlog_event_index(&backlog1, 1) == 2);
+    CHECK(backlog1.events[1].payload == 0);
+}
+
+TEST_CASE("backlog interns styles and keeps truecolor") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+
+    // Coloured output repeats a few styles.
+    for (int i = 0; i < 300; ++i) {
+        append_text(&backlog, "\x1b[1;34mdir\x1b[0m \x1b[32mexe\x1b[0m ");
+        append_text(&backlog, "\x1b[38;2;255;128;1mrgb\x1b[48;5;200mbg\x1b[m\n");
+    }
+    REQUIRE(backlog.events.len == 300 * 7);
+    CHECK(backlog.styles.len == 5);
+    CHECK(sizeof(Backlog_Event) == 8);
+
+    Backlog_Style truecolor = backlog.styles[backlog.events[4].payload];
+    CHECK(truecolor.foreground == (STYLE_COLOR_RGB | 0xff8001));
+    Backlog_Style background = backlog.styles[backlog.events[5].payload];
+    CHECK(background.foreground == (STYLE_COLOR_RGB | 0xff8001));
+    CHECK(background.background == 200);
+
+    // Events are found by index even though they only store offsets.
+    uint64_t line = 0;
+    for (size_t e = 0; e < backlog.events.len; e += 7) {
+        CHECK(backlog_event_index(&backlog, e) == line);
+        CHECK(backlog_event_index(&backlog, e + 4) == line + 8);
+        CHECK(backlog_events_lower_bound(&backlog, line) == e);
+        line += 14;
+    }
+
+    // Going back to the start of the line moves the events that were cut off.
+    append_text(&backlog, "\x1b[31mpartial\x1b[0m line");
+    append_text(&backlog, "\r");
+    append_text(&backlog, "x");
+    uint64_t line_start = backlog.lines.last();
+    CHECK(backlog_event_index(&backlog, backlog.events.len - 1) == line_start);
+    CHECK(backlog_events_upper_bound(&backlog, line_start) == backlog.events.len);
+
+    Backlog_State* backlogs[] = {&backlog};
+    backlog_dec_refcount(backlogs, &backlog);
+}
+
+TEST_CASE("backlog append_text hyperlinks") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+
+    append_text(&backlog, "a\x1b]8;;https://example.com\abc\x1b]8;;\x1b\\d");
+
+    cz::String output = dbg_stringify_backlog(&backlog);
+    CZ_DEFER(output.drop(cz::heap_allocator()));
+    CHECK(output == "abcd");
+
+    REQUIRE(backlog.events.len == 2);
+    CHECK(backlog.events[0].type == BACKLOG_EVENT_START_HYPERLINK);
+    CHECK(backlog_event_index(&backlog, 0) == 1);
+    CHECK(cz::Str(backlog.hyperlinks[backlog.events[0].payload]) == "https://example.com");
+    CHECK(backlog.events[1].type == BACKLOG_EVENT_END_HYPERLINK);
+    CHECK(backlog_event_index(&backlog, 1) == 3);
+    CHECK(!backlog.inside_hyperlink);
+}
+
+TEST_CASE("backlog coalesces progress bar redraws") {
+    // Progress bars with styles, hyperlinks, cursor movement, and aborted sequences.
+    cz::String data = {};
+    CZ_DEFER(data.drop(cz::heap_allocator()));
+    data.reserve_exact(cz::heap_allocator(), 64 << 10);
+    data.append("Downloading\n");
+    for (int i = 0; i <= 200; ++i) {
+        data.append("\r\x1b[K\x1b[1;32m   Building\x1b[0m [");
+        for (int j = 0; j < 20; ++j)
+            data.push(j < i / 10 ? '=' : ' ');
+        data.append("] ");
+        data.push('0' + i / 100);
+        data.push('0' + i / 10 % 10);
+        data.push('0' + i % 10);
+        if (i % 7 == 0)
+            data.append("\x1b[3C\x1b]8;;http://x\x1b\\link\x1b]8;;\a");
+        if (i % 11 == 0)
+            data.append("\x1b[1\x08x\x1b[H");
+        if (i % 50 == 0)
+            data.append("\r\r\n");
+    }
+    data.append("\rdone\n\x1b[31mred\rprogress\x1b[38;2;1;2;3m\r");
+
+    Backlog_State expected = {};
+    init_backlog(&expected, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    append_text(&expected, data);
+
+    // Feed it in uneven pieces and flush in between like frames do.
+    Backlog_State actual = {};
+    init_backlog(&actual, /*id=*/1, /*max_length=*/1ull << 30 /*1GB*/);
+    actual.coalesce_progress = true;
+    size_t steps[] = {1, 300, 17, 2, 4096, 33};
+    for (size_t done = 0, i = 0; done < data.len; ++i) {
+        size_t len = cz::min(steps[i % 6], data.len - done);
+        append_text(&actual, data.slice(done, done + len));
+        if (i % 4 == 3)
+            backlog_flush(&actual);
+        done += len;
+    }
+    CHECK(actual.line_edit.dropped > 150);
+    backlog_flush(&actual);
+
+    cz::String expected_string = dbg_stringify_backlog(&expected);
+    CZ_DEFER(expected_string.drop(cz::heap_allocator()));
+    cz::String actual_string = dbg_stringify_backlog(&actual);
+    CZ_DEFER(actual_string.drop(cz::heap_allocator()));
+    CHECK(actual_string == expected_string);
+    REQUIRE(actual.lines.count() == expected.lines.count());
+    for (size_t i = 0; i < actual.lines.count(); ++i) {
+        CHECK(actual.lines.get(i) == expected.lines.get(i));
+    }
+
+    // Every character has the same style and hyperlink.  Replaced redraws don't leave
+    // an event behind for every style they set so there are fewer events.
+    CHECK(actual.events.len < expected.events.len);
+    for (uint64_t i = 0; i < expected.length; ++i) {
+        Backlog_Event_State expected_state =
+            backlog_event_state_at(&expected, backlog_events_upper_bound(&expected, i));
+        Backlog_Event_State actual_state =
+            backlog_event_state_at(&actual, backlog_events_upper_bound(&actual, i));
+        uint32_t expected_style = (expected_state.style_event == (uint64_t)-1
+                                       ? 0
+                                       : expected.events[expected_state.style_event].payload);
+        uint32_t actual_style = (actual_state.style_event == (uint64_t)-1
+                                     ? 0
+                                     : actual.events[actual_state.style_event].payload);
+        CHECK(actual_style == expected_style);
+        CHECK((actual_state.hyperlink_event == (uint64_t)-1) ==
+              (expected_state.hyperlink_event == (uint64_t)-1));
+    }
+    CHECK(actual.style.foreground == expected.style.foreground);
+    CHECK(actual.escape_parser.state == expected.escape_parser.state);
+
+    // Both continue the same way after the pending '\r'.
+    append_text(&expected, "x\n");
+    append_text(&actual, "x\n");
+    backlog_flush(&actual);
+    cz::String expected_end = dbg_stringify_backlog(&expected);
+    CZ_DEFER(expected_end.drop(cz::heap_allocator()));
+    cz::String actual_end = dbg_stringify_backlog(&actual);
+    CZ_DEFER(actual_end.drop(cz::heap_allocator()));
+    CHECK(actual_end == expected_end);
+
+    Backlog_State* backlogs[] = {&expected, &actual};
+    backlog_dec_refcount(backlogs, &expected);
+    backlog_dec_refcount(backlogs, &actual);
+}
+
+TEST_CASE("backlog chunks are recycled through the pool") {
+    Backlog_Pool_Stats before = backlog_pool_stats();
+
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    cz::Vector<Backlog_State*> backlogs = {};
+    CZ_DEFER(backlogs.drop(cz::heap_allocator()));
+    backlogs.reserve(cz::heap_allocator(), 1);
+    backlogs.push(&backlog);
+
+    // Fill two chunks then go back to the start of the line.
+    cz::String line = {};
+    CZ_DEFER(line.drop(cz::heap_allocator()));
+    line.reserve_exact(cz::heap_allocator(), BBS * 2);
+    for (size_t i = 0; i < BBS * 2; ++i)
+        line.push('=');
+    append_text(&backlog, line);
+    append_text(&backlog, "\r");
+    append_text(&backlog, "done");
+
+    Backlog_Pool_Stats middle = backlog_pool_stats();
+    CHECK(middle.chunk_size == BBS);
+    CHECK(middle.allocated_chunks == before.allocated_chunks + 1);
+
+    // The truncated chunks get reused for the next write.
+    append_text(&backlog, line);
+    Backlog_Pool_Stats after = backlog_pool_stats();
+    CHECK(after.hits >= middle.hits + 2);
+    CHECK(after.misses == middle.misses);
+
+    backlog_dec_refcount(backlogs, &backlog);
+    CHECK(backlog_pool_stats().allocated_chunks == before.allocated_chunks);
+}
+
+TEST_CASE("backlog event checkpoints match replaying every event") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+
+    for (int i = 0; i < 500; ++i) {
+        append_text(&backlog, i % 2 ? "\x1b[31mred " : "\x1b[32mgreen ");
+        if (i % 7 == 0)
+            append_text(&backlog, "\x1b]8;;https://example.com\x1b\\link");
+        if (i % 7 == 3)
+            append_text(&backlog, "\x1b]8;;\x1b\\");
+    }
+    REQUIRE(backlog.events.len > 3 * BACKLOG_EVENT_CHECKPOINT_INTERVAL);
+
+    Backlog_Event_State expected = {(uint64_t)-1, (uint64_t)-1};
+    for (size_t e = 0; e <= backlog.events.len; ++e) {
+        Backlog_Event_State actual = backlog_event_state_at(&backlog, e);
+        CHECK(actual.style_event == expected.style_event);
+        CHECK(actual.hyperlink_event == expected.hyperlink_event);
+        if (e == backlog.events.len)
+            break;
+
+        Backlog_Event* event = &backlog.events[e];
+        if (event->type == BACKLOG_EVENT_START_HYPERLINK)
+            expected.hyperlink_event = e;
+        else if (event->type == BACKLOG_EVENT_END_HYPERLINK)
+            expected.hyperlink_event = -1;
+        else
+            expected.style_event = e;
+
+        uint64_t index = backlog_event_index(&backlog, e);
+        CHECK(backlog_events_upper_bound(&backlog, index) > e);
+        CHECK(backlog_events_lower_bound(&backlog, index) <= e);
+    }
+}
+
+TEST_CASE("backlog_commit_tail matches append_text") {
+    // Plain text across a chunk boundary, then special characters in both spans.
+    cz::String data = {};
+    CZ_DEFER(data.drop(cz::heap_allocator()));
+    data.reserve_exact(cz::heap_allocator(), BBS * 3);
+    for (size_t i = 0; i < BBS - 10; ++i)
+        data.push(i % 64 == 63 ? '\n' : 'a' + (i % 26));
+    data.append("abc\r\ndef\x1b[31mghi\x1b]8;;http://x\x1b\\jkl\x1b]8;;\x1b\\\n");
+    for (size_t i = 0; i < BBS; ++i)
+        data.push(i % 100 == 99 ? '\n' : '0' + (i % 10));
+    data.append("\x1b[");
+
+    Backlog_State expected = {};
+    init_backlog(&expected, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    append_text(&expected, data);
+
+    Backlog_State actual = {};
+    init_backlog(&actual, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    size_t steps[] = {BBS / 2, BBS / 2, 4096, 7, BBS};
+    for (size_t done = 0, i = 0; done < data.len; ++i) {
+        size_t len = cz::min(steps[i % 5], data.len - done);
+        Backlog_Tail_Space space = backlog_tail_space(&actual, len);
+        REQUIRE(space.first.len + space.second.len == len);
+        memcpy(space.first.elems, data.buffer + done, space.first.len);
+        memcpy(space.second.elems, data.buffer + done + space.first.len, space.second.len);
+        CHECK(backlog_commit_tail(&actual, len) == len);
+        done += len;
+    }
+
+    cz::String expected_string = dbg_stringify_backlog(&expected);
+    CZ_DEFER(expected_string.drop(cz::heap_allocator()));
+    cz::String actual_string = dbg_stringify_backlog(&actual);
+    CZ_DEFER(actual_string.drop(cz::heap_allocator()));
+    CHECK(actual_string == expected_string);
+    REQUIRE(actual.lines.count() == expected.lines.count());
+    for (size_t i = 0; i < actual.lines.count(); ++i) {
+        CHECK(actual.lines.get(i) == expected.lines.get(i));
+    }
+    CHECK(actual.events.len == expected.events.len);
+}
+
+TEST_CASE("backlog_commit_tail only makes room for what was read") {
+    Backlog_State expected = {};
+    init_backlog(&expected, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/1, /*max_length=*/8 * BBS);
+    backlog.ring_retention = true;
+    cz::Vector<Backlog_State*> backlogs = {};
+    CZ_DEFER(backlogs.drop(cz::heap_allocator()));
+    backlogs.reserve(cz::heap_allocator(), 2);
+    backlogs.push(&expected);
+    backlogs.push(&backlog);
+
+    // Ask for much more space than is used, like the read loop does.
+    bool kept_enough = true;
+    for (size_t i = 0; i < 5000; ++i) {
+        char buffer[32];
+        cz::Str line = {buffer, (size_t)snprintf(buffer, sizeof(buffer), "line %zu\n", i)};
+        append_text(&expected, line);
+
+        Backlog_Tail_Space space = backlog_tail_space(&backlog, 64 << 10);
+        size_t first = cz::min(space.first.len, line.len);
+        REQUIRE(first + space.second.len >= line.len);
+        memcpy(space.first.elems, line.buffer, first);
+        memcpy(space.second.elems, line.buffer + first, line.len - first);
+        CHECK(backlog_commit_tail(&backlog, line.len) == line.len);
+
+        if (backlog.length >= backlog.max_length &&
+            backlog.length - backlog.discarded < backlog.max_length / 2) {
+            kept_enough = false;
+        }
+    }
+
+    CHECK(kept_enough);
+    CHECK(backlog.length == expected.length);
+    CHECK(backlog.discarded > 0);
+    bool same = true;
+    for (uint64_t i = backlog.discarded; i < backlog.length; ++i) {
+        if (backlog.get(i) != expected.get(i))
+            same = false;
+    }
+    CHECK(same);
+
+    backlog_dec_refcount(backlogs, &expected);
+    backlog_dec_refcount(backlogs, &backlog);
+}
+
+TEST_CASE("backlog_adopt_tail matches append_text") {
+    Backlog_Pool_Stats before = backlog_pool_stats();
+
+    // Plain text across chunk boundaries, then special characters in the middle of a chunk.
+    cz::String data = {};
+    CZ_DEFER(data.drop(cz::heap_allocator()));
+    data.reserve_exact(cz::heap_allocator(), BBS * 8);
+    for (size_t i = 0; i < BBS * 3 - 10; ++i)
+        data.push(i % 64 == 63 ? '\n' : 'a' + (i % 26));
+    data.append("abc\r\ndef\x1b[31mghi\x1b]8;;http://x\x1b\\jkl\x1b]8;;\x1b\\\n");
+    for (size_t i = 0; i < BBS * 3; ++i)
+        data.push(i % 100 == 99 ? '\n' : '0' + (i % 10));
+    data.append("\x1b[");
+
+    Backlog_State expected = {};
+    init_backlog(&expected, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    append_text(&expected, data);
+
+    Backlog_State actual = {};
+    init_backlog(&actual, /*id=*/1, /*max_length=*/1ull << 30 /*1GB*/);
+    cz::Vector<Backlog_State*> backlogs = {};
+    CZ_DEFER(backlogs.drop(cz::heap_allocator()));
+    backlogs.reserve(cz::heap_allocator(), 2);
+    backlogs.push(&expected);
+    backlogs.push(&actual);
+
+    // The fourth read doesn't line up with the end of the backlog.
+    size_t steps[] = {BBS / 2, 2 * BBS + 5, 7, BBS, 3 * BBS};
+    cz::Vector<char*> chunks = {};
+    CZ_DEFER(chunks.drop(cz::heap_allocator()));
+    for (size_t done = 0, i = 0; done < data.len; ++i) {
+        size_t len = cz::min(steps[i % 5], data.len - done);
+        Backlog_Tail_Loan loan = backlog_tail_loan(&actual, len);
+        REQUIRE(loan.max == len);
+        size_t offset = (i % 5 == 3 ? (loan.offset + 1) % BBS : loan.offset);
+
+        chunks.len = 0;
+        chunks.reserve(cz::heap_allocator(), (offset + len + BBS - 1) / BBS);
+        for (size_t j = 0; j < offset + len; j += BBS)
+            chunks.push(backlog_pool_alloc());
+        for (size_t j = 0; j < len; ++j)
+            chunks[(offset + j) / BBS][(offset + j) % BBS] = data[done + j];
+
+        CHECK(backlog_adopt_tail(&actual, chunks, offset, len) == len);
+        done += len;
+    }
+
+    cz::String expected_string = dbg_stringify_backlog(&expected);
+    CZ_DEFER(expected_string.drop(cz::heap_allocator()));
+    cz::String actual_string = dbg_stringify_backlog(&actual);
+    CZ_DEFER(actual_string.drop(cz::heap_allocator()));
+    CHECK(actual_string == expected_string);
+    REQUIRE(actual.lines.count() == expected.lines.count());
+    for (size_t i = 0; i < actual.lines.count(); ++i) {
+        CHECK(actual.lines.get(i) == expected.lines.get(i));
+    }
+    CHECK(actual.events.len == expected.events.len);
+
+    // Every chunk that was handed over is either used or back in the pool.
+    backlog_dec_refcount(backlogs, &expected);
+    backlog_dec_refcount(backlogs, &actual);
+    CHECK(backlog_pool_stats().allocated_chunks == before.allocated_chunks);
+}
+
+TEST_CASE("backlog_adopt_tail only makes room for what was read") {
+    Backlog_Pool_Stats before = backlog_pool_stats();
+
+    Backlog_State expected = {};
+    init_backlog(&expected, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/1, /*max_length=*/8 * BBS);
+    backlog.ring_retention = true;
+    cz::Vector<Backlog_State*> backlogs = {};
+    CZ_DEFER(backlogs.drop(cz::heap_allocator()));
+    backlogs.reserve(cz::heap_allocator(), 2);
+    backlogs.push(&expected);
+    backlogs.push(&backlog);
+
+    // Lend much more than is read, like the reader thread does each frame.
+    bool kept_enough = true;
+    cz::Vector<char*> chunks = {};
+    CZ_DEFER(chunks.drop(cz::heap_allocator()));
+    for (size_t i = 0; i < 5000; ++i) {
+        char buffer[32];
+        cz::Str line = {buffer, (size_t)snprintf(buffer, sizeof(buffer), "line %zu\n", i)};
+        append_text(&expected, line);
+
+        Backlog_Tail_Loan loan = backlog_tail_loan(&backlog, 1 << 20);
+        REQUIRE(loan.max >= line.len);
+        CHECK(loan.max <= backlog.max_length / 8);
+
+        chunks.len = 0;
+        chunks.reserve(cz::heap_allocator(), 2);
+        for (size_t j = 0; j < loan.offset + line.len; j += BBS)
+            chunks.push(backlog_pool_alloc());
+        for (size_t j = 0; j < line.len; ++j)
+            chunks[(loan.offset + j) / BBS][(loan.offset + j) % BBS] = line[j];
+        CHECK(backlog_adopt_tail(&backlog, chunks, loan.offset, line.len) == line.len);
+
+        if (backlog.length >= backlog.max_length &&
+            backlog.length - backlog.discarded < backlog.max_length / 2) {
+            kept_enough = false;
+        }
+    }
+
+    CHECK(kept_enough);
+    CHECK(backlog.length == expected.length);
+    CHECK(backlog.discarded > 0);
+    bool same = true;
+    for (uint64_t i = backlog.discarded; i < backlog.length; ++i) {
+        if (backlog.get(i) != expected.get(i))
+            same = false;
+    }
+    CHECK(same);
+
+    backlog_dec_refcount(backlogs, &expected);
+    backlog_dec_refcount(backlogs, &backlog);
+    CHECK(backlog_pool_stats().allocated_chunks == before.allocated_chunks);
+}
+
+TEST_CASE("backlog ring retention keeps the newest output") {
+    Backlog_State expected = {};
+    init_backlog(&expected, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/8 * BBS);
+    backlog.ring_retention = true;
+
+    // Write way more than fits, in various sizes and with styles along the way.
+    for (size_t i = 0; i < 2000; ++i) {
+        cz::String line = cz::format(cz::heap_allocator(), "line ", i, ' ');
+        CZ_DEFER(line.drop(cz::heap_allocator()));
+        line.reserve(cz::heap_allocator(), 64 + (i == 1500 ? 12 * BBS : 0));
+        for (size_t j = 0; j < i % 37; ++j)
+            line.push('a' + (j % 26));
+        if (i % 50 == 0)
+            line.append(i % 100 == 0 ? "\x1b[31m" : "\x1b[0m");
+        line.push('\n');
+        if (i == 1500) {
+            // Bigger than the whole backlog.
+            for (size_t j = 0; j < 12 * BBS; ++j)
+                line.push(j % 80 == 79 ? '\n' : 'x');
+        }
+        append_text(&expected, line);
+        append_text(&backlog, line);
+    }
+
+    CHECK(backlog.length == expected.length);
+    CHECK(backlog.discarded > 0);
+    CHECK(backlog.discarded % BBS == 0);
+    CHECK(backlog.length - backlog.discarded <= 8 * BBS);
+    CHECK(backlog.buffers.len <= 9);
+
+    // The retained text is the end of the full text.
+    cz::String expected_string = dbg_stringify_backlog(&expected);
+    CZ_DEFER(expected_string.drop(cz::heap_allocator()));
+    cz::String actual_string = dbg_stringify_backlog(&backlog);
+    CZ_DEFER(actual_string.drop(cz::heap_allocator()));
+    CHECK(actual_string == expected_string.slice_start(backlog.discarded));
+
+    // Line starts keep their absolute indices.
+    REQUIRE(backlog.discarded_lines + backlog.lines.count() == expected.lines.count());
+    for (size_t i = 0; i < backlog.lines.count(); ++i) {
+        CHECK(backlog.lines.get(i) == expected.lines.get(backlog.discarded_lines + i));
+    }
+
+    // The style in effect is the same everywhere that is left.
+    for (uint64_t index = backlog.discarded; index < backlog.length; index += 97) {
+        Backlog_Event_State actual_state =
+            backlog_event_state_at(&backlog, backlog_events_upper_bound(&backlog, index));
+        Backlog_Event_State expected_state =
+            backlog_event_state_at(&expected, backlog_events_upper_bound(&expected, index));
+        REQUIRE(actual_state.style_event != (uint64_t)-1);
+        REQUIRE(expected_state.style_event != (uint64_t)-1);
+        Backlog_Event actual_event = backlog.events[actual_state.style_event];
+        Backlog_Event expected_event = expected.events[expected_state.style_event];
+        CHECK(actual_event.type == expected_event.type);
+        CHECK(backlog.styles[actual_event.payload].foreground ==
+              expected.styles[expected_event.payload].foreground);
+    }
+}
+
+TEST_CASE("backlog flow stops at max_length and resumes") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/2 * BBS);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+
+    CHECK(backlog_flow(&backlog) == BACKLOG_FLOW_READING);
+    backlog.paused = true;
+    CHECK(backlog_flow(&backlog) == BACKLOG_FLOW_PAUSED);
+    backlog.paused = false;
+
+    // Fill the backlog.  The rest isn't consumed so it can be read later.
+    cz::String text = {};
+    CZ_DEFER(text.drop(cz::heap_allocator()));
+    text.reserve_exact(cz::heap_allocator(), 3 * BBS);
+    for (size_t i = 0; i < 3 * BBS; ++i)
+        text.push(i % 80 == 79 ? '\n' : 'a' + (i % 26));
+    CHECK(append_text(&backlog, text) == 2 * BBS);
+    CHECK(backlog_flow(&backlog) == BACKLOG_FLOW_FULL);
+
+    // Raising the limit lets the rest in.
+    backlog_raise_max_length(&backlog, 4 * BBS);
+    CHECK(backlog_flow(&backlog) == BACKLOG_FLOW_READING);
+    CHECK(append_text(&backlog, text.slice_start(2 * BBS)) == BBS);
+
+    cz::String output = dbg_stringify_backlog(&backlog);
+    CZ_DEFER(output.drop(cz::heap_allocator()));
+    CHECK(output == text);
+
+    // Ring retention makes a full backlog readable again.
+    CHECK(append_text(&backlog, text) == BBS);
+    CHECK(backlog_flow(&backlog) == BACKLOG_FLOW_FULL);
+    backlog_enable_ring_retention(&backlog);
+    CHECK(backlog_flow(&backlog) == BACKLOG_FLOW_READING);
+    CHECK(append_text(&backlog, text) == text.len);
+    CHECK(backlog.length == 7 * BBS);
+    CHECK(backlog.get(backlog.length - 1) == text.last());
+}
+
+TEST_CASE("backlog spilled chunks read back the same") {
+    cz::String data = {};
+    CZ_DEFER(data.drop(cz::heap_allocator()));
+    data.reserve_exact(cz::heap_allocator(), BBS * 20);
+    for (size_t i = 0; i < BBS * 20 - 10; ++i)
+        data.push('a' + (i % 26));
+
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    append_text(&backlog, data);
+    Backlog_State* backlogs[] = {&backlog};
+
+    // Spill everything but the last chunk.
+    Backlog_Spill_Stats before = backlog_spill_stats();
+    backlog_spill_enforce_budget(backlogs, {}, /*budget=*/1);
+    Backlog_Spill_Stats middle = backlog_spill_stats();
+    CHECK(middle.spills == before.spills + 19);
+    CHECK(middle.spilled_bytes == before.spilled_bytes + 19 * BBS);
+    CHECK(backlog.buffers[0] == nullptr);
+
+    // Visible backlogs are left alone.
+    Backlog_State other = {};
+    init_backlog(&other, /*id=*/1, /*max_length=*/1ull << 30 /*1GB*/);
+    append_text(&other, data);
+    Backlog_State* visible[] = {&other};
+    backlog_spill_enforce_budget(visible, visible, /*budget=*/1);
+    CHECK(backlog_spill_stats().spills == middle.spills);
+
+    // Reading maps the chunks back in.
+    cz::String output = dbg_stringify_backlog(&backlog);
+    CZ_DEFER(output.drop(cz::heap_allocator()));
+    CHECK(output == data);
+    CHECK(backlog_spill_stats().faults == middle.faults + 19);
+    CHECK(backlog_spill_stats().mapped_bytes == middle.mapped_bytes + 19 * BBS);
+
+    // Going back to the start of the line writes to the first chunk again.
+    backlog_spill_enforce_budget(backlogs, {}, /*budget=*/1);
+    append_text(&backlog, "\rdone");
+    output.drop(cz::heap_allocator());
+    output = dbg_stringify_backlog(&backlog);
+    CHECK(output == "done");
+
+    cz::Vector<Backlog_State*> all = {};
+    CZ_DEFER(all.drop(cz::heap_allocator()));
+    all.reserve(cz::heap_allocator(), 2);
+    all.push(&backlog);
+    all.push(&other);
+    backlog_dec_refcount(all, &backlog);
+    backlog_dec_refcount(all, &other);
+    CHECK(backlog_spill_stats().spilled_bytes == before.spilled_bytes);
+    CHECK(backlog_spill_stats().mapped_bytes == before.mapped_bytes);
+}
+
+TEST_CASE("backlog compressed chunks read back the same") {
+    cz::String data = {};
+    CZ_DEFER(data.drop(cz::heap_allocator()));
+    data.reserve_exact(cz::heap_allocator(), BBS * 40);
+    for (size_t line = 0; data.len + 100 < BBS * 40; ++line) {
+        data.append("src/backlog.cpp:");
+        data.push('0' + line % 10);
+        data.push('0' + line / 10 % 10);
+        data.append(": warning: unused variable 'x");
+        data.push('a' + line % 7);
+        data.append("'\n");
+    }
+
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    append_text(&backlog, data);
+    Backlog_State* backlogs[] = {&backlog};
+    size_t full_chunks = backlog.buffers.len - 1;
+    REQUIRE(full_chunks > BACKLOG_BLOCK_CACHE_SIZE);
+
+    // Running backlogs are left alone.
+    Backlog_Compress_Stats before = backlog_compress_stats();
+    backlog_compress_tick(backlogs, {});
+    backlog_compress_wait();
+    backlog_compress_tick(backlogs, {});
+    CHECK(backlog_compress_stats().compressed_chunks == before.compressed_chunks);
+
+    // Compress everything but the last chunk.
+    backlog.done = true;
+    backlog_compress_tick(backlogs, {});
+    backlog_compress_wait();
+    backlog_compress_tick(backlogs, {});
+    Backlog_Compress_Stats middle = backlog_compress_stats();
+    CHECK(middle.compressed_chunks == before.compressed_chunks + full_chunks);
+    CHECK(middle.compressed_bytes - before.compressed_bytes < full_chunks * BBS / 3);
+    CHECK(backlog.buffers[0] == nullptr);
+    CHECK(backlog.buffers[full_chunks] != nullptr);
+
+    // Reading decompresses through the cache.
+    cz::String output = dbg_stringify_backlog(&backlog);
+    CZ_DEFER(output.drop(cz::heap_allocator()));
+    CHECK(output == data);
+    CHECK(backlog_compress_stats().decompressions == middle.decompressions + full_chunks);
+
+    // Chunks evicted from the cache are decompressed again.
+    for (size_t i = 0; i < data.len; i += 4093) {
+        CHECK(backlog.get(i) == data[i]);
+    }
+
+    cz::Vector<Backlog_State*> all = {};
+    CZ_DEFER(all.drop(cz::heap_allocator()));
+    all.reserve(cz::heap_allocator(), 1);
+    all.push(&backlog);
+    backlog_dec_refcount(all, &backlog);
+    CHECK(backlog_compress_stats().compressed_bytes == before.compressed_bytes);
+}
+
+TEST_CASE("backlog spans walk chunks in both directions") {
+    cz::String data = {};
+    CZ_DEFER(data.drop(cz::heap_allocator()));
+    data.reserve_exact(cz::heap_allocator(), BBS * 3);
+    for (size_t i = 0; i < BBS * 3 - 7; ++i)
+        data.push('a' + (i % 26));
+    data[BBS + 5] = '\n';
+    data[BBS * 2 + 9] = '\n';
+
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    append_text(&backlog, data);
+
+    // Runs end at chunk boundaries.
+    uint64_t start = 10, end = BBS * 2 + 20;
+    Backlog_Spans spans = backlog_spans(&backlog, start, end);
+    cz::Str span;
+    REQUIRE(spans.next(&span));
+    CHECK(span == data.slice(start, BBS));
+    REQUIRE(spans.prev(&span));
+    CHECK(span == data.slice(BBS * 2, end));
+    REQUIRE(spans.next(&span));
+    CHECK(span == data.slice(BBS, BBS * 2));
+    CHECK_FALSE(spans.next(&span));
+    CHECK_FALSE(spans.prev(&span));
+
+    cz::String copy = {};
+    CZ_DEFER(copy.drop(cz::heap_allocator()));
+    backlog_append_range(&backlog, start, end, cz::heap_allocator(), &copy);
+    CHECK(copy == data.slice(start, end));
+
+    uint64_t index;
+    REQUIRE(backlog_find(&backlog, 0, backlog.length, '\n', &index));
+    CHECK(index == BBS + 5);
+    REQUIRE(backlog_find(&backlog, index + 1, backlog.length, '\n', &index));
+    CHECK(index == BBS * 2 + 9);
+    CHECK_FALSE(backlog_find(&backlog, index + 1, backlog.length, '\n', &index));
+    REQUIRE(backlog_rfind(&backlog, 0, backlog.length, '\n', &index));
+    CHECK(index == BBS * 2 + 9);
+    REQUIRE(backlog_rfind(&backlog, 0, index, '\n', &index));
+    CHECK(index == BBS + 5);
+    CHECK_FALSE(backlog_rfind(&backlog, 0, index, '\n', &index));
+
+    // Matches across a chunk boundary.
+    CHECK(backlog_matches(&backlog, BBS - 3, data.slice(BBS - 3, BBS + 3)));
+    CHECK_FALSE(backlog_matches(&backlog, BBS - 2, data.slice(BBS - 3, BBS + 3)));
+    CHECK_FALSE(backlog_matches(&backlog, backlog.length - 1, "zz"));
+
+    Backlog_State* backlogs[] = {&backlog};
+    backlog_dec_refcount(backlogs, &backlog);
+}
+
+TEST_CASE("backlog measures display widths as text is appended") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+
+    // Put a wide character across the first chunk boundary.
+    cz::String data = {};
+    CZ_DEFER(data.drop(cz::heap_allocator()));
+    data.reserve_exact(cz::heap_allocator(), BBS + 32);
+    for (size_t i = 0; i < BBS - 1; ++i)
+        data.push('a');
+    const cz::Str tail =
+        "\xe4\xb8\xad"      // CJK ideograph: 2 columns.
+        "e\xcc\x81"         // e + combining acute: 1 + 0 columns.
+        "\xf0\x9f\x98\x80"  // Emoji: 2 columns.
+        "\xff"              // Invalid byte: 1 column.
+        "\xe4\x41"          // Truncated sequence then 'A': 1 + 1 columns.
+        "\xc0\x80";         // Overlong encoding: 1 column.
+    data.append(tail);
+
+    // Feed one byte at a time so sequences are split across appends.
+    for (size_t i = 0; i < data.len; ++i)
+        append_text(&backlog, data.slice(i, i + 1));
+    CHECK(backlog.widths_until == backlog.length);
+
+    uint64_t start = BBS - 1;
+    CHECK(backlog.width_at(0) == 1);
+    CHECK(backlog.width_at(start) == 2);
+    CHECK(backlog.width_at(start + 3) == 1);
+    CHECK(backlog.width_at(start + 4) == 0);
+    CHECK(backlog.width_at(start + 6) == 2);
+    CHECK(backlog.width_at(start + 10) == 1);
+    CHECK(backlog.width_at(start + 11) == 1);
+    CHECK(backlog.width_at(start + 12) == 1);
+    CHECK(backlog.width_at(start + 13) == 1);
+
+    // An incomplete sequence waits for the rest.
+    append_text(&backlog, "\xe4\xb8");
+    CHECK(backlog.widths_until == backlog.length - 2);
+    append_text(&backlog, "\xad");
+    CHECK(backlog.widths_until == backlog.length);
+    CHECK(backlog.width_at(backlog.length - 3) == 2);
+
+    // Backspacing over a wide character forgets its width.
+    uint64_t wide = backlog.length - 3;
+    append_text(&backlog, "\b");
+    append_text(&backlog, "xyz");
+    CHECK(backlog.width_at(wide) == 1);
+
+    Backlog_State* backlogs[] = {&backlog};
+    backlog_dec_refcount(backlogs, &backlog);
+}
+
+TEST_CASE("scan_ascii stops at the first non-ASCII byte") {
+    char text[64];
+    memset(text, 'a', sizeof(text));
+    CHECK(scan_ascii({text, sizeof(text)}) == sizeof(text));
+    for (size_t i = 0; i < sizeof(text); ++i) {
+        text[i] = (char)0x80;
+        CHECK(scan_ascii({text, sizeof(text)}) == i);
+        CHECK(scan_ascii({text + i, sizeof(text) - i}) == 0);
+        text[i] = 'a';
+    }
+}
+
+TEST_CASE("backlog index forgets the filters of truncated text") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+
+    cz::String xs = {};
+    CZ_DEFER(xs.drop(cz::heap_allocator()));
+    xs.reserve_exact(cz::heap_allocator(), 5 * BBS);
+    for (size_t i = 0; i < 5 * BBS; ++i)
+        xs.push('x');
+
+    Backlog_Index_Stats before = backlog_index_stats();
+    append_text(&backlog, "a\n");
+    append_text(&backlog, xs);
+    backlog_index_tick(backlogs, /*budget=*/1ull << 30);
+    backlog_index_wait();
+    backlog_index_tick(backlogs, /*budget=*/1ull << 30);
+    CHECK(backlog_index_stats().indexed_chunks == before.indexed_chunks + 5);
+    CHECK(backlog.filters[0] != nullptr);
+
+    // Moving the cursor home rewrites the line.
+    append_text(&backlog, "\x1b[H");
+    REQUIRE(backlog.length == 2);
+    CHECK(backlog_index_stats().indexed_chunks == before.indexed_chunks);
+    CHECK(backlog.filters[0] == nullptr);
+
+    // The new text is indexed instead.
+    for (size_t i = 0; i < xs.len; ++i)
+        xs[i] = 'z';
+    append_text(&backlog, xs);
+    backlog_index_tick(backlogs, /*budget=*/1ull << 30);
+    backlog_index_wait();
+    backlog_index_tick(backlogs, /*budget=*/1ull << 30);
+    cz::Vector<uint32_t> bits = {};
+    CZ_DEFER(bits.drop(cz::heap_allocator()));
+    backlog_index_query("xxx", &bits);
+    CHECK_FALSE(backlog_index_may_match(&backlog, 1, bits));
+    backlog_index_query("zzz", &bits);
+    CHECK(backlog_index_may_match(&backlog, 1, bits));
+}
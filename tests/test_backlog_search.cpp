@@ -0,0 +1,93 @@
+#include <czt/test_base.hpp>
+
+#include <string.h>
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/string.hpp>
+#include "backlog.hpp"
+#include "backlog_search.hpp"
+
+#define BBS BACKLOG_BUFFER_SIZE
+
+static const char* naive_search(cz::Str text, cz::Str needle, bool reverse) {
+    if (needle.len > text.len)
+        return nullptr;
+    for (size_t j = 0; j <= text.len - needle.len; ++j) {
+        size_t i = (reverse ? text.len - needle.len - j : j);
+        if (memcmp(text.buffer + i, needle.buffer, needle.len) == 0)
+            return text.buffer + i;
+    }
+    return nullptr;
+}
+
+TEST_CASE("search_text matches a naive search") {
+    // Few distinct bytes so there are lots of partial matches.
+    char buffer[300];
+    for (size_t i = 0; i < sizeof(buffer); ++i)
+        buffer[i] = "aab"[(i * 7 + i / 5) % 3];
+
+    const char* needles[] = {"a", "b", "ab", "ba", "aab", "bab", "aabaa", "abababab", "c",
+                             "aabaaba aab", "abaabaabaabaabaabaabaabaabaaba"};
+    for (size_t len = 0; len <= sizeof(buffer); len += 13) {
+        cz::Str text = {buffer, len};
+        for (size_t n = 0; n < sizeof(needles) / sizeof(needles[0]); ++n) {
+            cz::Str needle = needles[n];
+            CHECK(search_text(text, needle) == naive_search(text, needle, false));
+            CHECK(search_text_scalar(text, needle) == naive_search(text, needle, false));
+            CHECK(search_text_reverse(text, needle) == naive_search(text, needle, true));
+            CHECK(search_text_reverse_scalar(text, needle) == naive_search(text, needle, true));
+        }
+    }
+}
+
+TEST_CASE("backlog search finds matches across chunks") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+
+    // Put the needle right before, on, and after every chunk boundary.
+    const cz::Str needle = "needle";
+    cz::String text = {};
+    CZ_DEFER(text.drop(cz::heap_allocator()));
+    text.reserve_exact(cz::heap_allocator(), 5 * BBS);
+    for (size_t i = 0; i < 5 * BBS; ++i)
+        text.push(i % 80 == 79 ? '\n' : "neel"[i % 4]);
+    for (size_t chunk = 1; chunk < 5; ++chunk) {
+        size_t offset = chunk * BBS - 3 + chunk * (chunk % 2 ? 1 : -1);
+        memcpy(text.buffer + offset, needle.buffer, needle.len);
+    }
+    append_text(&backlog, text);
+
+    cz::String stored = dbg_stringify_backlog(&backlog);
+    CZ_DEFER(stored.drop(cz::heap_allocator()));
+    REQUIRE(stored == text);
+
+    // Walk every match forwards and backwards.
+    for (size_t start = 0; start < text.len; start += BBS / 3) {
+        uint64_t index;
+        cz::Str rest = text.slice_start(start);
+        const char* expected = naive_search(rest, needle, false);
+        bool found = backlog_search_forward(&backlog, start, text.len, needle, &index);
+        REQUIRE(found == (expected != nullptr));
+        if (found)
+            CHECK(index == expected - text.buffer);
+
+        cz::Str before = text.slice_end(text.len - start);
+        expected = naive_search(before, needle, true);
+        found = backlog_search_backward(&backlog, 0, before.len, needle, &index);
+        REQUIRE(found == (expected != nullptr));
+        if (found)
+            CHECK(index == expected - text.buffer);
+    }
+
+    // Matches must be entirely inside the range.
+    uint64_t index;
+    uint64_t match = 2 * BBS - 3 - 2;
+    REQUIRE(backlog_search_forward(&backlog, BBS, 3 * BBS, needle, &index));
+    CHECK(index == match);
+    CHECK_FALSE(backlog_search_forward(&backlog, match + 1, match + 20, needle, &index));
+    CHECK_FALSE(backlog_search_backward(&backlog, BBS, match + needle.len - 1, needle, &index));
+    REQUIRE(backlog_search_backward(&backlog, BBS, match + needle.len, needle, &index));
+    CHECK(index == match);
+}
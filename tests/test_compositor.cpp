@@ -0,0 +1,65 @@
+#include <czt/test_base.hpp>
+
+#include "compositor.hpp"
+
+TEST_CASE("composite_blend matches composite_blend_scalar") {
+    // Cover every alpha and leave tails that don't fill a vector.
+    uint8_t coverage[256 + 7];
+    for (size_t i = 0; i < sizeof(coverage); ++i) {
+        coverage[i] = (uint8_t)(i * 37);
+    }
+    // Runs of empty and full coverage take the fast paths.
+    for (size_t i = 32; i < 48; ++i) {
+        coverage[i] = 0;
+    }
+    for (size_t i = 64; i < 80; ++i) {
+        coverage[i] = 0xff;
+    }
+
+    const uint32_t colors[] = {0x00000000, 0xffffffff, 0xff102030, 0x80ff7f01};
+    for (size_t count = 0; count <= sizeof(coverage); count += 13) {
+        for (uint32_t background : colors) {
+            for (uint32_t foreground : colors) {
+                uint32_t expected[sizeof(coverage)];
+                uint32_t actual[sizeof(coverage)];
+                composite_blend_scalar(expected, coverage, count, background, foreground);
+                composite_blend(actual, coverage, count, background, foreground);
+                for (size_t i = 0; i < count; ++i) {
+                    CHECK(actual[i] == expected[i]);
+                }
+            }
+        }
+    }
+
+    // The end points are exact.
+    uint8_t ends[2] = {0, 0xff};
+    uint32_t pixels[2];
+    composite_blend(pixels, ends, 2, 0xff102030, 0xffa0b0c0);
+    CHECK(pixels[0] == 0xff102030);
+    CHECK(pixels[1] == 0xffa0b0c0);
+}
+
+TEST_CASE("composite_row draws spans and underlines") {
+    const int width = 6;
+    const int height = 3;
+    uint32_t pixels[width * height] = {};
+
+    uint8_t mask[2 * height] = {0, 0xff, 0xff, 0, 0, 0};
+    Composite_Span spans[3] = {};
+    spans[0] = {0, 2, mask, 1, 2, false};
+    spans[1] = {2, 3, nullptr, 3, 4, true};
+    spans[2] = {5, 1, nullptr, 5, 0, false};
+
+    // Skip the first line.
+    composite_row((uint8_t*)(pixels + width), width * sizeof(uint32_t), 1, 2,
+                  /*underline_line=*/2, spans);
+
+    uint32_t expected[width * height] = {
+        0, 0, 0, 0, 0, 0,  //
+        2, 1, 3, 3, 3, 5,  //
+        1, 1, 4, 4, 4, 5,  //
+    };
+    for (int i = 0; i < width * height; ++i) {
+        CHECK(pixels[i] == expected[i]);
+    }
+}
@@ -0,0 +1,92 @@
+#include <czt/test_base.hpp>
+
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/string.hpp>
+#include "compress.hpp"
+
+static void check_round_trip(cz::Str input) {
+    cz::String block = {};
+    CZ_DEFER(block.drop(cz::heap_allocator()));
+    block.reserve_exact(cz::heap_allocator(), compress_block_bound(input.len));
+    block.len = compress_block(input.buffer, input.len, block.buffer);
+    REQUIRE(block.len <= compress_block_bound(input.len));
+
+    cz::String output = {};
+    CZ_DEFER(output.drop(cz::heap_allocator()));
+    output.reserve_exact(cz::heap_allocator(), input.len + 1);
+    REQUIRE(decompress_block(block.buffer, block.len, output.buffer, input.len));
+    output.len = input.len;
+    CHECK(output == input);
+
+    // The size has to match exactly.
+    CHECK_FALSE(decompress_block(block.buffer, block.len, output.buffer, input.len + 1));
+    if (input.len > 0)
+        CHECK_FALSE(decompress_block(block.buffer, block.len, output.buffer, input.len - 1));
+}
+
+TEST_CASE("compress_block round trips") {
+    check_round_trip("");
+    check_round_trip("a");
+    check_round_trip("hello world");
+
+    cz::String data = {};
+    CZ_DEFER(data.drop(cz::heap_allocator()));
+    data.reserve_exact(cz::heap_allocator(), 1 << 16);
+
+    // Long runs make matches that overlap their output.
+    for (size_t i = 0; i < 5000; ++i)
+        data.push('x');
+    check_round_trip(data);
+
+    // Repetitive lines like a compiler log.
+    data.len = 0;
+    for (size_t i = 0; data.len + 64 < data.cap; ++i) {
+        data.append("src/backlog.cpp: warning: unused variable ");
+        data.push('a' + (i % 26));
+        data.push('\n');
+    }
+    check_round_trip(data);
+
+    // Noise doesn't compress but shouldn't grow much either.
+    data.len = 0;
+    uint32_t state = 12345;
+    for (size_t i = 0; i < data.cap; ++i) {
+        state = state * 1103515245 + 12345;
+        data.push((char)(state >> 16));
+    }
+    check_round_trip(data);
+}
+
+TEST_CASE("compress_block shrinks repetitive text") {
+    cz::String data = {};
+    CZ_DEFER(data.drop(cz::heap_allocator()));
+    data.reserve_exact(cz::heap_allocator(), 4096);
+    while (data.len + 32 < data.cap)
+        data.append("[ 42%] Building CXX object\n");
+
+    cz::String block = {};
+    CZ_DEFER(block.drop(cz::heap_allocator()));
+    block.reserve_exact(cz::heap_allocator(), compress_block_bound(data.len));
+    size_t len = compress_block(data.buffer, data.len, block.buffer);
+    CHECK(len < data.len / 10);
+}
+
+TEST_CASE("decompress_block rejects corrupt blocks") {
+    char output[64];
+
+    // Literal length runs past the end of the block.
+    CHECK_FALSE(decompress_block("\x50" "abc", 4, output, sizeof(output)));
+
+    // Match offset of zero.
+    CHECK_FALSE(decompress_block("\x10" "a\x00\x00", 4, output, 5));
+
+    // Match offset before the start of the output.
+    CHECK_FALSE(decompress_block("\x10" "a\x05\x00", 4, output, 5));
+
+    // Length continuation byte is missing.
+    CHECK_FALSE(decompress_block("\xf0", 1, output, sizeof(output)));
+
+    // Output would overflow.
+    CHECK_FALSE(decompress_block("\x1f" "a\x01\x00\xff\x10", 6, output, sizeof(output)));
+}
@@ -0,0 +1,65 @@
+#include <czt/test_base.hpp>
+
+#include <string.h>
+#include "glyph_atlas.hpp"
+
+static void fill_mask(Glyph_Atlas* atlas, uint8_t* mask, uint64_t key) {
+    memset(mask, (uint8_t)key, (size_t)atlas->width * atlas->height);
+}
+
+static bool has_mask(Glyph_Atlas* atlas, uint64_t key) {
+    const uint8_t* mask = glyph_atlas_find(atlas, key);
+    if (!mask)
+        return false;
+    for (int i = 0; i < atlas->width * atlas->height; ++i) {
+        if (mask[i] != (uint8_t)key)
+            return false;
+    }
+    return true;
+}
+
+TEST_CASE("glyph atlas evicts the least recently used glyph") {
+    Glyph_Atlas atlas;
+    glyph_atlas_init(&atlas, /*width=*/3, /*height=*/5, /*max_bytes=*/3 * 5 * 3);
+    REQUIRE(atlas.max_slots == 3);
+
+    for (uint64_t key = 1; key <= 3; ++key) {
+        CHECK(glyph_atlas_find(&atlas, key) == nullptr);
+        fill_mask(&atlas, glyph_atlas_insert(&atlas, key), key);
+    }
+
+    // Touch 1 so 2 is the least recently used.
+    CHECK(has_mask(&atlas, 1));
+    fill_mask(&atlas, glyph_atlas_insert(&atlas, 4), 4);
+
+    CHECK(has_mask(&atlas, 1));
+    CHECK_FALSE(has_mask(&atlas, 2));
+    CHECK(has_mask(&atlas, 3));
+    CHECK(has_mask(&atlas, 4));
+    CHECK(atlas.evictions == 1);
+
+    glyph_atlas_drop(&atlas);
+}
+
+TEST_CASE("glyph atlas keeps every key findable through many evictions") {
+    Glyph_Atlas atlas;
+    glyph_atlas_init(&atlas, /*width=*/2, /*height=*/2, /*max_bytes=*/4 * 100);
+
+    // Keys that collide in the table.
+    for (uint64_t i = 0; i < 5000; ++i) {
+        uint64_t key = glyph_atlas_key((uint32_t)(i * 64), (int)(i % 3));
+        if (!glyph_atlas_find(&atlas, key))
+            fill_mask(&atlas, glyph_atlas_insert(&atlas, key), key);
+
+        // The last 100 keys must all still be there.
+        if (i % 500 == 499) {
+            for (uint64_t j = i - 99; j <= i; ++j) {
+                uint64_t key2 = glyph_atlas_key((uint32_t)(j * 64), (int)(j % 3));
+                CHECK(has_mask(&atlas, key2));
+            }
+        }
+    }
+    CHECK(atlas.slots.len == 100);
+
+    glyph_atlas_drop(&atlas);
+}
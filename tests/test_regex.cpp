@@ -0,0 +1,272 @@
+#include <czt/test_base.hpp>
+
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/string.hpp>
+#include "backlog.hpp"
+#include "regex.hpp"
+
+#define BBS BACKLOG_BUFFER_SIZE
+
+namespace {
+struct Match {
+    uint64_t start;
+    uint64_t end;
+};
+}
+
+static cz::String make_text(size_t len, cz::Str alphabet, size_t line_length, uint32_t seed) {
+    cz::String text = {};
+    text.reserve_exact(cz::heap_allocator(), len);
+    uint32_t state = seed;
+    for (size_t i = 0; i < len; ++i) {
+        state = state * 1103515245 + 12345;
+        text.push((state >> 16) % line_length == 0 ? '\n' : alphabet[(state >> 8) % alphabet.len]);
+    }
+    return text;
+}
+
+/// Every position a match starts at, found by backtracking.
+static cz::Vector<Match> backtracking_matches(Regex* regex, cz::Str text) {
+    cz::Vector<Match> matches = {};
+    size_t line_start = 0;
+    for (size_t i = 0; i <= text.len; ++i) {
+        if (i < text.len && text[i] != '\n')
+            continue;
+        cz::Str line = text.slice(line_start, i);
+        for (size_t start = 0; start <= line.len; ++start) {
+            size_t end;
+            if (regex_match_backtracking(regex, line, start, &end)) {
+                matches.reserve(cz::heap_allocator(), 1);
+                matches.push({line_start + start, line_start + end});
+            }
+        }
+        line_start = i + 1;
+    }
+    return matches;
+}
+
+/// Compare stepping through the matches in both directions to backtracking.
+static bool matches_agree(Regex* regex, Backlog_State* backlog, cz::Str text) {
+    cz::Vector<Match> expected = backtracking_matches(regex, text);
+    CZ_DEFER(expected.drop(cz::heap_allocator()));
+
+    bool agree = true;
+    size_t count = 0;
+    uint64_t start, end;
+    for (uint64_t position = 0;
+         regex_search_forward(regex, backlog, position, backlog->length + 1, &start, &end);
+         position = start + 1) {
+        agree &= (count < expected.len && expected[count].start == start &&
+                  expected[count].end == end);
+        ++count;
+    }
+    agree &= (count == expected.len);
+
+    count = 0;
+    for (uint64_t position = backlog->length + 1;
+         regex_search_backward(regex, backlog, 0, position, &start, &end); position = start) {
+        ++count;
+        agree &= (count <= expected.len && expected[expected.len - count].start == start &&
+                  expected[expected.len - count].end == end);
+    }
+    agree &= (count == expected.len);
+    return agree;
+}
+
+TEST_CASE("regex_compile rejects invalid patterns") {
+    Regex regex = {};
+    CZ_DEFER(regex_drop(&regex));
+    const char* error = nullptr;
+
+    const char* invalid[] = {"(ab", "ab)", "*a", "a|+", "[ab", "a\\", "[b-a]", "a{3,2}",
+                             "a{5000}", "\\b", "(?<x>a)", "\\xg0"};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(*invalid); ++i) {
+        INFO(invalid[i]);
+        error = nullptr;
+        CHECK_FALSE(regex_compile(&regex, invalid[i], 0, &error));
+        CHECK(error != nullptr);
+    }
+
+    // A `{` that isn't a count is a literal.
+    CHECK(regex_compile(&regex, "a{b}|x{1,}|[]a]|(?:a)", 0, &error));
+}
+
+TEST_CASE("regex search picks the longest of the first matches") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+    append_text(&backlog, "xab abcd\nERROR: timeout=250\nerror");
+
+    Regex regex = {};
+    CZ_DEFER(regex_drop(&regex));
+    const char* error;
+    uint64_t start, end;
+
+    REQUIRE(regex_compile(&regex, "ab|abcd", 0, &error));
+    REQUIRE(regex_search_forward(&regex, &backlog, 0, backlog.length, &start, &end));
+    CHECK(start == 1);
+    CHECK(end == 3);
+    REQUIRE(regex_search_forward(&regex, &backlog, 2, backlog.length, &start, &end));
+    CHECK(start == 4);
+    CHECK(end == 8);
+
+    REQUIRE(regex_compile(&regex, "ERROR.*timeout=\\d+", 0, &error));
+    REQUIRE(regex_search_backward(&regex, &backlog, 0, backlog.length, &start, &end));
+    CHECK(start == 9);
+    CHECK(end == 27);
+
+    // Anchors are per line and `(?i)` ignores case.
+    REQUIRE(regex_compile(&regex, "(?i)^error$", 0, &error));
+    REQUIRE(regex_search_forward(&regex, &backlog, 0, backlog.length, &start, &end));
+    CHECK(start == 28);
+    CHECK(end == 33);
+    CHECK_FALSE(regex_search_forward(&regex, &backlog, 29, backlog.length, &start, &end));
+
+    REQUIRE(regex_compile(&regex, "^error", REGEX_CASE_INSENSITIVE, &error));
+    REQUIRE(regex_search_backward(&regex, &backlog, 0, 28, &start, &end));
+    CHECK(start == 9);
+}
+
+TEST_CASE("regex search agrees with backtracking") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+
+    // Long enough that matches cross chunks.
+    cz::String text = make_text(3 * BBS + 100, "aabc AB1", 40, 7);
+    CZ_DEFER(text.drop(cz::heap_allocator()));
+    append_text(&backlog, text);
+
+    const char* patterns[] = {
+        "a", "ab*c", "(a|b)+c", "^a", "a$", "^$", "b?", "[^a ]+", "\\d+", "a.c", "(?i)ab", "x",
+        "a{2,3}", "(a*)*b", "A|1$", "^(a|b)*$", "c+|\\w\\W", "(^| )b", "a(b|$)", "^^a|c$$",
+        "[a-c]{2}\\s", "(ab|a)(c|bcd)?", "^", "$", "^b?", "a?$"};
+    Regex regex = {};
+    CZ_DEFER(regex_drop(&regex));
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(*patterns); ++i) {
+        INFO(patterns[i]);
+        const char* error;
+        REQUIRE(regex_compile(&regex, patterns[i], 0, &error));
+        CHECK(matches_agree(&regex, &backlog, text));
+    }
+}
+
+TEST_CASE("regex search rebuilds the DFA when it gets too big") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+
+    cz::String text = make_text(120000, "ababababababababababababababababababc", 300, 3);
+    CZ_DEFER(text.drop(cz::heap_allocator()));
+    append_text(&backlog, text);
+
+    // Needs a state for every combination of the last 17 bytes.
+    Regex regex = {};
+    CZ_DEFER(regex_drop(&regex));
+    const char* error;
+    REQUIRE(regex_compile(&regex, "(a|b)*a(a|b){16}c", 0, &error));
+    CHECK(matches_agree(&regex, &backlog, text));
+    CHECK(regex.forward.flushes + regex.reverse.flushes > 0);
+}
+
+TEST_CASE("regex search doesn't backtrack") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+
+    cz::String line = {};
+    CZ_DEFER(line.drop(cz::heap_allocator()));
+    line.reserve_exact(cz::heap_allocator(), 1001);
+    for (size_t i = 0; i < 1000; ++i)
+        line.push('a');
+    line.push('\n');
+    for (size_t i = 0; i < 1000; ++i)
+        append_text(&backlog, line);
+
+    // Backtracking would take forever on every line.
+    Regex regex = {};
+    CZ_DEFER(regex_drop(&regex));
+    const char* error;
+    uint64_t start, end;
+    REQUIRE(regex_compile(&regex, "(a|aa)*b", 0, &error));
+    CHECK_FALSE(regex_search_forward(&regex, &backlog, 0, backlog.length, &start, &end));
+    CHECK_FALSE(regex_search_backward(&regex, &backlog, 0, backlog.length, &start, &end));
+}
+
+TEST_CASE("regex search walks every match on a long line") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+
+    // One line with matches in most chunks.  Every search reuses the
+    // scan of the rest of the line instead of starting it over.
+    cz::String text = make_text(20 * BBS, "aabc AB1", 1 << 30, 5);
+    CZ_DEFER(text.drop(cz::heap_allocator()));
+    for (size_t i = 0; i < text.len; ++i) {
+        if (text[i] == '\n')
+            text[i] = 'c';
+    }
+    append_text(&backlog, text);
+
+    const char* patterns[] = {"a", "ab*c", "^a", "c$", "b?", "[^a ]+", "1(A|B)*1", "$"};
+    Regex regex = {};
+    CZ_DEFER(regex_drop(&regex));
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(*patterns); ++i) {
+        INFO(patterns[i]);
+        const char* error;
+        REQUIRE(regex_compile(&regex, patterns[i], 0, &error));
+        CHECK(matches_agree(&regex, &backlog, text));
+    }
+
+    // Rewriting the line throws away the scan even though it ends in the same place.
+    const char* error;
+    REQUIRE(regex_compile(&regex, "a", 0, &error));
+    CHECK(matches_agree(&regex, &backlog, text));
+    for (size_t i = 0; i < text.len; ++i) {
+        if (text[i] == 'a')
+            text[i] = ' ';
+        else if (text[i] == ' ')
+            text[i] = 'a';
+    }
+    append_text(&backlog, "\r");
+    append_text(&backlog, text);
+    REQUIRE(backlog.length == text.len);
+    CHECK(matches_agree(&regex, &backlog, text));
+}
+
+TEST_CASE("regex_search_forward_before cuts lines at the limit") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+    append_text(&backlog, "xaaaa aaab\nab");
+
+    Regex regex = {};
+    CZ_DEFER(regex_drop(&regex));
+    const char* error;
+    uint64_t start, end;
+
+    // Matches are shortened at the limit.
+    REQUIRE(regex_compile(&regex, "a+", 0, &error));
+    REQUIRE(regex_search_forward_before(&regex, &backlog, 0, 10, 3, &start, &end));
+    CHECK(start == 1);
+    CHECK(end == 3);
+
+    // `$` only matches at the end of the line.
+    REQUIRE(regex_compile(&regex, "a+$|a+b", 0, &error));
+    CHECK_FALSE(regex_search_forward_before(&regex, &backlog, 0, 10, 5, &start, &end));
+    REQUIRE(regex_search_forward_before(&regex, &backlog, 0, 10, 10, &start, &end));
+    CHECK(start == 6);
+    CHECK(end == 10);
+    REQUIRE(regex_search_forward_before(&regex, &backlog, 0, 13, 13, &start, &end));
+    CHECK(start == 6);
+    REQUIRE(regex_search_forward_before(&regex, &backlog, 10, 13, 13, &start, &end));
+    CHECK(start == 11);
+    CHECK(end == 13);
+}
@@ -0,0 +1,71 @@
+#include <czt/test_base.hpp>
+
+#include <cz/defer.hpp>
+#include "backlog.hpp"
+#include "config.hpp"
+#include "render.hpp"
+
+/// Find the wraps the slow way by walking every code point like `render_backlog` does.
+static cz::Vector<Backlog_Wrap_Point> find_wraps_slow(Backlog_State* backlog, int num_cols) {
+    cz::Vector<Backlog_Wrap_Point> wraps = {};
+    Visual_Point point = {};
+    while (point.inner < backlog->length) {
+        uint64_t start = point.inner;
+        uint64_t column = point.column;
+        int y = point.y;
+        char seq[5] = {backlog->get(start)};
+        size_t len = make_backlog_code_point(seq, backlog, start);
+        coord_trans(&point, num_cols, seq[0], backlog->width_at(start));
+        point.inner = start + len;
+        if (point.y != y && seq[0] != '\n') {
+            wraps.reserve(cz::heap_allocator(), 1);
+            wraps.push({start, column});
+        }
+    }
+    return wraps;
+}
+
+static void check_wraps(Backlog_State* backlog, int num_cols) {
+    update_wrap_index(backlog, num_cols);
+    cz::Vector<Backlog_Wrap_Point> expected = find_wraps_slow(backlog, num_cols);
+    CZ_DEFER(expected.drop(cz::heap_allocator()));
+
+    cz::Slice<Backlog_Wrap_Point> actual = backlog->wrap_index.points;
+    REQUIRE(actual.len == expected.len);
+    for (size_t i = 0; i < actual.len; ++i) {
+        CHECK(actual[i].index == expected[i].index);
+        CHECK(actual[i].column == expected[i].column);
+    }
+}
+
+TEST_CASE("wrap index matches coord_trans") {
+    cfg.tab_width = 8;
+
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+
+    const cz::Str text =
+        "short\n"
+        "a\tline\twith\ttabs\tthat\tis\tlong\tenough\tto\twrap\n"
+        "\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80"
+        "\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\xe2\x94\x80\n"
+        "0123456789012345678901234567890123456789\n"
+        "\xe4\xb8\xad\xe6\x96\x87\xe4\xb8\xad\xe6\x96\x87 e\xcc\x81 \xf0\x9f\x98\x80\xf0\x9f\x98\x80x\n"
+        "progress 10%\rprogress 100%\n";
+
+    // Feed one byte at a time so code points and escape sequences get split.
+    for (size_t i = 0; i < text.len; ++i) {
+        append_text(&backlog, text.slice(i, i + 1));
+        check_wraps(&backlog, 10);
+    }
+
+    // Resizing rebuilds the index.
+    check_wraps(&backlog, 7);
+    check_wraps(&backlog, 80);
+    check_wraps(&backlog, 1);
+
+    uint64_t row_start, column;
+    REQUIRE(find_next_visual_row(&backlog, 0, backlog.length, &row_start, &column));
+    CHECK(row_start == 1);
+    CHECK(column == 1);
+}
@@ -0,0 +1,335 @@
+#include <czt/test_base.hpp>
+
+#include <string.h>
+#include <atomic>
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/string.hpp>
+#include <cz/util.hpp>
+#include "backlog.hpp"
+#include "backlog_index.hpp"
+#include "search.hpp"
+#include "work_pool.hpp"
+
+#define BBS BACKLOG_BUFFER_SIZE
+
+static void count_task(void* context, size_t task, size_t thread) {
+    std::atomic<uint32_t>* counts = (std::atomic<uint32_t>*)context;
+    REQUIRE(thread < work_pool_threads());
+    counts[task]++;
+}
+
+TEST_CASE("work_pool_run runs every task once") {
+    std::atomic<uint32_t> counts[1000];
+    for (size_t batch = 0; batch < 20; ++batch) {
+        size_t tasks = batch * 50;
+        for (size_t i = 0; i < tasks; ++i)
+            counts[i] = 0;
+        work_pool_run(tasks, count_task, counts);
+        for (size_t i = 0; i < tasks; ++i)
+            CHECK(counts[i] == 1);
+    }
+}
+
+static cz::String make_text(size_t len, size_t seed) {
+    cz::String text = {};
+    text.reserve_exact(cz::heap_allocator(), len);
+    for (size_t i = 0; i < len; ++i)
+        text.push(i % 80 == 79 ? '\n' : "ab"[(i * 7 + i / 3 + seed) % 5 == 0]);
+    return text;
+}
+
+static size_t count_matches(cz::Str text, cz::Str query) {
+    size_t count = 0;
+    for (size_t i = 0; i + query.len <= text.len; ++i)
+        count += (memcmp(text.buffer + i, query.buffer, query.len) == 0);
+    return count;
+}
+
+TEST_CASE("search_refresh finds every match and picks up new output") {
+    Backlog_State backlog1 = {};
+    Backlog_State backlog2 = {};
+    init_backlog(&backlog1, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    init_backlog(&backlog2, /*id=*/1, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog1, &backlog2};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog1));
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog2));
+
+    // Big enough to be split into several tasks.
+    cz::String text1 = make_text(3 << 20, 0);
+    cz::String text2 = make_text(5 * BBS + 17, 3);
+    CZ_DEFER(text1.drop(cz::heap_allocator()));
+    CZ_DEFER(text2.drop(cz::heap_allocator()));
+    append_text(&backlog1, text1);
+    append_text(&backlog2, text2.slice_end(3 * BBS + 1));
+
+    Search_State search = {};
+    CZ_DEFER(search_drop_matches(&search));
+    cz::Str query = "bab";
+    search_refresh(&search, backlogs, query);
+    REQUIRE(search.matches.len == 2);
+    CHECK_FALSE(search.truncated);
+    CHECK(search.matches[0].indices.len == count_matches(text1, query));
+    CHECK(search.matches[1].indices.len == count_matches(text2.slice_end(3 * BBS + 1), query));
+
+    // Only the new output is searched.  A match can span the old and new output.
+    append_text(&backlog2, text2.slice_start(3 * BBS + 1));
+    search_refresh(&search, backlogs, query);
+    CHECK(search.matches[1].indices.len == count_matches(text2, query));
+    CHECK(search.total_matches == count_matches(text1, query) + count_matches(text2, query));
+
+    // Stepping walks the sorted list in both directions.  There isn't a match at the start.
+    REQUIRE(search_match_number(&search, 0, 0) == 0);
+    uint64_t outer = 0, inner = 0;
+    size_t steps = 0;
+    bool all_match = true, all_sorted = true, all_numbered = true;
+    uint64_t prev_outer = 0, prev_inner = 0;
+    while (search_step(&search, /*is_forward=*/true, &outer, &inner)) {
+        all_match &= backlog_matches(backlogs[outer], inner, query);
+        all_sorted &= (steps == 0 || outer > prev_outer || inner > prev_inner);
+        prev_outer = outer;
+        prev_inner = inner;
+        ++steps;
+        all_numbered &= (search_match_number(&search, outer, inner) == steps);
+    }
+    CHECK(all_match);
+    CHECK(all_sorted);
+    CHECK(all_numbered);
+    CHECK(steps == search.total_matches);
+
+    uint64_t last_outer = outer, last_inner = inner;
+    REQUIRE(search_step(&search, /*is_forward=*/false, &outer, &inner));
+    CHECK((outer < last_outer || inner < last_inner));
+
+    // A new query starts over.
+    search_refresh(&search, backlogs, "zzz");
+    CHECK(search.total_matches == 0);
+    outer = 0;
+    inner = 0;
+    CHECK_FALSE(search_step(&search, /*is_forward=*/true, &outer, &inner));
+}
+
+TEST_CASE("search_refresh searches rewritten output again") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+
+    Search_State search = {};
+    CZ_DEFER(search_drop_matches(&search));
+    append_text(&backlog, "ok foo\nfoo foo foo");
+    search_refresh(&search, backlogs, "foo");
+    REQUIRE(search.total_matches == 4);
+
+    // A progress bar redraws the line.
+    append_text(&backlog, "\rbar bar bar foo");
+    search_refresh(&search, backlogs, "foo");
+    REQUIRE(search.total_matches == 2);
+    CHECK(search.matches[0].indices[0] == 3);
+    CHECK(search.matches[0].indices[1] == 19);
+
+    // A shorter line leaves no matches past the end.
+    append_text(&backlog, "\rfo");
+    search_refresh(&search, backlogs, "foo");
+    CHECK(search.total_matches == 1);
+    uint64_t outer = 0, inner = 4;
+    CHECK_FALSE(search_step(&search, /*is_forward=*/true, &outer, &inner));
+
+    // The rewritten text is searched once it is written.
+    append_text(&backlog, "o\nfoo");
+    search_refresh(&search, backlogs, "foo");
+    REQUIRE(search.total_matches == 3);
+    CHECK(search.matches[0].indices[1] == 7);
+    CHECK(search.matches[0].indices[2] == 11);
+}
+
+/// Index every full chunk of `backlogs` and install the filters.
+static void index_backlogs(cz::Slice<Backlog_State*> backlogs) {
+    for (bool done = false; !done;) {
+        backlog_index_tick(backlogs, /*budget=*/1ull << 30);
+        backlog_index_wait();
+        done = true;
+        for (size_t i = 0; i < backlogs.len; ++i)
+            done &= (backlogs[i]->indexed_until + BBS + 2 > backlogs[i]->length);
+    }
+    backlog_index_tick(backlogs, /*budget=*/1ull << 30);
+}
+
+TEST_CASE("search_refresh skips chunks the index rules out") {
+    Backlog_Index_Stats before = backlog_index_stats();
+    {
+        Backlog_State backlog = {};
+        init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+        Backlog_State* backlogs[] = {&backlog};
+        CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+
+        // Needles in the middle of a chunk and crossing into the next one.
+        cz::String text = make_text(40 * BBS + 17, 1);
+        CZ_DEFER(text.drop(cz::heap_allocator()));
+        const cz::Str needle = "needle";
+        const size_t positions[] = {10 * BBS - 3, 20 * BBS + 100, 30 * BBS - 5, 40 * BBS - 1};
+        for (size_t position : positions)
+            memcpy(text.buffer + position, needle.buffer, needle.len);
+        append_text(&backlog, text);
+
+        index_backlogs(backlogs);
+        Backlog_Index_Stats stats = backlog_index_stats();
+        CHECK(stats.indexed_chunks == before.indexed_chunks + 40);
+        CHECK(stats.filter_bytes == stats.indexed_chunks * BACKLOG_INDEX_FILTER_SIZE);
+
+        // Most chunks are ruled out but never the ones with a needle.
+        cz::Vector<uint32_t> bits = {};
+        CZ_DEFER(bits.drop(cz::heap_allocator()));
+        backlog_index_query(needle, &bits);
+        size_t skipped = 0;
+        bool kept_needles = true;
+        for (size_t outer = 0; outer < backlog.buffers.len; ++outer) {
+            if (backlog_index_may_match(&backlog, outer, bits))
+                continue;
+            ++skipped;
+            for (size_t position : positions)
+                kept_needles &= (position / BBS != outer);
+        }
+        CHECK(skipped > 30);
+        CHECK(kept_needles);
+
+        Search_State search = {};
+        CZ_DEFER(search_drop_matches(&search));
+        search_refresh(&search, backlogs, needle);
+        CHECK(search.total_matches == 4);
+        search_refresh(&search, backlogs, "bab");
+        CHECK(search.total_matches == count_matches(text, "bab"));
+    }
+    CHECK(backlog_index_stats().indexed_chunks == before.indexed_chunks);
+}
+
+/// Walk `[start, end)` like `render_backlog` and mark the bytes that are highlighted.
+static cz::String draw_highlights(Search_State* search,
+                                  Backlog_State* backlog,
+                                  uint64_t start,
+                                  uint64_t end) {
+    cz::String marks = {};
+    marks.reserve_exact(cz::heap_allocator(), end - start);
+    bool highlighting = search_highlight_start(search, backlog, start);
+    uint64_t match_start = 0, match_end = 0;
+    for (uint64_t i = start; i < end; ++i) {
+        if (highlighting && i >= match_end)
+            search_highlight_next(search, backlog, i, &match_start, &match_end);
+        marks.push(highlighting && i >= match_start && i < match_end ? '^' : ' ');
+    }
+    return marks;
+}
+
+TEST_CASE("search highlights every match on screen") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+    cz::String text = make_text(8 * BBS, 5);
+    CZ_DEFER(text.drop(cz::heap_allocator()));
+    append_text(&backlog, text);
+
+    Search_State search = {};
+    CZ_DEFER(search_drop_highlights(&search));
+    CZ_DEFER(search_drop_regex(&search));
+    CZ_DEFER(search.prompt.text.drop(cz::heap_allocator()));
+    search.prompt.text = cz::Str("abba").clone(cz::heap_allocator());
+
+    // Matches that start above the screen are highlighted too.
+    const uint64_t top = 3 * BBS + 5, bottom = top + 2000;
+    cz::String expected = {};
+    CZ_DEFER(expected.drop(cz::heap_allocator()));
+    expected.reserve_exact(cz::heap_allocator(), bottom - top);
+    for (uint64_t i = top; i < bottom; ++i) {
+        bool inside = false;
+        for (uint64_t start = i - 3; start <= i; ++start)
+            inside |= (memcmp(text.buffer + start, "abba", 4) == 0);
+        expected.push(inside ? '^' : ' ');
+    }
+
+    cz::String marks = draw_highlights(&search, &backlog, top, bottom);
+    CZ_DEFER(marks.drop(cz::heap_allocator()));
+    CHECK(marks == expected);
+
+    // Only about a screen's worth of text is scanned and
+    // nothing is scanned again when the same rows are drawn.
+    REQUIRE(search.highlights.len == 1);
+    uint64_t scanned = search.highlights[0].scanned;
+    CHECK(scanned - top < (bottom - top) + 2 * BBS);
+    cz::String again = draw_highlights(&search, &backlog, top, bottom);
+    CZ_DEFER(again.drop(cz::heap_allocator()));
+    CHECK(again == expected);
+    CHECK(search.highlights[0].scanned == scanned);
+
+    // Scrolling down keeps the matches still on screen.
+    cz::String scrolled = draw_highlights(&search, &backlog, top + 300, bottom);
+    CZ_DEFER(scrolled.drop(cz::heap_allocator()));
+    CHECK(scrolled == expected.slice_start(300));
+    CHECK(search.highlights[0].scanned == scanned);
+
+    // Regexes are highlighted in the same places as stepping through their matches.
+    search.is_regex = true;
+    search.prompt.text.len = 0;
+    search.prompt.text.reserve(cz::heap_allocator(), 8);
+    search.prompt.text.append("b+a|^ab");
+    uint64_t index = top;
+    while (text[index - 1] != '\n')
+        --index;
+    const char* error;
+    REQUIRE(regex_compile(&search.regex, search.prompt.text, 0, &error));
+    for (uint64_t i = 0; i < expected.len; ++i)
+        expected[i] = ' ';
+    uint64_t start, end;
+    while (regex_search_forward(&search.regex, &backlog, index, bottom, &start, &end)) {
+        for (uint64_t i = cz::max(start, top); i < cz::min(end, bottom); ++i)
+            expected[i - top] = '^';
+        index = cz::max(end, start + 1);
+    }
+
+    CHECK(memchr(expected.buffer, '^', expected.len));
+
+    cz::String regex_marks = draw_highlights(&search, &backlog, top, bottom);
+    CZ_DEFER(regex_marks.drop(cz::heap_allocator()));
+    CHECK(regex_marks == expected);
+}
+
+TEST_CASE("search highlights regex matches on a long line") {
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    Backlog_State* backlogs[] = {&backlog};
+    CZ_DEFER(backlog_dec_refcount(backlogs, &backlog));
+
+    // One 2 MiB line with a match every 64 bytes.
+    cz::String row = {};
+    CZ_DEFER(row.drop(cz::heap_allocator()));
+    row.reserve_exact(cz::heap_allocator(), 64);
+    for (size_t i = 0; i < 63; ++i)
+        row.push('.');
+    row.push('x');
+    while (backlog.length < (2 << 20))
+        append_text(&backlog, row);
+
+    Search_State search = {};
+    CZ_DEFER(search_drop_highlights(&search));
+    CZ_DEFER(search_drop_regex(&search));
+    CZ_DEFER(search.prompt.text.drop(cz::heap_allocator()));
+    search.is_regex = true;
+    search.prompt.text = cz::Str("x").clone(cz::heap_allocator());
+
+    const uint64_t top = (1 << 20) + 5, bottom = top + 4000;
+    cz::String expected = {};
+    CZ_DEFER(expected.drop(cz::heap_allocator()));
+    expected.reserve_exact(cz::heap_allocator(), bottom - top);
+    for (uint64_t i = top; i < bottom; ++i)
+        expected.push(i % 64 == 63 ? '^' : ' ');
+
+    cz::String marks = draw_highlights(&search, &backlog, top, bottom);
+    CZ_DEFER(marks.drop(cz::heap_allocator()));
+    CHECK(marks == expected);
+
+    // Only text near the screen is read instead of the rest of the line.
+    REQUIRE(search.highlights.len == 1);
+    CHECK(search.highlights[0].scanned < bottom + BBS);
+    CHECK(search.regex.line_cache.line_end < bottom + BBS);
+    CHECK(search.regex.line_cache.bottom + BBS > top);
+}
@@ -0,0 +1,125 @@
+#include <czt/test_base.hpp>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <cz/defer.hpp>
+#include <cz/util.hpp>
+#include <thread>
+#include "backlog.hpp"
+#include "backlog_pool.hpp"
+#include "tty_reader.hpp"
+
+#define BBS BACKLOG_BUFFER_SIZE
+
+static void write_pattern(int fd, size_t total) {
+    char buffer[3000];
+    for (size_t written = 0; written < total;) {
+        size_t len = cz::min(sizeof(buffer), total - written);
+        for (size_t i = 0; i < len; ++i) {
+            buffer[i] = (char)((written + i) % 251);
+        }
+        ssize_t result = write(fd, buffer, len);
+        if (result <= 0)
+            break;
+        written += result;
+    }
+    close(fd);
+}
+
+TEST_CASE("tty_reader hands over every byte in order") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+
+    Tty_Reader* reader = start_tty_reader(fds[0]);
+    REQUIRE(reader);
+
+    const size_t total = 1 << 20;
+    std::thread writer(write_pattern, fds[1], total);
+
+    // Small loans at odd offsets so reads are split across chunks and the loans fill up.
+    size_t collected = 0;
+    bool in_order = true;
+    for (size_t i = 0; collected < total; ++i) {
+        Tty_Reader_Output output = tty_reader_collect(reader);
+        for (size_t j = 0; j < output.len; ++j) {
+            size_t position = output.offset + j;
+            char ch = output.chunks[position / BBS][position % BBS];
+            if (ch != (char)((collected + j) % 251))
+                in_order = false;
+        }
+        for (size_t j = 0; j < output.chunks.len; ++j) {
+            backlog_pool_free(output.chunks[j]);
+        }
+        collected += output.len;
+        if (output.len == 0)
+            std::this_thread::yield();
+
+        tty_reader_lend(reader, (i * 1000) % BBS, 1000 + i % BBS);
+    }
+    writer.join();
+
+    CHECK(in_order);
+    CHECK(collected == total);
+    CHECK(!tty_reader_has_output(reader));
+
+    stop_tty_reader(reader);
+    close(fds[0]);
+}
+
+TEST_CASE("tty_reader output is adopted by the backlog") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+
+    Tty_Reader* reader = start_tty_reader(fds[0]);
+    REQUIRE(reader);
+
+    Backlog_State backlog = {};
+    init_backlog(&backlog, /*id=*/0, /*max_length=*/1ull << 30 /*1GB*/);
+    cz::Vector<Backlog_State*> backlogs = {};
+    CZ_DEFER(backlogs.drop(cz::heap_allocator()));
+    backlogs.reserve(cz::heap_allocator(), 1);
+    backlogs.push(&backlog);
+
+    // Plain text so every read is scanned in place.
+    const size_t total = 1 << 20;
+    std::thread writer([&]() {
+        char buffer[3000];
+        for (size_t written = 0; written < total;) {
+            size_t len = cz::min(sizeof(buffer), total - written);
+            for (size_t i = 0; i < len; ++i) {
+                buffer[i] = (written + i) % 100 == 99 ? '\n' : 'a' + (written + i) % 26;
+            }
+            ssize_t result = write(fds[1], buffer, len);
+            if (result <= 0)
+                break;
+            written += result;
+        }
+        close(fds[1]);
+    });
+
+    while (backlog.length < total) {
+        Tty_Reader_Output output = tty_reader_collect(reader);
+        if (output.len > 0)
+            backlog_adopt_tail(&backlog, output.chunks, output.offset, output.len);
+        else
+            std::this_thread::yield();
+
+        Backlog_Tail_Loan loan = backlog_tail_loan(&backlog, 5 * BBS + 3);
+        tty_reader_lend(reader, loan.offset, loan.max);
+    }
+    writer.join();
+
+    bool in_order = true;
+    for (size_t i = 0; i < total; ++i) {
+        if (backlog.get(i) != (i % 100 == 99 ? '\n' : 'a' + i % 26))
+            in_order = false;
+    }
+    CHECK(in_order);
+    CHECK(backlog.length == total);
+    CHECK(backlog.lines.count() == total / 100);
+
+    stop_tty_reader(reader);
+    close(fds[0]);
+    backlog_dec_refcount(backlogs, &backlog);
+}
+#endif